@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <fstream>
+
+#include <fmt/format.h>
+
+#include "BenchCommon.hpp"
+
+bool parseOptions(int &argc, char **&argv, const char *description, const GOptionEntry *entries)
+{
+	GOptionContext *context;
+	GError *error{};
+	bool parsed;
+
+	gst_init(&argc, &argv);
+	context = g_option_context_new(description);
+	g_option_context_add_main_entries(context, entries, nullptr);
+	if(!(parsed = g_option_context_parse(context, &argc, &argv, &error)))
+	{
+		fmt::print(stderr, "{}\n", error->message);
+		g_error_free(error);
+	}
+	g_option_context_free(context);
+	return parsed;
+}
+
+gboolean quitLoop(void *data)
+{
+	g_main_loop_quit(static_cast<GMainLoop *>(data));
+	return G_SOURCE_REMOVE;
+}
+
+void runFor(GMainLoop *loop, double seconds)
+{
+	g_timeout_add(static_cast<guint>(seconds * 1000), quitLoop, loop);
+	g_main_loop_run(loop);
+}
+
+std::vector<std::string> splitList(const char *list)
+{
+	std::vector<std::string> items;
+	char **parts = g_strsplit(list, ",", -1);
+
+	for(char **part = parts; *part != nullptr; part++)
+	{
+		if(**part != '\0')
+			items.emplace_back(*part);
+	}
+	g_strfreev(parts);
+	return items;
+}
+
+double percentile(const std::vector<double> &sorted, double fraction)
+{
+	if(sorted.empty())
+		return 0;
+	return sorted[static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1))];
+}
+
+std::string jsonString(std::string_view value)
+{
+	std::string escaped{ "\"" };
+
+	for(auto c : value)
+	{
+		if(c == '"' || c == '\\')
+			escaped += '\\';
+		if(static_cast<unsigned char>(c) >= 0x20)
+			escaped += c;
+	}
+	return escaped + "\"";
+}
+
+void appendLatencies(std::back_insert_iterator<std::string> append, std::vector<double> &latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+	fmt::format_to(append, "{{\"samples\": {}, \"p50\": {:.3f}, \"p95\": {:.3f}, \"p99\": {:.3f}, \"max\": {:.3f}}}",
+								 latencies.size(), percentile(latencies, 0.5), percentile(latencies, 0.95),
+								 percentile(latencies, 0.99), latencies.empty() ? 0 : latencies.back());
+}
+
+std::unique_ptr<ServerHandle> startServer(Options &options, int32_t port,
+																							std::back_insert_iterator<std::string> append)
+{
+	options.address = "127.0.0.1";
+	options.port = std::to_string(port);
+	options.httpPort = 0;
+	options.encoderForced = true;
+
+	auto server = std::make_unique<ServerHandle>(&options);
+	try
+	{
+		server->attach(1);
+	}
+	catch(const std::runtime_error &)
+	{
+		fmt::format_to(append, ", \"error\": \"server failed to attach\"}}");
+		return nullptr;
+	}
+	return server;
+}
+
+void appendResults(std::string &out, size_t count, const std::function<void(size_t index, int32_t port)> &runConfig)
+{
+	out += "  \"results\": [\n";
+	for(size_t i = 0; i < count; i++)
+	{
+		runConfig(i, BASE_PORT + static_cast<int32_t>(i));
+		out += i + 1 < count ? ",\n" : "\n";
+	}
+	out += "  ]\n}\n";
+}
+
+bool writeOutput(const std::string &out, const char *output)
+{
+	if(output == nullptr)
+	{
+		fmt::print("{}", out);
+		return true;
+	}
+
+	std::ofstream file{ output };
+
+	file << out;
+	if(!file)
+	{
+		fmt::print(stderr, "failed to write {}\n", output);
+		return false;
+	}
+	return true;
+}
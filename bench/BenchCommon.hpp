@@ -0,0 +1,88 @@
+/**
+ * @file BenchCommon.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ *
+ * Scaffolding of the benchmarks serving a matrix of configurations from an
+ * in-process server: option parsing, running the main loop, the JSON output
+ * and the latency statistics.
+ * */
+
+#ifndef RTSPCAM_BENCHCOMMON_HPP
+#define RTSPCAM_BENCHCOMMON_HPP
+
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ServerHandle.hpp"
+
+/// Port of the first configuration, every configuration gets a port of its own
+static constexpr int32_t BASE_PORT{ 18554 };
+/// Milliseconds the clients get to tear down their sessions before the server goes
+static constexpr guint TEARDOWN_TIME{ 500 };
+
+/**
+ * @brief Initialize GStreamer and parse the command line.
+ *
+ * @param description Summary shown after the program name in the help.
+ * @return false when the options are invalid, the error is printed.
+ * */
+bool parseOptions(int &argc, char **&argv, const char *description, const GOptionEntry *entries);
+
+/**
+ * @brief Stop the main loop, as a GSourceFunc.
+ * */
+gboolean quitLoop(void *data);
+
+/**
+ * @brief Run the main loop for a number of seconds.
+ * */
+void runFor(GMainLoop *loop, double seconds);
+
+/**
+ * @brief Split a comma separated list, empty items are skipped.
+ * */
+std::vector<std::string> splitList(const char *list);
+
+/**
+ * @brief Value at a fraction of sorted samples, 0 without samples.
+ * */
+double percentile(const std::vector<double> &sorted, double fraction);
+
+/**
+ * @brief Quoted and escaped JSON string.
+ * */
+std::string jsonString(std::string_view value);
+
+/**
+ * @brief Sort latencies and append their JSON object with the count, percentiles and maximum.
+ * */
+void appendLatencies(std::back_insert_iterator<std::string> append, std::vector<double> &latencies);
+
+/**
+ * @brief Serve the given options on the local address and attach the first camera.
+ *
+ * @return nullptr when the server failed to attach, the error is appended to the JSON object.
+ * */
+std::unique_ptr<ServerHandle> startServer(Options &options, int32_t port,
+																							std::back_insert_iterator<std::string> append);
+
+/**
+ * @brief Append the results array of a matrix, a configuration at a time.
+ *
+ * @param count Number of configurations.
+ * @param runConfig Serves the configuration of an index on the given port and appends its JSON object.
+ * */
+void appendResults(std::string &out, size_t count, const std::function<void(size_t index, int32_t port)> &runConfig);
+
+/**
+ * @brief Write the JSON to a file, or to stdout without one.
+ *
+ * @return false when the file cannot be written, the error is printed.
+ * */
+bool writeOutput(const std::string &out, const char *output);
+
+#endif // RTSPCAM_BENCHCOMMON_HPP
@@ -0,0 +1,123 @@
+/**
+ * @file DebayerBench.cpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ *
+ * Compares the single pass debayer element against the bayer2rgb ! videoconvert
+ * chain it replaces on a 5 MP Bayer frame.
+ * */
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <fmt/format.h>
+#include <gst/gst.h>
+#include <gst/app/app.h>
+
+#include "DebayerElement.hpp"
+
+static constexpr int32_t WIDTH{ 2448 };
+static constexpr int32_t HEIGHT{ 2048 };
+static constexpr int ITERATIONS{ 100 };
+
+static constexpr const char *CHAINS[] = {
+	"bayer2rgb ! video/x-raw, format=(string)RGBx ! videoconvert ! video/x-raw, format=(string)I420",
+	"rtspcamdebayer method=bilinear n-bands=1 ! video/x-raw, format=(string)I420",
+	"rtspcamdebayer method=malvar n-bands=1 ! video/x-raw, format=(string)I420",
+	"rtspcamdebayer method=bilinear ! video/x-raw, format=(string)I420",
+	"rtspcamdebayer method=malvar ! video/x-raw, format=(string)I420",
+	"rtspcamdebayer method=bilinear ! video/x-raw, format=(string)NV12",
+};
+
+/**
+ * @brief Push the frame through a chain.
+ *
+ * @return Milliseconds per frame, a negative value when the chain cannot run.
+ * */
+static double measure(const char *chain, GstBuffer *frame)
+{
+	GError *error{};
+	GstElement *pipeline, *source;
+	GstBus *bus;
+	GstMessage *message;
+	GstCaps *caps;
+	auto description = fmt::format("appsrc name=src format=time block=true max-bytes={} ! {} ! fakesink sync=false",
+																 2 * WIDTH * HEIGHT, chain);
+
+	pipeline = gst_parse_launch(description.c_str(), &error);
+	if(pipeline == nullptr)
+	{
+		fmt::print("{}: {}\n", chain, error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	source = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+	caps = gst_caps_new_simple("video/x-bayer", "format", G_TYPE_STRING, "rggb", "width", G_TYPE_INT, WIDTH, "height",
+														 G_TYPE_INT, HEIGHT, "framerate", GST_TYPE_FRACTION, 30, 1, nullptr);
+	gst_app_src_set_caps(GST_APP_SRC(source), caps);
+	gst_caps_unref(caps);
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < ITERATIONS; i++)
+	{
+		// shares the memory of the frame
+		GstBuffer *buffer = gst_buffer_copy(frame);
+
+		GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(i, GST_SECOND, 30);
+		gst_app_src_push_buffer(GST_APP_SRC(source), buffer);
+	}
+	gst_app_src_end_of_stream(GST_APP_SRC(source));
+
+	bus = gst_element_get_bus(pipeline);
+	message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+																			 static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	bool failed = GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR;
+
+	gst_message_unref(message);
+	gst_object_unref(bus);
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(source);
+	gst_object_unref(pipeline);
+
+	return failed ? -1 : elapsed.count() / ITERATIONS;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<uint8_t> data(static_cast<size_t>(WIDTH) * HEIGHT);
+	std::mt19937 random{ 42 };
+	GstBuffer *frame;
+
+	gst_init(&argc, &argv);
+	registerDebayerElement();
+
+	for(auto &value : data)
+		value = static_cast<uint8_t>(random());
+	frame = gst_buffer_new_allocate(nullptr, data.size(), nullptr);
+	gst_buffer_fill(frame, 0, data.data(), data.size());
+
+	fmt::print("Bayer {}x{} to YUV 4:2:0, ms/frame\n", WIDTH, HEIGHT);
+	for(auto chain : CHAINS)
+	{
+		double result = measure(chain, frame);
+
+		if(result < 0)
+			fmt::print("{:>10} {}\n", "failed", chain);
+		else
+			fmt::print("{:>10.2f} {}\n", result, chain);
+	}
+
+	if(const auto pool = debayerPool(); pool != nullptr)
+	{
+		fmt::print("{} pool threads, {} bands stolen\n", pool->numThreads(), pool->steals());
+		for(uint32_t i = 0; i < pool->numThreads(); i++)
+			fmt::print("{:>10.2f} s busy, worker {}\n", static_cast<double>(pool->busyTime(i)) / 1e9, i);
+	}
+
+	gst_buffer_unref(frame);
+	return 0;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file LossClient.cpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ *
+ * RTSP client dropping RTP packets before its RTP session, so its receiver
+ * reports tell the server about the loss. Run it against a server started
+ * with --adaptive-bitrate and watch rtspcam_encoder_bitrate_kbps fall:
+ *
+ *     rtspcam_loss_client rtsp://127.0.0.1:8554/stream 0.15 60
+ * */
+
+#include <atomic>
+#include <cstdlib>
+
+#include <fmt/format.h>
+#include <gst/gst.h>
+
+/// Client state shared with the callbacks
+struct LossClient
+{
+	GMainLoop *loop;
+	double dropProbability;
+	/// Frames decoded since the last report
+	std::atomic<uint64_t> frames;
+};
+
+/**
+ * @brief Wrap netsim in the pads rtpbin links a decoder with.
+ * */
+static GstElement *requestRtpDecoder([[maybe_unused]] GstElement *rtpbin, guint session, void *data)
+{
+	auto client = static_cast<LossClient *>(data);
+	GstElement *bin, *netsim;
+	GstPad *pad;
+
+	netsim = gst_element_factory_make("netsim", nullptr);
+	if(netsim == nullptr)
+	{
+		fmt::print("netsim not found, install gst-plugins-bad\n");
+		return nullptr;
+	}
+	g_object_set(netsim, "drop-probability", static_cast<float>(client->dropProbability), nullptr);
+
+	bin = gst_bin_new(fmt::format("loss{}", session).c_str());
+	gst_bin_add(GST_BIN(bin), netsim);
+	pad = gst_element_get_static_pad(netsim, "sink");
+	gst_element_add_pad(bin, gst_ghost_pad_new("rtp_sink", pad));
+	gst_object_unref(pad);
+	pad = gst_element_get_static_pad(netsim, "src");
+	gst_element_add_pad(bin, gst_ghost_pad_new("rtp_src", pad));
+	gst_object_unref(pad);
+	return bin;
+}
+
+static void newManager([[maybe_unused]] GstElement *source, GstElement *manager, void *data)
+{
+	g_signal_connect(manager, "request-rtp-decoder", G_CALLBACK(requestRtpDecoder), data);
+}
+
+static GstPadProbeReturn countFrame([[maybe_unused]] GstPad *pad, [[maybe_unused]] GstPadProbeInfo *info, void *data)
+{
+	static_cast<LossClient *>(data)->frames++;
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean report(void *data)
+{
+	fmt::print("{} fps\n", static_cast<LossClient *>(data)->frames.exchange(0));
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean stop(void *data)
+{
+	g_main_loop_quit(static_cast<LossClient *>(data)->loop);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean busMessage([[maybe_unused]] GstBus *bus, GstMessage *message, void *data)
+{
+	GError *error{};
+
+	if(GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR)
+	{
+		gst_message_parse_error(message, &error, nullptr);
+		fmt::print("{}\n", error->message);
+		g_error_free(error);
+		g_main_loop_quit(static_cast<LossClient *>(data)->loop);
+	}
+	else if(GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS)
+	{
+		g_main_loop_quit(static_cast<LossClient *>(data)->loop);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char *argv[])
+{
+	GError *error{};
+	GstElement *pipeline, *source, *sink;
+	GstPad *pad;
+	GstBus *bus;
+	LossClient client{ nullptr, 0.1, 0 };
+	guint seconds{ 60 };
+
+	gst_init(&argc, &argv);
+	if(argc < 2)
+	{
+		fmt::print("usage: {} URL [DROP-PROBABILITY] [SECONDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(argc > 2)
+		client.dropProbability = g_ascii_strtod(argv[2], nullptr);
+	if(argc > 3)
+		seconds = static_cast<guint>(g_ascii_strtoull(argv[3], nullptr, 10));
+
+	// UDP only, a TCP transport would retransmit instead of reporting loss
+	auto description = fmt::format("rtspsrc name=src protocols=udp latency=200 location=\"{}\" ! decodebin ! "
+																 "fakesink name=sink sync=false",
+																 argv[1]);
+	pipeline = gst_parse_launch(description.c_str(), &error);
+	if(pipeline == nullptr)
+	{
+		fmt::print("{}\n", error->message);
+		g_error_free(error);
+		return EXIT_FAILURE;
+	}
+
+	source = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+	g_signal_connect(source, "new-manager", G_CALLBACK(newManager), &client);
+	gst_object_unref(source);
+
+	sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	pad = gst_element_get_static_pad(sink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, countFrame, &client, nullptr);
+	gst_object_unref(pad);
+	gst_object_unref(sink);
+
+	client.loop = g_main_loop_new(nullptr, FALSE);
+	bus = gst_element_get_bus(pipeline);
+	gst_bus_add_watch(bus, busMessage, &client);
+	g_timeout_add_seconds(1, report, &client);
+	g_timeout_add_seconds(seconds, stop, &client);
+
+	fmt::print("dropping {:.0f}% of the RTP packets of {} for {} s\n", client.dropProbability * 100, argv[1], seconds);
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+	g_main_loop_run(client.loop);
+
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_bus_remove_watch(bus);
+	gst_object_unref(bus);
+	gst_object_unref(pipeline);
+	g_main_loop_unref(client.loop);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,468 @@
+/**
+ * @file PipelineBench.cpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ *
+ * Runs the server in-process against the Aravis fake camera, or a raw capture
+ * given with --replay, and connects local RTSP clients to it. Every
+ * configuration of the matrix is measured after a warm-up: frame rate and
+ * capture-to-receive latency at the clients, CPU time per thread and resident
+ * memory of the process. The results are printed as JSON:
+ *
+ *     rtspcam_bench --resolutions 1280x720,1920x1080 --encoders x264enc --clients 1,4 --buffers 8,16 > bench.json
+ *
+ * The latency is taken from the NTP time rtspsrc derives for a frame from the
+ * sender reports, which follows the capture timestamp of the frame, so it
+ * needs GStreamer 1.22 or newer. Frames received before the first sender
+ * report have no such time and are only counted.
+ * */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+
+#include <fmt/format.h>
+#include <gst/gst.h>
+
+#include "BenchCommon.hpp"
+#include "DebayerElement.hpp"
+#include "Encoder.hpp"
+#include "RawCapture.hpp"
+
+/// Seconds from the NTP epoch in 1900 to the Unix epoch
+static constexpr guint64 NTP_UNIX_OFFSET{ 2'208'988'800ULL };
+/// Milliseconds between the samples of the resident memory
+static constexpr guint RSS_INTERVAL{ 250 };
+
+/// Settings shared by all configurations
+struct BenchSettings
+{
+	double warmup;
+	double duration;
+	double frameRate;
+	bool udp;
+	std::string replayFile;
+	std::optional<double> replayRate;
+};
+
+/// Point of the matrix
+struct BenchConfig
+{
+	int32_t width;
+	int32_t height;
+	Encoder encoder;
+	uint32_t clients;
+	uint32_t buffers;
+};
+
+/// Client state shared with its pad probe
+struct BenchClient
+{
+	GstElement *pipeline;
+	std::atomic<bool> measuring;
+	std::atomic<uint64_t> frames;
+	std::mutex mutex;
+	/// Capture-to-receive latencies in milliseconds
+	std::vector<double> latencies;
+};
+
+/// CPU ticks and name of a thread of the process
+struct ThreadTimes
+{
+	std::string name;
+	uint64_t ticks;
+};
+
+/**
+ * @brief Resident memory of the process in bytes.
+ * */
+static uint64_t residentMemory()
+{
+	std::ifstream status{ "/proc/self/status" };
+	std::string line;
+
+	while(std::getline(status, line))
+	{
+		if(line.starts_with("VmRSS:"))
+			return g_ascii_strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+	}
+	return 0;
+}
+
+static gboolean sampleResidentMemory(void *data)
+{
+	auto peak = static_cast<uint64_t *>(data);
+
+	*peak = std::max(*peak, residentMemory());
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief User and system CPU ticks of every thread of the process.
+ * */
+static std::map<pid_t, ThreadTimes> threadTimes()
+{
+	std::map<pid_t, ThreadTimes> threads;
+	DIR *directory = opendir("/proc/self/task");
+	dirent *entry;
+
+	if(directory == nullptr)
+		return threads;
+
+	while((entry = readdir(directory)) != nullptr)
+	{
+		std::ifstream file{ fmt::format("/proc/self/task/{}/stat", entry->d_name) };
+		std::string stat;
+		unsigned long user{}, system{};
+
+		if(entry->d_name[0] == '.' || !std::getline(file, stat))
+			continue;
+
+		// the name is in parentheses and may hold spaces, utime and stime are the 12th and 13th field after it
+		auto open = stat.find('('), close = stat.rfind(')');
+		if(open == std::string::npos || close == std::string::npos ||
+			 sscanf(stat.c_str() + close + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user,
+							&system) != 2)
+			continue;
+		threads[static_cast<pid_t>(g_ascii_strtoll(entry->d_name, nullptr, 10))] = {
+			stat.substr(open + 1, close - open - 1), user + system
+		};
+	}
+	closedir(directory);
+	return threads;
+}
+
+/**
+ * @brief Count the frames reaching the depayloader and the latency of their last packet.
+ * */
+static GstPadProbeReturn receivePacket([[maybe_unused]] GstPad *pad, GstPadProbeInfo *info, void *data)
+{
+	static GstStaticCaps ntpCaps = GST_STATIC_CAPS("timestamp/x-ntp");
+	auto client = static_cast<BenchClient *>(data);
+	GstCaps *caps = gst_static_caps_get(&ntpCaps);
+
+	auto receive = [client, caps](GstBuffer *buffer) {
+		guint8 header[2];
+		GstReferenceTimestampMeta *meta;
+
+		// the marker bit of the RTP header flags the last packet of a frame
+		if(!client->measuring || gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header) ||
+			 (header[1] & 0x80) == 0)
+			return;
+
+		client->frames++;
+		if((meta = gst_buffer_get_reference_timestamp_meta(buffer, caps)) != nullptr &&
+			 meta->timestamp > NTP_UNIX_OFFSET * GST_SECOND)
+		{
+			auto capture = static_cast<double>(meta->timestamp - NTP_UNIX_OFFSET * GST_SECOND);
+			auto now = static_cast<double>(g_get_real_time()) * 1000;
+			std::lock_guard lock{ client->mutex };
+
+			client->latencies.push_back((now - capture) / 1e6);
+		}
+	};
+
+	if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+	{
+		GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+
+		for(guint i = 0; i < gst_buffer_list_length(list); i++)
+			receive(gst_buffer_list_get(list, i));
+	}
+	else
+	{
+		receive(GST_PAD_PROBE_INFO_BUFFER(info));
+	}
+	gst_caps_unref(caps);
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean clientMessage([[maybe_unused]] GstBus *bus, GstMessage *message, [[maybe_unused]] void *data)
+{
+	GError *error{};
+
+	if(GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR)
+	{
+		gst_message_parse_error(message, &error, nullptr);
+		fmt::print(stderr, "client: {}\n", error->message);
+		g_error_free(error);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static bool startClient(BenchClient &client, const std::string &url, Codec codec, bool udp)
+{
+	GError *error{};
+	GstElement *source, *depay;
+	GstPad *pad;
+	GstBus *bus;
+	auto description = fmt::format("rtspsrc name=src latency=0 protocols={} location=\"{}\" ! {} name=depay ! "
+																 "fakesink sync=false",
+																 udp ? "udp" : "tcp", url,
+																 codec == Codec::H265 ? "rtph265depay" : "rtph264depay");
+
+	client.pipeline = gst_parse_launch(description.c_str(), &error);
+	if(client.pipeline == nullptr)
+	{
+		fmt::print(stderr, "client: {}\n", error->message);
+		g_error_free(error);
+		return false;
+	}
+
+	// the NTP time of the frames is only attached on request
+	source = gst_bin_get_by_name(GST_BIN(client.pipeline), "src");
+	if(g_object_class_find_property(G_OBJECT_GET_CLASS(source), "add-reference-timestamp-meta") != nullptr)
+		g_object_set(source, "add-reference-timestamp-meta", TRUE, nullptr);
+	gst_object_unref(source);
+
+	depay = gst_bin_get_by_name(GST_BIN(client.pipeline), "depay");
+	pad = gst_element_get_static_pad(depay, "sink");
+	gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+										receivePacket, &client, nullptr);
+	gst_object_unref(pad);
+	gst_object_unref(depay);
+
+	bus = gst_element_get_bus(client.pipeline);
+	gst_bus_add_watch(bus, clientMessage, nullptr);
+	gst_object_unref(bus);
+
+	gst_element_set_state(client.pipeline, GST_STATE_PLAYING);
+	return true;
+}
+
+static void stopClient(BenchClient &client)
+{
+	GstBus *bus;
+
+	if(client.pipeline == nullptr)
+		return;
+
+	gst_element_set_state(client.pipeline, GST_STATE_NULL);
+	bus = gst_element_get_bus(client.pipeline);
+	gst_bus_remove_watch(bus);
+	gst_object_unref(bus);
+	gst_object_unref(client.pipeline);
+	client.pipeline = nullptr;
+}
+
+/**
+ * @brief Serve a configuration, measure it and append its JSON object to the output.
+ * */
+static void runConfig(GMainLoop *loop, const BenchSettings &settings, const BenchConfig &config, int32_t port,
+											std::string &out)
+{
+	auto append = std::back_inserter(out);
+	const auto &encoder = encoderInfo(config.encoder);
+	Options options{};
+	std::vector<std::unique_ptr<BenchClient>> clients;
+	std::map<pid_t, ThreadTimes> startTimes, endTimes;
+	std::map<std::string, double> threadLoad;
+	std::vector<double> latencies, rates;
+	uint64_t peakMemory{}, frames{};
+	double totalLoad{};
+
+	fmt::format_to(append, "    {{\"width\": {}, \"height\": {}, \"encoder\": \"{}\", \"clients\": {}, \"buffers\": {}",
+								 config.width, config.height, encoder.element, config.clients, config.buffers);
+	if(!isEncoderAvailable(config.encoder))
+	{
+		fmt::format_to(append, ", \"error\": \"encoder not available\"}}");
+		return;
+	}
+
+	options.width = config.width;
+	options.height = config.height;
+	options.frameRate = settings.frameRate;
+	options.streamBuffers = config.buffers;
+	options.encoder = config.encoder;
+	options.encoding.codec = encoder.codec;
+	options.fakeCamera = settings.replayFile.empty();
+	options.replayFile = settings.replayFile;
+	options.replayRate = settings.replayRate;
+
+	auto server = startServer(options, port, append);
+	if(server == nullptr)
+		return;
+
+	auto url = fmt::format("rtsp://127.0.0.1:{}/{}", port, options.path);
+	for(uint32_t i = 0; i < config.clients; i++)
+	{
+		auto &client = clients.emplace_back(std::make_unique<BenchClient>());
+		startClient(*client, url, encoder.codec, settings.udp);
+	}
+
+	// encoders and clients settle before anything is counted
+	runFor(loop, settings.warmup);
+	startTimes = threadTimes();
+	for(auto &client : clients)
+		client->measuring = true;
+
+	guint sampler = g_timeout_add(RSS_INTERVAL, sampleResidentMemory, &peakMemory);
+	gint64 start = g_get_monotonic_time();
+	runFor(loop, settings.duration);
+	double elapsed = static_cast<double>(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+	g_source_remove(sampler);
+
+	for(auto &client : clients)
+		client->measuring = false;
+	endTimes = threadTimes();
+	uint64_t memory = residentMemory();
+	peakMemory = std::max(peakMemory, memory);
+
+	for(auto &client : clients)
+	{
+		std::lock_guard lock{ client->mutex };
+
+		frames += client->frames;
+		rates.push_back(static_cast<double>(client->frames) / elapsed);
+		latencies.insert(latencies.end(), client->latencies.begin(), client->latencies.end());
+	}
+
+	// threads started during the measurement count from zero, the ones gone are lost
+	for(const auto &[thread, times] : endTimes)
+	{
+		auto before = startTimes.find(thread);
+		uint64_t ticks = times.ticks - (before != startTimes.end() ? before->second.ticks : 0);
+		double load = 100.0 * static_cast<double>(ticks) / static_cast<double>(sysconf(_SC_CLK_TCK)) / elapsed;
+
+		threadLoad[times.name] += load;
+		totalLoad += load;
+	}
+
+	for(auto &client : clients)
+		stopClient(*client);
+	runFor(loop, TEARDOWN_TIME / 1000.0);
+	server.reset();
+
+	fmt::format_to(append, ", \"seconds\": {:.2f}, \"frames\": {}", elapsed, frames);
+	fmt::format_to(append, ", \"fps\": {{\"mean\": {:.2f}, \"min\": {:.2f}}}",
+								 rates.empty() ? 0 : static_cast<double>(frames) / elapsed / static_cast<double>(rates.size()),
+								 rates.empty() ? 0 : *std::min_element(rates.begin(), rates.end()));
+	fmt::format_to(append, ", \"latency_ms\": ");
+	appendLatencies(append, latencies);
+	fmt::format_to(append, ", \"cpu_percent\": {{\"total\": {:.1f}, \"threads\": {{", totalLoad);
+	bool first = true;
+	for(const auto &[name, load] : threadLoad)
+	{
+		fmt::format_to(append, "{}{}: {:.1f}", first ? "" : ", ", jsonString(name), load);
+		first = false;
+	}
+	fmt::format_to(append, "}}}}, \"rss_bytes\": {{\"end\": {}, \"peak\": {}}}}}", memory, peakMemory);
+}
+
+int main(int argc, char *argv[])
+{
+	GMainLoop *loop;
+	const char *resolutions{ "1280x720,1920x1080" };
+	const char *encoders{ "x264enc" };
+	const char *clientCounts{ "1,4" };
+	const char *bufferCounts{ "8,16" };
+	const char *replayFile{};
+	const char *output{};
+	double replayRate{ -1 };
+	double warmup{ 3 };
+	double duration{ 10 };
+	double frameRate{ 30 };
+	gboolean udp{};
+	std::vector<BenchConfig> configs;
+	BenchSettings settings;
+	std::string out;
+
+	static const GOptionEntry optionEntries[] = {
+		{ "resolutions", 0, 0, G_OPTION_ARG_STRING, &resolutions, "Frame sizes, ignored with --replay",
+			"WIDTHxHEIGHT,..." },
+		{ "encoders", 0, 0, G_OPTION_ARG_STRING, &encoders, "Encoder elements", "x264enc,..." },
+		{ "clients", 0, 0, G_OPTION_ARG_STRING, &clientCounts, "Numbers of RTSP clients", "N,..." },
+		{ "buffers", 0, 0, G_OPTION_ARG_STRING, &bufferCounts, "Numbers of Aravis stream buffers", "N,..." },
+		{ "frame-rate", 0, 0, G_OPTION_ARG_DOUBLE, &frameRate, "Camera frame rate", "default: 30" },
+		{ "warmup", 0, 0, G_OPTION_ARG_DOUBLE, &warmup, "Seconds before a configuration is measured", "default: 3" },
+		{ "duration", 0, 0, G_OPTION_ARG_DOUBLE, &duration, "Seconds a configuration is measured", "default: 10" },
+		{ "udp", 0, 0, G_OPTION_ARG_NONE, &udp, "Stream over UDP instead of interleaved in the RTSP connection",
+			nullptr },
+		{ "replay", 0, 0, G_OPTION_ARG_FILENAME, &replayFile, "Raw capture served instead of the fake camera", nullptr },
+		{ "replay-rate", 0, 0, G_OPTION_ARG_DOUBLE, &replayRate, "Replay frame rate, 0 for as fast as possible",
+			"default: rate of the capture" },
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "File the JSON is written to", "default: stdout" },
+		{ nullptr }
+	};
+
+	if(!parseOptions(argc, argv, "- end-to-end benchmark of the RTSP server", optionEntries))
+		return EXIT_FAILURE;
+
+	settings = { warmup, duration, frameRate, udp != FALSE, replayFile != nullptr ? replayFile : "", {} };
+	if(replayRate >= 0)
+		settings.replayRate = replayRate;
+
+	std::vector<std::pair<int32_t, int32_t>> sizes;
+	if(!settings.replayFile.empty())
+	{
+		RawCaptureHeader header{};
+
+		// the capture has a single size
+		if(!readRawCaptureHeader(settings.replayFile, header))
+			return EXIT_FAILURE;
+		sizes.emplace_back(header.width, header.height);
+	}
+	else
+	{
+		for(const auto &resolution : splitList(resolutions))
+		{
+			int32_t width, height;
+
+			if(sscanf(resolution.c_str(), "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+				sizes.emplace_back(width, height);
+			else
+				fmt::print(stderr, "invalid resolution '{}'\n", resolution);
+		}
+	}
+
+	for(const auto &[width, height] : sizes)
+	{
+		for(const auto &name : splitList(encoders))
+		{
+			Encoder encoder;
+
+			if(!encoderFromString(name.c_str(), encoder))
+			{
+				fmt::print(stderr, "unknown encoder '{}'\n", name);
+				continue;
+			}
+			for(const auto &clientCount : splitList(clientCounts))
+			{
+				for(const auto &bufferCount : splitList(bufferCounts))
+				{
+					configs.push_back({ width, height, encoder,
+															static_cast<uint32_t>(g_ascii_strtoull(clientCount.c_str(), nullptr, 10)),
+															static_cast<uint32_t>(g_ascii_strtoull(bufferCount.c_str(), nullptr, 10)) });
+				}
+			}
+		}
+	}
+
+	if(!registerDebayerElement())
+		fmt::print(stderr, "failed to register the {} element\n", DEBAYER_ELEMENT_NAME);
+	loop = g_main_loop_new(nullptr, false);
+
+	char *version = gst_version_string();
+	fmt::format_to(std::back_inserter(out),
+								 "{{\n  \"gstreamer\": {},\n  \"source\": {},\n  \"transport\": \"{}\",\n  \"frame_rate\": {},\n"
+								 "  \"warmup_seconds\": {},\n  \"duration_seconds\": {},\n",
+								 jsonString(version), jsonString(settings.replayFile.empty() ? "fake-camera" : settings.replayFile),
+								 settings.udp ? "udp" : "tcp", settings.frameRate, settings.warmup, settings.duration);
+	g_free(version);
+	appendResults(out, configs.size(), [&](size_t index, int32_t port) {
+		const auto &config = configs[index];
+
+		fmt::print(stderr, "[{}/{}] {}x{} {} clients={} buffers={}\n", index + 1, configs.size(), config.width,
+							 config.height, encoderInfo(config.encoder).element, config.clients, config.buffers);
+		runConfig(loop, settings, config, port, out);
+	});
+
+	g_main_loop_unref(loop);
+	return writeOutput(out, output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
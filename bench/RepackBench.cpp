@@ -0,0 +1,189 @@
+/**
+ * @file RepackBench.cpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ *
+ * Compares the row repacking kernels against the plain per-row memcpy loop
+ * for various ROI widths. The output of every SIMD kernel is checked against
+ * the scalar one first, the benchmark fails on a mismatch.
+ * */
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "Repack.hpp"
+
+static constexpr size_t HEIGHT{ 2048 };
+static constexpr int ITERATIONS{ 50 };
+static constexpr size_t WIDTHS[] = { 18, 34, 66, 130, 322, 642, 1282, 2446 };
+
+template<typename Func>
+static double measure(Func &&func)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for(int i = 0; i < ITERATIONS; i++)
+		func();
+
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ITERATIONS;
+}
+
+static void memcpyLoop(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t height)
+{
+	for(size_t i = 0; i < height; i++)
+		memcpy(dst + i * dstStride, src + i * srcStride, srcStride);
+}
+
+/**
+ * @brief SIMD levels the running CPU supports, lowest first.
+ * */
+static std::vector<SimdLevel> simdLevels()
+{
+	SimdLevel best = detectSimdLevel();
+	std::vector<SimdLevel> levels;
+
+	if(best == SimdLevel::Neon)
+		return { SimdLevel::Neon };
+	for(auto level : { SimdLevel::Sse2, SimdLevel::Ssse3, SimdLevel::Avx2 })
+	{
+		if(level <= best)
+			levels.push_back(level);
+	}
+	return levels;
+}
+
+static std::vector<uint8_t> randomBytes(size_t size)
+{
+	std::mt19937 generator{ static_cast<std::mt19937::result_type>(size) };
+	std::vector<uint8_t> bytes(size);
+
+	for(auto &byte : bytes)
+		byte = static_cast<uint8_t>(generator());
+	return bytes;
+}
+
+/**
+ * @brief Run a kernel at every level into a buffer of its own and compare with the scalar output.
+ * */
+template<typename Func>
+static bool sameAsScalar(const std::vector<SimdLevel> &levels, size_t size, Func &&func, const char *what,
+												 size_t width)
+{
+	std::vector<uint8_t> expected(size, 0xcc);
+	bool same = true;
+
+	setRepackSimdLevel(SimdLevel::Scalar);
+	func(expected.data());
+	for(auto level : levels)
+	{
+		std::vector<uint8_t> actual(size, 0xcc);
+
+		setRepackSimdLevel(level);
+		func(actual.data());
+		if(memcmp(expected.data(), actual.data(), size) != 0)
+		{
+			fmt::print(stderr, "{} width {}: {} output differs from scalar\n", what, width, simdLevelName(level));
+			same = false;
+		}
+	}
+	return same;
+}
+
+static bool benchRepack(const std::vector<SimdLevel> &levels)
+{
+	bool same = true;
+
+	fmt::print("repack Mono8, {} rows, us/frame\n", HEIGHT);
+	fmt::print("{:>8} {:>10} {:>10}", "width", "memcpy", "scalar");
+	for(auto level : levels)
+		fmt::print(" {:>10}", simdLevelName(level));
+	fmt::print("\n");
+
+	for(auto width : WIDTHS)
+	{
+		// odd widths are the ones which need repacking
+		size_t rowSize = width + 1;
+		size_t dstStride = alignedRowStride(rowSize);
+		std::vector<uint8_t> src = randomBytes(rowSize * HEIGHT);
+		std::vector<uint8_t> dst(dstStride * HEIGHT);
+
+		same &= sameAsScalar(
+				levels, dst.size(),
+				[&](uint8_t *out) { repackRows(src.data(), rowSize, out, dstStride, rowSize, HEIGHT); }, "repack", rowSize);
+
+		double baseline = measure([&] { memcpyLoop(src.data(), rowSize, dst.data(), dstStride, HEIGHT); });
+		setRepackSimdLevel(SimdLevel::Scalar);
+		double scalar = measure([&] { repackRows(src.data(), rowSize, dst.data(), dstStride, rowSize, HEIGHT); });
+		fmt::print("{:>8} {:>10.1f} {:>10.1f}", rowSize, baseline, scalar);
+		for(auto level : levels)
+		{
+			setRepackSimdLevel(level);
+			fmt::print(" {:>10.1f}",
+								 measure([&] { repackRows(src.data(), rowSize, dst.data(), dstStride, rowSize, HEIGHT); }));
+		}
+		fmt::print("\n");
+	}
+	return same;
+}
+
+static bool benchUnpack(const std::vector<SimdLevel> &levels)
+{
+	static constexpr std::pair<PackedLayout, const char *> LAYOUTS[] = {
+		{ PackedLayout::GigE10, "Mono10Packed" },
+		{ PackedLayout::GigE12, "Mono12Packed" },
+		{ PackedLayout::Lsb10, "Mono10p" },
+		{ PackedLayout::Lsb12, "Mono12p" }
+	};
+	bool same = true;
+
+	for(const auto &[layout, name] : LAYOUTS)
+	{
+		fmt::print("\nunpack {} to 16-bit, {} rows, us/frame\n", name, HEIGHT);
+		fmt::print("{:>8} {:>10}", "width", "scalar");
+		for(auto level : levels)
+			fmt::print(" {:>10}", simdLevelName(level));
+		fmt::print("\n");
+
+		for(auto width : WIDTHS)
+		{
+			uint32_t bitsPerPixel = layout == PackedLayout::Lsb10 ? 10 : 12;
+			size_t srcStride = packedRowStride(static_cast<int32_t>(width), bitsPerPixel);
+			size_t dstStride = alignedRowStride(width * sizeof(uint16_t));
+			std::vector<uint8_t> src = randomBytes(srcStride * HEIGHT);
+			std::vector<uint8_t> dst(dstStride * HEIGHT);
+
+			same &= sameAsScalar(
+					levels, dst.size(),
+					[&](uint8_t *out) { unpackRows(src.data(), srcStride, out, dstStride, width, HEIGHT, layout); }, name,
+					width);
+
+			setRepackSimdLevel(SimdLevel::Scalar);
+			double scalar =
+					measure([&] { unpackRows(src.data(), srcStride, dst.data(), dstStride, width, HEIGHT, layout); });
+			fmt::print("{:>8} {:>10.1f}", width, scalar);
+			for(auto level : levels)
+			{
+				setRepackSimdLevel(level);
+				fmt::print(" {:>10.1f}",
+									 measure([&] { unpackRows(src.data(), srcStride, dst.data(), dstStride, width, HEIGHT, layout); }));
+			}
+			fmt::print("\n");
+		}
+	}
+	return same;
+}
+
+int main()
+{
+	std::vector<SimdLevel> levels = simdLevels();
+	bool same = benchRepack(levels);
+
+	same &= benchUnpack(levels);
+	return same ? 0 : 1;
+}
@@ -0,0 +1,431 @@
+/**
+ * @file SessionBench.cpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ *
+ * Runs the server in-process against the Aravis fake camera and sets up
+ * growing numbers of RTSP sessions from a few generator threads, each client
+ * on a connection of its own. DESCRIBE, SETUP and PLAY are timed per request,
+ * the clients receive over UDP on sockets nobody reads, so only the RTSP
+ * handling of the server is measured. For every combination of client count
+ * and server threading the latency percentiles are printed as JSON, overall
+ * and over the number of sessions already playing when a request was sent:
+ *
+ *     rtspcam_session_bench --clients 10,50,100,200 --threads 1,0,per-client > sessions.json
+ *
+ * Latency that grows with the number of playing sessions means the clients
+ * queue up behind each other on the threads of the server.
+ * */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+
+#include <fmt/format.h>
+#include <gst/gst.h>
+#include <gst/rtsp/rtsp.h>
+
+#include "BenchCommon.hpp"
+#include "Encoder.hpp"
+
+/// Microseconds a client waits for the server to connect or answer a request
+static constexpr gint64 REQUEST_TIMEOUT{ 10 * G_USEC_PER_SEC };
+
+/// Requests timed for every client
+enum class Request
+{
+	Connect,
+	Describe,
+	Setup,
+	Play,
+	Count
+};
+
+static constexpr const char *REQUEST_NAMES[]{ "connect", "describe", "setup", "play" };
+
+/// Settings shared by all configurations
+struct BenchSettings
+{
+	int32_t width;
+	int32_t height;
+	Encoder encoder;
+	uint32_t connectThreads;
+	uint32_t bucketSize;
+	double hold;
+};
+
+/// Point of the matrix
+struct BenchConfig
+{
+	uint32_t clients;
+	/// Threads of the server, 0 for one per core
+	uint32_t threads;
+	bool threadPerClient;
+};
+
+/// Client connection and the time its requests took
+struct BenchClient
+{
+	GstRTSPConnection *connection;
+	GSocket *rtpSocket;
+	GSocket *rtcpSocket;
+	std::string session;
+	/// Sessions playing when the client started
+	uint32_t playing;
+	/// Latencies in milliseconds, negative when the request failed
+	double latencies[static_cast<size_t>(Request::Count)];
+	std::string error;
+};
+
+/**
+ * @brief Call a function for every index on a number of threads while the main loop runs.
+ * */
+static void runOnThreads(GMainLoop *loop, uint32_t count, uint32_t numThreads,
+												 const std::function<void(uint32_t index)> &function)
+{
+	std::vector<std::thread> threads;
+	std::atomic<uint32_t> next{}, running{ numThreads };
+
+	for(uint32_t i = 0; i < numThreads; i++)
+	{
+		threads.emplace_back([&] {
+			for(uint32_t index; (index = next++) < count;)
+				function(index);
+			// the last thread stops the loop, the server keeps accepting until then
+			if(--running == 0)
+				g_idle_add(quitLoop, loop);
+		});
+	}
+	g_main_loop_run(loop);
+	for(auto &thread : threads)
+		thread.join();
+}
+
+/**
+ * @brief UDP socket on a free local port.
+ * */
+static GSocket *bindSocket(uint16_t &port)
+{
+	GSocket *socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, nullptr);
+	GInetAddress *address;
+	GSocketAddress *bound;
+
+	if(socket == nullptr)
+		return nullptr;
+
+	address = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	bound = g_inet_socket_address_new(address, 0);
+	g_object_unref(address);
+	if(!g_socket_bind(socket, bound, false, nullptr))
+	{
+		g_object_unref(bound);
+		g_object_unref(socket);
+		return nullptr;
+	}
+	g_object_unref(bound);
+
+	bound = g_socket_get_local_address(socket, nullptr);
+	port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound));
+	g_object_unref(bound);
+	return socket;
+}
+
+/**
+ * @brief Send a request on the connection of a client and wait for its response.
+ *
+ * @return Response or nullptr when the request failed, the error of the client is set.
+ * */
+static GstRTSPMessage *sendRequest(BenchClient &client, GstRTSPMethod method, const std::string &url, uint32_t cseq,
+																	 const std::vector<std::pair<GstRTSPHeaderField, std::string>> &headers)
+{
+	GstRTSPMessage *request, *response;
+	GstRTSPStatusCode code{};
+	GstRTSPResult result;
+
+	gst_rtsp_message_new_request(&request, method, url.c_str());
+	gst_rtsp_message_add_header(request, GST_RTSP_HDR_CSEQ, std::to_string(cseq).c_str());
+	for(const auto &[field, value] : headers)
+		gst_rtsp_message_add_header(request, field, value.c_str());
+	result = gst_rtsp_connection_send_usec(client.connection, request, REQUEST_TIMEOUT);
+	gst_rtsp_message_free(request);
+	if(result != GST_RTSP_OK)
+	{
+		client.error = fmt::format("{} failed to send: {}", gst_rtsp_method_as_text(method), gst_rtsp_strresult(result));
+		return nullptr;
+	}
+
+	gst_rtsp_message_new(&response);
+	result = gst_rtsp_connection_receive_usec(client.connection, response, REQUEST_TIMEOUT);
+	if(result == GST_RTSP_OK)
+		gst_rtsp_message_parse_response(response, &code, nullptr, nullptr);
+	if(result != GST_RTSP_OK || code != GST_RTSP_STS_OK)
+	{
+		client.error = result != GST_RTSP_OK
+										 ? fmt::format("{} failed: {}", gst_rtsp_method_as_text(method), gst_rtsp_strresult(result))
+										 : fmt::format("{} failed: {}", gst_rtsp_method_as_text(method), gst_rtsp_status_as_text(code));
+		gst_rtsp_message_free(response);
+		return nullptr;
+	}
+	return response;
+}
+
+/**
+ * @brief Connect a client and set up its stream, timing every step.
+ * */
+static void startClient(BenchClient &client, const std::string &url, std::atomic<uint32_t> &playing)
+{
+	GstRTSPUrl *rtspUrl;
+	GstRTSPMessage *response;
+	uint16_t rtpPort, rtcpPort;
+	char *session;
+	gint64 start;
+
+	auto timed = [&client, &start](Request request) {
+		client.latencies[static_cast<size_t>(request)] =
+			static_cast<double>(g_get_monotonic_time() - start) / 1000.0;
+	};
+
+	client.playing = playing;
+	std::fill(std::begin(client.latencies), std::end(client.latencies), -1.0);
+	if(gst_rtsp_url_parse(url.c_str(), &rtspUrl) != GST_RTSP_OK)
+	{
+		client.error = "invalid url";
+		return;
+	}
+	gst_rtsp_connection_create(rtspUrl, &client.connection);
+	gst_rtsp_url_free(rtspUrl);
+
+	start = g_get_monotonic_time();
+	if(gst_rtsp_connection_connect_usec(client.connection, REQUEST_TIMEOUT) != GST_RTSP_OK)
+	{
+		client.error = "failed to connect";
+		return;
+	}
+	timed(Request::Connect);
+
+	start = g_get_monotonic_time();
+	if((response = sendRequest(client, GST_RTSP_DESCRIBE, url, 1, { { GST_RTSP_HDR_ACCEPT, "application/sdp" } })) ==
+		 nullptr)
+		return;
+	timed(Request::Describe);
+	gst_rtsp_message_free(response);
+
+	// the packets are dropped by the kernel once the receive buffers are full
+	if((client.rtpSocket = bindSocket(rtpPort)) == nullptr || (client.rtcpSocket = bindSocket(rtcpPort)) == nullptr)
+	{
+		client.error = "failed to bind the client ports";
+		return;
+	}
+
+	start = g_get_monotonic_time();
+	if((response = sendRequest(client, GST_RTSP_SETUP, url + "/stream=0", 2,
+														 { { GST_RTSP_HDR_TRANSPORT,
+																 fmt::format("RTP/AVP;unicast;client_port={}-{}", rtpPort, rtcpPort) } })) ==
+		 nullptr)
+		return;
+	timed(Request::Setup);
+	if(gst_rtsp_message_get_header(response, GST_RTSP_HDR_SESSION, &session, 0) == GST_RTSP_OK)
+	{
+		client.session = session;
+		// the session id is sent back without its timeout
+		client.session = client.session.substr(0, client.session.find(';'));
+	}
+	gst_rtsp_message_free(response);
+
+	start = g_get_monotonic_time();
+	if((response = sendRequest(client, GST_RTSP_PLAY, url, 3, { { GST_RTSP_HDR_SESSION, client.session } })) == nullptr)
+		return;
+	timed(Request::Play);
+	gst_rtsp_message_free(response);
+	playing++;
+}
+
+static void stopClient(BenchClient &client, const std::string &url)
+{
+	if(client.connection != nullptr)
+	{
+		if(!client.session.empty())
+		{
+			if(auto response = sendRequest(client, GST_RTSP_TEARDOWN, url, 4, { { GST_RTSP_HDR_SESSION, client.session } });
+				 response != nullptr)
+				gst_rtsp_message_free(response);
+		}
+		gst_rtsp_connection_free(client.connection);
+		client.connection = nullptr;
+	}
+	if(client.rtpSocket != nullptr)
+		g_object_unref(client.rtpSocket);
+	if(client.rtcpSocket != nullptr)
+		g_object_unref(client.rtcpSocket);
+	client.rtpSocket = client.rtcpSocket = nullptr;
+}
+
+/**
+ * @brief Serve a configuration, set up its sessions and append its JSON object to the output.
+ * */
+static void runConfig(GMainLoop *loop, const BenchSettings &settings, const BenchConfig &config, int32_t port,
+											std::string &out)
+{
+	auto append = std::back_inserter(out);
+	Options options{};
+	std::vector<BenchClient> clients(config.clients);
+	std::atomic<uint32_t> playing{};
+	uint32_t failed{};
+
+	fmt::format_to(append, "    {{\"clients\": {}, \"server_threads\": ", config.clients);
+	if(config.threadPerClient)
+		fmt::format_to(append, "\"per-client\"");
+	else
+		fmt::format_to(append, "{}", config.threads > 0 ? config.threads : g_get_num_processors());
+
+	options.width = settings.width;
+	options.height = settings.height;
+	options.encoder = settings.encoder;
+	options.encoding.codec = encoderInfo(settings.encoder).codec;
+	options.fakeCamera = true;
+	options.serverThreads = config.threads;
+	options.threadPerClient = config.threadPerClient;
+
+	auto server = startServer(options, port, append);
+	if(server == nullptr)
+		return;
+
+	auto url = fmt::format("rtsp://127.0.0.1:{}/{}", port, options.path);
+	gint64 start = g_get_monotonic_time();
+	runOnThreads(loop, config.clients, settings.connectThreads,
+							 [&](uint32_t index) { startClient(clients[index], url, playing); });
+	double elapsed = static_cast<double>(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+	for(const auto &client : clients)
+	{
+		if(!client.error.empty() && failed++ == 0)
+			fmt::print(stderr, "client: {}\n", client.error);
+	}
+
+	// the sessions stream for a while before they go, as a viewer would
+	runFor(loop, settings.hold);
+	runOnThreads(loop, config.clients, settings.connectThreads,
+							 [&](uint32_t index) { stopClient(clients[index], url); });
+	runFor(loop, TEARDOWN_TIME / 1000.0);
+	server.reset();
+
+	fmt::format_to(append, ", \"playing\": {}, \"failed\": {}, \"setup_seconds\": {:.3f}, \"latency_ms\": {{",
+								 playing.load(), failed, elapsed);
+	for(size_t request = 0; request < static_cast<size_t>(Request::Count); request++)
+	{
+		std::vector<double> latencies;
+
+		for(const auto &client : clients)
+		{
+			if(client.latencies[request] >= 0)
+				latencies.push_back(client.latencies[request]);
+		}
+		fmt::format_to(append, "{}\"{}\": ", request > 0 ? ", " : "", REQUEST_NAMES[request]);
+		appendLatencies(append, latencies);
+	}
+
+	// requests sent with more sessions playing should not take longer
+	fmt::format_to(append, "}}, \"by_playing\": [");
+	for(uint32_t bucket = 0; bucket * settings.bucketSize < config.clients; bucket++)
+	{
+		std::vector<double> latencies;
+
+		for(const auto &client : clients)
+		{
+			if(client.playing / settings.bucketSize != bucket)
+				continue;
+			for(auto request : { Request::Describe, Request::Setup, Request::Play })
+			{
+				if(client.latencies[static_cast<size_t>(request)] >= 0)
+					latencies.push_back(client.latencies[static_cast<size_t>(request)]);
+			}
+		}
+		fmt::format_to(append, "{}{{\"playing\": {}, \"requests\": ", bucket > 0 ? ", " : "",
+									 bucket * settings.bucketSize);
+		appendLatencies(append, latencies);
+		out += "}";
+	}
+	out += "]}";
+}
+
+int main(int argc, char *argv[])
+{
+	GMainLoop *loop;
+	const char *clientCounts{ "10,50,100,200" };
+	const char *threadCounts{ "1,0,per-client" };
+	const char *encoder{ "x264enc" };
+	const char *output{};
+	int32_t width{ 320 };
+	int32_t height{ 240 };
+	int32_t connectThreads{ 16 };
+	int32_t bucketSize{ 25 };
+	double hold{ 2 };
+	std::vector<BenchConfig> configs;
+	BenchSettings settings;
+	std::string out;
+
+	static const GOptionEntry optionEntries[] = {
+		{ "clients", 0, 0, G_OPTION_ARG_STRING, &clientCounts, "Numbers of RTSP clients", "N,..." },
+		{ "threads", 0, 0, G_OPTION_ARG_STRING, &threadCounts,
+			"Server threads, 0 for one per core, per-client for a thread per client", "N,..." },
+		{ "connect-threads", 0, 0, G_OPTION_ARG_INT, &connectThreads, "Threads the clients are set up from",
+			"default: 16" },
+		{ "bucket", 0, 0, G_OPTION_ARG_INT, &bucketSize, "Playing sessions the latencies are grouped by",
+			"default: 25" },
+		{ "hold", 0, 0, G_OPTION_ARG_DOUBLE, &hold, "Seconds the sessions play before they are torn down",
+			"default: 2" },
+		{ "width", 0, 0, G_OPTION_ARG_INT, &width, "Frame width", "default: 320" },
+		{ "height", 0, 0, G_OPTION_ARG_INT, &height, "Frame height", "default: 240" },
+		{ "encoder", 0, 0, G_OPTION_ARG_STRING, &encoder, "Encoder element", "default: x264enc" },
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "File the JSON is written to", "default: stdout" },
+		{ nullptr }
+	};
+
+	if(!parseOptions(argc, argv, "- RTSP session setup benchmark of the server", optionEntries))
+		return EXIT_FAILURE;
+
+	settings = { width, height, Encoder::X264, static_cast<uint32_t>(std::max(connectThreads, 1)),
+							 static_cast<uint32_t>(std::max(bucketSize, 1)), hold };
+	if(!encoderFromString(encoder, settings.encoder))
+	{
+		fmt::print(stderr, "unknown encoder '{}'\n", encoder);
+		return EXIT_FAILURE;
+	}
+	if(!isEncoderAvailable(settings.encoder))
+	{
+		fmt::print(stderr, "encoder '{}' not available\n", encoder);
+		return EXIT_FAILURE;
+	}
+
+	for(const auto &threadCount : splitList(threadCounts))
+	{
+		for(const auto &clientCount : splitList(clientCounts))
+		{
+			configs.push_back({ static_cast<uint32_t>(g_ascii_strtoull(clientCount.c_str(), nullptr, 10)),
+													static_cast<uint32_t>(g_ascii_strtoull(threadCount.c_str(), nullptr, 10)),
+													threadCount == "per-client" });
+		}
+	}
+
+	loop = g_main_loop_new(nullptr, false);
+
+	char *version = gst_version_string();
+	fmt::format_to(std::back_inserter(out),
+								 "{{\n  \"gstreamer\": {},\n  \"width\": {},\n  \"height\": {},\n"
+								 "  \"encoder\": \"{}\",\n  \"connect_threads\": {},\n  \"hold_seconds\": {},\n",
+								 jsonString(version), settings.width, settings.height, encoderInfo(settings.encoder).element,
+								 settings.connectThreads, settings.hold);
+	g_free(version);
+	appendResults(out, configs.size(), [&](size_t index, int32_t port) {
+		const auto &config = configs[index];
+
+		fmt::print(stderr, "[{}/{}] clients={} threads={}\n", index + 1, configs.size(), config.clients,
+							 config.threadPerClient ? "per-client" : std::to_string(config.threads));
+		runConfig(loop, settings, config, port, out);
+	});
+
+	g_main_loop_unref(loop);
+	return writeOutput(out, output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
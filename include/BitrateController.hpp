@@ -0,0 +1,117 @@
+/**
+ * @file BitrateController.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_BITRATECONTROLLER_HPP
+#define RTSPCAM_BITRATECONTROLLER_HPP
+
+#include <map>
+
+#include "Common.hpp"
+
+/// Key of the controller attached to the media factory of a stream
+static constexpr const char *BITRATE_CONTROLLER_KEY{ "rtspcam-bitrate-controller" };
+
+/**
+ * Counters of a bitrate controller.
+ * */
+struct BitrateControllerStats
+{
+	/// Bitrate of the encoder in kbit/s
+	int64_t bitrate;
+	uint64_t increases;
+	uint64_t decreases;
+	/// Clients that sent a receiver report since the media was prepared
+	size_t clients;
+	/// Loss fraction and jitter in milliseconds of the last receiver report
+	double fractionLost;
+	double jitter;
+};
+
+/**
+ * @class BitrateController
+ *
+ * Adapts the bitrate of the encoder of a stream to the RTCP receiver
+ * reports of its clients.
+ *
+ * Every client gets its own rate by AIMD: a report with heavy loss cuts the
+ * rate in proportion to the loss, rising jitter above a limit cuts it by a
+ * fixed factor, and a clean report adds a step towards the stream bitrate.
+ * The rate of a client stays within the limits of the controller. Clients of
+ * a shared media share the encoder, which runs at the rate of the slowest.
+ * */
+class BitrateController
+{
+public:
+	/**
+	 * @param encoder Encoder of the stream, for the unit of its bitrate property.
+	 * @param minBitrate Lowest rate of a client in kbit/s.
+	 * @param maxBitrate Highest rate of a client in kbit/s, the configured bitrate of the stream.
+	 * */
+	BitrateController(Encoder encoder, int64_t minBitrate, int64_t maxBitrate);
+	~BitrateController();
+
+	BitrateController(const BitrateController &) = delete;
+	BitrateController &operator=(const BitrateController &) = delete;
+
+	/**
+	 * @brief Control an encoder element, replacing the previous one.
+	 *
+	 * The clients are forgotten, the encoder starts at the highest rate.
+	 * */
+	void attach(GstElement *encoder);
+
+	/**
+	 * @brief Stop controlling the encoder and restore its highest rate.
+	 * */
+	void detach();
+
+	/**
+	 * @brief Adapt the rate of a client to its receiver report.
+	 *
+	 * Called from the RTCP threads of the media sessions.
+	 *
+	 * @param ssrc SSRC of the client.
+	 * @param fractionLost Fraction of the packets lost since the previous report, 0 to 1.
+	 * @param jitter Interarrival jitter in milliseconds.
+	 * */
+	void onReport(guint32 ssrc, double fractionLost, double jitter);
+
+	/**
+	 * @brief Forget a client that left or timed out.
+	 * */
+	void removeClient(guint32 ssrc);
+
+	[[nodiscard]]
+	BitrateControllerStats stats() const;
+
+private:
+	struct Client
+	{
+		/// Rate of the client in kbit/s
+		int64_t bitrate;
+		/// Jitter of the previous report in milliseconds
+		double jitter;
+	};
+
+	/**
+	 * @brief Set the encoder to the lowest client rate, called with the lock held.
+	 * */
+	void apply();
+
+	Encoder _encoderKind;
+	int64_t _minBitrate;
+	int64_t _maxBitrate;
+	mutable std::mutex _mutex;
+	GstElement *_encoder;
+	std::map<guint32, Client> _clients;
+	int64_t _bitrate;
+	uint64_t _increases;
+	uint64_t _decreases;
+	double _fractionLost;
+	double _jitter;
+};
+
+#endif // RTSPCAM_BITRATECONTROLLER_HPP
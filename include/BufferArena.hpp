@@ -0,0 +1,114 @@
+/**
+ * @file BufferArena.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_BUFFERARENA_HPP
+#define RTSPCAM_BUFFERARENA_HPP
+
+#include "Common.hpp"
+
+/**
+ * Pages backing an arena.
+ * */
+enum class ArenaBacking
+{
+	/// Pages reserved in the hugetlb pool
+	HugeTlb,
+	/// Regular mapping the kernel is asked to back with transparent huge pages
+	TransparentHuge,
+	/// Regular pages
+	Pages
+};
+
+/**
+ * Huge pages of the system as reported by /proc/meminfo.
+ * */
+struct HugePageInfo
+{
+	uint64_t total;
+	uint64_t free;
+	/// Size of a huge page in bytes
+	uint64_t pageSize;
+	/// Whether transparent huge pages can be requested with madvise
+	bool transparent;
+};
+
+/**
+ * Memory held by the stream buffers of a camera.
+ * */
+struct StreamMemory
+{
+	/// Mapped bytes
+	size_t bytes;
+	ArenaBacking backing;
+};
+
+/**
+ * @class BufferArena
+ *
+ * One mapping holding the Aravis stream buffers of a camera.
+ *
+ * Huge pages are taken from the hugetlb pool when it has enough free pages,
+ * otherwise transparent huge pages are requested and regular pages are used
+ * when the kernel has them disabled. The pages are touched up front so the
+ * stream thread never faults them in.
+ *
+ * Every Aravis buffer made from the arena keeps it alive, so frames wrapped
+ * by GStreamer stay valid after the stream that filled them is gone.
+ * */
+class BufferArena: public std::enable_shared_from_this<BufferArena>
+{
+public:
+	/**
+	 * @param bufferSize Size of a buffer in bytes, buffers start on page boundaries.
+	 * @param count Number of buffers.
+	 * @param hugePages Try huge pages before regular pages.
+	 * @return nullptr when no memory could be mapped.
+	 * */
+	static std::shared_ptr<BufferArena> create(size_t bufferSize, uint32_t count, bool hugePages);
+
+	~BufferArena();
+
+	BufferArena(const BufferArena &) = delete;
+	BufferArena &operator=(const BufferArena &) = delete;
+
+	/**
+	 * @brief Make an Aravis buffer over a slot of the arena, it holds a reference to the arena.
+	 * */
+	[[nodiscard]]
+	ArvBuffer *newBuffer(uint32_t index);
+
+	[[nodiscard]]
+	uint32_t count() const;
+
+	/**
+	 * @brief Mapped bytes, the buffers rounded up to pages.
+	 * */
+	[[nodiscard]]
+	size_t size() const;
+
+	[[nodiscard]]
+	ArenaBacking backing() const;
+
+	static const char *backingName(ArenaBacking backing);
+
+private:
+	BufferArena(uint8_t *data, size_t size, size_t bufferSize, size_t slotSize, uint32_t count, ArenaBacking backing);
+
+	uint8_t *_data;
+	size_t _size;
+	size_t _bufferSize;
+	size_t _slotSize;
+	uint32_t _count;
+	ArenaBacking _backing;
+};
+
+/**
+ * @brief Read the huge page pool and the transparent huge page mode.
+ * */
+[[nodiscard]]
+HugePageInfo hugePageInfo();
+
+#endif // RTSPCAM_BUFFERARENA_HPP
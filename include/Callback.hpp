@@ -7,14 +7,17 @@
 #ifndef RTSPCAM_CALLBACK_HPP
 #define RTSPCAM_CALLBACK_HPP
 
+#include <gio/gio.h>
+
 #include "Common.hpp"
+#include "CaptureBackend.hpp"
+#include "EncoderProbe.hpp"
+#include "FramePool.hpp"
+#include "Metrics.hpp"
 
-struct ArvGstBufferReleaseData
-{
-	GWeakRef stream;
-	ArvBuffer *arvBuffer;
-	guint8 *data;
-};
+class DeviceHandle;
+class CapturePipeline;
+class StreamRelay;
 
 /**
  * \brief Timeout callback is periodically run to clean up the expired sessions from the
@@ -25,6 +28,38 @@ struct ArvGstBufferReleaseData
  */
 bool cleanupTimeout(GstRTSPServer *server);
 
+/**
+ * \brief Client filter closing every client, used when the server shuts down.
+ *
+ * \param server RTSP server.
+ * \param client connected client.
+ * \param data unused.
+ * */
+GstRTSPFilterResult closeClient(GstRTSPServer *server, GstRTSPClient *client, void *data);
+
+/**
+ * \brief Session filter removing every session, used when the server shuts down.
+ *
+ * \param pool session pool of the server.
+ * \param session session in the pool.
+ * \param data unused.
+ * */
+GstRTSPFilterResult closeSession(GstRTSPSessionPool *pool, GstRTSPSession *session, void *data);
+
+/**
+ * \brief Periodic check of the stream of a camera, run on the main loop.
+ *
+ * \param data device handle of the camera.
+ * */
+gboolean streamWatchdog(void *data);
+
+/**
+ * \brief Periodic step raising a throttled frame rate back, run on the main loop.
+ *
+ * \param data device handle of the camera.
+ * */
+gboolean throttleRaise(void *data);
+
 /**
  * \brief Called when a new media pipeline is constructed.
  *
@@ -36,7 +71,132 @@ bool cleanupTimeout(GstRTSPServer *server);
  * */
 void configureMedia(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data);
 
-void mediaConstructed(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data);
+/**
+ * \brief Called when a new media of a stream profile is constructed.
+ *
+ * The media reads from the shared capture pipeline of its camera, which is
+ * started by the first media of the camera.
+ *
+ * \param factory a Gstreamer RTSP media factory instance.
+ * \param media a media to be configured.
+ * \param data capture pipeline of the camera.
+ * */
+void configureProfileMedia(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data);
+
+/**
+ * \brief Called when a media of a stream profile is unprepared.
+ *
+ * \param media unprepared media.
+ * \param data capture pipeline of the camera.
+ * */
+void profileMediaUnprepared(GstRTSPMedia *media, void *data);
+
+/**
+ * \brief Called when a new media attached to a persistent capture pipeline is constructed.
+ *
+ * \param factory a Gstreamer RTSP media factory instance.
+ * \param media a media to be configured.
+ * \param data relay of the encoded stream served by the media.
+ * */
+void configureRelayMedia(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data);
+
+/**
+ * \brief The media is ready to receive frames from the relay.
+ *
+ * \param media prepared media.
+ * \param data relay of the encoded stream.
+ * */
+void relayMediaPrepared(GstRTSPMedia *media, void *data);
+
+/**
+ * \brief The media stops receiving frames from the relay.
+ *
+ * \param media unprepared media.
+ * \param data relay of the encoded stream.
+ * */
+void relayMediaUnprepared(GstRTSPMedia *media, void *data);
+
+/**
+ * \brief Let the bitrate controller of a factory drive the encoder of its media.
+ *
+ * Nothing is installed when the factory has no controller.
+ *
+ * \param factory factory of the media, holding the controller.
+ * \param media media being configured.
+ * \param encoder encoder of the stream, the reference is taken over, may be nullptr.
+ * */
+void installBitrateControl(GstRTSPMediaFactory *factory, GstRTSPMedia *media, GstElement *encoder);
+
+/**
+ * \brief Watch the receiver reports arriving in the RTP sessions of the media.
+ *
+ * \param media prepared media.
+ * \param data bitrate controller of the stream.
+ * */
+void bitrateMediaPrepared(GstRTSPMedia *media, void *data);
+
+/**
+ * \brief Stop watching the RTP sessions and release the encoder.
+ *
+ * \param media unprepared media.
+ * \param data bitrate controller of the stream.
+ * */
+void bitrateMediaUnprepared(GstRTSPMedia *media, void *data);
+
+/**
+ * \brief A source of an RTP session sent RTCP, e.g. a receiver report of a client.
+ *
+ * \param session internal RTP session of a stream.
+ * \param source RTP source of the sender of the packet.
+ * \param data bitrate controller of the stream.
+ * */
+void rtcpSourceActive(GObject *session, GObject *source, void *data);
+
+/**
+ * \brief A source of an RTP session sent a BYE or timed out.
+ *
+ * \param session internal RTP session of a stream.
+ * \param source RTP source that left.
+ * \param data bitrate controller of the stream.
+ * */
+void rtcpSourceGone(GObject *session, GObject *source, void *data);
+
+/**
+ * \brief An encoded frame reached the app sink of a relay.
+ *
+ * \param sink app sink of the persistent capture pipeline.
+ * \param data relay owning the app sink.
+ * */
+GstFlowReturn relayNewSample(GstAppSink *sink, void *data);
+
+/**
+ * \brief The app sink at the end of the muxed main stream has a new sample.
+ *
+ * \param sink app sink of the persistent capture pipeline.
+ * \param data disk ring recording the stream.
+ * */
+GstFlowReturn recordingNewSample(GstAppSink *sink, void *data);
+
+/**
+ * \brief Count the packets the streams of a media send by lower transport.
+ *
+ * Connected to the media-configure signal of every factory next to the
+ * handler building the media.
+ *
+ * \param factory factory of the media.
+ * \param media media being configured.
+ * \param data transport metrics of the stream.
+ * */
+void configureTransportCounters(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data);
+
+/**
+ * \brief Probe counting the packets leaving the payloader of a stream.
+ *
+ * \param pad source pad of the stream.
+ * \param info probe info with a buffer or buffer list.
+ * \param data transport metrics of the stream.
+ * */
+GstPadProbeReturn transportProbe(GstPad *pad, GstPadProbeInfo *info, void *data);
 
 void mediaStateChanged(GstRTSPMedia *media, GstState state, void *data);
 
@@ -46,25 +206,150 @@ void mediaStateChanged(GstRTSPMedia *media, GstState state, void *data);
  *
  * \param server gstreamer RTSPServer instance.
  * \param client connected client instance.
+ * \param data server handle.
  * */
 void clientConnected(GstRTSPServer *server, GstRTSPClient *client, void *data);
 
 /**
- * \brief The signal called when a client disconnects from server.
+ * \brief The signal called when a client set up a stream.
  *
- * We stop feeding data to server when there is no connected client.
+ * The transport of the client is added to the session registry as a
+ * session of the camera mounted at the requested path.
+ *
+ * \param client connected client instance.
+ * \param ctx context of the SETUP request.
+ * \param data server handle.
+ * */
+void clientSetup(GstRTSPClient *client, GstRTSPContext *ctx, void *data);
+
+/**
+ * \brief The signal called when a client disconnects from server.
  *
- * \param server gstreamer RTSPServer instance.
  * \param client connected client instance.
+ * \param data server handle.
  * */
 void clientClosed(GstRTSPClient *client, void *data);
 
-GstBuffer *toGstBuffer(ArvBuffer *arvBuffer, guint partId, ArvStream *stream);
+/**
+ * \brief A source of the RTP session of a stream sent RTCP, kept for the session of the client it came from.
+ *
+ * \param session RTP session of the stream.
+ * \param source RTP source that sent the packet.
+ * \param data session registry.
+ * */
+void sessionReport(GObject *session, GObject *source, void *data);
+
+/**
+ * \brief Describe a part of an Aravis buffer as a frame.
+ *
+ * \param arvBuffer camera buffer popped from the stream.
+ * \param partId buffer part to describe.
+ * \param rowStride row stride the camera delivers, 0 for packed rows.
+ * */
+FrameView arvFrameView(ArvBuffer *arvBuffer, guint partId, size_t rowStride);
+
+/**
+ * \brief Release returning an Aravis buffer to its stream.
+ *
+ * \param arvBuffer camera buffer popped from the stream.
+ * \param stream stream owning the camera buffer.
+ * \param pool pool providing the release records.
+ * */
+FrameRelease arvFrameRelease(ArvBuffer *arvBuffer, ArvStream *stream, FramePool *pool);
+
+/**
+ * \brief Wrap a frame into a GStreamer buffer.
+ *
+ * The frame memory is wrapped and released on release of the GStreamer buffer.
+ * A row stride GStreamer cannot handle is described by GstVideoMeta when downstream accepts it.
+ * Otherwise, as well as for packed 10/12-bit frames, the frame is repacked into a buffer
+ * taken from the frame pool and the frame memory is released right away.
+ *
+ * \param frame frame of a camera or a capture backend.
+ * \param pool pool providing repack buffers.
+ * \param videoMetaInfo video info for the video meta, nullptr to repack unaligned frames.
+ * \param release release of the frame memory, called on failure too.
+ * */
+GstBuffer *toGstBuffer(const FrameView &frame, FramePool *pool, const GstVideoInfo *videoMetaInfo,
+											 FrameRelease release);
+
+/**
+ * \brief Probe of the app source pad watching for the answer to its allocation query.
+ *
+ * \param pad source pad of the app source.
+ * \param info probe info with the query.
+ * \param data device handle owning the app source.
+ * */
+GstPadProbeReturn sourceAllocationQuery(GstPad *pad, GstPadProbeInfo *info, void *data);
+
+/**
+ * \brief The app source queue drained below its limit.
+ *
+ * \param source app source of the media.
+ * \param length amount of bytes needed, unused for app sources in push mode.
+ * \param data device handle feeding the app source.
+ * */
+void sourceNeedData(GstAppSrc *source, guint length, void *data);
+
+/**
+ * \brief The app source queue reached its limit.
+ *
+ * \param source app source of the media.
+ * \param data device handle feeding the app source.
+ * */
+void sourceEnoughData(GstAppSrc *source, void *data);
+
+/**
+ * \brief Add the latency probes of a camera to a pipeline.
+ *
+ * The app source named srvsrc, every encoder and the payloader named pay0
+ * found in the bin are probed.
+ *
+ * \param bin pipeline to probe.
+ * \param metrics metrics of the camera feeding the pipeline.
+ * */
+void installLatencyProbes(GstBin *bin, CaptureMetrics *metrics);
+
+/**
+ * \brief Probe observing the latency of the frames passing a pad.
+ *
+ * \param pad probed pad.
+ * \param info probe info with a buffer or buffer list.
+ * \param data stage and metrics of the probe.
+ * */
+GstPadProbeReturn latencyProbe(GstPad *pad, GstPadProbeInfo *info, void *data);
+
+/**
+ * \brief Probe counting the frames leaving the encoder of a probe pipeline.
+ *
+ * \param pad probed pad.
+ * \param info probe info with a buffer.
+ * \param data count of the encoded frames.
+ * */
+GstPadProbeReturn encodedFrameProbe(GstPad *pad, GstPadProbeInfo *info, void *data);
+
+/**
+ * \brief A client connected to the HTTP server, called on a worker thread of the service.
+ *
+ * \param service listening socket service.
+ * \param connection connection of the client.
+ * \param sourceObject unused.
+ * \param data HTTP server.
+ * */
+gboolean httpRun(GThreadedSocketService *service, GSocketConnection *connection, GObject *sourceObject, void *data);
+
+/**
+ * \brief The HTTP socket service was finalized after its last connection was answered.
+ *
+ * \param data HTTP server.
+ * \param service finalized service.
+ * */
+void httpServiceFinalized(void *data, GObject *service);
 
 void gstBufferReleaseCallback(ArvGstBufferReleaseData *releaseData);
 
 void cameraStream(void *data, ArvStreamCallbackType type, ArvBuffer *buffer);
 
-void newBuffer(ArvStream *stream, GstAppSrc *source);
+void newBuffer(ArvStream *stream, DeviceHandle *devHandle);
 
 #endif // RTSPCAM_CALLBACK_HPP
@@ -0,0 +1,97 @@
+/**
+ * @file CaptureBackend.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_CAPTUREBACKEND_HPP
+#define RTSPCAM_CAPTUREBACKEND_HPP
+
+#include "Common.hpp"
+
+class DeviceHandle;
+
+/**
+ * Frame in memory owned by a capture backend.
+ * */
+struct FrameView
+{
+	const uint8_t *data;
+	size_t size;
+	int32_t width;
+	int32_t height;
+	ArvPixelFormat pixelFormat;
+	/// Row stride in bytes, 0 when the rows are packed
+	size_t rowStride;
+	/// Camera timestamp in nanoseconds, 0 when there is none
+	guint64 deviceTime;
+	/// Host time the frame was received at in nanoseconds since the epoch
+	guint64 systemTime;
+	guint64 frameId;
+};
+
+/**
+ * Gives the memory of a frame back to its backend.
+ *
+ * Called once the frame is no longer read: when the GStreamer buffer
+ * wrapping it is freed, or right away when the frame was copied.
+ * */
+struct FrameRelease
+{
+	void *data;
+	GDestroyNotify notify;
+};
+
+/**
+ * Format of the frames of a backend.
+ * */
+struct FrameFormat
+{
+	int32_t width;
+	int32_t height;
+	ArvPixelFormat pixelFormat;
+	/// GenICam name of the pixel format, e.g. BayerRG8
+	std::string pixelFormatName;
+	/// Row stride in bytes, 0 when the rows are packed
+	size_t rowStride;
+	/// Frame size in bytes
+	guint payload;
+	/// Nominal frame rate, 0 when unknown
+	double frameRate;
+};
+
+/**
+ * @class CaptureBackend
+ *
+ * Source of frames feeding a device handle in place of an Aravis camera.
+ *
+ * A backend delivers its frames from a thread of its own through
+ * DeviceHandle::deliverFrame(), which converts and pushes them on the same
+ * path as the camera frames.
+ * */
+class CaptureBackend
+{
+public:
+	virtual ~CaptureBackend() = default;
+
+	/**
+	 * @brief Name of the source, used in place of the camera serial number.
+	 * */
+	[[nodiscard]]
+	virtual const std::string &name() const = 0;
+
+	[[nodiscard]]
+	virtual const FrameFormat &format() const = 0;
+
+	/**
+	 * @brief Start delivering frames to a device handle.
+	 * */
+	virtual bool start(DeviceHandle *device) = 0;
+
+	/**
+	 * @brief Stop delivering frames, no frame is delivered anymore once it returns.
+	 * */
+	virtual void stop() = 0;
+};
+
+#endif // RTSPCAM_CAPTUREBACKEND_HPP
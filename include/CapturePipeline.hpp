@@ -0,0 +1,90 @@
+/**
+ * @file CapturePipeline.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_CAPTUREPIPELINE_HPP
+#define RTSPCAM_CAPTUREPIPELINE_HPP
+
+#include "DeviceHandle.hpp"
+#include "DiskRing.hpp"
+#include "StreamRelay.hpp"
+
+/**
+ * @class CapturePipeline
+ *
+ * Pipeline shared by all stream profiles of a camera.
+ *
+ * The camera frames are debayered once and split with a tee into one branch
+ * per profile, every branch scales the frames to the profile resolution and
+ * hands them to the media of the profile through an intervideosink channel.
+ * The pipeline runs while at least one media of the camera is prepared.
+ *
+ * In always-on mode the branches encode the frames as well and end in app
+ * sinks. The pipeline is kept running and medias attach to the relay of
+ * their stream instead, so a client never waits for the camera to start.
+ * The encoded main stream may also be muxed into MPEG-TS and recorded.
+ * */
+class CapturePipeline
+{
+public:
+	/**
+	 * @param device Camera feeding the pipeline.
+	 * @param launchString Pipeline description with an appsrc named srvsrc.
+	 * @param relaySinks Names of the app sinks relayed to the medias, one relay per sink.
+	 * @param relayMediaType Media type of the relayed streams.
+	 * */
+	CapturePipeline(DeviceHandle *device, std::string launchString, const std::vector<std::string> &relaySinks = {},
+									const std::string &relayMediaType = "video/x-h264");
+	~CapturePipeline();
+
+	CapturePipeline(const CapturePipeline &) = delete;
+	CapturePipeline &operator=(const CapturePipeline &) = delete;
+
+	/**
+	 * @brief Register a media using the pipeline, the first one starts it.
+	 * */
+	void acquire();
+
+	/**
+	 * @brief Unregister a media, the last one stops the pipeline.
+	 * */
+	void release();
+
+	/**
+	 * @brief Relay of the app sink with the given index.
+	 * */
+	[[nodiscard]]
+	StreamRelay *relay(size_t index) const;
+
+	/**
+	 * @brief Record the samples of an app sink, set before the pipeline starts.
+	 *
+	 * @param sinkName Name of the app sink at the end of the muxed stream.
+	 * @param recording Ring the samples are written to.
+	 * */
+	void setRecording(std::string sinkName, DiskRing *recording);
+
+	/**
+	 * @brief Name of the intervideo channel or the relay sink of a profile.
+	 * */
+	static std::string channelName(const std::string &serial, const std::string &profile);
+
+private:
+	void start();
+
+	void stop();
+
+	DeviceHandle *_device;
+	std::string _launchString;
+	std::vector<std::string> _relaySinks;
+	std::vector<std::unique_ptr<StreamRelay>> _relays;
+	std::string _recordingSink;
+	DiskRing *_recording;
+	GstElement *_pipeline;
+	std::mutex _mutex;
+	uint32_t _numUsers;
+};
+
+#endif // RTSPCAM_CAPTUREPIPELINE_HPP
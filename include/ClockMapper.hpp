@@ -0,0 +1,59 @@
+/**
+ * @file ClockMapper.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_CLOCKMAPPER_HPP
+#define RTSPCAM_CLOCKMAPPER_HPP
+
+#include "Common.hpp"
+
+/**
+ * @class ClockMapper
+ *
+ * Maps camera timestamps onto the pipeline clock.
+ *
+ * Every frame gives an observation of the offset between both clocks, which
+ * is the true offset plus the transfer delay of the frame. The mapper keeps
+ * the lower envelope of the observations: it follows a smaller offset at once
+ * and drifts towards larger ones slowly, so delay jitter is filtered out while
+ * the drift between the camera and the host clock is still corrected.
+ * */
+class ClockMapper
+{
+public:
+	/**
+	 * @param smoothing Weight of a new observation above the current offset.
+	 * */
+	explicit ClockMapper(double smoothing = 0.01);
+
+	/**
+	 * @brief Forget the offset, e.g. when the camera clock was reset.
+	 * */
+	void reset();
+
+	/**
+	 * @brief Map a camera timestamp to the pipeline clock.
+	 *
+	 * Mapped times are strictly increasing.
+	 *
+	 * @param sourceTime Camera timestamp in nanoseconds.
+	 * @param clockTime Pipeline clock time the frame was received at.
+	 * */
+	GstClockTime map(guint64 sourceTime, GstClockTime clockTime);
+
+	/**
+	 * @brief Current offset between the pipeline clock and the camera clock in nanoseconds.
+	 * */
+	[[nodiscard]]
+	gint64 offset() const;
+
+private:
+	double _smoothing;
+	bool _initialized;
+	double _offset;
+	GstClockTime _last;
+};
+
+#endif // RTSPCAM_CLOCKMAPPER_HPP
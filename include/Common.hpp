@@ -7,16 +7,146 @@
 #ifndef RTSPCAM_COMMON_HPP
 #define RTSPCAM_COMMON_HPP
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <optional>
+#include <vector>
 
 #include <arv.h>
 #include <gst/gst.h>
 #include <gst/app/app.h>
+#include <gst/video/video.h>
 #include <gst/rtsp-server/rtsp-server.h>
 #include <gst/rtsp-server/rtsp-client.h>
 
+/**
+ * What to do with a new frame when the frame queue is full.
+ * */
+enum class OverflowPolicy
+{
+	DropOldest,
+	DropNewest,
+	Block
+};
+
+/**
+ * How the device handle reacts when the app source queue is full.
+ * */
+enum class FlowControl
+{
+	/// Frames are queued regardless of the app source state
+	None,
+	/// Frames are dropped at the source until the app source needs data again
+	Drop,
+	/// Camera frame rate is lowered until the app source needs data again
+	Throttle
+};
+
+/**
+ * Lower transports the RTP streams are offered to clients on.
+ * */
+enum class TransportPolicy
+{
+	/// Every client gets its own copy over UDP or interleaved in the RTSP connection
+	Unicast,
+	/// One copy per stream sent to a multicast group, clients that cannot join it are refused
+	Multicast,
+	/// Multicast, clients that cannot join the group fall back to interleaved TCP
+	MulticastPreferred
+};
+
+/**
+ * Hardware the streams may be encoded on.
+ * */
+enum class HardwareMode
+{
+	/// Any encoder found, the fastest one wins
+	Auto,
+	/// Jetson hardware encoder only
+	Gpu,
+	/// Encoders working on system memory
+	Cpu
+};
+
+/**
+ * Encoders the media pipelines can be built with.
+ * */
+enum class Encoder
+{
+	Nvv4l2H264,
+	Nvv4l2H265,
+	VaapiH264,
+	VaapiH265,
+	X264,
+	OpenH264,
+	X265
+};
+
+/**
+ * Video codec of the streams.
+ * */
+enum class Codec
+{
+	H264,
+	H265
+};
+
+/**
+ * Bitrate control of the encoders.
+ * */
+enum class RateControl
+{
+	/// Constant bitrate, steady bandwidth
+	Cbr,
+	/// Variable bitrate, the bitrate is the ceiling
+	Vbr
+};
+
+/**
+ * Speed/quality trade-off of the encoders, mapped to the closest setting of each encoder.
+ * */
+enum class EncoderPreset
+{
+	UltraFast,
+	Fast,
+	Medium,
+	Slow
+};
+
+/**
+ * Tuning of the encoders, unset values keep the defaults of the encoder.
+ * */
+struct EncoderSettings
+{
+	/// Codec of the streams, only encoders of the codec are probed
+	Codec codec{ Codec::H264 };
+	/// Frames between keyframes, 0 for the encoder default or one second in always-on mode
+	int32_t gopLength{ 0 };
+	/// B-frames between reference frames
+	int32_t bFrames{ 0 };
+	std::optional<RateControl> rateControl{};
+	std::optional<EncoderPreset> preset{};
+	/// Encoder threads, 0 for the encoder default
+	uint32_t threads{ 0 };
+};
+
+/**
+ * Output stream of a camera with its own resolution and bitrate.
+ * */
+struct StreamProfile
+{
+	/// Mount path suffix of the stream
+	std::string name;
+	/// Output frame width
+	int32_t width;
+	/// Output frame height
+	int32_t height;
+	/// Encoder bitrate in kbit/s
+	int64_t bitrate;
+};
+
 /**
  * Shared options for both server and device handles
  * */
@@ -38,7 +168,7 @@ struct Options
 	int32_t width{ 2448 };
 	/// Camera frame height
 	int32_t height{ 2048 };
-	/// Encoder bitrate
+	/// Encoder bitrate in kbit/s
 	int64_t bitrate{ 10'000 };
 	/// Frame rate
 	std::optional<double> frameRate{};
@@ -47,8 +177,82 @@ struct Options
 	/// Gain value for camera device
 	std::optional<double> gain{};
 	int32_t usbMode{ 1 };
-	/// Use GPU pipeline url or CPU
-	bool useGpu{ true };
+	/// Number of frames queued between the camera stream and the app source
+	uint32_t queueDepth{ 4 };
+	/// Aravis stream buffers per camera, 0 for the stored calibration or the default
+	uint32_t streamBuffers{ 0 };
+	/// Calibrate the stream at startup when no calibration is stored
+	bool calibrate{ false };
+	/// Calibrate the stream even when a calibration is stored
+	bool recalibrate{ false };
+	/// File the stream calibrations are stored in, empty for the user configuration directory
+	std::string calibrationFile{};
+	/// Allocate the stream buffers from huge pages when the system has them
+	bool hugePages{ true };
+	/// Frame periods without a frame before the camera is reopened, 0 to never reopen it
+	uint32_t stallFrames{ 10 };
+	/// Policy applied when the frame queue is full
+	OverflowPolicy overflowPolicy{ OverflowPolicy::DropOldest };
+	/// Reaction to the app source signalling enough data
+	FlowControl flowControl{ FlowControl::Drop };
+	/// Maximum bytes queued in the app source, 0 to size it from the camera payload
+	uint64_t maxQueueBytes{ 0 };
+	/// Timestamp frames with the camera clock instead of the arrival time at the app source
+	bool hardwareTimestamps{ true };
+	/// CPU to pin the stream thread of each camera to, in the order cameras are found
+	std::vector<int32_t> cpuAffinity{};
+	/// Scaled sub-streams served next to the main stream from the same capture
+	std::vector<StreamProfile> profiles{};
+	/// Threads of the pool debayering frames on the CPU path, 0 for one per core
+	uint32_t debayerThreads{ 0 };
+	/// Keep capture and encoding running without clients, medias attach to the running streams
+	bool alwaysOn{ false };
+	/// Directory the main streams are recorded to, empty to not record
+	std::string recordDir{};
+	/// Disk space of the recording of a camera in bytes
+	uint64_t recordSize{ 1ULL << 30 };
+	/// Duration of a recording segment in seconds
+	uint32_t recordSegment{ 2 };
+	/// Raw capture file replayed in place of the cameras, empty to use the cameras
+	std::string replayFile{};
+	/// Replay frame rate, unset for the rate of the file and 0 to replay as fast as frames are taken
+	std::optional<double> replayRate{};
+	/// Directory the raw camera frames are dumped to for replay, empty to not dump them
+	std::string rawRecordDir{};
+	/// Frames dumped per camera
+	uint32_t rawRecordFrames{ 300 };
+	/// Threads the RTSP clients are served on, 0 for one per core
+	uint32_t serverThreads{ 0 };
+	/// Serve every RTSP client on a thread of its own, the number of threads is not limited
+	bool threadPerClient{ false };
+	/// Lower transports offered to the clients
+	TransportPolicy transport{ TransportPolicy::Unicast };
+	/// Range of the multicast groups handed to the streams
+	std::string multicastAddressMin{ "224.3.0.1" };
+	std::string multicastAddressMax{ "224.3.0.254" };
+	/// Range of the multicast RTP and RTCP ports
+	uint16_t multicastPortMin{ 5000 };
+	uint16_t multicastPortMax{ 5999 };
+	/// Time to live of the multicast packets
+	uint32_t multicastTtl{ 16 };
+	/// Address of the HTTP metrics endpoint
+	std::string httpAddress{ "127.0.0.1" };
+	/// Port of the HTTP metrics endpoint, 0 to disable it
+	uint16_t httpPort{ 9464 };
+	/// Enable the Aravis fake camera interface
+	bool fakeCamera{ false };
+	/// Hardware the encoders are probed on
+	HardwareMode mode{ HardwareMode::Auto };
+	/// Encoder of all streams, chosen by the startup probe
+	Encoder encoder{ Encoder::X264 };
+	/// Encoder given on the command line, the startup probe is skipped
+	bool encoderForced{ false };
+	/// Codec, rate control and GOP of the streams
+	EncoderSettings encoding{};
+	/// Adapt the encoder bitrate to the RTCP receiver reports of the clients
+	bool adaptiveBitrate{ false };
+	/// Lowest adaptive bitrate of a client in kbit/s, 0 for an eighth of the stream bitrate
+	int64_t minBitrate{ 0 };
 };
 
 struct DeviceBounds
@@ -59,6 +263,38 @@ struct DeviceBounds
 	double frameRateMin;
 	double gainMax;
 	double gainMin;
+	int32_t offsetXMin;
+	int32_t offsetXMax;
+	int32_t offsetXIncrement;
+	int32_t offsetYMin;
+	int32_t offsetYMax;
+	int32_t offsetYIncrement;
+};
+
+/**
+ * Outcome of changing a camera setting.
+ * */
+enum class ControlStatus
+{
+	Ok,
+	/// Value outside the bounds of the camera or not a multiple of its increment
+	OutOfBounds,
+	/// Camera rejected the value
+	Failed
+};
+
+/**
+ * Settings of a camera that can be changed while it is acquiring.
+ * */
+struct CameraControls
+{
+	/// Exposure time in microseconds, unset while the exposure is automatic
+	std::optional<double> exposure;
+	std::optional<double> gain;
+	double frameRate;
+	/// Offset of the region of interest on the sensor
+	int32_t offsetX;
+	int32_t offsetY;
 };
 
 #endif // RTSPCAM_COMMON_HPP
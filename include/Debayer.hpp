@@ -0,0 +1,92 @@
+/**
+ * @file Debayer.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_DEBAYER_HPP
+#define RTSPCAM_DEBAYER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Colour filter order of the top left 2x2 cell of a Bayer frame.
+ * */
+enum class BayerOrder
+{
+	Rggb,
+	Bggr,
+	Grbg,
+	Gbrg
+};
+
+/**
+ * Interpolation of the missing colour samples.
+ * */
+enum class DebayerMethod
+{
+	/// Average of the nearest samples of the colour, 3x3 neighbourhood
+	Bilinear,
+	/// Malvar-He-Cutler gradient corrected interpolation, 5x5 neighbourhood
+	Malvar
+};
+
+/**
+ * YUV 4:2:0 layout written by the debayer.
+ * */
+enum class DebayerOutput
+{
+	I420,
+	NV12
+};
+
+/**
+ * Destination planes of a debayered frame.
+ * */
+struct DebayerPlanes
+{
+	uint8_t *y;
+	size_t yStride;
+	/// U plane, the interleaved UV plane for NV12
+	uint8_t *u;
+	size_t uStride;
+	/// V plane, unused for NV12
+	uint8_t *v;
+	size_t vStride;
+};
+
+/**
+ * @brief Parse the format field of video/x-bayer caps.
+ *
+ * @return false for orders other than 8-bit bggr, rggb, grbg and gbrg.
+ * */
+bool bayerOrderFromString(const char *format, BayerOrder &order);
+
+/**
+ * @brief Rows of the neighbourhood read above and below the rows of a band.
+ * */
+int32_t debayerHaloRows(DebayerMethod method);
+
+/**
+ * @brief Debayer a band of an 8-bit Bayer frame into YUV 4:2:0 in a single pass.
+ *
+ * Every 2x2 cell gives four luma samples and one chroma sample, RGB is only
+ * computed per pixel in registers. The rows of a band and the halo rows around it
+ * are copied into a per-thread window of padded rows, halo rows shared with the
+ * neighbouring bands are copied by both, so bands of a frame can be debayered independently.
+ * The outer 2x2 cells are repeated past the borders to keep the colour filter order.
+ * Colours are converted with BT.601 limited range coefficients.
+ *
+ * @param src First row of the Bayer frame.
+ * @param srcStride Bayer row stride in bytes.
+ * @param width Frame width, a multiple of 2 and at least 4.
+ * @param height Frame height, a multiple of 2 and at least 4.
+ * @param firstRow First row of the band, a multiple of 2.
+ * @param lastRow Row after the band, a multiple of 2 or the frame height.
+ * */
+void debayerRows(const uint8_t *src, size_t srcStride, int32_t width, int32_t height, BayerOrder order,
+								 DebayerMethod method, DebayerOutput output, const DebayerPlanes &planes, int32_t firstRow,
+								 int32_t lastRow);
+
+#endif // RTSPCAM_DEBAYER_HPP
@@ -0,0 +1,50 @@
+/**
+ * @file DebayerElement.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_DEBAYERELEMENT_HPP
+#define RTSPCAM_DEBAYERELEMENT_HPP
+
+#include <gst/base/gstbasetransform.h>
+
+#include "Debayer.hpp"
+#include "Metrics.hpp"
+#include "WorkStealingPool.hpp"
+
+/// Name of the element in launch strings
+static constexpr const char *DEBAYER_ELEMENT_NAME{ "rtspcamdebayer" };
+
+G_BEGIN_DECLS
+
+#define RTSPCAM_TYPE_DEBAYER (rtspcam_debayer_get_type())
+G_DECLARE_FINAL_TYPE(RtspcamDebayer, rtspcam_debayer, RTSPCAM, DEBAYER, GstBaseTransform)
+
+G_END_DECLS
+
+/**
+ * @brief Register the debayer element, so launch strings can use it.
+ *
+ * The element converts 8-bit video/x-bayer frames to I420 or NV12 in a single
+ * pass, replacing bayer2rgb followed by videoconvert. Frames are split into
+ * horizontal bands debayered on a work-stealing pool shared by all instances.
+ * Its properties are method (bilinear or malvar) and n-bands (0 for four
+ * bands per pool thread, 1 to debayer on the streaming thread).
+ *
+ * @param numThreads Threads of the shared pool, 0 for one per core. Only the
+ * first registration creates the pool.
+ * */
+bool registerDebayerElement(uint32_t numThreads = 0);
+
+/**
+ * @brief Pool shared by the debayer elements, nullptr before registration.
+ * */
+const WorkStealingPool *debayerPool();
+
+/**
+ * @brief Wall time of debayering a frame, over all elements.
+ * */
+const Histogram &debayerFrameTime();
+
+#endif // RTSPCAM_DEBAYERELEMENT_HPP
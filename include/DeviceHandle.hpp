@@ -8,22 +8,62 @@
 #define RTSPCAM_DEVICEHANDLE_HPP
 
 #include "Common.hpp"
+#include "BufferArena.hpp"
+#include "CaptureBackend.hpp"
+#include "ClockMapper.hpp"
+#include "FramePool.hpp"
+#include "FramePusher.hpp"
+#include "Metrics.hpp"
+#include "RawCapture.hpp"
 
 /**
  * @class DeviceHandle
  *
  * The class handles camera device to capture frames and push
  * buffers to GStreamer app source.
+ *
+ * The frames come from an Aravis camera, or from a capture backend such as
+ * a replay which then has no camera settings and is never reopened.
  * */
 class DeviceHandle
 {
 public:
-	explicit DeviceHandle(const Options *options, uint32_t numStreamBuffers = 30);
+	/**
+	 * @param options Shared options.
+	 * @param deviceId Aravis device ID of the camera, nullptr for the first available one.
+	 * @param cpu CPU to pin the stream thread to, -1 to leave it to the scheduler.
+	 * @param numStreamBuffers Number of Aravis stream buffers, 0 for the stored calibration or the default.
+	 * */
+	explicit DeviceHandle(const Options *options, const char *deviceId = nullptr, int32_t cpu = -1,
+												uint32_t numStreamBuffers = 0);
+
+	/**
+	 * @param options Shared options.
+	 * @param backend Source of the frames, started and stopped with the acquisition.
+	 * @param cpu CPU to pin the thread of the backend to, -1 to leave it to the scheduler.
+	 * */
+	DeviceHandle(const Options *options, std::unique_ptr<CaptureBackend> backend, int32_t cpu = -1);
 	~DeviceHandle();
 
+	[[nodiscard]]
+	bool isInitialized() const;
+
 	[[nodiscard]]
 	bool isPlaying() const;
 
+	/**
+	 * @brief Serial number of the camera, the device ID if it has none.
+	 * */
+	[[nodiscard]]
+	const std::string &serial() const;
+
+	/**
+	 * @brief Called on the stream thread when it starts.
+	 *
+	 * Raises the thread priority and pins it to the configured CPU.
+	 * */
+	void onStreamThreadStarted();
+
 	/**
 	 * @brief Set app source from server media factory.
 	 *
@@ -37,33 +77,383 @@ public:
 	 * */
 	void startAcquisition();
 
+	/**
+	 * @brief Set the app source of a new media and start the acquisition into it.
+	 *
+	 * Both happen under one lock, a media of the camera going away on another
+	 * RTSP thread meanwhile cannot stop the acquisition in between.
+	 * */
+	void startAcquisition(GstAppSrc *source);
+
 	/**
 	 * Stops acquisition and frees allocated objects.
 	 * */
 	void stopAcquisition();
 
 	/**
-	 * @brief Increase number of clients.
+	 * @brief Stop the acquisition if it feeds the given app source.
+	 *
+	 * A media stopping after the next one of the camera was configured leaves
+	 * the acquisition of the next one running.
+	 * */
+	void stopAcquisition(GstAppSrc *source);
+
+	/**
+	 * @brief Stop the acquisition but keep the app source for a later restart.
+	 *
+	 * Used while the media of the camera is prepared but no client watches it,
+	 * nothing is done when the acquisition is not running.
+	 * */
+	void suspendAcquisition();
+
+	/**
+	 * @brief Restart a suspended acquisition, nothing is done without an app source.
+	 * */
+	void resumeAcquisition();
+
+	/**
+	 * @brief Check that frames keep arriving, called periodically on the main loop.
+	 *
+	 * A stream without a frame for the configured number of frame periods has
+	 * stalled, e.g. because the camera was unplugged. The camera and its
+	 * stream are then reopened with exponential backoff while the app source,
+	 * and with it the RTSP sessions, stay as they are. A check is skipped
+	 * while the acquisition is started or stopped on another thread.
+	 * */
+	void checkStream();
+
+	/**
+	 * @brief Called on the stream thread before a frame is handled.
 	 * */
-	int32_t incrNumClient();
+	void beginFrame();
 
 	/**
-	 * @brief Decrease number of clients.
+	 * @brief Called on the stream thread after a frame was handled.
 	 * */
-	int32_t decrNumClient();
+	void endFrame();
+
+	/**
+	 * @brief Deliver a frame of the capture backend, called from its thread.
+	 *
+	 * The frame is released right away when it is dropped.
+	 * */
+	void deliverFrame(const FrameView &frame, FrameRelease release);
+
+	/**
+	 * @brief Convert, timestamp and queue a frame the flow control accepted.
+	 * */
+	void pushFrame(const FrameView &frame, FrameRelease release);
+
+	/**
+	 * @brief Whether the stream stalled and the camera is being reopened.
+	 * */
+	[[nodiscard]]
+	bool isRecovering() const;
+
+	/**
+	 * @brief Set a fixed exposure time, the automatic exposure is turned off.
+	 *
+	 * The camera settings can be changed from any thread while the camera is
+	 * acquiring, they apply from the next frame on and are kept when the
+	 * acquisition restarts.
+	 *
+	 * @param exposure Exposure time in microseconds.
+	 * */
+	ControlStatus setExposure(double exposure);
+
+	/**
+	 * @brief Set a fixed gain, the automatic gain is turned off.
+	 * */
+	ControlStatus setGain(double gain);
+
+	/**
+	 * @brief Set the acquisition frame rate, also the rate the flow control recovers to.
+	 * */
+	ControlStatus setFrameRate(double frameRate);
+
+	/**
+	 * @brief Move the region of interest on the sensor, its size is kept.
+	 * */
+	ControlStatus setRoiOffset(int32_t x, int32_t y);
+
+	/**
+	 * @brief Current settings as reported by the camera.
+	 * */
+	[[nodiscard]]
+	CameraControls controls();
+
+	/**
+	 * @brief Bounds of the settings, the frame rate bounds follow the exposure.
+	 * */
+	[[nodiscard]]
+	DeviceBounds bounds();
+
+	/**
+	 * @brief App source the frames are pushed to.
+	 * */
+	[[nodiscard]]
+	GstAppSrc *source() const;
+
+	/**
+	 * @brief Check whether a new frame should be delivered.
+	 *
+	 * Called from the stream thread, frames are dropped at the source while the
+	 * app source has enough data and the flow control drops frames.
+	 * */
+	[[nodiscard]]
+	bool acceptFrame();
+
+	/**
+	 * @brief The app source queue drained below its limit.
+	 * */
+	void onNeedData();
+
+	/**
+	 * @brief The app source queue is full.
+	 *
+	 * The throttle lowers the frame rate and starts a periodic step on the
+	 * main loop raising it back while the app source keeps up.
+	 * */
+	void onEnoughData();
+
+	/**
+	 * @brief Raise a throttled frame rate by a step, called periodically on the main loop.
+	 *
+	 * @return false once the frame rate is back at its target.
+	 * */
+	bool raiseFrameRate();
+
+	/**
+	 * @brief Number of frames dropped by the flow control.
+	 * */
+	[[nodiscard]]
+	uint64_t flowControlDrops() const;
+
+	/**
+	 * @brief Number of frames the leaky queue of the app sources dropped, 0 before GStreamer 1.20.
+	 * */
+	[[nodiscard]]
+	uint64_t sourceDrops();
+
+	/**
+	 * @brief Timestamp a frame from the camera clock.
+	 *
+	 * PTS/DTS are the camera timestamp mapped onto the pipeline clock, the duration is the
+	 * distance to the previous frame. The raw camera time and frame ID are attached as
+	 * GstReferenceTimestampMeta with "timestamp/x-aravis-device" caps, the host time the
+	 * frame was received at with "timestamp/x-unix" caps. The frame ID is also the buffer offset.
+	 *
+	 * @param buffer Frame to timestamp.
+	 * @param deviceTime Camera timestamp in nanoseconds, 0 if the camera has none.
+	 * @param systemTime Host time in nanoseconds since the epoch when the frame was received.
+	 * @param frameId Camera frame ID.
+	 * */
+	void timestampBuffer(GstBuffer *buffer, guint64 deviceTime, guint64 systemTime, guint64 frameId);
+
+	/**
+	 * @brief Queue decoupling the stream thread from the app source.
+	 * */
+	[[nodiscard]]
+	FramePusher *pusher();
+
+	/**
+	 * @brief Video info to describe frames with GstVideoMeta instead of repacking them.
+	 *
+	 * Bayer caps have no video format, their meta has an unknown format and
+	 * only describes the row stride, which the debayer element reads.
+	 *
+	 * @return Video info of the source caps or nullptr when downstream does not
+	 * accept video meta or the caps cannot be described by a single plane.
+	 * */
+	[[nodiscard]]
+	const GstVideoInfo *videoMetaInfo() const;
+
+	/**
+	 * @brief Record whether downstream accepts video meta.
+	 *
+	 * Called with the result of the allocation query made by the app source.
+	 * */
+	void setVideoMetaSupported(bool supported);
+
+	/**
+	 * @brief Row stride of the camera frames in bytes, 0 when the rows are packed.
+	 *
+	 * Set when the camera pads its rows to the stride GStreamer expects.
+	 * */
+	[[nodiscard]]
+	size_t rowStride() const;
+
+	/**
+	 * @brief Memory of the stream buffers of the current stream.
+	 * */
+	[[nodiscard]]
+	StreamMemory streamMemory();
+
+	/**
+	 * @brief Pool recycling frame buffers, sized from the number of stream buffers.
+	 * */
+	[[nodiscard]]
+	FramePool *framePool();
+
+	/**
+	 * @brief Recorder dumping the raw camera frames, nullptr when they are not dumped.
+	 * */
+	[[nodiscard]]
+	RawRecorder *rawRecorder();
+
+	/**
+	 * @brief Counters and latency histograms of the camera.
+	 * */
+	[[nodiscard]]
+	CaptureMetrics *metrics();
+
+	/**
+	 * @brief Number of clients watching the camera.
+	 * */
+	[[nodiscard]]
+	uint32_t numClients() const;
+
+	/**
+	 * @brief Set the number of clients, counted by the session registry.
+	 * */
+	void setNumClients(uint32_t numClients);
 
 private:
+	DeviceHandle(const Options *options, int32_t cpu, uint32_t numStreamBuffers,
+							 std::unique_ptr<CaptureBackend> backend);
+
+	/**
+	 * @brief Choose the number of stream buffers and the packet size.
+	 *
+	 * Without a configured number of buffers the settings stored for the
+	 * camera are used. When there are none or they were made for another frame
+	 * size or frame rate, the stream is calibrated if the options ask for it,
+	 * otherwise a fixed number of buffers and the default packet size are used.
+	 * */
+	void configureStream(uint32_t numStreamBuffers);
+
+	/**
+	 * @brief Open and configure the camera, its pixel format and payload are cached.
+	 *
+	 * @param deviceId Aravis device ID, nullptr for the first available camera.
+	 * */
+	bool openCamera(const char *deviceId);
+
+	/**
+	 * @brief Start, stop or suspend the acquisition or set its source, the lifecycle lock is held by the caller.
+	 * */
+	void startLocked();
+	void stopLocked();
+	void suspendLocked();
+	void setSourceLocked(GstAppSrc *source);
+
+	/**
+	 * @brief Drop the app source, its queue drops are kept, the lifecycle lock is held by the caller.
+	 * */
+	void releaseSource();
+
+	void closeCamera();
+
+	/**
+	 * @brief Ask the camera to pad its rows to the stride GStreamer expects, called with the camera lock held.
+	 *
+	 * @return Row stride the camera delivers, 0 when it keeps the rows packed.
+	 * */
+	size_t configureLinePitch();
+
+	/**
+	 * @brief Push stream buffers allocated from a buffer arena, Aravis allocates them when no memory could be mapped.
+	 * */
+	void createStreamBuffers();
+
+	/**
+	 * @brief Create the stream, apply the settings and start the acquisition.
+	 * */
+	bool startStream();
+
+	void stopStream();
+
+	/**
+	 * @brief Try to reopen a stalled camera, the next attempt is scheduled on failure.
+	 * */
+	void recover(gint64 now);
+
+	/**
+	 * @brief Read the bounds of the settings, called with the camera lock held.
+	 * */
+	void updateBounds();
+
+	/// Apply a setting, called with the camera lock held
+	ControlStatus applyExposure(double exposure);
+	ControlStatus applyGain(double gain);
+	ControlStatus applyFrameRate(double frameRate);
+	ControlStatus applyRoiOffset(int32_t x, int32_t y);
+
 	const Options *_options;
 	bool _isInitialized;
-	uint32_t _numDevices;
-	int32_t _numClient;
+	std::atomic<uint32_t> _numClients;
 	uint32_t _numStreamBuffers;
+	int32_t _cpu;
+	std::string _deviceId;
+	std::string _serial;
 
-	GstState _state;
+	/// Held while the acquisition is started, stopped or recovered, by RTSP threads and the main loop
+	std::mutex _lifecycleMutex;
+	std::atomic<GstState> _state;
 	DeviceBounds _bounds;
 	ArvCamera *_camera;
 	ArvStream *_stream;
 	GstAppSrc *_source;
+	CaptureMetrics _metrics;
+	FramePool _framePool;
+	FramePusher _pusher;
+	std::mutex _cameraMutex;
+	std::atomic<bool> _saturated;
+	std::atomic<uint64_t> _flowControlDrops;
+	/// Drops of the app source queues as of the last count, and of the sources released before
+	std::atomic<uint64_t> _sourceDrops;
+	uint64_t _releasedSourceDrops;
+	/// Main loop source raising a throttled frame rate, guarded by the camera mutex
+	guint _throttleRaise;
+	double _targetFrameRate;
+	double _frameRate;
+	/// Settings applied whenever the acquisition starts, unset ones are left to the camera
+	std::optional<double> _exposure;
+	std::optional<double> _gain;
+	std::optional<double> _requestedFrameRate;
+	int32_t _offsetX;
+	int32_t _offsetY;
+	/// Negotiated GigE Vision packet size, 0 to leave it to the camera
+	uint32_t _packetSize;
+	ArvPixelFormat _pixelFormat;
+	std::string _pixelFormatName;
+	guint _payload;
+	size_t _rowStride;
+	StreamMemory _streamMemory;
+
+	/// Stream watchdog source on the main context
+	guint _watchdog;
+	/// Monotonic time the stream thread last got a frame
+	std::atomic<gint64> _lastFrameTime;
+	std::atomic<bool> _frameBusy;
+	std::atomic<bool> _recovering;
+	gint64 _recoveryDelay;
+	gint64 _nextRecovery;
+	/// Monotonic time the camera was last reopened at
+	gint64 _recoveredAt;
+	/// Underruns of the current stream counted so far
+	guint64 _underruns;
+
+	ClockMapper _clockMapper;
+	guint64 _lastSourceTime;
+
+	GstVideoInfo _videoInfo;
+	bool _hasVideoInfo;
+	std::atomic<bool> _videoMetaSupported;
+
+	/// Source of the frames in place of the camera
+	std::unique_ptr<CaptureBackend> _backend;
+	std::unique_ptr<RawRecorder> _rawRecorder;
 };
 
 #endif // RTSPCAM_DEVICEHANDLE_HPP
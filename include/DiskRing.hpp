@@ -0,0 +1,218 @@
+/**
+ * @file DiskRing.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_DISKRING_HPP
+#define RTSPCAM_DISKRING_HPP
+
+#include <functional>
+
+#include "Common.hpp"
+#include "Metrics.hpp"
+
+/**
+ * @class DiskRing
+ *
+ * Recording of an encoded stream in a fixed set of segment files on disk.
+ *
+ * The segment files are preallocated when the ring is opened and reused in
+ * turn, the oldest segment is overwritten once the ring is full. A segment
+ * starts at a keyframe when it has reached its duration, so every segment
+ * can be decoded on its own. Data is collected in a page-aligned block and
+ * written a block at a time at block-aligned offsets, a segment is synced
+ * to disk when it is closed.
+ *
+ * Writes come from one streaming thread, clips are exported from any other.
+ * The segment index lives in memory only, the ring starts empty on every start.
+ * It has a lock of its own that is never held across disk I/O, a segment is
+ * marked closed under it and synced after it is released, so the metrics and
+ * the exports never wait for the disk.
+ * */
+class DiskRing
+{
+public:
+	/**
+	 * @brief Segment of an exported clip, as it was when the clip was chosen.
+	 * */
+	struct ClipPart
+	{
+		uint32_t index;
+		uint64_t length;
+		uint64_t generation;
+		bool keyframe;
+	};
+
+	/**
+	 * @brief Receiver of the data of a clip, false stops the export.
+	 * */
+	using ClipWriter = std::function<bool(const uint8_t *data, size_t size)>;
+
+	/**
+	 * @param directory Directory of the segment files, created when missing.
+	 * @param size Bytes of all segments together.
+	 * @param segmentSize Bytes of a segment, rounded up to whole blocks.
+	 * @param segmentDuration Duration of a segment in microseconds.
+	 * */
+	DiskRing(std::string directory, uint64_t size, uint64_t segmentSize, gint64 segmentDuration);
+	~DiskRing();
+
+	DiskRing(const DiskRing &) = delete;
+	DiskRing &operator=(const DiskRing &) = delete;
+
+	/**
+	 * @brief Create and preallocate the segment files.
+	 *
+	 * @return false when a file cannot be created or the disk lacks the space.
+	 * */
+	bool open();
+
+	/**
+	 * @brief Append data of the stream, called from the streaming thread.
+	 *
+	 * @param keyframe Whether the data starts a frame decodable on its own.
+	 * */
+	void write(const uint8_t *data, size_t size, bool keyframe);
+
+	/**
+	 * @brief Close the current segment, e.g. when the stream restarts.
+	 * */
+	void finishSegment();
+
+	/**
+	 * @brief Choose the segments of the recording of the last seconds.
+	 *
+	 * The clip starts at the last segment beginning with a keyframe at least
+	 * the given seconds ago, or at the oldest one when the ring is shorter.
+	 *
+	 * @param seconds Length of the clip.
+	 * @param parts Segments of the clip, oldest first.
+	 * @return false when nothing decodable is recorded yet.
+	 * */
+	bool clipParts(double seconds, std::vector<ClipPart> &parts);
+
+	/**
+	 * @brief Read the segments of a clip a chunk at a time and pass them on.
+	 *
+	 * Nothing of the clip is held in memory but the chunk being passed on.
+	 * Segments overwritten before the clip got to them are skipped up to the
+	 * next keyframe, a segment overwritten while it is read ends the clip.
+	 *
+	 * @return false when a segment cannot be read or the writer stopped the export.
+	 * */
+	bool exportClip(const std::vector<ClipPart> &parts, const ClipWriter &write);
+
+	/**
+	 * @brief Seconds of recording available for export.
+	 * */
+	[[nodiscard]]
+	double duration();
+
+	[[nodiscard]]
+	const std::string &directory() const;
+
+	[[nodiscard]]
+	uint64_t bytesWritten() const;
+
+	[[nodiscard]]
+	uint64_t writeErrors() const;
+
+	/**
+	 * @brief Time of writing a block.
+	 * */
+	[[nodiscard]]
+	const Histogram &writeTime() const;
+
+	/**
+	 * @brief Time of syncing a closed segment to disk.
+	 * */
+	[[nodiscard]]
+	const Histogram &syncTime() const;
+
+	/**
+	 * @brief Segment size holding a segment of a stream with twice the given bitrate.
+	 *
+	 * @param bitrate Bitrate of the stream in kbit/s.
+	 * @param seconds Duration of a segment.
+	 * */
+	static uint64_t segmentSizeFor(int64_t bitrate, uint32_t seconds);
+
+private:
+	struct Segment
+	{
+		/// Monotonic time of the first and the last write
+		gint64 start;
+		gint64 end;
+		/// Bytes of the stream in the file
+		uint64_t length;
+		bool keyframe;
+		/// Incremented whenever a segment file is reused, 0 while it was never written
+		uint64_t generation;
+	};
+
+	/**
+	 * @brief Close the current segment and start the next one, called with the block lock held.
+	 *
+	 * @return Index of the closed segment to sync, -1 when no segment was open.
+	 * */
+	int startSegment(bool keyframe, gint64 now);
+
+	/**
+	 * @brief Write out and close the current segment, called with the block lock held.
+	 *
+	 * @return Index of the closed segment to sync once the block lock is released.
+	 * */
+	uint32_t closeSegment();
+
+	/**
+	 * @brief Sync a closed segment to disk, called without a lock held.
+	 * */
+	void syncSegment(uint32_t index);
+
+	/**
+	 * @brief Write the staged bytes of the current block, called with the block lock held.
+	 * */
+	void flush();
+
+	/**
+	 * @brief Whether the segment of a clip was not overwritten since the clip was chosen.
+	 * */
+	[[nodiscard]]
+	bool isCurrent(const ClipPart &part);
+
+	/**
+	 * @brief Index of the newest segment, called with the lock held.
+	 * */
+	[[nodiscard]]
+	uint32_t newest() const;
+
+	std::string _directory;
+	uint64_t _segmentSize;
+	gint64 _segmentDuration;
+	std::vector<int> _files;
+	/// Changed with both locks held, read with either
+	std::vector<Segment> _segments;
+	uint32_t _current;
+	/// Whether the current segment takes writes
+	bool _writing;
+	uint64_t _generation;
+
+	uint8_t *_block;
+	/// Offset of the block in the current segment
+	uint64_t _blockOffset;
+	size_t _staged;
+	/// Staged bytes already written by an earlier flush of the block
+	size_t _flushed;
+
+	/// Guards the staging block and orders the writes of the segment files
+	std::mutex _blockMutex;
+	/// Guards the segment index, taken after the block lock
+	std::mutex _mutex;
+	std::atomic<uint64_t> _bytesWritten;
+	std::atomic<uint64_t> _writeErrors;
+	Histogram _writeTime;
+	Histogram _syncTime;
+};
+
+#endif // RTSPCAM_DISKRING_HPP
@@ -0,0 +1,97 @@
+/**
+ * @file Encoder.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_ENCODER_HPP
+#define RTSPCAM_ENCODER_HPP
+
+#include <span>
+
+#include "Common.hpp"
+#include "PipelineBuilder.hpp"
+
+/**
+ * Elements an encoder is built from.
+ * */
+struct EncoderInfo
+{
+	Encoder encoder;
+	/// Name of the encoder element factory
+	const char *element;
+	Codec codec;
+	/// Element converting I420 frames for the encoder, nullptr when it takes system memory
+	const char *converter;
+	/// Factor converting kbit/s to the unit of the bitrate property
+	int64_t bitrateScale;
+};
+
+/**
+ * Typed description of the encoder of a stream.
+ * */
+struct EncoderDescription
+{
+	Encoder encoder;
+	/// Bitrate in kbit/s, converted to the unit of the encoder
+	int64_t bitrate;
+	EncoderSettings settings;
+};
+
+/**
+ * @brief All encoders in the order they are probed.
+ * */
+[[nodiscard]]
+std::span<const EncoderInfo> encoders();
+
+[[nodiscard]]
+const EncoderInfo &encoderInfo(Encoder encoder);
+
+/**
+ * @brief Parse an encoder element name, e.g. x264enc.
+ * */
+bool encoderFromString(const char *name, Encoder &encoder);
+
+/**
+ * @brief Parse a codec name, h264 or h265.
+ * */
+bool codecFromString(const char *name, Codec &codec);
+
+/**
+ * @brief Lower case name of a codec used in element names, e.g. h264 for h264parse.
+ * */
+[[nodiscard]]
+const char *codecName(Codec codec);
+
+/**
+ * @brief Media type of an encoded stream, e.g. video/x-h264.
+ * */
+[[nodiscard]]
+std::string codecMediaType(Codec codec);
+
+/**
+ * @brief Whether the encoder and the elements around it are registered.
+ * */
+[[nodiscard]]
+bool isEncoderAvailable(Encoder encoder);
+
+/**
+ * @brief Append the elements encoding I420 frames in system memory.
+ *
+ * The settings are mapped to the properties of the encoder, settings the
+ * encoder has no property for are left out.
+ * */
+void appendEncoder(PipelineBuilder &pipeline, const EncoderDescription &description);
+
+/**
+ * @brief Follow the always sink pads of a linear chain up to the first encoder.
+ *
+ * Ghost pads and request pads are not followed, e.g. the search stops at a
+ * tee or at the edge of a bin.
+ *
+ * @return New reference to the encoder, nullptr when there is none upstream.
+ * */
+[[nodiscard]]
+GstElement *upstreamEncoder(GstElement *element);
+
+#endif // RTSPCAM_ENCODER_HPP
@@ -0,0 +1,45 @@
+/**
+ * @file EncoderProbe.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_ENCODERPROBE_HPP
+#define RTSPCAM_ENCODERPROBE_HPP
+
+#include "Encoder.hpp"
+
+/**
+ * Encoded frames counted by a probe on the sink of a benchmark pipeline.
+ * */
+struct EncodedFrameCount
+{
+	/// Frames left out of the measurement while the encoder warms up
+	uint32_t warmup;
+	uint32_t frames;
+	/// Monotonic time of the first and the last frame measured, in microseconds
+	gint64 first;
+	gint64 last;
+};
+
+/**
+ * @brief Encode synthetic frames as fast as possible.
+ *
+ * @return Frames encoded per second, a negative value when the encoder failed.
+ * */
+[[nodiscard]]
+double measureEncoder(const EncoderDescription &description, int32_t width, int32_t height);
+
+/**
+ * @brief Pick the encoder of the streams.
+ *
+ * Every encoder of the configured codec found in the registry and allowed
+ * by the hardware mode encodes a short synthetic stream at the configured
+ * resolution with the configured settings. The fastest one wins, a warning
+ * is logged when it misses the target frame rate.
+ *
+ * @return The fastest encoder, x264enc or x265enc when none works.
+ * */
+Encoder probeEncoder(const Options &options);
+
+#endif // RTSPCAM_ENCODERPROBE_HPP
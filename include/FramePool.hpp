@@ -0,0 +1,102 @@
+/**
+ * @file FramePool.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_FRAMEPOOL_HPP
+#define RTSPCAM_FRAMEPOOL_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Common.hpp"
+
+struct ReleaseDataStore;
+
+struct ArvGstBufferReleaseData
+{
+	GWeakRef stream;
+	ArvBuffer *arvBuffer;
+	/// Store the record returns to, held while the record is out so it outlives its pool
+	std::shared_ptr<ReleaseDataStore> store;
+};
+
+/**
+ * @class FramePool
+ *
+ * Recycles the memory used to hand camera frames to GStreamer.
+ *
+ * Repacked frames are taken from a GstBufferPool keyed by the frame size, so
+ * buffers return to the pool when the pipeline releases them instead of being
+ * freed. Release records of the wrapped (zero-copy) frames are recycled the same way,
+ * from a store kept alive by the records still held downstream, so frames may be
+ * released after the pool is gone. When the pool is exhausted a plain allocation
+ * is made and counted as a miss, frame buffers and records are counted apart.
+ * */
+class FramePool
+{
+public:
+	explicit FramePool(uint32_t capacity);
+	~FramePool();
+
+	FramePool(const FramePool &) = delete;
+	FramePool &operator=(const FramePool &) = delete;
+
+	/**
+	 * @brief Get a writable buffer of the given size.
+	 *
+	 * The pool is reconfigured when the size differs from the current one,
+	 * buffers of the previous size are freed as soon as they are released.
+	 *
+	 * @param size Size of the frame in bytes.
+	 * */
+	GstBuffer *acquireBuffer(gsize size);
+
+	/**
+	 * @brief Get a release record for a frame wrapping Aravis memory.
+	 * */
+	ArvGstBufferReleaseData *acquireReleaseData();
+
+	/**
+	 * @brief Return a release record to the store it was taken from, also after its pool is gone.
+	 * */
+	static void recycleReleaseData(ArvGstBufferReleaseData *releaseData);
+
+	/**
+	 * @brief Resize the pool before the first frame, e.g. to a calibrated number of stream buffers.
+	 * */
+	void reserve(uint32_t capacity);
+
+	/**
+	 * @brief Drop the pooled frame buffers.
+	 * */
+	void reset();
+
+	[[nodiscard]]
+	uint64_t hits() const;
+
+	[[nodiscard]]
+	uint64_t misses() const;
+
+	[[nodiscard]]
+	uint64_t releaseDataHits() const;
+
+	[[nodiscard]]
+	uint64_t releaseDataMisses() const;
+
+private:
+	void configure(gsize size);
+
+	uint32_t _capacity;
+	gsize _bufferSize;
+	GstBufferPool *_bufferPool;
+	std::shared_ptr<ReleaseDataStore> _store;
+
+	std::atomic<uint64_t> _hits;
+	std::atomic<uint64_t> _misses;
+};
+
+#endif // RTSPCAM_FRAMEPOOL_HPP
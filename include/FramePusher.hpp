@@ -0,0 +1,108 @@
+/**
+ * @file FramePusher.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_FRAMEPUSHER_HPP
+#define RTSPCAM_FRAMEPUSHER_HPP
+
+#include <thread>
+
+#include "Common.hpp"
+#include "Metrics.hpp"
+#include "SpscRing.hpp"
+
+struct FramePusherStats
+{
+	/// Frames pushed to the app source
+	uint64_t pushed;
+	/// Frames dropped because the queue was full
+	uint64_t dropped;
+	/// Frames waiting in the queue
+	size_t depth;
+	/// Average time a frame spent in the queue in microseconds
+	double averageLatency;
+	/// Longest time a frame spent in the queue in microseconds
+	int64_t maxLatency;
+};
+
+/**
+ * @class FramePusher
+ *
+ * Decouples the Aravis stream thread from the app source.
+ *
+ * Frames are queued in a lock-free ring by the stream thread and pushed to
+ * the app source from a dedicated thread, so a stall in the app source queue
+ * never blocks packet reassembly. When the ring is full the overflow policy
+ * decides whether the oldest or the newest frame is dropped or the stream
+ * thread waits.
+ * */
+class FramePusher
+{
+public:
+	/**
+	 * @param depth Number of frames queued.
+	 * @param policy Policy applied when the queue is full.
+	 * @param metrics Metrics observing the push latency, nullptr for none.
+	 * */
+	FramePusher(uint32_t depth, OverflowPolicy policy, CaptureMetrics *metrics = nullptr);
+	~FramePusher();
+
+	FramePusher(const FramePusher &) = delete;
+	FramePusher &operator=(const FramePusher &) = delete;
+
+	/**
+	 * @brief Start the pusher thread.
+	 *
+	 * @param source App source to push frames to.
+	 * */
+	void start(GstAppSrc *source);
+
+	/**
+	 * @brief Stop the pusher thread, queued frames are dropped.
+	 * */
+	void stop();
+
+	/**
+	 * @brief Queue a frame, called from the stream thread.
+	 *
+	 * Takes ownership of the buffer.
+	 *
+	 * @return false when the frame was dropped.
+	 * */
+	bool push(GstBuffer *buffer);
+
+	[[nodiscard]]
+	FramePusherStats stats() const;
+
+private:
+	bool enqueue(GstBuffer *buffer);
+
+	void run();
+
+	void drain();
+
+	void drop(GstBuffer *buffer);
+
+	OverflowPolicy _policy;
+	CaptureMetrics *_metrics;
+	SpscRing<GstBuffer *> _ring;
+	std::thread _thread;
+	GstAppSrc *_source;
+	std::atomic<bool> _running;
+
+	/// Bumped when a frame is queued or the pusher stops, the pusher thread waits on it
+	std::atomic<uint32_t> _queued;
+	/// Bumped when a frame is taken or the pusher stops, a blocked stream thread waits on it
+	std::atomic<uint32_t> _taken;
+	/// Pushes in progress, stop waits for them before it drains the queue
+	std::atomic<uint32_t> _pushing;
+
+	std::atomic<uint64_t> _pushed;
+	std::atomic<uint64_t> _dropped;
+	std::atomic<int64_t> _latencySum;
+	std::atomic<int64_t> _latencyMax;
+};
+
+#endif // RTSPCAM_FRAMEPUSHER_HPP
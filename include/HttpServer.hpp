@@ -0,0 +1,107 @@
+/**
+ * @file HttpServer.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_HTTPSERVER_HPP
+#define RTSPCAM_HTTPSERVER_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+
+#include <gio/gio.h>
+
+#include "Common.hpp"
+
+/**
+ * Writer of a body too large to be held in memory, called on the worker thread
+ * of the connection after the head was sent. False when the client went away.
+ * */
+using HttpBodyWriter = std::function<bool(GOutputStream *output, GCancellable *cancellable)>;
+
+struct HttpResponse
+{
+	int32_t status;
+	std::string contentType;
+	std::string body;
+	/// Streams the body in place of body when set, the response then ends when the connection closes
+	HttpBodyWriter writeBody{};
+};
+
+/**
+ * Handler of a path, called with the request method and the query string.
+ * */
+using HttpHandler = std::function<HttpResponse(std::string_view method, std::string_view query)>;
+
+/**
+ * @class HttpServer
+ *
+ * Minimal HTTP/1.0 server for local monitoring and control endpoints.
+ *
+ * Connections are accepted on the default main context and answered on a small
+ * pool of worker threads, a slow client never holds up the RTSP server or the
+ * watchdogs. Handlers may run concurrently, every connection is closed after the response.
+ * */
+class HttpServer
+{
+public:
+	HttpServer();
+	~HttpServer();
+
+	HttpServer(const HttpServer &) = delete;
+	HttpServer &operator=(const HttpServer &) = delete;
+
+	/**
+	 * @brief Serve a path.
+	 *
+	 * @param path Absolute path without query, e.g. /metrics.
+	 * @param handler Handler of the requests.
+	 * */
+	void addHandler(const std::string &path, HttpHandler handler);
+
+	/**
+	 * @brief Start accepting connections.
+	 *
+	 * @return false when the address cannot be bound.
+	 * */
+	bool listen(const std::string &address, uint16_t port);
+
+	/**
+	 * @brief Stop accepting connections and wait for the requests being answered.
+	 *
+	 * Called before the state used by the handlers is torn down.
+	 * */
+	void stop();
+
+	/**
+	 * @brief Answer a request, called on a worker thread for every accepted connection.
+	 *
+	 * @param connection Connection of the client.
+	 * */
+	void onConnection(GSocketConnection *connection);
+
+	/**
+	 * @brief The service was finalized, no worker answers a request anymore.
+	 * */
+	void onServiceFinalized();
+
+	/**
+	 * @brief Value of a parameter in a query string, empty if missing.
+	 * */
+	static std::string queryValue(std::string_view query, std::string_view name);
+
+private:
+	HttpResponse handle(std::string_view method, std::string_view target) const;
+
+	GSocketService *_service;
+	GCancellable *_cancellable;
+	std::map<std::string, HttpHandler> _handlers;
+	std::mutex _mutex;
+	std::condition_variable _finalized;
+	bool _serviceAlive;
+};
+
+#endif // RTSPCAM_HTTPSERVER_HPP
@@ -0,0 +1,329 @@
+/**
+ * @file Metrics.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_METRICS_HPP
+#define RTSPCAM_METRICS_HPP
+
+#include <array>
+
+#include "Common.hpp"
+
+/**
+ * @class Histogram
+ *
+ * Lock-free latency histogram with fixed buckets, rendered in the
+ * Prometheus text format.
+ * */
+class Histogram
+{
+public:
+	Histogram();
+
+	/**
+	 * @brief Count a latency.
+	 *
+	 * @param value Latency in nanoseconds.
+	 * */
+	void observe(guint64 value);
+
+	/**
+	 * @brief Append the bucket, sum and count samples.
+	 *
+	 * @param out Text to append to.
+	 * @param name Metric name.
+	 * @param labels Labels of the samples without braces, e.g. camera="1",stage="push", may be empty.
+	 * */
+	void render(std::string &out, std::string_view name, std::string_view labels) const;
+
+	/// Upper bounds of the buckets in nanoseconds, the last bucket is unbounded
+	static constexpr std::array<guint64, 12> BOUNDS{
+		500'000, 1'000'000, 2'000'000, 5'000'000, 10'000'000, 20'000'000,
+		50'000'000, 100'000'000, 200'000'000, 500'000'000, 1'000'000'000, 2'000'000'000
+	};
+
+private:
+	std::array<std::atomic<uint64_t>, BOUNDS.size() + 1> _buckets;
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+};
+
+/**
+ * @class LossWindow
+ *
+ * Frame loss over the last seconds, counted in one-second slots.
+ * */
+class LossWindow
+{
+public:
+	LossWindow();
+
+	/**
+	 * @brief Count frames, called from the stream thread.
+	 *
+	 * @param frames Frames expected, including the lost ones.
+	 * @param lost Frames lost.
+	 * */
+	void count(uint64_t frames, uint64_t lost);
+
+	/**
+	 * @brief Lost frames per expected frame over the window, 0 without frames.
+	 * */
+	[[nodiscard]]
+	double rate() const;
+
+	/// Seconds covered by the window
+	static constexpr size_t SLOTS{ 10 };
+
+private:
+	struct Slot
+	{
+		/// Monotonic second the slot counts
+		gint64 second;
+		uint64_t frames;
+		uint64_t lost;
+	};
+
+	mutable std::mutex _mutex;
+	std::array<Slot, SLOTS> _slots;
+};
+
+/**
+ * Points of the frame path latencies are measured at, relative to the host
+ * time Aravis received the frame at.
+ * */
+enum class LatencyStage
+{
+	/// Frame handed to the new-buffer handler
+	Arrival,
+	/// Frame pushed to the app source
+	Push,
+	/// Frame left the app source queue
+	Source,
+	/// Encoded frame left the encoder
+	Encoder,
+	/// RTP packets of the frame left the payloader
+	Payloader,
+	Count
+};
+
+/**
+ * @class CaptureMetrics
+ *
+ * Counters and latency histograms of a camera.
+ *
+ * Encoders and payloaders do not keep buffer metas, frames are followed
+ * past the app source by their PTS instead: the capture time is recorded
+ * when a frame leaves the app source and looked up by the PTS of the
+ * encoder and payloader output.
+ * */
+class CaptureMetrics
+{
+public:
+	CaptureMetrics();
+
+	/**
+	 * @brief Host time a frame was received at, from its "timestamp/x-unix" meta.
+	 *
+	 * @return Time in nanoseconds since the epoch, 0 when the frame has no such meta.
+	 * */
+	static guint64 captureTime(GstBuffer *buffer);
+
+	/**
+	 * @brief Observe the latency of a stage from the capture time of a frame.
+	 * */
+	void observe(LatencyStage stage, guint64 captureTime);
+
+	/**
+	 * @brief Observe a stage of a frame carrying its capture time.
+	 * */
+	void observe(LatencyStage stage, GstBuffer *buffer);
+
+	/**
+	 * @brief Remember the capture time of a frame by its PTS.
+	 * */
+	void trace(GstClockTime pts, guint64 captureTime);
+
+	/**
+	 * @brief Observe a stage of a frame followed by its PTS.
+	 * */
+	void observeTraced(LatencyStage stage, GstClockTime pts);
+
+	/**
+	 * @brief Capture time remembered for a PTS.
+	 *
+	 * @return Time in nanoseconds since the epoch, 0 when the PTS is not traced.
+	 * */
+	[[nodiscard]]
+	guint64 tracedCaptureTime(GstClockTime pts);
+
+	/**
+	 * @brief Count a frame completed by Aravis with the given status.
+	 * */
+	void countStatus(ArvBufferStatus status);
+
+	/**
+	 * @brief Count a frame given back because the stream had no buffers left.
+	 * */
+	void countBacklogDrop();
+
+	/**
+	 * @brief Count frames Aravis had no free buffer for.
+	 * */
+	void countUnderruns(uint64_t underruns);
+
+	/**
+	 * @brief Count a stream that stopped delivering frames.
+	 * */
+	void countStall();
+
+	/**
+	 * @brief Count a stream that delivers again after reopening the camera.
+	 * */
+	void countRecovery();
+
+	[[nodiscard]]
+	const Histogram &histogram(LatencyStage stage) const;
+
+	[[nodiscard]]
+	uint64_t statusCount(ArvBufferStatus status) const;
+
+	[[nodiscard]]
+	uint64_t backlogDrops() const;
+
+	[[nodiscard]]
+	uint64_t underruns() const;
+
+	[[nodiscard]]
+	uint64_t stalls() const;
+
+	[[nodiscard]]
+	uint64_t recoveries() const;
+
+	/**
+	 * @brief Frames failed, given back or never delivered over the last seconds.
+	 * */
+	[[nodiscard]]
+	const LossWindow &loss() const;
+
+	static const char *stageName(LatencyStage stage);
+
+	static const char *statusName(ArvBufferStatus status);
+
+	/// Statuses counted, ARV_BUFFER_STATUS_UNKNOWN to ARV_BUFFER_STATUS_PAYLOAD_NOT_SUPPORTED
+	static constexpr std::array<ArvBufferStatus, 10> STATUSES{
+		ARV_BUFFER_STATUS_UNKNOWN, ARV_BUFFER_STATUS_SUCCESS, ARV_BUFFER_STATUS_CLEARED,
+		ARV_BUFFER_STATUS_TIMEOUT, ARV_BUFFER_STATUS_MISSING_PACKETS, ARV_BUFFER_STATUS_WRONG_PACKET_ID,
+		ARV_BUFFER_STATUS_SIZE_MISMATCH, ARV_BUFFER_STATUS_FILLING, ARV_BUFFER_STATUS_ABORTED,
+		ARV_BUFFER_STATUS_PAYLOAD_NOT_SUPPORTED
+	};
+
+private:
+	struct TraceEntry
+	{
+		GstClockTime pts;
+		guint64 captureTime;
+	};
+
+	/// Frames in flight between the app source and the payloader
+	static constexpr size_t TRACE_SIZE{ 64 };
+
+	std::array<Histogram, static_cast<size_t>(LatencyStage::Count)> _histograms;
+	std::array<std::atomic<uint64_t>, STATUSES.size()> _statusCounts;
+	std::atomic<uint64_t> _backlogDrops;
+	std::atomic<uint64_t> _underruns;
+	std::atomic<uint64_t> _stalls;
+	std::atomic<uint64_t> _recoveries;
+	LossWindow _loss;
+
+	std::mutex _traceMutex;
+	std::array<TraceEntry, TRACE_SIZE> _trace;
+	size_t _traceNext;
+};
+
+/**
+ * Lower transports the RTP packets of a stream are sent on.
+ * */
+enum class RtpTransport
+{
+	/// A copy per client over UDP
+	Udp,
+	/// A copy per stream to the multicast group
+	Multicast,
+	/// A copy per client interleaved in its RTSP connection
+	Tcp,
+	Count
+};
+
+/**
+ * @class TransportMetrics
+ *
+ * Bytes and packets a stream sent by lower transport.
+ *
+ * Packets are counted once where they leave the payloader and multiplied
+ * by the copies the transports of the stream send: one per unicast client
+ * and one for all multicast clients. The clients are counted when their
+ * sessions are set up and removed, a packet costs a few atomic additions
+ * whatever the number of clients.
+ * */
+class TransportMetrics
+{
+public:
+	TransportMetrics();
+
+	/**
+	 * @brief Count packets sent to the clients of every transport.
+	 *
+	 * @param packets Packets left the payloader.
+	 * @param bytes Bytes of the packets.
+	 * */
+	void count(uint64_t packets, uint64_t bytes);
+
+	/**
+	 * @brief A client set up the stream on a transport.
+	 * */
+	void addClient(RtpTransport transport);
+
+	/**
+	 * @brief A client of a transport is gone.
+	 * */
+	void removeClient(RtpTransport transport);
+
+	[[nodiscard]]
+	uint64_t bytes(RtpTransport transport) const;
+
+	[[nodiscard]]
+	uint64_t packets(RtpTransport transport) const;
+
+	/**
+	 * @brief Clients set up on a transport.
+	 * */
+	[[nodiscard]]
+	uint32_t clients(RtpTransport transport) const;
+
+	/**
+	 * @brief Packets and bytes that left the payloader, a single copy.
+	 *
+	 * Every client of the stream gets all of them, its sessions count from here.
+	 * */
+	[[nodiscard]]
+	uint64_t sentPackets() const;
+
+	[[nodiscard]]
+	uint64_t sentBytes() const;
+
+	static const char *transportName(RtpTransport transport);
+
+private:
+	static constexpr size_t COUNT{ static_cast<size_t>(RtpTransport::Count) };
+
+	std::array<std::atomic<uint64_t>, COUNT> _bytes;
+	std::array<std::atomic<uint64_t>, COUNT> _packets;
+	std::array<std::atomic<uint32_t>, COUNT> _clients;
+	std::atomic<uint64_t> _sentPackets;
+	std::atomic<uint64_t> _sentBytes;
+};
+
+#endif // RTSPCAM_METRICS_HPP
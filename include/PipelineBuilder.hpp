@@ -0,0 +1,99 @@
+/**
+ * @file PipelineBuilder.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_PIPELINEBUILDER_HPP
+#define RTSPCAM_PIPELINEBUILDER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class PipelineBuilder
+ *
+ * Builds gst-launch pipeline descriptions from typed elements and caps.
+ *
+ * Elements and caps filters are appended to the current chain and linked
+ * with "!". Properties and caps fields apply to the last element or caps
+ * filter appended, string values are quoted when the parser needs it.
+ * A branch starts a new chain linked to a named element, e.g. a tee.
+ *
+ * @code
+ * PipelineBuilder pipeline;
+ * pipeline.element("videotestsrc").property("num-buffers", 10)
+ *   .caps("video/x-raw").field("format", "I420").field("width", 640)
+ *   .element("fakesink");
+ * @endcode
+ * */
+class PipelineBuilder
+{
+public:
+	PipelineBuilder();
+
+	/**
+	 * @brief Append an element.
+	 *
+	 * @param factory Name of the element factory.
+	 * */
+	PipelineBuilder &element(std::string_view factory);
+
+	/**
+	 * @brief Append a caps filter.
+	 *
+	 * @param mediaType Media type, e.g. video/x-raw.
+	 * @param features Caps features, e.g. memory:NVMM, empty for system memory.
+	 * */
+	PipelineBuilder &caps(std::string_view mediaType, std::string_view features = {});
+
+	PipelineBuilder &property(std::string_view name, std::string_view value);
+
+	PipelineBuilder &property(std::string_view name, const char *value);
+
+	PipelineBuilder &property(std::string_view name, int64_t value);
+
+	/**
+	 * @brief Add a string field to the last caps filter.
+	 * */
+	PipelineBuilder &field(std::string_view name, std::string_view value);
+
+	PipelineBuilder &field(std::string_view name, const char *value);
+
+	/**
+	 * @brief Add an integer field to the last caps filter.
+	 * */
+	PipelineBuilder &field(std::string_view name, int32_t value);
+
+	/**
+	 * @brief Add a fraction field to the last caps filter.
+	 * */
+	PipelineBuilder &field(std::string_view name, int32_t numerator, int32_t denominator);
+
+	/**
+	 * @brief Start a chain fed by a named element, e.g. a branch of a tee.
+	 * */
+	PipelineBuilder &branch(std::string_view name);
+
+	/**
+	 * @brief Pipeline description for gst_parse_launch.
+	 * */
+	[[nodiscard]]
+	std::string str() const;
+
+private:
+	struct Chain
+	{
+		/// Element the chain is linked to, empty for a chain starting at a source
+		std::string origin;
+		std::vector<std::string> items;
+	};
+
+	std::string &last();
+
+	std::vector<Chain> _chains;
+};
+
+#endif // RTSPCAM_PIPELINEBUILDER_HPP
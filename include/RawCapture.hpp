@@ -0,0 +1,121 @@
+/**
+ * @file RawCapture.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_RAWCAPTURE_HPP
+#define RTSPCAM_RAWCAPTURE_HPP
+
+#include <thread>
+
+#include "CaptureBackend.hpp"
+#include "SpscRing.hpp"
+
+/// Identifies a raw capture file
+static constexpr char RAW_CAPTURE_MAGIC[8]{ 'r', 't', 's', 'p', 'r', 'a', 'w', '1' };
+/// Alignment of the header size and of every frame in the file
+static constexpr size_t RAW_CAPTURE_ALIGNMENT{ 4096 };
+
+/**
+ * Header at the start of a raw capture file.
+ *
+ * Frames follow at the header size, every frame in a slot of the frame
+ * size rounded up to the alignment, so frames of a mapped file start on
+ * pages. Values are stored in host byte order.
+ * */
+struct RawCaptureHeader
+{
+	char magic[8];
+	uint32_t headerSize;
+	uint32_t pixelFormat;
+	char pixelFormatName[32];
+	int32_t width;
+	int32_t height;
+	/// Row stride in bytes, 0 when the rows are packed
+	uint32_t rowStride;
+	uint32_t frameSize;
+	/// Frames in the file, 0 when the recording was interrupted
+	uint64_t frameCount;
+	/// Frame rate of the camera while recording
+	double frameRate;
+};
+
+/**
+ * @brief Size of the slot of a frame in a raw capture file.
+ * */
+[[nodiscard]]
+size_t rawCaptureSlotSize(const RawCaptureHeader &header);
+
+/**
+ * @brief Read and check the header of a raw capture file.
+ *
+ * The frame count of an interrupted recording is derived from the file size.
+ * */
+bool readRawCaptureHeader(const std::string &path, RawCaptureHeader &header);
+
+/**
+ * @brief Frame format described by a raw capture header.
+ * */
+[[nodiscard]]
+FrameFormat rawCaptureFormat(const RawCaptureHeader &header);
+
+/**
+ * @class RawRecorder
+ *
+ * Dumps camera frames into a raw capture file for replay.
+ *
+ * The stream thread copies a frame into a free slot and queues it, a writer
+ * thread writes the slots to the file and gives them back. Both directions
+ * are single producer, single consumer rings, frames arriving while all
+ * slots wait for the disk are dropped.
+ * */
+class RawRecorder
+{
+public:
+	/**
+	 * @param numFrames Frames to record before the file is closed.
+	 * @param numSlots Frames waiting for the disk at most.
+	 * */
+	explicit RawRecorder(uint64_t numFrames, uint32_t numSlots = 16);
+	~RawRecorder();
+
+	RawRecorder(const RawRecorder &) = delete;
+	RawRecorder &operator=(const RawRecorder &) = delete;
+
+	/**
+	 * @brief Create the file and start the writer thread.
+	 * */
+	bool open(const std::string &path, const FrameFormat &format);
+
+	/**
+	 * @brief Queue a copy of a frame, called from the stream thread.
+	 * */
+	void record(const FrameView &frame);
+
+private:
+	void run();
+
+	void finish();
+
+	uint64_t _numFrames;
+	uint32_t _numSlots;
+	std::string _path;
+	int _file;
+	RawCaptureHeader _header;
+	size_t _slotSize;
+	uint8_t *_slots;
+	/// Slots free for the stream thread and slots waiting for the writer thread
+	SpscRing<uint32_t> _free;
+	SpscRing<uint32_t> _filled;
+	std::thread _thread;
+	std::atomic<bool> _running;
+	/// Bumped when a frame is queued or the recorder stops, the writer thread waits on it
+	std::atomic<uint32_t> _queued;
+	/// Frames queued so far, stream thread only
+	uint64_t _requested;
+	std::atomic<uint64_t> _written;
+	std::atomic<uint64_t> _dropped;
+};
+
+#endif // RTSPCAM_RAWCAPTURE_HPP
@@ -0,0 +1,110 @@
+/**
+ * @file Repack.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_REPACK_HPP
+#define RTSPCAM_REPACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <arv.h>
+
+/**
+ * Instruction set used by the repacking kernels.
+ * */
+enum class SimdLevel
+{
+	Scalar,
+	Sse2,
+	Ssse3,
+	Avx2,
+	Neon
+};
+
+/**
+ * Layout of packed 10/12-bit pixel formats.
+ * */
+enum class PackedLayout
+{
+	/// Byte aligned pixels, rows are copied as is
+	None,
+	/// GigE Vision Mono10Packed/BayerXX10Packed, 2 pixels in 3 bytes
+	GigE10,
+	/// GigE Vision Mono12Packed/BayerXX12Packed, 2 pixels in 3 bytes
+	GigE12,
+	/// PFNC Mono10p/BayerXX10p, 4 pixels in 5 bytes, LSB first
+	Lsb10,
+	/// PFNC Mono12p/BayerXX12p, 2 pixels in 3 bytes, LSB first
+	Lsb12
+};
+
+/**
+ * @brief Best instruction set supported by the running CPU.
+ * */
+SimdLevel detectSimdLevel();
+
+/**
+ * @brief Instruction set of the kernels currently in use.
+ * */
+SimdLevel repackSimdLevel();
+
+/**
+ * @brief Force kernels of the given instruction set.
+ *
+ * The level is lowered to the one supported by the CPU, used by benchmarks
+ * to compare the kernels against each other.
+ * */
+void setRepackSimdLevel(SimdLevel level);
+
+const char *simdLevelName(SimdLevel level);
+
+/**
+ * @brief Packed layout of the camera pixel format.
+ * */
+PackedLayout packedLayout(ArvPixelFormat pixelFormat);
+
+/**
+ * @brief Size of a tightly packed row in bytes.
+ *
+ * @param width Row width in pixels.
+ * @param bitsPerPixel Bits per pixel as given by ARV_PIXEL_FORMAT_BIT_PER_PIXEL.
+ * */
+size_t packedRowStride(int32_t width, uint32_t bitsPerPixel);
+
+/**
+ * @brief Row stride of a frame accepted by GStreamer, a multiple of 4.
+ * */
+size_t alignedRowStride(size_t rowSize);
+
+/**
+ * @brief Copy rows between buffers of different strides.
+ *
+ * The padding of destination rows is left untouched.
+ *
+ * @param rowSize Number of bytes to copy from every row.
+ * */
+void repackRows(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t rowSize, size_t height);
+
+/**
+ * @brief Unpack 10/12-bit packed rows into 16-bit little-endian pixels.
+ *
+ * Pixel values are MSB aligned to use the full 16-bit range.
+ *
+ * @param width Row width in pixels.
+ * */
+void unpackRows(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t width, size_t height,
+								PackedLayout layout);
+
+/**
+ * @brief GStreamer caps of a packed pixel format after unpacking to 16-bit.
+ *
+ * @param pixelFormatName GenICam name of the pixel format, e.g. "BayerRG12Packed".
+ * @return Caps string or an empty string when the format is not supported.
+ * */
+std::string unpackedCapsString(const char *pixelFormatName);
+
+#endif // RTSPCAM_REPACK_HPP
@@ -0,0 +1,65 @@
+/**
+ * @file ReplaySource.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_REPLAYSOURCE_HPP
+#define RTSPCAM_REPLAYSOURCE_HPP
+
+#include <thread>
+
+#include "CaptureBackend.hpp"
+#include "RawCapture.hpp"
+
+/**
+ * @class ReplaySource
+ *
+ * Capture backend replaying the frames of a raw capture file in a loop.
+ *
+ * The file is mapped and its pages are read in before the replay starts,
+ * frames are wrapped without copying and keep the mapping alive until
+ * GStreamer releases them. Frames are delivered at a fixed rate, or as fast
+ * as the pipeline takes them, which makes runs repeatable without a camera.
+ * */
+class ReplaySource: public CaptureBackend
+{
+public:
+	/**
+	 * @param path Raw capture file.
+	 * @param frameRate Replay rate, unset for the rate of the file and 0 to not throttle.
+	 * */
+	ReplaySource(std::string path, std::optional<double> frameRate);
+	~ReplaySource() override;
+
+	/**
+	 * @brief Map the file and read its header.
+	 * */
+	bool open();
+
+	[[nodiscard]]
+	const std::string &name() const override;
+
+	[[nodiscard]]
+	const FrameFormat &format() const override;
+
+	bool start(DeviceHandle *device) override;
+
+	void stop() override;
+
+private:
+	struct Mapping;
+
+	void run(DeviceHandle *device);
+
+	std::string _path;
+	std::string _name;
+	std::optional<double> _frameRate;
+	RawCaptureHeader _header;
+	FrameFormat _format;
+	std::shared_ptr<Mapping> _mapping;
+	std::thread _thread;
+	std::atomic<bool> _running;
+};
+
+#endif // RTSPCAM_REPLAYSOURCE_HPP
@@ -7,15 +7,49 @@
 #ifndef RTSPCAM_SERVERHANDLE_HPP
 #define RTSPCAM_SERVERHANDLE_HPP
 
-#include "DeviceHandle.hpp"
+#include <thread>
+#include <vector>
+
+#include "BitrateController.hpp"
+#include "CapturePipeline.hpp"
+#include "HttpServer.hpp"
+#include "SessionRegistry.hpp"
+
+/**
+ * Stream of a camera with the media factory serving it.
+ * */
+struct StreamMount
+{
+	std::string path;
+	GstRTSPMediaFactory *factory;
+	/// Adapts the encoder to the receiver reports, nullptr when the bitrate is fixed
+	std::unique_ptr<BitrateController> bitrate{};
+	/// Bytes sent by lower transport
+	std::unique_ptr<TransportMetrics> transports{ std::make_unique<TransportMetrics>() };
+};
+
+/**
+ * Camera served by the RTSP server with its mount points.
+ * */
+struct CameraMount
+{
+	DeviceHandle *device;
+	/// Capture shared by the streams, nullptr when the main stream is the only one
+	CapturePipeline *capture;
+	std::string path;
+	/// Main stream followed by the sub-streams of the stream profiles
+	std::vector<StreamMount> streams;
+	/// Recording of the main stream, nullptr when it is not recorded
+	std::unique_ptr<DiskRing> recording{};
+};
 
 /**
  * @brief Handles internal structure of RTSP Server.
  *
  * The class initializes GStreamer RTSP server, handles authorization
  * and callbacks of the server.
- * It also initializes device handle to capture frames from IP Camera
- * and push them to the pipeline of the server.
+ * It also initializes a device handle for every camera found to capture
+ * frames and push them to the pipeline of its mount point.
  *
  * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
  * @ingroup Server
@@ -37,23 +71,146 @@ public:
 	/**
 	 * @brief Attach server to the main context.
 	 *
+	 * The server accepts connections on the main context, its clients are
+	 * served on the threads of its thread pool. Expired sessions are removed
+	 * on a context and thread of their own.
+	 *
 	 * @param[in] timeoutInterval Timeout for seession cleaning in seconds.
 	 * */
 	void attach(uint32_t timeoutInterval = 2);
 
+	/**
+	 * @brief Find the camera serving the given URL path.
+	 *
+	 * @param path Absolute path of a request, e.g. a stream control URL.
+	 * @return Device handle or nullptr when no mount point matches.
+	 * */
+	DeviceHandle *deviceForPath(const char *path) const;
+
+	/**
+	 * @brief Find the transport counters of the stream serving the given URL path.
+	 *
+	 * @param path Absolute path of a request, e.g. a stream control URL.
+	 * @return Transport metrics or nullptr when no stream matches.
+	 * */
+	TransportMetrics *transportsForPath(const char *path) const;
+
+	/**
+	 * @brief Streams set up by the clients.
+	 * */
+	[[nodiscard]]
+	SessionRegistry *sessions();
+
+	/**
+	 * @brief List the sessions of the clients as JSON.
+	 *
+	 * The camera parameter limits the list to the sessions of a camera.
+	 *
+	 * @param method HTTP method.
+	 * @param query Query string of the request.
+	 * */
+	HttpResponse handleSessions(std::string_view method, std::string_view query);
+
+	/**
+	 * @brief Render the metrics of all cameras in the Prometheus text format.
+	 * */
+	[[nodiscard]]
+	std::string renderMetrics() const;
+
+	/**
+	 * @brief Read or change the settings of a camera while it is streaming.
+	 *
+	 * GET returns the settings and their bounds, POST applies the exposure,
+	 * gain, frame-rate, offset-x and offset-y parameters of the query in this
+	 * order and stops at the first one the camera rejects. The camera
+	 * parameter selects a camera by serial number, it may be left out when
+	 * a single camera is served.
+	 *
+	 * @param method HTTP method.
+	 * @param query Query string of the request.
+	 * */
+	HttpResponse handleControl(std::string_view method, std::string_view query);
+
+	/**
+	 * @brief Export the last seconds of the recording of a camera as an MPEG-TS clip.
+	 *
+	 * The seconds parameter sets the length of the clip, 30 s by default. The
+	 * clip starts at a keyframe and may be a segment longer, it is copied
+	 * from the segments without transcoding. The camera parameter selects a
+	 * camera like for the control endpoint.
+	 *
+	 * @param method HTTP method.
+	 * @param query Query string of the request.
+	 * */
+	HttpResponse handleRecording(std::string_view method, std::string_view query);
+
 protected:
 	/**
-	 * @brief Intialize media factory.
+	 * @brief Open all cameras found by Aravis.
+	 *
+	 * A single camera is mounted at the configured path, several cameras
+	 * at the configured path followed by their serial number.
+	 *
+	 * @param path URL path
+	 * */
+	void initDevices(const std::string &path);
+
+	/**
+	 * @brief Intialize media factories of a camera.
 	 *
 	 * The media factory is responsible for creating or recycling
 	 * media objects based on the passed URL.
-	 * In this method we initialize media factory with predefined launch
-	 * string as url parameter.
-	 * Also we bind media factory and media related callbacks here.
+	 * The main stream is mounted at the camera path. Without stream profiles
+	 * its media captures from the camera directly, otherwise the camera is
+	 * captured and debayered once by a shared pipeline and every profile,
+	 * including the main stream, encodes a scaled copy of the frames.
+	 * In always-on mode the shared pipeline encodes the streams as well
+	 * and the medias only payload the frames relayed to them.
+	 * The stream of a profile is mounted at the camera path followed by
+	 * the profile name.
+	 *
+	 * @param mount Camera to create the factories for.
+	 * @param profiles Sub-streams served next to the main stream.
+	 * */
+	void initMediaFactory(CameraMount &mount, const std::vector<StreamProfile> &profiles) noexcept;
+
+	/**
+	 * @brief Create a media factory and add it to the mount points.
 	 *
+	 * The factory offers the lower transports of the transport policy,
+	 * multicast groups are taken from the address pool of the server.
+	 *
+	 * @param path URL path
+	 * @param launchString Pipeline description of the media.
+	 * @param configure Handler of the media-configure signal.
+	 * @param data Data passed to the handler.
+	 * */
+	GstRTSPMediaFactory *addMediaFactory(const std::string &path, const std::string &launchString,
+																			 GCallback configure, void *data) noexcept;
+
+	/**
+	 * @brief Add a stream to the mount points of a camera.
+	 *
+	 * With adaptive bitrate the stream gets a bitrate controller, attached to
+	 * its factory for the media-configure handler. The packets of its medias
+	 * are counted by lower transport.
+	 *
+	 * @param mount Camera serving the stream.
 	 * @param path URL path
+	 * @param factory Media factory of the stream.
+	 * @param bitrate Configured bitrate of the stream in kbit/s.
+	 * */
+	void addStream(CameraMount &mount, const std::string &path, GstRTSPMediaFactory *factory, int64_t bitrate);
+
+	/**
+	 * @brief Size the thread pool the RTSP clients are served on.
+	 *
+	 * Every thread of the pool runs a context of its own, a client is served
+	 * on one thread for all its requests and interleaved packets. The pool is
+	 * limited to the configured number of threads, one per core by default,
+	 * or starts a thread for every client.
 	 * */
-	void initMediaFactory(const char *path = "/live") noexcept;
+	void initThreadPool() noexcept;
 
 	/**
 	 * @brief Initialize GStreamer RTSP Server authentication logic.
@@ -65,13 +222,36 @@ protected:
 	 * */
 	void initAuth() noexcept;
 
+	/**
+	 * @brief Follow the number of clients of a camera.
+	 *
+	 * A camera captured for its media alone stops acquiring when its last
+	 * client leaves, also while the media stays prepared for other clients,
+	 * and starts again with the next one. Shared capture pipelines follow
+	 * their medias and keep running in always-on mode.
+	 *
+	 * @param device Camera whose clients changed.
+	 * @param numClients Clients watching the camera.
+	 * */
+	void onClientsChanged(DeviceHandle *device, uint32_t numClients);
+
 private:
 	bool _enableAuth;
 	const Options *_options;
 	GstRTSPServer *_server;
-	GstRTSPMediaFactory *_factory;
 	GstRTSPAuth *_auth;
-	DeviceHandle *_deviceHandle;
+	/// Multicast groups and ports shared by all streams
+	GstRTSPAddressPool *_addressPool;
+	std::vector<CameraMount> _mounts;
+	SessionRegistry _sessions;
+	HttpServer _http;
+	/// Source of the server on the main context, removed with the server
+	guint _serverSource;
+	/// Context, loop and thread the expired sessions are removed on
+	GMainContext *_cleanupContext;
+	GMainLoop *_cleanupLoop;
+	GSource *_cleanupSource;
+	std::thread _cleanupThread;
 };
 
 #endif // RTSPCAM_SERVERHANDLE_HPP
@@ -0,0 +1,196 @@
+/**
+ * @file SessionRegistry.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_SESSIONREGISTRY_HPP
+#define RTSPCAM_SESSIONREGISTRY_HPP
+
+#include <functional>
+#include <map>
+
+#include "Metrics.hpp"
+
+class DeviceHandle;
+
+/**
+ * Snapshot of a stream set up by a client.
+ * */
+struct SessionInfo
+{
+	uint64_t id;
+	/// Address of the RTSP connection of the client
+	std::string address;
+	/// Control path the stream was set up with
+	std::string path;
+	/// Serial number of the camera
+	std::string camera;
+	RtpTransport transport;
+	/// Real time the stream was set up at, in microseconds since the epoch
+	gint64 startTime;
+	uint64_t bytes;
+	uint64_t packets;
+	/// Loss fraction and jitter in milliseconds of the last receiver report, unset before the first one
+	std::optional<double> fractionLost;
+	std::optional<double> jitter;
+	/// Bytes the kernel has not sent yet on the RTSP connection, where interleaved packets queue up
+	uint64_t queueBytes;
+};
+
+/**
+ * @class Session
+ *
+ * Stream set up by a client.
+ *
+ * Every client of a stream gets all of its packets, the session counts what
+ * the stream sent since it was set up and adds its client to the transport
+ * counters of the stream while it lives. Nothing is counted per session on
+ * the send path.
+ * */
+class Session
+{
+public:
+	/**
+	 * @param info Fixed fields of the session, the counters start at zero.
+	 * @param client Client of the session, only used as a key.
+	 * @param device Camera of the stream.
+	 * @param transports Transport counters of the stream, nullptr when it has none.
+	 * @param rtcpAddress Address the receiver reports of the client come from, empty when unknown.
+	 * @param socket Socket of the RTSP connection, a reference is taken.
+	 * */
+	Session(SessionInfo info, const void *client, DeviceHandle *device, TransportMetrics *transports,
+					std::string rtcpAddress, GSocket *socket);
+	~Session();
+
+	Session(const Session &) = delete;
+	Session &operator=(const Session &) = delete;
+
+	/**
+	 * @brief Keep a receiver report of the client.
+	 *
+	 * @param fractionLost Fraction of the packets lost since the previous report, 0 to 1.
+	 * @param jitter Interarrival jitter in milliseconds.
+	 * */
+	void report(double fractionLost, double jitter);
+
+	[[nodiscard]]
+	uint64_t id() const;
+
+	[[nodiscard]]
+	const void *client() const;
+
+	[[nodiscard]]
+	DeviceHandle *device() const;
+
+	[[nodiscard]]
+	const std::string &rtcpAddress() const;
+
+	/**
+	 * @brief Fixed fields and current counters of the session.
+	 * */
+	[[nodiscard]]
+	SessionInfo info() const;
+
+private:
+	SessionInfo _info;
+	const void *_client;
+	DeviceHandle *_device;
+	TransportMetrics *_transports;
+	/// Packets and bytes the stream had sent when the session was set up
+	uint64_t _packetsBase;
+	uint64_t _bytesBase;
+	std::string _rtcpAddress;
+	GSocket *_socket;
+	std::atomic<bool> _hasReport;
+	std::atomic<double> _fractionLost;
+	std::atomic<double> _jitter;
+};
+
+/**
+ * @class SessionRegistry
+ *
+ * Streams set up by the clients of the server and the number of clients
+ * of every camera.
+ *
+ * A session is attached to the stream transport of its client and removed
+ * with it, however the transport ends: teardown, a closed connection or a
+ * session timeout. Sessions are only locked when they are added, removed,
+ * reported on or listed, so the RTSP server may run its contexts on any
+ * number of threads.
+ * */
+class SessionRegistry
+{
+public:
+	/**
+	 * Called with the number of clients of a camera whenever it changes, after the lock of the registry
+	 * is released. The calls are made one at a time and the count is taken right before each, so the
+	 * last call has the current count even when changes race on several threads.
+	 * */
+	using ClientsChanged = std::function<void(DeviceHandle *device, uint32_t numClients)>;
+
+	explicit SessionRegistry(ClientsChanged clientsChanged);
+	~SessionRegistry();
+
+	SessionRegistry(const SessionRegistry &) = delete;
+	SessionRegistry &operator=(const SessionRegistry &) = delete;
+
+	/**
+	 * @brief Add the session of a stream transport a client set up.
+	 *
+	 * @param client Client owning the transport.
+	 * @param transport Transport of the stream, the session is removed when it is finalized.
+	 * @param device Camera of the stream.
+	 * @param transports Transport counters of the stream, nullptr when it has none.
+	 * @param path Control path the stream was set up with.
+	 * */
+	void add(GstRTSPClient *client, GstRTSPStreamTransport *transport, DeviceHandle *device,
+					 TransportMetrics *transports, std::string path);
+
+	/**
+	 * @brief Keep a receiver report for the session it came from.
+	 *
+	 * @param rtcpAddress Address and port the report came from.
+	 * @param fractionLost Fraction of the packets lost since the previous report, 0 to 1.
+	 * @param jitter Interarrival jitter in milliseconds.
+	 * */
+	void report(std::string_view rtcpAddress, double fractionLost, double jitter);
+
+	/**
+	 * @brief Snapshot of all sessions, ordered by the time they were set up.
+	 * */
+	[[nodiscard]]
+	std::vector<SessionInfo> sessions() const;
+
+	/**
+	 * @brief Clients watching a camera, a client is counted once whatever number of streams it set up.
+	 * */
+	[[nodiscard]]
+	uint32_t numClients(DeviceHandle *device) const;
+
+private:
+	/**
+	 * @brief Remove a session, called when its transport is finalized.
+	 * */
+	void remove(uint64_t id);
+
+	/**
+	 * @brief Pass the number of clients of a camera on, called without the lock.
+	 * */
+	void clientsChanged(DeviceHandle *device);
+
+	static void transportFinalized(void *data);
+
+	ClientsChanged _clientsChanged;
+	/// Keeps the calls of the callback in order, the lock of the registry is not held during them
+	std::mutex _clientsChangedMutex;
+	mutable std::mutex _mutex;
+	uint64_t _nextId;
+	std::map<uint64_t, std::unique_ptr<Session>> _sessions;
+	/// Transports the sessions are attached to
+	std::map<uint64_t, GstRTSPStreamTransport *> _transports;
+	/// Sessions of every client of a camera
+	std::map<DeviceHandle *, std::map<const void *, uint32_t>> _clients;
+};
+
+#endif // RTSPCAM_SESSIONREGISTRY_HPP
@@ -0,0 +1,137 @@
+/**
+ * @file SpscRing.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_SPSCRING_HPP
+#define RTSPCAM_SPSCRING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @class SpscRing
+ *
+ * Bounded lock-free ring for a single producer and a single consumer.
+ *
+ * Every item carries a 64-bit stamp, e.g. the time it was queued.
+ * Besides the consumer the producer may also take the oldest item with evict()
+ * to make room, both sides then race for the head index and only the winner
+ * owns the item. Slots are atomics, so items must be lock-free atomic types.
+ * */
+template<typename T>
+class SpscRing
+{
+	static_assert(std::atomic<T>::is_always_lock_free, "ring items must be lock-free atomics");
+
+public:
+	/**
+	 * @param capacity Number of items, rounded up to a power of two.
+	 * */
+	explicit SpscRing(size_t capacity):
+		_capacity{ roundUp(capacity) },
+		_mask{ _capacity - 1 },
+		_slots{ std::make_unique<Slot[]>(_capacity) },
+		_head{},
+		_tail{}
+	{}
+
+	SpscRing(const SpscRing &) = delete;
+	SpscRing &operator=(const SpscRing &) = delete;
+
+	/**
+	 * @brief Queue an item, producer only.
+	 *
+	 * @return false when the ring is full.
+	 * */
+	bool push(T item, uint64_t stamp)
+	{
+		uint64_t tail = _tail.load(std::memory_order_relaxed);
+
+		if(tail - _head.load(std::memory_order_acquire) >= _capacity)
+			return false;
+
+		Slot &slot = _slots[tail & _mask];
+		slot.item.store(item, std::memory_order_relaxed);
+		slot.stamp.store(stamp, std::memory_order_relaxed);
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Take the oldest item, consumer only.
+	 *
+	 * @return false when the ring is empty.
+	 * */
+	bool pop(T &item, uint64_t &stamp)
+	{
+		return take(item, stamp);
+	}
+
+	/**
+	 * @brief Take the oldest item to make room for a new one, producer only.
+	 * */
+	bool evict(T &item, uint64_t &stamp)
+	{
+		return take(item, stamp);
+	}
+
+	[[nodiscard]]
+	size_t size() const
+	{
+		uint64_t head = _head.load(std::memory_order_acquire);
+		return static_cast<size_t>(_tail.load(std::memory_order_acquire) - head);
+	}
+
+	[[nodiscard]]
+	size_t capacity() const
+	{
+		return _capacity;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<T> item;
+		std::atomic<uint64_t> stamp;
+	};
+
+	static size_t roundUp(size_t capacity)
+	{
+		size_t size = 1;
+
+		while(size < capacity)
+			size <<= 1;
+		return size;
+	}
+
+	bool take(T &item, uint64_t &stamp)
+	{
+		uint64_t head = _head.load(std::memory_order_acquire);
+
+		while(head != _tail.load(std::memory_order_acquire))
+		{
+			const Slot &slot = _slots[head & _mask];
+			item = slot.item.load(std::memory_order_relaxed);
+			stamp = slot.stamp.load(std::memory_order_relaxed);
+
+			// the slot is not reused before the head moves past it, so the
+			// loaded item is valid if this side is the one moving the head
+			if(_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	const size_t _capacity;
+	const size_t _mask;
+	std::unique_ptr<Slot[]> _slots;
+
+	alignas(64) std::atomic<uint64_t> _head;
+	alignas(64) std::atomic<uint64_t> _tail;
+};
+
+#endif // RTSPCAM_SPSCRING_HPP
@@ -0,0 +1,88 @@
+/**
+ * @file StreamCalibration.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_STREAMCALIBRATION_HPP
+#define RTSPCAM_STREAMCALIBRATION_HPP
+
+#include "Common.hpp"
+
+/**
+ * Stream configuration chosen for a camera.
+ * */
+struct StreamSettings
+{
+	/// Number of Aravis stream buffers
+	uint32_t numBuffers;
+	/// GigE Vision packet size in bytes, 0 for other interfaces
+	uint32_t packetSize;
+};
+
+/**
+ * Camera configuration a calibration was made for, it is redone when any of it changes.
+ * */
+struct CalibrationKey
+{
+	/// Frame size in bytes
+	guint payload;
+	double frameRate;
+};
+
+/**
+ * Outcome of streaming with a number of buffers.
+ * */
+struct CalibrationTrial
+{
+	guint64 completed;
+	guint64 failures;
+	guint64 underruns;
+};
+
+/**
+ * @brief Path of the calibration file, a file in the user configuration directory unless configured.
+ * */
+[[nodiscard]]
+std::string calibrationFilePath(const Options &options);
+
+/**
+ * @brief Read the stream settings stored for a camera.
+ *
+ * @return false when the file has no settings for the camera or they were
+ * made for another frame size or frame rate.
+ * */
+bool loadStreamSettings(const std::string &path, const std::string &serial, const CalibrationKey &key,
+												StreamSettings &settings);
+
+/**
+ * @brief Store the stream settings of a camera, the entries of other cameras are kept.
+ * */
+bool saveStreamSettings(const std::string &path, const std::string &serial, const CalibrationKey &key,
+												const StreamSettings &settings);
+
+/**
+ * @brief Stream for a few seconds with a number of buffers.
+ *
+ * Frames are held back like the pipeline holds the frames it wraps without
+ * copying, the loss is read from the stream statistics.
+ *
+ * @param camera Camera not acquiring.
+ * @param numBuffers Stream buffers to try.
+ * @param heldFrames Frames kept out of the stream before they are returned.
+ * */
+CalibrationTrial runCalibrationTrial(ArvCamera *camera, uint32_t numBuffers, uint32_t heldFrames);
+
+/**
+ * @brief Find the smallest stream configuration streaming without loss.
+ *
+ * GigE Vision cameras get the largest packet size the network path takes
+ * first. Candidate buffer counts are then tried from the smallest one up,
+ * the first without failed frames or underruns wins.
+ *
+ * @param camera Camera not acquiring, at the resolution and frame rate it will stream at.
+ * @param heldFrames Frames the pipeline holds at most.
+ * */
+StreamSettings calibrateStream(ArvCamera *camera, uint32_t heldFrames);
+
+#endif // RTSPCAM_STREAMCALIBRATION_HPP
@@ -0,0 +1,133 @@
+/**
+ * @file StreamRelay.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_STREAMRELAY_HPP
+#define RTSPCAM_STREAMRELAY_HPP
+
+#include "Common.hpp"
+#include "Metrics.hpp"
+
+/**
+ * @class StreamRelay
+ *
+ * Forwards an encoded stream of the persistent capture pipeline to the app
+ * sources of the RTSP medias watching it.
+ *
+ * The relay caches the frames since the last IDR frame, which carries the
+ * SPS/PPS in band, and pushes them to a media as soon as it attaches, so a
+ * new client can decode the next frame without waiting for a keyframe.
+ *
+ * Frames keep their spacing in the media: the PTS of the capture pipeline
+ * is moved to the running time of the media by an offset taken when the
+ * media attaches, the cached frames end at its current running time.
+ * */
+class StreamRelay
+{
+public:
+	/**
+	 * @param metrics Metrics of the camera, the relayed frames are traced for the medias.
+	 * @param mediaType Media type of the encoded stream, e.g. video/x-h264.
+	 * @param maxCachedFrames Longest group of pictures kept for new medias.
+	 * */
+	explicit StreamRelay(CaptureMetrics *metrics, std::string mediaType = "video/x-h264",
+											 uint32_t maxCachedFrames = 120);
+	~StreamRelay();
+
+	StreamRelay(const StreamRelay &) = delete;
+	StreamRelay &operator=(const StreamRelay &) = delete;
+
+	/**
+	 * @brief Start relaying the samples of an app sink.
+	 *
+	 * @param sink App sink at the end of the encoded stream, the relay takes ownership.
+	 * */
+	void setSink(GstAppSink *sink);
+
+	/**
+	 * @brief Stop relaying and forget the cached frames.
+	 * */
+	void clearSink();
+
+	/**
+	 * @brief Caps of the encoded stream, nullptr before the first sample.
+	 *
+	 * @return New reference to the caps.
+	 * */
+	[[nodiscard]]
+	GstCaps *caps();
+
+	/**
+	 * @brief Media type of the encoded stream, known before the first sample.
+	 * */
+	[[nodiscard]]
+	const std::string &mediaType() const;
+
+	/**
+	 * @brief Encoder feeding the app sink, nullptr while there is no sink.
+	 *
+	 * @return New reference to the encoder.
+	 * */
+	[[nodiscard]]
+	GstElement *encoder();
+
+	/**
+	 * @brief Metrics of the camera feeding the encoded stream.
+	 * */
+	[[nodiscard]]
+	CaptureMetrics *metrics() const;
+
+	/**
+	 * @brief Start pushing frames to the app source of a media.
+	 *
+	 * The cached group of pictures is pushed first. When there is none a
+	 * keyframe is requested from the encoder.
+	 * */
+	void attach(GstAppSrc *source);
+
+	void detach(GstAppSrc *source);
+
+	/**
+	 * @brief Relay a sample of the app sink, called from its streaming thread.
+	 * */
+	GstFlowReturn onSample(GstSample *sample);
+
+	[[nodiscard]]
+	size_t numSources();
+
+private:
+	/// App source of a media and the offset of its running time to the capture pipeline
+	struct Source
+	{
+		GstAppSrc *source;
+		/// GST_CLOCK_STIME_NONE until the first frame is stamped
+		GstClockTimeDiff offset;
+	};
+
+	void pushCache(Source &source, GstClockTime now);
+
+	/**
+	 * @brief PTS of a live frame in the media of a source.
+	 *
+	 * @return GST_CLOCK_TIME_NONE when the app source has to stamp the frame on arrival.
+	 * */
+	GstClockTime sourceTime(Source &source, GstClockTime pts);
+
+	void clearCache();
+
+	void requestKeyframe();
+
+	std::string _mediaType;
+	std::mutex _mutex;
+	GstAppSink *_sink;
+	GstCaps *_caps;
+	CaptureMetrics *_metrics;
+	std::vector<Source> _sources;
+	/// Frames since the last IDR frame, empty while waiting for one
+	std::vector<GstBuffer *> _cache;
+	uint32_t _maxCachedFrames;
+};
+
+#endif // RTSPCAM_STREAMRELAY_HPP
@@ -0,0 +1,106 @@
+/**
+ * @file WorkStealingPool.hpp
+ * @author Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>
+ * @date 16.10.26
+ * */
+
+#ifndef RTSPCAM_WORKSTEALINGPOOL_HPP
+#define RTSPCAM_WORKSTEALINGPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class WorkStealingPool
+ *
+ * Fixed set of worker threads running batches of indexed tasks.
+ *
+ * A batch is split into contiguous runs, one per worker deque, so neighbouring
+ * tasks stay on the same core. A worker takes tasks from the front of its own
+ * deque and steals from the back of the others once it runs dry, which evens
+ * out bands that take longer than their neighbours. Several threads may run
+ * batches at the same time, e.g. the streaming threads of different cameras.
+ * */
+class WorkStealingPool
+{
+public:
+	/**
+	 * @param numThreads Worker threads, 0 for one per core.
+	 * */
+	explicit WorkStealingPool(uint32_t numThreads);
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool &) = delete;
+	WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+	/**
+	 * @brief Run a task for every index below numTasks and wait for all of them.
+	 *
+	 * Must not be called from a task.
+	 * */
+	void run(size_t numTasks, const std::function<void(size_t)> &task);
+
+	[[nodiscard]]
+	uint32_t numThreads() const;
+
+	/**
+	 * @brief Time a worker spent running tasks since the pool started, in nanoseconds.
+	 * */
+	[[nodiscard]]
+	uint64_t busyTime(uint32_t worker) const;
+
+	/**
+	 * @brief Tasks run by another worker than the one they were queued to.
+	 * */
+	[[nodiscard]]
+	uint64_t steals() const;
+
+private:
+	struct Batch
+	{
+		const std::function<void(size_t)> *task;
+		size_t remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+
+	struct Task
+	{
+		Batch *batch;
+		size_t index;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::atomic<uint64_t> busy{};
+		std::thread thread;
+	};
+
+	void work(uint32_t index);
+
+	bool take(uint32_t index, Task &task);
+
+	void execute(uint32_t index, const Task &task);
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+
+	/// Guards the sleep of idle workers
+	std::mutex _sleepMutex;
+	std::condition_variable _wake;
+	/// Tasks queued and not yet taken
+	size_t _pending;
+	bool _stopping;
+
+	std::atomic<uint64_t> _steals;
+};
+
+#endif // RTSPCAM_WORKSTEALINGPOOL_HPP
@@ -2,9 +2,12 @@
 #include <arv.h>
 
 #include "Common.hpp"
+#include "DebayerElement.hpp"
+#include "EncoderProbe.hpp"
+#include "RawCapture.hpp"
 #include "ServerHandle.hpp"
 
-static const std::string gPlugins[] = { "appsrc", "videoconvert" };
+static const std::string gPlugins[] = { "appsrc", "appsink", "videoscale", "videotestsrc" };
 
 bool checkPlugins();
 
@@ -22,6 +25,10 @@ int main(int argc, char **argv)
 
 	mainLoop = g_main_loop_new(nullptr, false);
 	options = parseOptions(argc, argv);
+	if(!registerDebayerElement(options.debayerThreads))
+		GST_ERROR("failed to register the %s element", DEBAYER_ELEMENT_NAME);
+	if(!options.encoderForced)
+		options.encoder = probeEncoder(options);
 
 	serverHandle = std::make_unique<ServerHandle>(&options);
 	serverHandle->attach(4);
@@ -71,6 +78,46 @@ Options parseOptions(int argc, char *argv[])
 	double *exposure{};
 	double *gain{};
 	const char *mode{};
+	const char *encoder{};
+	const char *codec{};
+	const char *rateControl{};
+	const char *preset{};
+	int32_t gopLength{};
+	int32_t bFrames{};
+	int32_t encoderThreads{};
+	gboolean adaptiveBitrate{};
+	int64_t minBitrate{};
+	int32_t queueDepth{ 4 };
+	int32_t streamBuffers{};
+	int32_t stallFrames{ -1 };
+	gboolean calibrate{};
+	gboolean recalibrate{};
+	gboolean hugePages{ TRUE };
+	const char *calibrationFile{};
+	const char *overflow{};
+	const char *flowControl{};
+	int64_t maxQueueBytes{};
+	gboolean hardwareTimestamps{ TRUE };
+	gboolean fakeCamera{};
+	gboolean alwaysOn{};
+	const char *recordDir{};
+	int64_t recordSize{};
+	int32_t recordSegment{};
+	const char *replayFile{};
+	double replayRate{ -1 };
+	const char *rawRecordDir{};
+	int32_t rawRecordFrames{};
+	int32_t serverThreads{};
+	gboolean threadPerClient{};
+	const char *transport{};
+	const char *multicastAddresses{};
+	const char *multicastPorts{};
+	int32_t multicastTtl{};
+	const char *httpAddress{};
+	int32_t httpPort{ -1 };
+	int32_t debayerThreads{ -1 };
+	const char *cpuAffinity{};
+	char **profiles{};
 	const char *address{};
 	const char *port{};
 	const char *streamUri{};
@@ -88,8 +135,81 @@ Options parseOptions(int argc, char *argv[])
 		{ "gain", 'g', 0, G_OPTION_ARG_DOUBLE, gain, "Acquisition gain value", "default: 22" },
 		{ "width", 'w', 0, G_OPTION_ARG_INT, &width, "Region width", "default: 2448" },
 		{ "height", 'h', 0, G_OPTION_ARG_INT, &height, "Region height", "default: 2048" },
-		{ "bitrate", 'b', 0, G_OPTION_ARG_INT64, &bitrate, "Encoder bitrate", "default: 10000" },
-		{ "mode", 'm', 0, G_OPTION_ARG_STRING, &mode, "Hardware to use", "gpu|cpu" },
+		{ "bitrate", 'b', 0, G_OPTION_ARG_INT64, &bitrate, "Encoder bitrate in kbit/s", "default: 4096" },
+		{ "mode", 'm', 0, G_OPTION_ARG_STRING, &mode, "Hardware the encoders are probed on", "auto|gpu|cpu" },
+		{ "encoder", 0, 0, G_OPTION_ARG_STRING, &encoder, "Encoder to use instead of probing at startup",
+			"nvv4l2h264enc|nvv4l2h265enc|vaapih264enc|vaapih265enc|x264enc|openh264enc|x265enc" },
+		{ "codec", 0, 0, G_OPTION_ARG_STRING, &codec, "Codec of the streams", "h264|h265" },
+		{ "gop", 0, 0, G_OPTION_ARG_INT, &gopLength, "Frames between keyframes", "default: encoder default" },
+		{ "b-frames", 0, 0, G_OPTION_ARG_INT, &bFrames, "B-frames between reference frames", "default: 0" },
+		{ "rate-control", 0, 0, G_OPTION_ARG_STRING, &rateControl, "Bitrate control of the encoder", "cbr|vbr" },
+		{ "preset", 0, 0, G_OPTION_ARG_STRING, &preset, "Encoder speed preset", "ultrafast|fast|medium|slow" },
+		{ "encoder-threads", 0, 0, G_OPTION_ARG_INT, &encoderThreads, "Encoder threads",
+			"default: encoder default" },
+		{ "adaptive-bitrate", 0, 0, G_OPTION_ARG_NONE, &adaptiveBitrate,
+			"Adapt the encoder bitrate to the RTCP receiver reports of the clients", nullptr },
+		{ "min-bitrate", 0, 0, G_OPTION_ARG_INT64, &minBitrate, "Lowest adaptive bitrate of a client in kbit/s",
+			"default: bitrate / 8" },
+		{ "queue-depth", 0, 0, G_OPTION_ARG_INT, &queueDepth, "Frames queued between camera and app source", "default: 4" },
+		{ "stream-buffers", 0, 0, G_OPTION_ARG_INT, &streamBuffers, "Aravis stream buffers per camera",
+			"default: calibrated or 30" },
+		{ "stall-frames", 0, 0, G_OPTION_ARG_INT, &stallFrames,
+			"Frame periods without a frame before the camera is reopened, 0 to disable", "default: 10" },
+		{ "no-huge-pages", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &hugePages,
+			"Allocate the stream buffers from regular pages", nullptr },
+		{ "calibrate", 0, 0, G_OPTION_ARG_NONE, &calibrate,
+			"Calibrate the stream buffers and packet size of cameras without a stored calibration", nullptr },
+		{ "recalibrate", 0, 0, G_OPTION_ARG_NONE, &recalibrate, "Calibrate the stream buffers and packet size again",
+			nullptr },
+		{ "calibration-file", 0, 0, G_OPTION_ARG_STRING, &calibrationFile, "File the stream calibrations are stored in",
+			"default: ~/.config/rtspcam/calibration.ini" },
+		{ "overflow", 0, 0, G_OPTION_ARG_STRING, &overflow, "Policy when the frame queue is full",
+			"drop-oldest|drop-newest|block" },
+		{ "flow-control", 0, 0, G_OPTION_ARG_STRING, &flowControl, "Reaction to a full app source queue",
+			"none|drop|throttle" },
+		{ "max-queue-bytes", 0, 0, G_OPTION_ARG_INT64, &maxQueueBytes, "App source queue limit in bytes",
+			"default: 4 frames" },
+		{ "no-hw-timestamps", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &hardwareTimestamps,
+			"Timestamp frames on arrival at the app source instead of with the camera clock", nullptr },
+		{ "cpu-affinity", 0, 0, G_OPTION_ARG_STRING, &cpuAffinity, "CPUs to pin camera stream threads to",
+			"cpu,cpu,..." },
+		{ "profile", 0, 0, G_OPTION_ARG_STRING_ARRAY, &profiles, "Additional scaled stream, may be repeated",
+			"name:WIDTHxHEIGHT@BITRATE" },
+		{ "debayer-threads", 0, 0, G_OPTION_ARG_INT, &debayerThreads,
+			"Threads debayering frames on the CPU path, 0 for one per core", "default: 0" },
+		{ "always-on", 0, 0, G_OPTION_ARG_NONE, &alwaysOn, "Keep capturing and encoding while no client is connected",
+			nullptr },
+		{ "record-dir", 0, 0, G_OPTION_ARG_STRING, &recordDir,
+			"Record the main stream of every camera to a ring of segments in this directory", nullptr },
+		{ "record-size", 0, 0, G_OPTION_ARG_INT64, &recordSize, "Disk space of the recording of a camera in MiB",
+			"default: 1024" },
+		{ "record-segment", 0, 0, G_OPTION_ARG_INT, &recordSegment, "Duration of a recording segment in seconds",
+			"default: 2" },
+		{ "replay", 0, 0, G_OPTION_ARG_FILENAME, &replayFile, "Serve the frames of a raw capture instead of the cameras",
+			nullptr },
+		{ "replay-rate", 0, 0, G_OPTION_ARG_DOUBLE, &replayRate, "Replay frame rate, 0 to replay as fast as possible",
+			"default: rate of the capture" },
+		{ "record-raw", 0, 0, G_OPTION_ARG_FILENAME, &rawRecordDir,
+			"Dump the raw frames of every camera to SERIAL.raw in this directory for replay", nullptr },
+		{ "record-raw-frames", 0, 0, G_OPTION_ARG_INT, &rawRecordFrames, "Raw frames dumped per camera",
+			"default: 300" },
+		{ "server-threads", 0, 0, G_OPTION_ARG_INT, &serverThreads, "Threads the RTSP clients are served on",
+			"default: one per core" },
+		{ "thread-per-client", 0, 0, G_OPTION_ARG_NONE, &threadPerClient, "Serve every RTSP client on its own thread",
+			nullptr },
+		{ "transport", 0, 0, G_OPTION_ARG_STRING, &transport, "Lower transports offered to the clients",
+			"unicast|multicast|multicast-preferred" },
+		{ "multicast-addresses", 0, 0, G_OPTION_ARG_STRING, &multicastAddresses, "Multicast groups of the streams",
+			"default: 224.3.0.1-224.3.0.254" },
+		{ "multicast-ports", 0, 0, G_OPTION_ARG_STRING, &multicastPorts, "Multicast RTP and RTCP ports",
+			"default: 5000-5999" },
+		{ "multicast-ttl", 0, 0, G_OPTION_ARG_INT, &multicastTtl, "Time to live of the multicast packets",
+			"default: 16" },
+		{ "http-address", 0, 0, G_OPTION_ARG_STRING, &httpAddress, "Address of the HTTP metrics endpoint",
+			"default: 127.0.0.1" },
+		{ "http-port", 0, 0, G_OPTION_ARG_INT, &httpPort, "Port of the HTTP metrics endpoint, 0 to disable",
+			"default: 9464" },
+		{ "fake-camera", 0, 0, G_OPTION_ARG_NONE, &fakeCamera, "Enable the Aravis fake camera", nullptr },
 		{ nullptr }
 	};
 
@@ -126,6 +246,201 @@ Options parseOptions(int argc, char *argv[])
 	if(gain != nullptr)
 		options.gain = *gain;
 	options.bitrate = bitrate;
+	if(mode != nullptr)
+	{
+		if(g_str_equal(mode, "gpu"))
+			options.mode = HardwareMode::Gpu;
+		else if(g_str_equal(mode, "cpu"))
+			options.mode = HardwareMode::Cpu;
+		else
+			options.mode = HardwareMode::Auto;
+	}
+	if(codec != nullptr && !codecFromString(codec, options.encoding.codec))
+		GST_ERROR("Unknown codec '%s', expected h264 or h265\n", codec);
+	if(encoder != nullptr)
+	{
+		if(encoderFromString(encoder, options.encoder))
+			options.encoderForced = true;
+		else
+			GST_ERROR("Unknown encoder '%s', probing the available ones\n", encoder);
+	}
+	// a forced encoder decides the codec
+	if(options.encoderForced)
+		options.encoding.codec = encoderInfo(options.encoder).codec;
+	if(gopLength > 0)
+		options.encoding.gopLength = gopLength;
+	if(bFrames > 0)
+		options.encoding.bFrames = bFrames;
+	if(encoderThreads > 0)
+		options.encoding.threads = static_cast<uint32_t>(encoderThreads);
+	options.adaptiveBitrate = adaptiveBitrate;
+	if(minBitrate > 0)
+		options.minBitrate = minBitrate;
+	if(rateControl != nullptr)
+	{
+		if(g_str_equal(rateControl, "cbr"))
+			options.encoding.rateControl = RateControl::Cbr;
+		else if(g_str_equal(rateControl, "vbr"))
+			options.encoding.rateControl = RateControl::Vbr;
+		else
+			GST_ERROR("Unknown rate control '%s', expected cbr or vbr\n", rateControl);
+	}
+	if(preset != nullptr)
+	{
+		if(g_str_equal(preset, "ultrafast"))
+			options.encoding.preset = EncoderPreset::UltraFast;
+		else if(g_str_equal(preset, "fast"))
+			options.encoding.preset = EncoderPreset::Fast;
+		else if(g_str_equal(preset, "medium"))
+			options.encoding.preset = EncoderPreset::Medium;
+		else if(g_str_equal(preset, "slow"))
+			options.encoding.preset = EncoderPreset::Slow;
+		else
+			GST_ERROR("Unknown preset '%s', expected ultrafast, fast, medium or slow\n", preset);
+	}
+	if(queueDepth > 0)
+		options.queueDepth = static_cast<uint32_t>(queueDepth);
+	if(streamBuffers > 0)
+		options.streamBuffers = static_cast<uint32_t>(streamBuffers);
+	options.calibrate = calibrate;
+	options.recalibrate = recalibrate;
+	options.hugePages = hugePages;
+	if(stallFrames >= 0)
+		options.stallFrames = static_cast<uint32_t>(stallFrames);
+	if(calibrationFile != nullptr)
+		options.calibrationFile = calibrationFile;
+	if(overflow != nullptr)
+	{
+		if(g_str_equal(overflow, "drop-newest"))
+			options.overflowPolicy = OverflowPolicy::DropNewest;
+		else if(g_str_equal(overflow, "block"))
+			options.overflowPolicy = OverflowPolicy::Block;
+		else
+			options.overflowPolicy = OverflowPolicy::DropOldest;
+	}
+	if(flowControl != nullptr)
+	{
+		if(g_str_equal(flowControl, "none"))
+			options.flowControl = FlowControl::None;
+		else if(g_str_equal(flowControl, "throttle"))
+			options.flowControl = FlowControl::Throttle;
+		else
+			options.flowControl = FlowControl::Drop;
+	}
+	if(maxQueueBytes > 0)
+		options.maxQueueBytes = static_cast<uint64_t>(maxQueueBytes);
+	options.hardwareTimestamps = hardwareTimestamps;
+	options.fakeCamera = fakeCamera;
+	options.alwaysOn = alwaysOn;
+	if(recordDir != nullptr)
+	{
+		options.recordDir = recordDir;
+		// the recording takes the stream encoded by the persistent capture
+		options.alwaysOn = true;
+	}
+	if(recordSize > 0)
+		options.recordSize = static_cast<uint64_t>(recordSize) << 20;
+	if(recordSegment > 0)
+		options.recordSegment = static_cast<uint32_t>(recordSegment);
+	if(rawRecordDir != nullptr)
+		options.rawRecordDir = rawRecordDir;
+	if(rawRecordFrames > 0)
+		options.rawRecordFrames = static_cast<uint32_t>(rawRecordFrames);
+	if(replayRate >= 0)
+		options.replayRate = replayRate;
+	if(replayFile != nullptr)
+	{
+		RawCaptureHeader header{};
+
+		options.replayFile = replayFile;
+		// the streams take the format of the capture
+		if(readRawCaptureHeader(options.replayFile, header))
+		{
+			options.width = header.width;
+			options.height = header.height;
+			if(!options.frameRate && options.replayRate.value_or(header.frameRate) > 0)
+				options.frameRate = options.replayRate.value_or(header.frameRate);
+		}
+	}
+	if(serverThreads > 0)
+		options.serverThreads = static_cast<uint32_t>(serverThreads);
+	options.threadPerClient = threadPerClient;
+	if(transport != nullptr)
+	{
+		if(g_str_equal(transport, "unicast"))
+			options.transport = TransportPolicy::Unicast;
+		else if(g_str_equal(transport, "multicast"))
+			options.transport = TransportPolicy::Multicast;
+		else if(g_str_equal(transport, "multicast-preferred"))
+			options.transport = TransportPolicy::MulticastPreferred;
+		else
+			GST_ERROR("Unknown transport '%s', expected unicast, multicast or multicast-preferred\n", transport);
+	}
+	if(multicastAddresses != nullptr)
+	{
+		char **range = g_strsplit(multicastAddresses, "-", 2);
+
+		if(g_strv_length(range) == 2 && g_hostname_is_ip_address(range[0]) && g_hostname_is_ip_address(range[1]))
+		{
+			options.multicastAddressMin = range[0];
+			options.multicastAddressMax = range[1];
+		}
+		else
+		{
+			GST_ERROR("Invalid multicast addresses '%s', expected MIN-MAX\n", multicastAddresses);
+		}
+		g_strfreev(range);
+	}
+	if(multicastPorts != nullptr)
+	{
+		uint32_t minPort, maxPort;
+
+		if(sscanf(multicastPorts, "%u-%u", &minPort, &maxPort) == 2 && minPort > 0 && minPort < maxPort &&
+			 maxPort <= G_MAXUINT16)
+		{
+			options.multicastPortMin = static_cast<uint16_t>(minPort);
+			options.multicastPortMax = static_cast<uint16_t>(maxPort);
+		}
+		else
+		{
+			GST_ERROR("Invalid multicast ports '%s', expected MIN-MAX\n", multicastPorts);
+		}
+	}
+	if(multicastTtl > 0 && multicastTtl <= 255)
+		options.multicastTtl = static_cast<uint32_t>(multicastTtl);
+	if(debayerThreads >= 0)
+		options.debayerThreads = static_cast<uint32_t>(debayerThreads);
+	if(httpAddress != nullptr)
+		options.httpAddress = httpAddress;
+	if(httpPort >= 0 && httpPort <= G_MAXUINT16)
+		options.httpPort = static_cast<uint16_t>(httpPort);
+	if(cpuAffinity != nullptr)
+	{
+		char **cpus = g_strsplit(cpuAffinity, ",", -1);
+
+		for(char **cpu = cpus; *cpu != nullptr; cpu++)
+			options.cpuAffinity.push_back(static_cast<int32_t>(g_ascii_strtoll(*cpu, nullptr, 10)));
+		g_strfreev(cpus);
+	}
+	if(profiles != nullptr)
+	{
+		for(char **profile = profiles; *profile != nullptr; profile++)
+		{
+			char name[64]{};
+			int32_t profileWidth, profileHeight;
+			int64_t profileBitrate;
+
+			if(sscanf(*profile, "%63[^:]:%dx%d@%" G_GINT64_FORMAT, name, &profileWidth, &profileHeight,
+								 &profileBitrate) != 4 ||
+				 profileWidth <= 0 || profileHeight <= 0 || profileBitrate <= 0)
+			{
+				GST_ERROR("Invalid stream profile '%s', expected name:WIDTHxHEIGHT@BITRATE\n", *profile);
+				continue;
+			}
+			options.profiles.push_back({ name, profileWidth, profileHeight, profileBitrate });
+		}
+		g_strfreev(profiles);
+	}
 
 	return options;
 }
@@ -0,0 +1,116 @@
+#include <algorithm>
+
+#include "BitrateController.hpp"
+#include "Encoder.hpp"
+
+/// Loss fraction above which the rate of a client is cut in proportion to the loss
+static constexpr double LOSS_DECREASE_THRESHOLD{ 0.10 };
+/// Loss fraction below which the rate of a client grows
+static constexpr double LOSS_INCREASE_THRESHOLD{ 0.02 };
+/// Jitter in milliseconds above which rising jitter is taken as a filling queue
+static constexpr double JITTER_LIMIT{ 40 };
+/// Rate kept when the jitter of a client rises above the limit
+static constexpr double JITTER_DECREASE_FACTOR{ 0.85 };
+/// Additive step per clean report, as a fraction of the highest rate
+static constexpr double INCREASE_STEP{ 0.05 };
+
+BitrateController::BitrateController(Encoder encoder, int64_t minBitrate, int64_t maxBitrate):
+	_encoderKind{ encoder },
+	_minBitrate{ std::min(minBitrate, maxBitrate) },
+	_maxBitrate{ maxBitrate },
+	_encoder{},
+	_bitrate{ maxBitrate },
+	_increases{},
+	_decreases{},
+	_fractionLost{},
+	_jitter{}
+{}
+
+BitrateController::~BitrateController()
+{
+	detach();
+}
+
+void BitrateController::attach(GstElement *encoder)
+{
+	std::lock_guard lock{ _mutex };
+
+	if(_encoder != nullptr)
+		gst_object_unref(_encoder);
+	_encoder = GST_ELEMENT(gst_object_ref(encoder));
+	_clients.clear();
+	_bitrate = -1;
+	apply();
+}
+
+void BitrateController::detach()
+{
+	std::lock_guard lock{ _mutex };
+
+	_clients.clear();
+	apply();
+	if(_encoder != nullptr)
+	{
+		gst_object_unref(_encoder);
+		_encoder = nullptr;
+	}
+}
+
+void BitrateController::onReport(guint32 ssrc, double fractionLost, double jitter)
+{
+	std::lock_guard lock{ _mutex };
+	auto &client = _clients.try_emplace(ssrc, Client{ _maxBitrate, jitter }).first->second;
+	auto bitrate = static_cast<double>(client.bitrate);
+
+	if(fractionLost > LOSS_DECREASE_THRESHOLD)
+		bitrate *= 1 - fractionLost / 2;
+	else if(jitter > JITTER_LIMIT && jitter > client.jitter)
+		bitrate *= JITTER_DECREASE_FACTOR;
+	else if(fractionLost < LOSS_INCREASE_THRESHOLD)
+		bitrate += static_cast<double>(_maxBitrate) * INCREASE_STEP;
+
+	client.bitrate = std::clamp(static_cast<int64_t>(bitrate), _minBitrate, _maxBitrate);
+	client.jitter = jitter;
+	_fractionLost = fractionLost;
+	_jitter = jitter;
+	apply();
+}
+
+void BitrateController::removeClient(guint32 ssrc)
+{
+	std::lock_guard lock{ _mutex };
+
+	if(_clients.erase(ssrc) > 0)
+		apply();
+}
+
+BitrateControllerStats BitrateController::stats() const
+{
+	std::lock_guard lock{ _mutex };
+
+	return { _bitrate < 0 ? _maxBitrate : _bitrate, _increases, _decreases, _clients.size(), _fractionLost, _jitter };
+}
+
+void BitrateController::apply()
+{
+	int64_t bitrate = _maxBitrate;
+
+	for(const auto &[ssrc, client] : _clients)
+		bitrate = std::min(bitrate, client.bitrate);
+
+	if(bitrate == _bitrate || _encoder == nullptr)
+		return;
+
+	if(_bitrate >= 0)
+	{
+		if(bitrate > _bitrate)
+			_increases++;
+		else
+			_decreases++;
+		GST_INFO_OBJECT(_encoder, "bitrate %" G_GINT64_FORMAT " -> %" G_GINT64_FORMAT " kbit/s, %zu client(s)",
+										_bitrate, bitrate, _clients.size());
+	}
+	_bitrate = bitrate;
+	g_object_set(G_OBJECT(_encoder), "bitrate", static_cast<guint>(bitrate * encoderInfo(_encoderKind).bitrateScale),
+							 nullptr);
+}
@@ -0,0 +1,195 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "BufferArena.hpp"
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Map anonymous memory starting on a multiple of the alignment.
+ *
+ * More than needed is mapped and the unaligned head and the tail are unmapped again.
+ * */
+static void *mapAligned(size_t size, size_t alignment)
+{
+	void *mapped = mmap(nullptr, size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(mapped == MAP_FAILED)
+		return mapped;
+
+	auto start = reinterpret_cast<uintptr_t>(mapped);
+	auto aligned = roundUp(start, alignment);
+
+	if(aligned > start)
+		munmap(mapped, aligned - start);
+	if(start + alignment > aligned)
+		munmap(reinterpret_cast<void *>(aligned + size), start + alignment - aligned);
+	return reinterpret_cast<void *>(aligned);
+}
+
+static void releaseArena(void *arena)
+{
+	delete static_cast<std::shared_ptr<BufferArena> *>(arena);
+}
+
+std::shared_ptr<BufferArena> BufferArena::create(size_t bufferSize, uint32_t count, bool hugePages)
+{
+	auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	auto slotSize = roundUp(bufferSize, pageSize);
+	auto size = slotSize * count;
+	auto backing = ArenaBacking::Pages;
+	void *data = MAP_FAILED;
+
+	if(size == 0)
+		return nullptr;
+
+	if(hugePages)
+	{
+		auto info = hugePageInfo();
+		auto hugeSize = roundUp(size, info.pageSize);
+
+		// hugetlb pages are reserved when mapped, the mapping fails when the pool is short
+		if(info.free * info.pageSize >= hugeSize)
+		{
+			data = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+									-1, 0);
+			if(data != MAP_FAILED)
+			{
+				size = hugeSize;
+				backing = ArenaBacking::HugeTlb;
+			}
+			else
+			{
+				GST_INFO("failed to map %zu bytes of huge pages: %s", hugeSize, g_strerror(errno));
+			}
+		}
+		else
+		{
+			GST_INFO("%" PRIu64 " of %" PRIu64 " huge pages free, %zu needed for the stream buffers", info.free,
+							 info.total, hugeSize / info.pageSize);
+		}
+
+		if(data == MAP_FAILED && info.transparent)
+		{
+			// aligned to the huge page size, so the whole range can be backed by huge pages
+			data = mapAligned(hugeSize, info.pageSize);
+			if(data != MAP_FAILED)
+			{
+				size = hugeSize;
+				if(madvise(data, size, MADV_HUGEPAGE) == 0)
+					backing = ArenaBacking::TransparentHuge;
+			}
+		}
+	}
+
+	if(data == MAP_FAILED)
+	{
+		data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(data == MAP_FAILED)
+		{
+			GST_ERROR("failed to map %zu bytes of stream buffers: %s", size, g_strerror(errno));
+			return nullptr;
+		}
+	}
+
+	// fault the pages in now rather than on the stream thread
+	if(backing != ArenaBacking::HugeTlb)
+		std::memset(data, 0, size);
+
+	return std::shared_ptr<BufferArena>(
+		new BufferArena(static_cast<uint8_t *>(data), size, bufferSize, slotSize, count, backing));
+}
+
+BufferArena::BufferArena(uint8_t *data, size_t size, size_t bufferSize, size_t slotSize, uint32_t count,
+												 ArenaBacking backing):
+	_data{ data },
+	_size{ size },
+	_bufferSize{ bufferSize },
+	_slotSize{ slotSize },
+	_count{ count },
+	_backing{ backing }
+{}
+
+BufferArena::~BufferArena()
+{
+	munmap(_data, _size);
+}
+
+ArvBuffer *BufferArena::newBuffer(uint32_t index)
+{
+	return arv_buffer_new_full(_bufferSize, _data + index * _slotSize,
+														 new std::shared_ptr<BufferArena>(shared_from_this()), releaseArena);
+}
+
+uint32_t BufferArena::count() const
+{
+	return _count;
+}
+
+size_t BufferArena::size() const
+{
+	return _size;
+}
+
+ArenaBacking BufferArena::backing() const
+{
+	return _backing;
+}
+
+const char *BufferArena::backingName(ArenaBacking backing)
+{
+	switch(backing)
+	{
+		case ArenaBacking::HugeTlb:
+			return "hugetlb";
+		case ArenaBacking::TransparentHuge:
+			return "thp";
+		case ArenaBacking::Pages:
+			return "pages";
+	}
+	return "unknown";
+}
+
+HugePageInfo hugePageInfo()
+{
+	// 2 MiB unless /proc/meminfo tells otherwise
+	HugePageInfo info{ 0, 0, 2 << 20, false };
+	uint64_t reserved{};
+	char *contents{};
+
+	if(g_file_get_contents("/proc/meminfo", &contents, nullptr, nullptr))
+	{
+		char **lines = g_strsplit(contents, "\n", -1);
+
+		for(auto line = lines; *line != nullptr; line++)
+		{
+			uint64_t value;
+
+			if(sscanf(*line, "HugePages_Total: %" SCNu64, &value) == 1)
+				info.total = value;
+			else if(sscanf(*line, "HugePages_Free: %" SCNu64, &value) == 1)
+				info.free = value;
+			else if(sscanf(*line, "HugePages_Rsvd: %" SCNu64, &value) == 1)
+				reserved = value;
+			else if(sscanf(*line, "Hugepagesize: %" SCNu64 " kB", &value) == 1 && value > 0)
+				info.pageSize = value * 1024;
+		}
+		g_strfreev(lines);
+		g_free(contents);
+	}
+	// reserved pages are free but promised to other mappings
+	info.free = info.free > reserved ? info.free - reserved : 0;
+
+	if(g_file_get_contents("/sys/kernel/mm/transparent_hugepage/enabled", &contents, nullptr, nullptr))
+	{
+		info.transparent = strstr(contents, "[never]") == nullptr;
+		g_free(contents);
+	}
+	return info;
+}
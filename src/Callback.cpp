@@ -1,5 +1,64 @@
+#include <cstring>
+
+#include "BitrateController.hpp"
 #include "Callback.hpp"
+#include "CapturePipeline.hpp"
 #include "DeviceHandle.hpp"
+#include "DiskRing.hpp"
+#include "HttpServer.hpp"
+#include "RawCapture.hpp"
+#include "Repack.hpp"
+#include "ServerHandle.hpp"
+#include "SessionRegistry.hpp"
+#include "StreamRelay.hpp"
+
+/// Session registry the receiver reports of an RTP session are passed to
+static constexpr const char *SESSION_REGISTRY_KEY{ "rtspcam-session-registry" };
+/// App source of a media fed by a relay
+static constexpr const char *RELAY_SOURCE_KEY{ "rtspcam-relay-source" };
+/// Stage of the frame path observed by a latency probe
+struct LatencyProbe
+{
+	CaptureMetrics *metrics;
+	LatencyStage stage;
+};
+
+/// Stream of a media whose packets are counted by lower transport
+/// Frames queued in the app source of a relay media before old ones are dropped
+static constexpr guint64 RELAY_SOURCE_MAX_BYTES{ 8 * 1024 * 1024 };
+/// RTP clock rate of the video payloaders, the unit of the RTCP jitter
+static constexpr double RTP_VIDEO_CLOCK_RATE{ 90'000 };
+
+/**
+ * @brief Encoder feeding the payloader of a media.
+ *
+ * @return New reference to the encoder, nullptr for medias fed by a relay.
+ * */
+static GstElement *mediaEncoder(GstRTSPMedia *media)
+{
+	GstElement *element, *payloader, *encoder{};
+
+	element = gst_rtsp_media_get_element(media);
+	payloader = gst_bin_get_by_name(GST_BIN(element), "pay0");
+	if(payloader != nullptr)
+	{
+		encoder = upstreamEncoder(payloader);
+		gst_object_unref(payloader);
+	}
+	gst_object_unref(element);
+	return encoder;
+}
+
+gboolean streamWatchdog(void *data)
+{
+	reinterpret_cast<DeviceHandle *>(data)->checkStream();
+	return G_SOURCE_CONTINUE;
+}
+
+gboolean throttleRaise(void *data)
+{
+	return reinterpret_cast<DeviceHandle *>(data)->raiseFrameRate() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
 
 bool cleanupTimeout(GstRTSPServer *server)
 {
@@ -11,7 +70,19 @@ bool cleanupTimeout(GstRTSPServer *server)
 	return true;
 }
 
-void configureMedia([[maybe_unused]] GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data)
+GstRTSPFilterResult closeClient([[maybe_unused]] GstRTSPServer *server, [[maybe_unused]] GstRTSPClient *client,
+															 [[maybe_unused]] void *data)
+{
+	return GST_RTSP_FILTER_REMOVE;
+}
+
+GstRTSPFilterResult closeSession([[maybe_unused]] GstRTSPSessionPool *pool, [[maybe_unused]] GstRTSPSession *session,
+																[[maybe_unused]] void *data)
+{
+	return GST_RTSP_FILTER_REMOVE;
+}
+
+void configureMedia(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data)
 {
 	GstBin *bin;
 	GstElement *source;
@@ -22,50 +93,268 @@ void configureMedia([[maybe_unused]] GstRTSPMediaFactory *factory, GstRTSPMedia
 	bin = reinterpret_cast<GstBin *>(gst_rtsp_media_get_element(media));
 	// get our appsrc, we named it 'srvsrc' with the name property
 	source = gst_bin_get_by_name_recurse_up(bin, "srvsrc");
-	devHandle->setSource(reinterpret_cast<GstAppSrc *>(source));
-	devHandle->startAcquisition();
+	installLatencyProbes(bin, devHandle->metrics());
+	installBitrateControl(factory, media, mediaEncoder(media));
+	// the previous media of the camera may be stopping on another thread of the pool
+	devHandle->startAcquisition(reinterpret_cast<GstAppSrc *>(source));
 	g_signal_connect(media, "new-state", reinterpret_cast<GCallback>(mediaStateChanged), devHandle);
 	gst_object_unref(bin);
 }
 
-void mediaConstructed([[maybe_unused]] GstRTSPMediaFactory *factory, GstRTSPMedia *media, [[maybe_unused]] void *data)
+void configureProfileMedia(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data)
+{
+	auto capture = reinterpret_cast<CapturePipeline *>(data);
+
+	gst_rtsp_media_set_shared(media, true);
+	installBitrateControl(factory, media, mediaEncoder(media));
+	capture->acquire();
+	g_signal_connect(media, "unprepared", reinterpret_cast<GCallback>(profileMediaUnprepared), capture);
+}
+
+void profileMediaUnprepared([[maybe_unused]] GstRTSPMedia *media, void *data)
+{
+	reinterpret_cast<CapturePipeline *>(data)->release();
+}
+
+void configureRelayMedia(GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data)
+{
+	auto relay = reinterpret_cast<StreamRelay *>(data);
+	GstBin *bin;
+	GstElement *source;
+	GstCaps *caps;
+
+	gst_rtsp_media_set_shared(media, true);
+	bin = reinterpret_cast<GstBin *>(gst_rtsp_media_get_element(media));
+	source = gst_bin_get_by_name_recurse_up(bin, "relaysrc");
+	if(source == nullptr)
+	{
+		gst_object_unref(bin);
+		return;
+	}
+	// the relay traces the frames by their PTS in the media for the payloader
+	installLatencyProbes(bin, relay->metrics());
+	gst_object_unref(bin);
+
+	// the caps are known once the encoder produced its first frame
+	if((caps = relay->caps()) == nullptr)
+	{
+		caps = gst_caps_new_simple(relay->mediaType().c_str(), "stream-format", G_TYPE_STRING, "byte-stream",
+															 "alignment", G_TYPE_STRING, "au", nullptr);
+	}
+	// the relay stamps the frames, the app source only stamps those it could not
+	g_object_set(G_OBJECT(source), "caps", caps, "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp", TRUE,
+							 "max-bytes", RELAY_SOURCE_MAX_BYTES, "block", FALSE, nullptr);
+#if GST_CHECK_VERSION(1, 20, 0)
+	g_object_set(G_OBJECT(source), "leaky-type", GST_APP_LEAKY_TYPE_DOWNSTREAM, nullptr);
+#endif
+	gst_caps_unref(caps);
+
+	g_object_set_data_full(G_OBJECT(media), RELAY_SOURCE_KEY, source, gst_object_unref);
+	// the encoder lives in the capture pipeline and outlives the media
+	installBitrateControl(factory, media, relay->encoder());
+	g_signal_connect(media, "prepared", reinterpret_cast<GCallback>(relayMediaPrepared), relay);
+	g_signal_connect(media, "unprepared", reinterpret_cast<GCallback>(relayMediaUnprepared), relay);
+}
+
+void relayMediaPrepared(GstRTSPMedia *media, void *data)
+{
+	auto source = static_cast<GstAppSrc *>(g_object_get_data(G_OBJECT(media), RELAY_SOURCE_KEY));
+
+	if(source != nullptr)
+		reinterpret_cast<StreamRelay *>(data)->attach(source);
+}
+
+void relayMediaUnprepared(GstRTSPMedia *media, void *data)
+{
+	auto source = static_cast<GstAppSrc *>(g_object_get_data(G_OBJECT(media), RELAY_SOURCE_KEY));
+
+	if(source != nullptr)
+		reinterpret_cast<StreamRelay *>(data)->detach(source);
+}
+
+void installBitrateControl(GstRTSPMediaFactory *factory, GstRTSPMedia *media, GstElement *encoder)
+{
+	auto controller = static_cast<BitrateController *>(g_object_get_data(G_OBJECT(factory), BITRATE_CONTROLLER_KEY));
+
+	if(controller == nullptr)
+	{
+		if(encoder != nullptr)
+			gst_object_unref(encoder);
+		return;
+	}
+	if(encoder == nullptr)
+	{
+		GST_WARNING_OBJECT(media, "no encoder found, the bitrate is not adapted");
+		return;
+	}
+
+	controller->attach(encoder);
+	gst_object_unref(encoder);
+	g_signal_connect(media, "prepared", reinterpret_cast<GCallback>(bitrateMediaPrepared), controller);
+	g_signal_connect(media, "unprepared", reinterpret_cast<GCallback>(bitrateMediaUnprepared), controller);
+}
+
+void bitrateMediaPrepared(GstRTSPMedia *media, void *data)
+{
+	uint32_t i, numStreams;
+
+	// the RTP sessions exist once the streams joined the bin of the media
+	numStreams = gst_rtsp_media_n_streams(media);
+	for(i = 0; i < numStreams; i++)
+	{
+		GObject *session = gst_rtsp_stream_get_rtpsession(gst_rtsp_media_get_stream(media, i));
+
+		if(session == nullptr)
+			continue;
+		g_signal_connect(session, "on-ssrc-active", reinterpret_cast<GCallback>(rtcpSourceActive), data);
+		g_signal_connect(session, "on-bye-ssrc", reinterpret_cast<GCallback>(rtcpSourceGone), data);
+		g_signal_connect(session, "on-timeout", reinterpret_cast<GCallback>(rtcpSourceGone), data);
+		g_object_unref(session);
+	}
+}
+
+void bitrateMediaUnprepared(GstRTSPMedia *media, void *data)
+{
+	uint32_t i, numStreams;
+
+	numStreams = gst_rtsp_media_n_streams(media);
+	for(i = 0; i < numStreams; i++)
+	{
+		GObject *session = gst_rtsp_stream_get_rtpsession(gst_rtsp_media_get_stream(media, i));
+
+		if(session == nullptr)
+			continue;
+		g_signal_handlers_disconnect_by_data(session, data);
+		g_object_unref(session);
+	}
+	reinterpret_cast<BitrateController *>(data)->detach();
+}
+
+void rtcpSourceActive([[maybe_unused]] GObject *session, GObject *source, void *data)
+{
+	GstStructure *stats{};
+	gboolean internal{}, haveReport{};
+	guint ssrc, fractionLost, jitter;
+
+	g_object_get(source, "stats", &stats, nullptr);
+	if(stats == nullptr)
+		return;
+
+	// remote sources carry the last report block they sent about our stream
+	gst_structure_get_boolean(stats, "internal", &internal);
+	gst_structure_get_boolean(stats, "have-rb", &haveReport);
+	if(!internal && haveReport && gst_structure_get_uint(stats, "ssrc", &ssrc) &&
+		 gst_structure_get_uint(stats, "rb-fractionlost", &fractionLost) &&
+		 gst_structure_get_uint(stats, "rb-jitter", &jitter))
+	{
+		reinterpret_cast<BitrateController *>(data)->onReport(ssrc, fractionLost / 256.0,
+																													jitter * 1000.0 / RTP_VIDEO_CLOCK_RATE);
+	}
+	gst_structure_free(stats);
+}
+
+void rtcpSourceGone([[maybe_unused]] GObject *session, GObject *source, void *data)
+{
+	guint ssrc{};
+
+	g_object_get(source, "ssrc", &ssrc, nullptr);
+	reinterpret_cast<BitrateController *>(data)->removeClient(ssrc);
+}
+
+GstFlowReturn relayNewSample(GstAppSink *sink, void *data)
+{
+	GstSample *sample;
+	GstFlowReturn ret;
+
+	if((sample = gst_app_sink_pull_sample(sink)) == nullptr)
+		return GST_FLOW_EOS;
+
+	ret = reinterpret_cast<StreamRelay *>(data)->onSample(sample);
+	gst_sample_unref(sample);
+	return ret;
+}
+
+GstFlowReturn recordingNewSample(GstAppSink *sink, void *data)
+{
+	GstSample *sample;
+	GstBuffer *buffer;
+	GstMapInfo map;
+
+	if((sample = gst_app_sink_pull_sample(sink)) == nullptr)
+		return GST_FLOW_EOS;
+
+	buffer = gst_sample_get_buffer(sample);
+	if(buffer != nullptr && gst_buffer_map(buffer, &map, GST_MAP_READ))
+	{
+		// the muxer flags the packets of a keyframe and the tables before it as non-delta
+		reinterpret_cast<DiskRing *>(data)->write(map.data, map.size,
+																							!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT));
+		gst_buffer_unmap(buffer, &map);
+	}
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+void configureTransportCounters([[maybe_unused]] GstRTSPMediaFactory *factory, GstRTSPMedia *media, void *data)
 {
+	auto metrics = reinterpret_cast<TransportMetrics *>(data);
 	uint32_t i, numStreams;
 
 	numStreams = gst_rtsp_media_n_streams(media);
 
 	for(i = 0; i < numStreams; i++)
 	{
-		GstRTSPAddressPool *pool;
 		GstRTSPStream *stream;
-		char *min, *max;
+		GstPad *pad;
 
 		stream = gst_rtsp_media_get_stream(media, i);
-
-		if(stream == nullptr)
+		if(stream == nullptr || (pad = gst_rtsp_stream_get_srcpad(stream)) == nullptr)
 			continue;
 
-		// make a new address pool
-		pool = gst_rtsp_address_pool_new();
+		// the packets leave the payloader once, the clients counted by the sessions multiply them
+		gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+											reinterpret_cast<GstPadProbeCallback>(transportProbe), metrics, nullptr);
+		gst_object_unref(pad);
+	}
+}
 
-		min = g_strdup_printf("224.3.0.%d", (2 * i) + 1);
-		max = g_strdup_printf("224.3.0.%d", (2 * i) + 2);
-		gst_rtsp_address_pool_add_range(pool, min, max, 5000 + (10 * i), 5010 + (10 * i), 1);
-		g_free(min);
-		g_free(max);
+GstPadProbeReturn transportProbe([[maybe_unused]] GstPad *pad, GstPadProbeInfo *info, void *data)
+{
+	uint64_t packets, bytes{};
 
-		gst_rtsp_stream_set_address_pool(stream, pool);
-		g_object_unref(pool);
+	if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+	{
+		GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+
+		packets = gst_buffer_list_length(list);
+		for(guint i = 0; i < packets; i++)
+			bytes += gst_buffer_get_size(gst_buffer_list_get(list, i));
+	}
+	else
+	{
+		packets = 1;
+		bytes = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
 	}
+
+	reinterpret_cast<TransportMetrics *>(data)->count(packets, bytes);
+	return GST_PAD_PROBE_OK;
 }
 
-void mediaStateChanged([[maybe_unused]] GstRTSPMedia *media, GstState state, [[maybe_unused]] void *data)
+void mediaStateChanged(GstRTSPMedia *media, GstState state, void *data)
 {
 	auto devHandle = reinterpret_cast<DeviceHandle *>(data);
+	GstElement *bin, *source;
+
 	switch(state)
 	{
 		case GST_STATE_NULL:
-			devHandle->stopAcquisition();
+			// a media stopping late must not stop the acquisition of the one configured after it
+			bin = gst_rtsp_media_get_element(media);
+			source = gst_bin_get_by_name_recurse_up(GST_BIN(bin), "srvsrc");
+			devHandle->stopAcquisition(reinterpret_cast<GstAppSrc *>(source));
+			if(source != nullptr)
+				gst_object_unref(source);
+			gst_object_unref(bin);
 			break;
 		default:
 			break;
@@ -74,70 +363,279 @@ void mediaStateChanged([[maybe_unused]] GstRTSPMedia *media, GstState state, [[m
 
 void clientConnected([[maybe_unused]] GstRTSPServer *server, GstRTSPClient *client, void *data)
 {
-	auto _devHandle = reinterpret_cast<DeviceHandle *>(data);
-	g_message("client connected (current: %d)\n", _devHandle->incrNumClient());
+	g_message("client connected\n");
+	// the camera a client watches is only known once it sets up a stream
+	g_signal_connect(client, "setup-request", reinterpret_cast<GCallback>(clientSetup), data);
 	// hook the client close callback
-	g_signal_connect(client, "closed", reinterpret_cast<GCallback>(clientClosed), _devHandle);
+	g_signal_connect(client, "closed", reinterpret_cast<GCallback>(clientClosed), data);
+}
+
+void clientSetup(GstRTSPClient *client, GstRTSPContext *ctx, void *data)
+{
+	auto serverHandle = reinterpret_cast<ServerHandle *>(data);
+	DeviceHandle *devHandle;
+	GObject *rtpSession;
+
+	if(ctx->uri == nullptr || ctx->trans == nullptr ||
+		 (devHandle = serverHandle->deviceForPath(ctx->uri->abspath)) == nullptr)
+		return;
+
+	serverHandle->sessions()->add(client, ctx->trans, devHandle, serverHandle->transportsForPath(ctx->uri->abspath),
+																ctx->uri->abspath);
+
+	// the receiver reports of all clients of a stream arrive on its RTP session
+	if(ctx->stream != nullptr && (rtpSession = gst_rtsp_stream_get_rtpsession(ctx->stream)) != nullptr)
+	{
+		if(g_object_get_data(rtpSession, SESSION_REGISTRY_KEY) == nullptr)
+		{
+			g_object_set_data(rtpSession, SESSION_REGISTRY_KEY, serverHandle->sessions());
+			g_signal_connect(rtpSession, "on-ssrc-active", reinterpret_cast<GCallback>(sessionReport),
+											 serverHandle->sessions());
+		}
+		g_object_unref(rtpSession);
+	}
 }
 
 void clientClosed([[maybe_unused]] GstRTSPClient *client, [[maybe_unused]] void *data)
 {
-	auto _devHandle = reinterpret_cast<DeviceHandle *>(data);
-	g_message("client disconnected (current: %d)\n", _devHandle->decrNumClient());
+	// its sessions end with their transports, which may outlive the connection until they time out
+	g_message("client disconnected\n");
+}
+
+void sessionReport([[maybe_unused]] GObject *session, GObject *source, void *data)
+{
+	GstStructure *stats{};
+	gboolean internal{}, haveReport{};
+	guint fractionLost, jitter;
+	const char *rtcpFrom;
+
+	g_object_get(source, "stats", &stats, nullptr);
+	if(stats == nullptr)
+		return;
+
+	gst_structure_get_boolean(stats, "internal", &internal);
+	gst_structure_get_boolean(stats, "have-rb", &haveReport);
+	if(!internal && haveReport && (rtcpFrom = gst_structure_get_string(stats, "rtcp-from")) != nullptr &&
+		 gst_structure_get_uint(stats, "rb-fractionlost", &fractionLost) &&
+		 gst_structure_get_uint(stats, "rb-jitter", &jitter))
+	{
+		reinterpret_cast<SessionRegistry *>(data)->report(rtcpFrom, fractionLost / 256.0,
+																											jitter * 1000.0 / RTP_VIDEO_CLOCK_RATE);
+	}
+	gst_structure_free(stats);
 }
 
-GstBuffer *toGstBuffer(ArvBuffer *arvBuffer, guint partId, ArvStream *stream)
+FrameView arvFrameView(ArvBuffer *arvBuffer, guint partId, size_t rowStride)
 {
-	auto releaseData = new ArvGstBufferReleaseData();
-	int32_t arvRowStride;
-	int32_t width, height;
-	uint8_t *data;
-	size_t size;
-	uint8_t *bufferData;
-	size_t bufferSize;
+	FrameView frame{};
+
+	frame.data = static_cast<const uint8_t *>(arv_buffer_get_part_data(arvBuffer, partId, &frame.size));
+	arv_buffer_get_part_region(arvBuffer, partId, nullptr, nullptr, &frame.width, &frame.height);
+	frame.pixelFormat = arv_buffer_get_part_pixel_format(arvBuffer, partId);
+	frame.rowStride = rowStride;
+	frame.deviceTime = arv_buffer_get_timestamp(arvBuffer);
+	frame.systemTime = arv_buffer_get_system_timestamp(arvBuffer);
+	frame.frameId = arv_buffer_get_frame_id(arvBuffer);
+	return frame;
+}
+
+GstBuffer *toGstBuffer(const FrameView &frame, FramePool *pool, const GstVideoInfo *videoMetaInfo,
+											 FrameRelease release)
+{
+	GstBuffer *buffer;
+	PackedLayout layout;
+	size_t rowSize, frameRowStride, gstRowStride;
+	int32_t width = frame.width, height = frame.height;
+
+	layout = packedLayout(frame.pixelFormat);
+	rowSize = packedRowStride(width, ARV_PIXEL_FORMAT_BIT_PER_PIXEL(frame.pixelFormat));
+	// a camera padding its rows delivers them at the stride GStreamer expects
+	frameRowStride = frame.rowStride != 0 ? frame.rowStride : rowSize;
+
+	// packed 10/12-bit pixels are unpacked to 16-bit in the same pass,
+	// otherwise Gstreamer requires row stride to be a multiple of 4
+	if(layout != PackedLayout::None)
+		gstRowStride = alignedRowStride(width * sizeof(uint16_t));
+	else
+		gstRowStride = alignedRowStride(rowSize);
+
+	// downstream reads the frame stride from the video meta, no copy needed
+	if(layout == PackedLayout::None && gstRowStride != frameRowStride && videoMetaInfo != nullptr)
+		gstRowStride = frameRowStride;
+
+	if(layout != PackedLayout::None || gstRowStride != frameRowStride)
+	{
+		GstMapInfo map;
+
+		buffer = pool->acquireBuffer(height * gstRowStride);
+
+		if(!gst_buffer_map(buffer, &map, GST_MAP_WRITE))
+		{
+			GST_WARNING("failed to map frame buffer");
+			gst_buffer_unref(buffer);
+			release.notify(release.data);
+			return nullptr;
+		}
+
+		if(layout != PackedLayout::None)
+			unpackRows(frame.data, frameRowStride, map.data, gstRowStride, width, height, layout);
+		else
+			repackRows(frame.data, frameRowStride, map.data, gstRowStride, rowSize, height);
+
+		gst_buffer_unmap(buffer, &map);
+		// the frame is copied, its memory can be refilled right away
+		release.notify(release.data);
+
+		return buffer;
+	}
+
+	buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, const_cast<uint8_t *>(frame.data), frame.size, 0,
+																			 frame.size, release.data, release.notify);
+
+	if(videoMetaInfo != nullptr)
+	{
+		gsize offset[GST_VIDEO_MAX_PLANES]{};
+		gint stride[GST_VIDEO_MAX_PLANES]{ static_cast<gint>(frameRowStride) };
+
+		gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_INFO_FORMAT(videoMetaInfo), width,
+																	 height, 1, offset, stride);
+	}
+
+	return buffer;
+}
 
-	bufferData = (uint8_t *)arv_buffer_get_part_data(arvBuffer, partId, &bufferSize);
-	arv_buffer_get_part_region(arvBuffer, partId, nullptr, nullptr, &width, &height);
-	arvRowStride = static_cast<int>(
-			(width * ARV_PIXEL_FORMAT_BIT_PER_PIXEL(arv_buffer_get_part_pixel_format(arvBuffer, partId)) / 8));
+FrameRelease arvFrameRelease(ArvBuffer *arvBuffer, ArvStream *stream, FramePool *pool)
+{
+	ArvGstBufferReleaseData *releaseData = pool->acquireReleaseData();
 
 	g_weak_ref_init(&releaseData->stream, stream);
 	releaseData->arvBuffer = arvBuffer;
+	return { releaseData, reinterpret_cast<GDestroyNotify>(gstBufferReleaseCallback) };
+}
+
+GstPadProbeReturn sourceAllocationQuery([[maybe_unused]] GstPad *pad, GstPadProbeInfo *info, void *data)
+{
+	auto devHandle = reinterpret_cast<DeviceHandle *>(data);
+	GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+
+	if(GST_QUERY_TYPE(query) == GST_QUERY_ALLOCATION)
+		devHandle->setVideoMetaSupported(gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE, nullptr));
+
+	return GST_PAD_PROBE_OK;
+}
+
+void sourceNeedData([[maybe_unused]] GstAppSrc *source, [[maybe_unused]] guint length, void *data)
+{
+	reinterpret_cast<DeviceHandle *>(data)->onNeedData();
+}
+
+void sourceEnoughData([[maybe_unused]] GstAppSrc *source, void *data)
+{
+	reinterpret_cast<DeviceHandle *>(data)->onEnoughData();
+}
 
-	// Gstreamer requires row stride to be a multiple of 4
-	if((arvRowStride & 0x3) != 0)
+static void addLatencyProbe(GstElement *element, CaptureMetrics *metrics, LatencyStage stage)
+{
+	GstPad *pad = gst_element_get_static_pad(element, "src");
+
+	if(pad == nullptr)
+		return;
+	gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+										reinterpret_cast<GstPadProbeCallback>(latencyProbe), new LatencyProbe{ metrics, stage },
+										[](void *probe) { delete static_cast<LatencyProbe *>(probe); });
+	gst_object_unref(pad);
+}
+
+void installLatencyProbes(GstBin *bin, CaptureMetrics *metrics)
+{
+	GstIterator *iterator;
+	GValue item = G_VALUE_INIT;
+
+	iterator = gst_bin_iterate_recurse(bin);
+	while(gst_iterator_next(iterator, &item) == GST_ITERATOR_OK)
 	{
-		int gstRowStride;
-		int i;
+		auto element = GST_ELEMENT(g_value_get_object(&item));
+		auto name = GST_OBJECT_NAME(element);
+		auto klass = gst_element_get_metadata(element, GST_ELEMENT_METADATA_KLASS);
+
+		if(g_strcmp0(name, "srvsrc") == 0)
+			addLatencyProbe(element, metrics, LatencyStage::Source);
+		else if(g_strcmp0(name, "pay0") == 0)
+			addLatencyProbe(element, metrics, LatencyStage::Payloader);
+		else if(klass != nullptr && strstr(klass, "Encoder") != nullptr)
+			addLatencyProbe(element, metrics, LatencyStage::Encoder);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(iterator);
+}
 
-		gstRowStride = (arvRowStride & ~(0x3)) + 4;
+GstPadProbeReturn latencyProbe([[maybe_unused]] GstPad *pad, GstPadProbeInfo *info, void *data)
+{
+	auto probe = static_cast<LatencyProbe *>(data);
+	GstBuffer *buffer;
 
-		size = height * gstRowStride;
-		data = new uint8_t[size];
+	if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+	{
+		GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+		buffer = gst_buffer_list_length(list) > 0 ? gst_buffer_list_get(list, 0) : nullptr;
+	}
+	else
+	{
+		buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	}
 
-		for(i = 0; i < height; i++)
-		{
-			memcpy(data + i * gstRowStride, bufferData + i * arvRowStride, arvRowStride);
-		}
+	if(buffer == nullptr)
+		return GST_PAD_PROBE_OK;
+
+	if(probe->stage == LatencyStage::Source)
+	{
+		// frames are followed by their PTS past the app source, it is final here
+		guint64 captureTime = CaptureMetrics::captureTime(buffer);
 
-		releaseData->data = data;
+		probe->metrics->observe(LatencyStage::Source, captureTime);
+		probe->metrics->trace(GST_BUFFER_PTS(buffer), captureTime);
 	}
 	else
 	{
-		data = bufferData;
-		size = bufferSize;
+		probe->metrics->observeTraced(probe->stage, GST_BUFFER_PTS(buffer));
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn encodedFrameProbe([[maybe_unused]] GstPad *pad, [[maybe_unused]] GstPadProbeInfo *info, void *data)
+{
+	auto count = static_cast<EncodedFrameCount *>(data);
+	gint64 now = g_get_monotonic_time();
+
+	if(count->warmup > 0)
+	{
+		count->warmup--;
+		return GST_PAD_PROBE_OK;
 	}
 
-	return gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, data, size, 0, size, releaseData,
-																		 reinterpret_cast<GDestroyNotify>(gstBufferReleaseCallback));
+	if(count->frames++ == 0)
+		count->first = now;
+	count->last = now;
+	return GST_PAD_PROBE_OK;
+}
+
+gboolean httpRun([[maybe_unused]] GThreadedSocketService *service, GSocketConnection *connection,
+								 [[maybe_unused]] GObject *sourceObject, void *data)
+{
+	reinterpret_cast<HttpServer *>(data)->onConnection(connection);
+	return TRUE;
+}
+
+void httpServiceFinalized(void *data, [[maybe_unused]] GObject *service)
+{
+	reinterpret_cast<HttpServer *>(data)->onServiceFinalized();
 }
 
 void gstBufferReleaseCallback(ArvGstBufferReleaseData *releaseData)
 {
 	auto *stream = static_cast<ArvStream *>(g_weak_ref_get(&releaseData->stream));
 
-	delete[] releaseData->data;
-
 	if(ARV_IS_STREAM(stream))
 	{
 		int32_t nInputBuffers, nOutputBuffers, nBufferFilling;
@@ -153,23 +651,23 @@ void gstBufferReleaseCallback(ArvGstBufferReleaseData *releaseData)
 	}
 
 	g_weak_ref_clear(&releaseData->stream);
-	delete releaseData;
+	FramePool::recycleReleaseData(releaseData);
 }
 
-void cameraStream([[maybe_unused]] void *data, ArvStreamCallbackType type, [[maybe_unused]] ArvBuffer *buffer)
+void cameraStream(void *data, ArvStreamCallbackType type, [[maybe_unused]] ArvBuffer *buffer)
 {
 	if(type == ARV_STREAM_CALLBACK_TYPE_INIT)
 	{
-		if(!arv_make_thread_realtime(10) && !arv_make_thread_high_priority(-10))
-		{
-			GST_WARNING("failed to make stream thread high priority");
-		}
+		reinterpret_cast<DeviceHandle *>(data)->onStreamThreadStarted();
 	}
 }
 
-void newBuffer(ArvStream *stream, GstAppSrc *source)
+void newBuffer(ArvStream *stream, DeviceHandle *devHandle)
 {
 	int32_t nInputBuffers, nOutputBuffers, nBufferFilling;
+	ArvBufferStatus status;
+	bool hasBuffers;
+	CaptureMetrics *metrics = devHandle->metrics();
 	ArvBuffer *arvBuffer = arv_stream_pop_buffer(stream);
 	if(arvBuffer == nullptr)
 	{
@@ -177,18 +675,32 @@ void newBuffer(ArvStream *stream, GstAppSrc *source)
 		return;
 	}
 
+	devHandle->beginFrame();
+	status = arv_buffer_get_status(arvBuffer);
+	metrics->countStatus(status);
+	if(status != ARV_BUFFER_STATUS_SUCCESS)
+		GST_DEBUG("camera %s: frame %s", devHandle->serial().c_str(), CaptureMetrics::statusName(status));
 	arv_stream_get_n_owned_buffers(stream, &nInputBuffers, &nOutputBuffers, &nBufferFilling);
+	hasBuffers = nInputBuffers + nOutputBuffers + nBufferFilling > 0;
+	if(status == ARV_BUFFER_STATUS_SUCCESS && !hasBuffers)
+		metrics->countBacklogDrop();
 
-	if(arv_buffer_get_status(arvBuffer) == ARV_BUFFER_STATUS_SUCCESS &&
-		 nInputBuffers + nOutputBuffers + nBufferFilling > 0)
+	if(status == ARV_BUFFER_STATUS_SUCCESS && hasBuffers)
 	{
-		size_t size;
+		FrameView frame = arvFrameView(arvBuffer, 0, devHandle->rowStride());
+
+		// the recording takes every frame the camera delivers, also the ones dropped by the flow control
+		if(auto recorder = devHandle->rawRecorder(); recorder != nullptr)
+			recorder->record(frame);
 
-		arv_buffer_get_part_data(arvBuffer, 0, &size);
-		gst_app_src_push_buffer(source, toGstBuffer(arvBuffer, 0, stream));
+		if(devHandle->acceptFrame())
+			devHandle->pushFrame(frame, arvFrameRelease(arvBuffer, stream, devHandle->framePool()));
+		else
+			arv_stream_push_buffer(stream, arvBuffer);
 	}
 	else
 	{
 		arv_stream_push_buffer(stream, arvBuffer);
 	}
+	devHandle->endFrame();
 }
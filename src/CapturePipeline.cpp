@@ -0,0 +1,130 @@
+#include "CapturePipeline.hpp"
+#include "Callback.hpp"
+
+CapturePipeline::CapturePipeline(DeviceHandle *device, std::string launchString,
+																 const std::vector<std::string> &relaySinks, const std::string &relayMediaType):
+	_device{ device },
+	_launchString{ std::move(launchString) },
+	_relaySinks{ relaySinks },
+	_recording{},
+	_pipeline{},
+	_numUsers{}
+{
+	for(size_t i = 0; i < _relaySinks.size(); i++)
+		_relays.push_back(std::make_unique<StreamRelay>(_device->metrics(), relayMediaType));
+}
+
+CapturePipeline::~CapturePipeline()
+{
+	stop();
+}
+
+void CapturePipeline::acquire()
+{
+	std::lock_guard lock{ _mutex };
+
+	if(_numUsers++ == 0)
+		start();
+}
+
+void CapturePipeline::release()
+{
+	std::lock_guard lock{ _mutex };
+
+	if(_numUsers == 0)
+		return;
+	if(--_numUsers == 0)
+		stop();
+}
+
+StreamRelay *CapturePipeline::relay(size_t index) const
+{
+	return index < _relays.size() ? _relays[index].get() : nullptr;
+}
+
+void CapturePipeline::setRecording(std::string sinkName, DiskRing *recording)
+{
+	std::lock_guard lock{ _mutex };
+
+	_recordingSink = std::move(sinkName);
+	_recording = recording;
+}
+
+std::string CapturePipeline::channelName(const std::string &serial, const std::string &profile)
+{
+	return "rtspcam-" + serial + "-" + profile;
+}
+
+void CapturePipeline::start()
+{
+	GError *error{};
+	GstElement *source;
+
+	_pipeline = gst_parse_launch(_launchString.c_str(), &error);
+	if(_pipeline == nullptr)
+	{
+		GST_ERROR("failed to create capture pipeline: %s", error != nullptr ? error->message : "unknown error");
+		g_clear_error(&error);
+		return;
+	}
+	g_clear_error(&error);
+
+	source = gst_bin_get_by_name(GST_BIN(_pipeline), "srvsrc");
+	_device->setSource(reinterpret_cast<GstAppSrc *>(source));
+	installLatencyProbes(GST_BIN(_pipeline), _device->metrics());
+
+	for(size_t i = 0; i < _relaySinks.size(); i++)
+	{
+		auto sink = gst_bin_get_by_name(GST_BIN(_pipeline), _relaySinks[i].c_str());
+
+		if(sink == nullptr)
+		{
+			GST_WARNING("relay sink %s missing in capture pipeline", _relaySinks[i].c_str());
+			continue;
+		}
+		_relays[i]->setSink(reinterpret_cast<GstAppSink *>(sink));
+	}
+
+	if(_recording != nullptr)
+	{
+		auto sink = gst_bin_get_by_name(GST_BIN(_pipeline), _recordingSink.c_str());
+
+		if(sink != nullptr)
+		{
+			g_signal_connect(sink, "new-sample", reinterpret_cast<GCallback>(recordingNewSample), _recording);
+			gst_object_unref(sink);
+		}
+		else
+		{
+			GST_WARNING("recording sink %s missing in capture pipeline", _recordingSink.c_str());
+		}
+	}
+
+	if(gst_element_set_state(_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+	{
+		GST_ERROR("failed to start capture pipeline of camera %s", _device->serial().c_str());
+		stop();
+		return;
+	}
+
+	_device->startAcquisition();
+	GST_INFO("capture pipeline of camera %s started", _device->serial().c_str());
+}
+
+void CapturePipeline::stop()
+{
+	if(_pipeline == nullptr)
+		return;
+
+	_device->stopAcquisition();
+	gst_element_set_state(_pipeline, GST_STATE_NULL);
+	// the streaming threads are stopped, no sample reaches the relays anymore
+	for(auto &relay : _relays)
+		relay->clearSink();
+	// the muxer starts over with the pipeline, so does the segment
+	if(_recording != nullptr)
+		_recording->finishSegment();
+	gst_object_unref(_pipeline);
+	_pipeline = nullptr;
+	GST_INFO("capture pipeline of camera %s stopped", _device->serial().c_str());
+}
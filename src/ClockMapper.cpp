@@ -0,0 +1,46 @@
+#include "ClockMapper.hpp"
+
+ClockMapper::ClockMapper(double smoothing):
+	_smoothing{ smoothing },
+	_initialized{},
+	_offset{},
+	_last{ GST_CLOCK_TIME_NONE }
+{}
+
+void ClockMapper::reset()
+{
+	_initialized = false;
+	_offset = 0;
+	_last = GST_CLOCK_TIME_NONE;
+}
+
+GstClockTime ClockMapper::map(guint64 sourceTime, GstClockTime clockTime)
+{
+	auto observed = static_cast<double>(static_cast<gint64>(clockTime) - static_cast<gint64>(sourceTime));
+	gint64 mapped;
+
+	if(!_initialized || observed < _offset)
+	{
+		_offset = observed;
+		_initialized = true;
+	}
+	else
+	{
+		_offset += (observed - _offset) * _smoothing;
+	}
+
+	mapped = static_cast<gint64>(sourceTime) + static_cast<gint64>(_offset);
+	if(mapped < 0)
+		mapped = 0;
+
+	if(GST_CLOCK_TIME_IS_VALID(_last) && static_cast<GstClockTime>(mapped) <= _last)
+		mapped = static_cast<gint64>(_last + 1);
+
+	_last = static_cast<GstClockTime>(mapped);
+	return _last;
+}
+
+gint64 ClockMapper::offset() const
+{
+	return static_cast<gint64>(_offset);
+}
@@ -0,0 +1,310 @@
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "Debayer.hpp"
+
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+/// The loops are written to be vectorized, the AVX2 clone processes twice as many pixels
+#define DEBAYER_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+
+#ifndef DEBAYER_TARGET_CLONES
+#define DEBAYER_TARGET_CLONES
+#endif
+
+#define DEBAYER_INLINE inline __attribute__((always_inline))
+
+/// Columns repeated left and right of a row for the 5x5 neighbourhood
+static constexpr int32_t PAD{ 2 };
+/// Rows of the window, the neighbourhood of a row pair
+static constexpr int32_t WINDOW_ROWS{ 6 };
+
+enum class Site
+{
+	R,
+	/// Green in a row with red
+	Gr,
+	/// Green in a row with blue
+	Gb,
+	B
+};
+
+struct Rgb
+{
+	int32_t r;
+	int32_t g;
+	int32_t b;
+};
+
+static constexpr Site siteAt(BayerOrder order, int32_t dx, int32_t dy)
+{
+	constexpr Site sites[4][4]{
+		{ Site::R, Site::Gr, Site::Gb, Site::B },
+		{ Site::B, Site::Gb, Site::Gr, Site::R },
+		{ Site::Gr, Site::R, Site::B, Site::Gb },
+		{ Site::Gb, Site::B, Site::R, Site::Gr },
+	};
+	return sites[static_cast<int32_t>(order)][dy * 2 + dx];
+}
+
+static DEBAYER_INLINE int32_t clampByte(int32_t value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/**
+ * @brief Colour of a pixel.
+ *
+ * @param rows Rows two above to two below the pixel.
+ * */
+template<Site site, DebayerMethod method>
+static DEBAYER_INLINE Rgb interpolate(const uint8_t *__restrict const *rows, int32_t x)
+{
+	const uint8_t *__restrict n2 = rows[0], *__restrict n1 = rows[1], *__restrict c = rows[2];
+	const uint8_t *__restrict s1 = rows[3], *__restrict s2 = rows[4];
+	int32_t center = c[x];
+	int32_t cross = n1[x] + s1[x] + c[x - 1] + c[x + 1];
+	int32_t diagonal = n1[x - 1] + n1[x + 1] + s1[x - 1] + s1[x + 1];
+	int32_t horizontal = c[x - 1] + c[x + 1];
+	int32_t vertical = n1[x] + s1[x];
+
+	if constexpr(method == DebayerMethod::Bilinear)
+	{
+		if constexpr(site == Site::R)
+			return { center, (cross + 2) >> 2, (diagonal + 2) >> 2 };
+		else if constexpr(site == Site::B)
+			return { (diagonal + 2) >> 2, (cross + 2) >> 2, center };
+		else if constexpr(site == Site::Gr)
+			return { (horizontal + 1) >> 1, center, (vertical + 1) >> 1 };
+		else
+			return { (vertical + 1) >> 1, center, (horizontal + 1) >> 1 };
+	}
+	else
+	{
+		// Malvar-He-Cutler kernels scaled by 16
+		int32_t horizontal2 = c[x - 2] + c[x + 2];
+		int32_t vertical2 = n2[x] + s2[x];
+		int32_t axis2 = horizontal2 + vertical2;
+
+		if constexpr(site == Site::R || site == Site::B)
+		{
+			int32_t green = clampByte((8 * center + 4 * cross - 2 * axis2 + 8) >> 4);
+			int32_t opposite = clampByte((12 * center + 4 * diagonal - 3 * axis2 + 8) >> 4);
+
+			if constexpr(site == Site::R)
+				return { center, green, opposite };
+			else
+				return { opposite, green, center };
+		}
+		else
+		{
+			int32_t alongRow =
+				clampByte((10 * center + 8 * horizontal - 2 * horizontal2 - 2 * diagonal + vertical2 + 8) >> 4);
+			int32_t alongColumn =
+				clampByte((10 * center + 8 * vertical - 2 * vertical2 - 2 * diagonal + horizontal2 + 8) >> 4);
+
+			if constexpr(site == Site::Gr)
+				return { alongRow, center, alongColumn };
+			else
+				return { alongColumn, center, alongRow };
+		}
+	}
+}
+
+static DEBAYER_INLINE uint8_t luma(const Rgb &rgb)
+{
+	return static_cast<uint8_t>(((66 * rgb.r + 129 * rgb.g + 25 * rgb.b + 128) >> 8) + 16);
+}
+
+/**
+ * @brief Convert a row pair of the window.
+ *
+ * @param rows Window rows, two above the pair to two below it.
+ * */
+template<BayerOrder order, DebayerMethod method, DebayerOutput output>
+static DEBAYER_INLINE void convertRowPair(const uint8_t *const *window, int32_t width, uint8_t *__restrict y0,
+																					uint8_t *__restrict y1, uint8_t *__restrict u, uint8_t *__restrict v)
+{
+	// the window never aliases the planes, without restrict the loop is not vectorized
+	const uint8_t *__restrict rows[WINDOW_ROWS]{ window[0], window[1], window[2], window[3], window[4], window[5] };
+
+	for(int32_t x = 0; x < width; x += 2)
+	{
+		Rgb p00 = interpolate<siteAt(order, 0, 0), method>(rows, x);
+		Rgb p10 = interpolate<siteAt(order, 1, 0), method>(rows, x + 1);
+		Rgb p01 = interpolate<siteAt(order, 0, 1), method>(rows + 1, x);
+		Rgb p11 = interpolate<siteAt(order, 1, 1), method>(rows + 1, x + 1);
+		int32_t r = p00.r + p10.r + p01.r + p11.r;
+		int32_t g = p00.g + p10.g + p01.g + p11.g;
+		int32_t b = p00.b + p10.b + p01.b + p11.b;
+		auto cb = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+		auto cr = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+
+		y0[x] = luma(p00);
+		y0[x + 1] = luma(p10);
+		y1[x] = luma(p01);
+		y1[x + 1] = luma(p11);
+
+		if constexpr(output == DebayerOutput::I420)
+		{
+			u[x / 2] = cb;
+			v[x / 2] = cr;
+		}
+		else
+		{
+			u[x] = cb;
+			u[x + 1] = cr;
+		}
+	}
+}
+
+/**
+ * @brief Row window of a band.
+ *
+ * Rows are copied once into a ring with repeated border cells, so the
+ * conversion loops need no bounds checks.
+ * */
+class RowWindow
+{
+public:
+	RowWindow(const uint8_t *src, size_t srcStride, int32_t width, int32_t height):
+		_src{ src },
+		_srcStride{ srcStride },
+		_width{ width },
+		_height{ height },
+		_paddedWidth{ static_cast<size_t>(width + 2 * PAD) }
+	{
+		thread_local std::vector<uint8_t> scratch;
+
+		scratch.resize(WINDOW_ROWS * _paddedWidth);
+		_rows = scratch.data();
+	}
+
+	void load(int32_t row)
+	{
+		// repeat the outer cells, a step of two keeps the colour filter order
+		int32_t sourceRow = row < 0 ? row + 2 : (row >= _height ? row - 2 : row);
+		const uint8_t *src = _src + static_cast<size_t>(sourceRow) * _srcStride;
+		uint8_t *dst = slot(row);
+
+		memcpy(dst + PAD, src, static_cast<size_t>(_width));
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[PAD + _width] = src[_width - 2];
+		dst[PAD + _width + 1] = src[_width - 1];
+	}
+
+	/**
+	 * @brief First pixel of a loaded row.
+	 * */
+	[[nodiscard]]
+	const uint8_t *row(int32_t row) const
+	{
+		return slot(row) + PAD;
+	}
+
+private:
+	[[nodiscard]]
+	uint8_t *slot(int32_t row) const
+	{
+		return _rows + static_cast<size_t>((row % WINDOW_ROWS + WINDOW_ROWS) % WINDOW_ROWS) * _paddedWidth;
+	}
+
+	const uint8_t *_src;
+	size_t _srcStride;
+	int32_t _width;
+	int32_t _height;
+	size_t _paddedWidth;
+	uint8_t *_rows;
+};
+
+template<BayerOrder order, DebayerMethod method, DebayerOutput output>
+static DEBAYER_INLINE void debayerBand(const uint8_t *src, size_t srcStride, int32_t width, int32_t height,
+																			 const DebayerPlanes &planes, int32_t firstRow, int32_t lastRow)
+{
+	RowWindow window{ src, srcStride, width, height };
+	const uint8_t *rows[WINDOW_ROWS];
+
+	for(int32_t row = firstRow - PAD; row < firstRow + PAD; row++)
+		window.load(row);
+
+	for(int32_t y = firstRow; y < lastRow; y += 2)
+	{
+		window.load(y + 2);
+		window.load(y + 3);
+		for(int32_t i = 0; i < WINDOW_ROWS; i++)
+			rows[i] = window.row(y - PAD + i);
+
+		uint8_t *u = planes.u + static_cast<size_t>(y / 2) * planes.uStride;
+		uint8_t *v = output == DebayerOutput::I420 ? planes.v + static_cast<size_t>(y / 2) * planes.vStride : nullptr;
+
+		convertRowPair<order, method, output>(rows, width, planes.y + static_cast<size_t>(y) * planes.yStride,
+																					planes.y + static_cast<size_t>(y + 1) * planes.yStride, u, v);
+	}
+}
+
+template<DebayerMethod method, DebayerOutput output>
+static DEBAYER_INLINE void debayerBand(const uint8_t *src, size_t srcStride, int32_t width, int32_t height,
+																			 BayerOrder order, const DebayerPlanes &planes, int32_t firstRow,
+																			 int32_t lastRow)
+{
+	switch(order)
+	{
+		case BayerOrder::Rggb:
+			debayerBand<BayerOrder::Rggb, method, output>(src, srcStride, width, height, planes, firstRow, lastRow);
+			break;
+		case BayerOrder::Bggr:
+			debayerBand<BayerOrder::Bggr, method, output>(src, srcStride, width, height, planes, firstRow, lastRow);
+			break;
+		case BayerOrder::Grbg:
+			debayerBand<BayerOrder::Grbg, method, output>(src, srcStride, width, height, planes, firstRow, lastRow);
+			break;
+		case BayerOrder::Gbrg:
+			debayerBand<BayerOrder::Gbrg, method, output>(src, srcStride, width, height, planes, firstRow, lastRow);
+			break;
+	}
+}
+
+bool bayerOrderFromString(const char *format, BayerOrder &order)
+{
+	std::string_view name{ format != nullptr ? format : "" };
+
+	if(name == "rggb")
+		order = BayerOrder::Rggb;
+	else if(name == "bggr")
+		order = BayerOrder::Bggr;
+	else if(name == "grbg")
+		order = BayerOrder::Grbg;
+	else if(name == "gbrg")
+		order = BayerOrder::Gbrg;
+	else
+		return false;
+	return true;
+}
+
+int32_t debayerHaloRows(DebayerMethod method)
+{
+	return method == DebayerMethod::Malvar ? 2 : 1;
+}
+
+DEBAYER_TARGET_CLONES
+void debayerRows(const uint8_t *src, size_t srcStride, int32_t width, int32_t height, BayerOrder order,
+								 DebayerMethod method, DebayerOutput output, const DebayerPlanes &planes, int32_t firstRow,
+								 int32_t lastRow)
+{
+	if(method == DebayerMethod::Bilinear && output == DebayerOutput::I420)
+		debayerBand<DebayerMethod::Bilinear, DebayerOutput::I420>(src, srcStride, width, height, order, planes, firstRow,
+																															lastRow);
+	else if(method == DebayerMethod::Bilinear)
+		debayerBand<DebayerMethod::Bilinear, DebayerOutput::NV12>(src, srcStride, width, height, order, planes, firstRow,
+																															lastRow);
+	else if(output == DebayerOutput::I420)
+		debayerBand<DebayerMethod::Malvar, DebayerOutput::I420>(src, srcStride, width, height, order, planes, firstRow,
+																														lastRow);
+	else
+		debayerBand<DebayerMethod::Malvar, DebayerOutput::NV12>(src, srcStride, width, height, order, planes, firstRow,
+																														lastRow);
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <chrono>
+
+#include <gst/video/video.h>
+
+#include "DebayerElement.hpp"
+
+GST_DEBUG_CATEGORY_STATIC(debayerDebug);
+#define GST_CAT_DEFAULT debayerDebug
+
+/// Fewer rows per band are not worth a task
+static constexpr int32_t MIN_BAND_ROWS{ 32 };
+/// Bands per worker, spare bands let idle workers steal from slow ones
+static constexpr int32_t BANDS_PER_THREAD{ 4 };
+
+/// Shared by all debayer elements, so cameras do not oversubscribe the cores
+static std::unique_ptr<WorkStealingPool> gPool;
+static Histogram gFrameTime;
+
+enum
+{
+	PROP_0,
+	PROP_METHOD,
+	PROP_N_BANDS
+};
+
+struct _RtspcamDebayer
+{
+	GstBaseTransform parent;
+
+	DebayerMethod method;
+	uint32_t numBands;
+
+	BayerOrder order;
+	int32_t width;
+	int32_t height;
+	size_t srcStride;
+	DebayerOutput output;
+	GstVideoInfo outInfo;
+};
+
+G_DEFINE_TYPE(RtspcamDebayer, rtspcam_debayer, GST_TYPE_BASE_TRANSFORM)
+
+static GstStaticPadTemplate sinkTemplate = GST_STATIC_PAD_TEMPLATE(
+	"sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+	GST_STATIC_CAPS("video/x-bayer, format=(string){ bggr, rggb, grbg, gbrg }, "
+									"width=(int)[ 4, MAX ], height=(int)[ 4, MAX ], framerate=(fraction)[ 0/1, MAX ]"));
+
+static GstStaticPadTemplate srcTemplate =
+	GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("{ I420, NV12 }")));
+
+static GType debayerMethodGetType()
+{
+	static const GEnumValue values[] = {
+		{ static_cast<gint>(DebayerMethod::Bilinear), "Bilinear interpolation", "bilinear" },
+		{ static_cast<gint>(DebayerMethod::Malvar), "Malvar-He-Cutler gradient corrected interpolation", "malvar" },
+		{ 0, nullptr, nullptr }
+	};
+	static GType type = g_enum_register_static("RtspcamDebayerMethod", values);
+
+	return type;
+}
+
+static void debayerSetProperty(GObject *object, guint propertyId, const GValue *value, GParamSpec *spec)
+{
+	auto self = RTSPCAM_DEBAYER(object);
+
+	switch(propertyId)
+	{
+		case PROP_METHOD:
+			self->method = static_cast<DebayerMethod>(g_value_get_enum(value));
+			break;
+		case PROP_N_BANDS:
+			self->numBands = g_value_get_uint(value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propertyId, spec);
+			break;
+	}
+}
+
+static void debayerGetProperty(GObject *object, guint propertyId, GValue *value, GParamSpec *spec)
+{
+	auto self = RTSPCAM_DEBAYER(object);
+
+	switch(propertyId)
+	{
+		case PROP_METHOD:
+			g_value_set_enum(value, static_cast<gint>(self->method));
+			break;
+		case PROP_N_BANDS:
+			g_value_set_uint(value, self->numBands);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propertyId, spec);
+			break;
+	}
+}
+
+static GstCaps *debayerTransformCaps([[maybe_unused]] GstBaseTransform *transform, GstPadDirection direction,
+																		 GstCaps *caps, GstCaps *filter)
+{
+	GstCaps *result = gst_caps_new_empty();
+	GValue formats = G_VALUE_INIT;
+	GValue format = G_VALUE_INIT;
+	const char *const *names;
+	static const char *const rawFormats[] = { "I420", "NV12", nullptr };
+	static const char *const bayerFormats[] = { "bggr", "rggb", "grbg", "gbrg", nullptr };
+
+	names = direction == GST_PAD_SINK ? rawFormats : bayerFormats;
+	g_value_init(&formats, GST_TYPE_LIST);
+	g_value_init(&format, G_TYPE_STRING);
+	for(auto name = names; *name != nullptr; name++)
+	{
+		g_value_set_static_string(&format, *name);
+		gst_value_list_append_value(&formats, &format);
+	}
+
+	for(guint i = 0; i < gst_caps_get_size(caps); i++)
+	{
+		const GstStructure *structure = gst_caps_get_structure(caps, i);
+		GstStructure *converted =
+			gst_structure_new_empty(direction == GST_PAD_SINK ? "video/x-raw" : "video/x-bayer");
+
+		// only the geometry and the frame rate carry over between both sides
+		for(auto field : { "width", "height", "framerate" })
+		{
+			if(const GValue *value = gst_structure_get_value(structure, field); value != nullptr)
+				gst_structure_set_value(converted, field, value);
+		}
+		gst_structure_set_value(converted, "format", &formats);
+		result = gst_caps_merge_structure(result, converted);
+	}
+
+	g_value_unset(&format);
+	g_value_unset(&formats);
+
+	if(filter != nullptr)
+	{
+		GstCaps *intersection = gst_caps_intersect_full(filter, result, GST_CAPS_INTERSECT_FIRST);
+		gst_caps_unref(result);
+		result = intersection;
+	}
+	return result;
+}
+
+static gboolean debayerSetCaps(GstBaseTransform *transform, GstCaps *incaps, GstCaps *outcaps)
+{
+	auto self = RTSPCAM_DEBAYER(transform);
+	const GstStructure *structure = gst_caps_get_structure(incaps, 0);
+
+	if(!gst_structure_get_int(structure, "width", &self->width) ||
+		 !gst_structure_get_int(structure, "height", &self->height) ||
+		 !bayerOrderFromString(gst_structure_get_string(structure, "format"), self->order))
+	{
+		GST_ERROR_OBJECT(self, "unsupported input caps %" GST_PTR_FORMAT, incaps);
+		return FALSE;
+	}
+
+	if(self->width % 2 != 0 || self->height % 2 != 0)
+	{
+		GST_ERROR_OBJECT(self, "odd frame size %dx%d", self->width, self->height);
+		return FALSE;
+	}
+
+	if(!gst_video_info_from_caps(&self->outInfo, outcaps))
+		return FALSE;
+
+	// same row stride bayer2rgb expects, frames with video meta bring their own
+	self->srcStride = GST_ROUND_UP_4(static_cast<size_t>(self->width));
+	self->output = GST_VIDEO_INFO_FORMAT(&self->outInfo) == GST_VIDEO_FORMAT_NV12 ? DebayerOutput::NV12
+																																								: DebayerOutput::I420;
+	return TRUE;
+}
+
+static gboolean debayerGetUnitSize([[maybe_unused]] GstBaseTransform *transform, GstCaps *caps, gsize *size)
+{
+	const GstStructure *structure = gst_caps_get_structure(caps, 0);
+	GstVideoInfo info;
+	gint width, height;
+
+	if(gst_structure_has_name(structure, "video/x-bayer"))
+	{
+		if(!gst_structure_get_int(structure, "width", &width) || !gst_structure_get_int(structure, "height", &height))
+			return FALSE;
+		*size = GST_ROUND_UP_4(static_cast<gsize>(width)) * static_cast<gsize>(height);
+		return TRUE;
+	}
+
+	if(!gst_video_info_from_caps(&info, caps))
+		return FALSE;
+	*size = GST_VIDEO_INFO_SIZE(&info);
+	return TRUE;
+}
+
+static gboolean debayerTransformSize(GstBaseTransform *transform, GstPadDirection direction, GstCaps *caps, gsize size,
+																		 GstCaps *othercaps, gsize *othersize)
+{
+	GstVideoInfo info;
+
+	if(direction != GST_PAD_SINK)
+	{
+		return GST_BASE_TRANSFORM_CLASS(rtspcam_debayer_parent_class)
+			->transform_size(transform, direction, caps, size, othercaps, othersize);
+	}
+
+	// input frames with a row stride in their video meta are no multiple of the unit size
+	if(!gst_video_info_from_caps(&info, othercaps))
+		return FALSE;
+	*othersize = GST_VIDEO_INFO_SIZE(&info);
+	return TRUE;
+}
+
+static gboolean debayerProposeAllocation(GstBaseTransform *transform, GstQuery *decideQuery, GstQuery *query)
+{
+	GST_BASE_TRANSFORM_CLASS(rtspcam_debayer_parent_class)->propose_allocation(transform, decideQuery, query);
+
+	// frames of cameras padding their rows are taken as they are, the stride is read from the video meta
+	if(!gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE, nullptr))
+		gst_query_add_allocation_meta(query, GST_VIDEO_META_API_TYPE, nullptr);
+	return TRUE;
+}
+
+static GstFlowReturn debayerTransform(GstBaseTransform *transform, GstBuffer *inbuf, GstBuffer *outbuf)
+{
+	auto self = RTSPCAM_DEBAYER(transform);
+	GstVideoMeta *meta = gst_buffer_get_video_meta(inbuf);
+	size_t srcStride = meta != nullptr ? static_cast<size_t>(meta->stride[0]) : self->srcStride;
+	size_t srcOffset = meta != nullptr ? meta->offset[0] : 0;
+	GstMapInfo in;
+	GstVideoFrame out;
+	DebayerPlanes planes{};
+	int32_t numBands, bandRows;
+
+	if(!gst_buffer_map(inbuf, &in, GST_MAP_READ))
+		return GST_FLOW_ERROR;
+
+	// the last row of a frame with video meta may end right after its pixels
+	if(srcStride < static_cast<size_t>(self->width) ||
+		 in.size < srcOffset + srcStride * static_cast<size_t>(self->height - 1) + static_cast<size_t>(self->width) ||
+		 !gst_video_frame_map(&out, &self->outInfo, outbuf, GST_MAP_WRITE))
+	{
+		GST_ERROR_OBJECT(self, "failed to map frame of %" G_GSIZE_FORMAT " bytes", in.size);
+		gst_buffer_unmap(inbuf, &in);
+		return GST_FLOW_ERROR;
+	}
+
+	planes.y = static_cast<uint8_t *>(GST_VIDEO_FRAME_PLANE_DATA(&out, 0));
+	planes.yStride = static_cast<size_t>(GST_VIDEO_FRAME_PLANE_STRIDE(&out, 0));
+	planes.u = static_cast<uint8_t *>(GST_VIDEO_FRAME_PLANE_DATA(&out, 1));
+	planes.uStride = static_cast<size_t>(GST_VIDEO_FRAME_PLANE_STRIDE(&out, 1));
+	if(self->output == DebayerOutput::I420)
+	{
+		planes.v = static_cast<uint8_t *>(GST_VIDEO_FRAME_PLANE_DATA(&out, 2));
+		planes.vStride = static_cast<size_t>(GST_VIDEO_FRAME_PLANE_STRIDE(&out, 2));
+	}
+
+	numBands = static_cast<int32_t>(self->numBands != 0 ? self->numBands : BANDS_PER_THREAD * gPool->numThreads());
+	numBands = std::max(1, std::min(numBands, self->height / MIN_BAND_ROWS));
+	// bands start on even rows to keep the colour filter order, every band copies its
+	// rows and the halo rows around them into the row window of its thread
+	bandRows = ((self->height + numBands - 1) / numBands + 1) & ~1;
+	numBands = (self->height + bandRows - 1) / bandRows;
+
+	auto debayerBand = [&](size_t band) {
+		auto firstRow = static_cast<int32_t>(band) * bandRows;
+
+		debayerRows(in.data + srcOffset, srcStride, self->width, self->height, self->order, self->method, self->output,
+								planes, firstRow, std::min(firstRow + bandRows, self->height));
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	if(numBands == 1)
+		debayerBand(0);
+	else
+		gPool->run(static_cast<size_t>(numBands), debayerBand);
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+	gFrameTime.observe(static_cast<guint64>(elapsed.count()));
+	GST_LOG_OBJECT(self, "debayered frame in %d bands in %" G_GINT64_FORMAT " us", numBands,
+								 static_cast<gint64>(elapsed.count() / 1000));
+
+	gst_video_frame_unmap(&out);
+	gst_buffer_unmap(inbuf, &in);
+	return GST_FLOW_OK;
+}
+
+static void rtspcam_debayer_class_init(RtspcamDebayerClass *klass)
+{
+	auto objectClass = G_OBJECT_CLASS(klass);
+	auto elementClass = GST_ELEMENT_CLASS(klass);
+	auto transformClass = GST_BASE_TRANSFORM_CLASS(klass);
+
+	objectClass->set_property = debayerSetProperty;
+	objectClass->get_property = debayerGetProperty;
+
+	g_object_class_install_property(
+		objectClass, PROP_METHOD,
+		g_param_spec_enum("method", "Method", "Interpolation of the missing colour samples", debayerMethodGetType(),
+											static_cast<gint>(DebayerMethod::Bilinear),
+											static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+	g_object_class_install_property(
+		objectClass, PROP_N_BANDS,
+		g_param_spec_uint("n-bands", "Bands",
+											"Bands a frame is split into on the shared thread pool, 0 for automatic, "
+											"1 to debayer on the streaming thread",
+											0, G_MAXUINT16, 0, static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+	gst_element_class_set_static_metadata(elementClass, "Bayer to YUV converter", "Filter/Converter/Video",
+																				"Converts Bayer frames to I420 or NV12 in one pass",
+																				"Alvin Ahmadov <alvin.dev.ahmadov@gmail.com>");
+	gst_element_class_add_static_pad_template(elementClass, &sinkTemplate);
+	gst_element_class_add_static_pad_template(elementClass, &srcTemplate);
+
+	transformClass->transform_caps = debayerTransformCaps;
+	transformClass->set_caps = debayerSetCaps;
+	transformClass->get_unit_size = debayerGetUnitSize;
+	transformClass->transform_size = debayerTransformSize;
+	transformClass->propose_allocation = debayerProposeAllocation;
+	transformClass->transform = debayerTransform;
+
+	GST_DEBUG_CATEGORY_INIT(debayerDebug, DEBAYER_ELEMENT_NAME, 0, "rtspcam debayer");
+}
+
+static void rtspcam_debayer_init(RtspcamDebayer *self)
+{
+	self->method = DebayerMethod::Bilinear;
+	self->numBands = 0;
+	self->order = BayerOrder::Rggb;
+	self->width = 0;
+	self->height = 0;
+	self->srcStride = 0;
+	self->output = DebayerOutput::I420;
+	gst_video_info_init(&self->outInfo);
+}
+
+bool registerDebayerElement(uint32_t numThreads)
+{
+	if(gPool == nullptr)
+		gPool = std::make_unique<WorkStealingPool>(numThreads);
+	return gst_element_register(nullptr, DEBAYER_ELEMENT_NAME, GST_RANK_NONE, RTSPCAM_TYPE_DEBAYER);
+}
+
+const WorkStealingPool *debayerPool()
+{
+	return gPool.get();
+}
+
+const Histogram &debayerFrameTime()
+{
+	return gFrameTime;
+}
@@ -1,57 +1,190 @@
+#include <algorithm>
+#include <cmath>
+#include <pthread.h>
+
 #include "DeviceHandle.hpp"
 #include "Callback.hpp"
+#include "Repack.hpp"
+#include "StreamCalibration.hpp"
+
+/// Frames the app source queues when its size is not configured
+static constexpr uint32_t APP_SOURCE_QUEUED_FRAMES{ 4 };
+/// Frames in flight behind the app source, e.g. in the debayer element and the encoder queue
+static constexpr uint32_t DOWNSTREAM_HELD_FRAMES{ 2 };
+/// Stream buffers of a camera without a configured number or a stored calibration
+static constexpr uint32_t DEFAULT_STREAM_BUFFERS{ 30 };
+/// Milliseconds between the checks of the stream watchdog
+static constexpr guint WATCHDOG_INTERVAL{ 250 };
+/// Milliseconds between the steps raising a throttled frame rate back
+static constexpr guint THROTTLE_RAISE_INTERVAL{ 1000 };
+/// Shortest time without a frame taken as a stall, in microseconds
+static constexpr gint64 MIN_STALL_TIMEOUT{ G_USEC_PER_SEC };
+/// First and longest delay between attempts to reopen a stalled camera, in microseconds
+static constexpr gint64 RECOVERY_MIN_DELAY{ G_USEC_PER_SEC };
+static constexpr gint64 RECOVERY_MAX_DELAY{ 30 * G_USEC_PER_SEC };
+
+/**
+ * @brief Buffers the leaky queue of an app source dropped, 0 before GStreamer 1.20.
+ * */
+static guint64 droppedBuffers([[maybe_unused]] GstAppSrc *source)
+{
+	guint64 dropped{};
+
+#if GST_CHECK_VERSION(1, 20, 0)
+	if(GST_IS_APP_SRC(source))
+		g_object_get(G_OBJECT(source), "dropped", &dropped, nullptr);
+#endif
+	return dropped;
+}
+
+static bool inBounds(double value, double min, double max)
+{
+	return std::isfinite(value) && min <= value && value <= max;
+}
+
+static bool inBounds(int32_t value, int32_t min, int32_t max, int32_t increment)
+{
+	return min <= value && value <= max && (value - min) % increment == 0;
+}
 
-DeviceHandle::DeviceHandle(const Options *options, uint32_t numStreamBuffers):
+/**
+ * @brief Log the error of a failed setting.
+ * */
+static ControlStatus controlStatus(const char *name, GError *error)
+{
+	if(error == nullptr)
+		return ControlStatus::Ok;
+
+	GST_WARNING("failed to set %s: %s", name, error->message);
+	g_error_free(error);
+	return ControlStatus::Failed;
+}
+
+DeviceHandle::DeviceHandle(const Options *options, int32_t cpu, uint32_t numStreamBuffers,
+													 std::unique_ptr<CaptureBackend> backend):
 	_options{ options },
 	_isInitialized{},
-	_numDevices{},
-	_numClient{},
+	_numClients{},
 	_numStreamBuffers{ numStreamBuffers },
+	_cpu{ cpu },
 	_bounds{},
 	_camera{},
 	_stream{},
 	_state{ GstState::GST_STATE_NULL },
-	_source{}
-{
-	arv_update_device_list();
-	_numDevices = arv_get_n_devices();
+	_source{},
+	_metrics{},
+	_framePool{ numStreamBuffers },
+	_pusher{ options->queueDepth, options->overflowPolicy, &_metrics },
+	_saturated{},
+	_flowControlDrops{},
+	_sourceDrops{},
+	_releasedSourceDrops{},
+	_throttleRaise{},
+	_targetFrameRate{},
+	_frameRate{},
+	_exposure{ options->exposure },
+	_gain{ options->gain },
+	_requestedFrameRate{ options->frameRate },
+	_offsetX{},
+	_offsetY{},
+	_packetSize{},
+	_pixelFormat{},
+	_payload{},
+	_rowStride{},
+	_streamMemory{ 0, ArenaBacking::Pages },
+	_watchdog{},
+	_lastFrameTime{},
+	_frameBusy{},
+	_recovering{},
+	_recoveryDelay{ RECOVERY_MIN_DELAY },
+	_nextRecovery{},
+	_recoveredAt{},
+	_underruns{},
+	_clockMapper{},
+	_lastSourceTime{},
+	_videoInfo{},
+	_hasVideoInfo{},
+	_videoMetaSupported{},
+	_backend{ std::move(backend) },
+	_rawRecorder{}
+{}
 
-	if(_numDevices > 0)
+DeviceHandle::DeviceHandle(const Options *options, const char *deviceId, int32_t cpu, uint32_t numStreamBuffers):
+	DeviceHandle(options, cpu, numStreamBuffers, nullptr)
+{
+	// without a device ID the first available camera is opened
+	if(!openCamera(deviceId))
 	{
-		auto deviceId = arv_get_device_id(_numDevices - 1 ? _numDevices > 0 : 0);
-
-		_camera = arv_camera_new(nullptr, nullptr);
+		GST_ERROR("failed to open camera %s", deviceId != nullptr ? deviceId : "");
+		_isInitialized = false;
+		return;
+	}
 
-		if(!ARV_IS_CAMERA(_camera))
-		{
-			_isInitialized = false;
-			return;
-		}
+	_deviceId = deviceId != nullptr ? deviceId : arv_camera_get_device_id(_camera, nullptr);
+	if(auto serial = arv_camera_get_device_serial_number(_camera, nullptr); serial != nullptr)
+		_serial = serial;
+	else
+		_serial = _deviceId;
 
-		if(arv_camera_is_uv_device(_camera))
-			arv_camera_uv_set_usb_mode(_camera, static_cast<ArvUvUsbMode>(_options->usbMode));
-		arv_camera_set_chunk_mode(_camera, false, nullptr);
-		arv_camera_set_region(_camera, 0, 0, _options->width, _options->height, nullptr);
-		arv_camera_set_exposure_time_auto(_camera, ARV_AUTO_CONTINUOUS, nullptr);
-		arv_camera_get_exposure_time_bounds(_camera, &_bounds.exposureMin, &_bounds.exposureMax, nullptr);
-		arv_camera_get_frame_rate_bounds(_camera, &_bounds.frameRateMin, &_bounds.frameRateMax, nullptr);
-		arv_camera_get_gain_bounds(_camera, &_bounds.gainMin, &_bounds.gainMax, nullptr);
-		_isInitialized = true;
+	configureStream(numStreamBuffers);
+	_isInitialized = true;
+	_watchdog = g_timeout_add(WATCHDOG_INTERVAL, reinterpret_cast<GSourceFunc>(streamWatchdog), this);
 
-		GST_INFO("found camera(s): %d (%s)", _numDevices, deviceId);
-	}
-	else
+	if(!_options->rawRecordDir.empty())
 	{
-		GST_ERROR("no device found!");
+		FrameFormat format{ _options->width, _options->height, _pixelFormat, _pixelFormatName, _rowStride, _payload,
+												_requestedFrameRate.value_or(arv_camera_get_frame_rate(_camera, nullptr)) };
+
+		_rawRecorder = std::make_unique<RawRecorder>(_options->rawRecordFrames);
+		if(!_rawRecorder->open(_options->rawRecordDir + "/" + _serial + ".raw", format))
+			_rawRecorder.reset();
 	}
+
+	GST_INFO("opened camera %s (serial %s)", _deviceId.c_str(), _serial.c_str());
+	GST_INFO("repack kernels: %s", simdLevelName(repackSimdLevel()));
+}
+
+DeviceHandle::DeviceHandle(const Options *options, std::unique_ptr<CaptureBackend> backend, int32_t cpu):
+	DeviceHandle(options, cpu, 0, std::move(backend))
+{
+	const auto &format = _backend->format();
+
+	_deviceId = _serial = _backend->name();
+	_pixelFormat = format.pixelFormat;
+	_pixelFormatName = format.pixelFormatName;
+	_rowStride = format.rowStride;
+	_payload = format.payload;
+	_targetFrameRate = _frameRate = format.frameRate;
+	// sized for the frames in flight, there are no stream buffers to size it from
+	_framePool.reserve(_options->queueDepth + APP_SOURCE_QUEUED_FRAMES + DOWNSTREAM_HELD_FRAMES);
+	_isInitialized = true;
+
+	GST_INFO("opened capture backend %s", _serial.c_str());
+	GST_INFO("repack kernels: %s", simdLevelName(repackSimdLevel()));
 }
 
 DeviceHandle::~DeviceHandle()
 {
+	if(_watchdog != 0)
+		g_source_remove(_watchdog);
+	if(isPlaying())
+		stopAcquisition();
+	// the stream threads are gone, nothing adds the source again
+	if(_throttleRaise != 0)
+		g_source_remove(_throttleRaise);
+
 	if(GST_IS_APP_SRC(_source))
 	{
 		gst_object_unref(_source);
 	}
+
+	if(ARV_IS_CAMERA(_camera))
+		g_object_unref(_camera);
+}
+
+bool DeviceHandle::isInitialized() const
+{
+	return _isInitialized;
 }
 
 bool DeviceHandle::isPlaying() const
@@ -59,40 +192,157 @@ bool DeviceHandle::isPlaying() const
 	return _state == GstState::GST_STATE_PLAYING;
 }
 
+const std::string &DeviceHandle::serial() const
+{
+	return _serial;
+}
+
+void DeviceHandle::onStreamThreadStarted()
+{
+	if(!arv_make_thread_realtime(10) && !arv_make_thread_high_priority(-10))
+	{
+		GST_WARNING("failed to make stream thread high priority");
+	}
+
+	if(_cpu >= 0)
+	{
+		cpu_set_t cpuSet;
+
+		CPU_ZERO(&cpuSet);
+		CPU_SET(_cpu, &cpuSet);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
+			GST_WARNING("failed to pin stream thread of camera %s to cpu %d", _serial.c_str(), _cpu);
+	}
+}
+
 void DeviceHandle::setSource(GstAppSrc *source)
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	setSourceLocked(source);
+}
+
+void DeviceHandle::setSourceLocked(GstAppSrc *source)
 {
 	if(GST_IS_APP_SRC(source))
 	{
 		if(_source != nullptr)
 		{
 			if(isPlaying())
-				stopAcquisition();
-			gst_object_unref(_source);
+				suspendLocked();
+			releaseSource();
 		}
 
 		_source = source;
 
-		ArvPixelFormat pixelFormat = arv_camera_get_pixel_format(_camera, nullptr);
-		auto capsString = arv_pixel_format_to_gst_caps_string(pixelFormat);
-		auto pixelFormatString = arv_camera_get_pixel_format_as_string(_camera, nullptr);
+		// read when the camera was opened, it may be reopening now
+		auto pixelFormatString = _pixelFormatName.c_str();
+		std::string capsString;
+
+		// packed formats are unpacked to 16-bit before they are pushed
+		if(packedLayout(_pixelFormat) != PackedLayout::None)
+			capsString = unpackedCapsString(pixelFormatString);
+		else if(auto arvCapsString = arv_pixel_format_to_gst_caps_string(_pixelFormat); arvCapsString != nullptr)
+			capsString = arvCapsString;
 
-		if(capsString == nullptr)
+		if(capsString.empty())
 		{
 			GST_ERROR("GStreamer cannot understand this camera pixel format: %s!", pixelFormatString);
-			stopAcquisition();
+			stopLocked();
 			return;
 		}
 
-		GstCaps *caps = gst_caps_from_string(capsString);
+		GstCaps *caps = gst_caps_from_string(capsString.c_str());
 		gst_caps_set_simple(caps, "width", G_TYPE_INT, _options->width, "height", G_TYPE_INT, _options->height, "framerate",
 												GST_TYPE_FRACTION, 0, 1, nullptr);
 		gst_app_src_set_caps(_source, caps);
+		// bayer caps have no video format, their video meta only carries the row stride for the debayer element
+		if(gst_structure_has_name(gst_caps_get_structure(caps, 0), "video/x-bayer"))
+		{
+			gst_video_info_init(&_videoInfo);
+			_hasVideoInfo = true;
+		}
+		else
+		{
+			_hasVideoInfo = gst_video_info_from_caps(&_videoInfo, caps) && GST_VIDEO_INFO_N_PLANES(&_videoInfo) == 1;
+		}
 		gst_caps_unref(caps);
-		g_object_set(G_OBJECT(_source), "format", GST_FORMAT_TIME, "is-live", TRUE, "do-timestamp", TRUE, nullptr);
+
+		// the app source makes an allocation query when it negotiates, see
+		// whether downstream can handle the camera row stride through video meta
+		_videoMetaSupported = false;
+		GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(_source), "src");
+		gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL),
+											reinterpret_cast<GstPadProbeCallback>(sourceAllocationQuery), this, nullptr);
+		gst_object_unref(pad);
+		g_object_set(G_OBJECT(_source), "format", GST_FORMAT_TIME, "is-live", TRUE, "do-timestamp",
+								 !_options->hardwareTimestamps, nullptr);
+
+		if(_options->flowControl != FlowControl::None)
+		{
+			// a few frames of headroom unless configured, the queue must never grow without bound
+			guint64 maxBytes = _options->maxQueueBytes;
+			if(maxBytes == 0)
+				maxBytes = APP_SOURCE_QUEUED_FRAMES * static_cast<guint64>(_payload);
+
+			g_object_set(G_OBJECT(_source), "max-bytes", maxBytes, "block", FALSE, nullptr);
+#if GST_CHECK_VERSION(1, 20, 0)
+			g_object_set(G_OBJECT(_source), "leaky-type", GST_APP_LEAKY_TYPE_DOWNSTREAM, nullptr);
+#endif
+			_saturated = false;
+			g_signal_connect(_source, "need-data", reinterpret_cast<GCallback>(sourceNeedData), this);
+			g_signal_connect(_source, "enough-data", reinterpret_cast<GCallback>(sourceEnoughData), this);
+		}
 	}
 }
 
 void DeviceHandle::startAcquisition()
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	startLocked();
+}
+
+void DeviceHandle::startAcquisition(GstAppSrc *source)
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	setSourceLocked(source);
+	startLocked();
+}
+
+void DeviceHandle::stopAcquisition()
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	stopLocked();
+}
+
+void DeviceHandle::stopAcquisition(GstAppSrc *source)
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	if(source != nullptr && source == _source)
+		stopLocked();
+}
+
+void DeviceHandle::suspendAcquisition()
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	if(isPlaying())
+		suspendLocked();
+}
+
+void DeviceHandle::resumeAcquisition()
+{
+	std::lock_guard lifecycle{ _lifecycleMutex };
+
+	if(!isPlaying() && _source != nullptr)
+		startLocked();
+}
+
+void DeviceHandle::startLocked()
 {
 	if(!_isInitialized)
 	{
@@ -106,82 +356,756 @@ void DeviceHandle::startAcquisition()
 		return;
 	}
 
-	_stream = arv_camera_create_stream(_camera, cameraStream, nullptr, nullptr);
-	if(!ARV_IS_STREAM(_stream))
+	GST_INFO("starting acquisition");
+	_pusher.start(_source);
+	_state = GstState::GST_STATE_PLAYING;
+
+	if(_backend != nullptr)
 	{
-		GST_ERROR("can not start stream");
+		_clockMapper.reset();
+		_lastSourceTime = 0;
+		if(!_backend->start(this))
+			GST_ERROR("failed to start capture backend %s", _serial.c_str());
 		return;
 	}
 
-	arv_stream_set_emit_signals(_stream, true);
-	arv_stream_create_buffers(_stream, _numStreamBuffers, nullptr, nullptr, nullptr);
+	// a camera lost while nobody watched is reopened by the watchdog
+	if(!ARV_IS_CAMERA(_camera) || !startStream())
+	{
+		stopStream();
+		closeCamera();
+		_recovering = true;
+		_nextRecovery = g_get_monotonic_time();
+	}
+}
 
-	GST_INFO("starting acquisition");
-	arv_camera_set_acquisition_mode(_camera, ARV_ACQUISITION_MODE_CONTINUOUS, nullptr);
+void DeviceHandle::stopLocked()
+{
+	suspendLocked();
+	releaseSource();
+}
 
-	if(_options->exposure)
+void DeviceHandle::releaseSource()
+{
+	if(GST_IS_APP_SRC(_source))
 	{
-		if(double exposureTime{ _options->exposure.value() }; _bounds.exposureMin <= exposureTime <= _bounds.exposureMax)
-		{
-			arv_camera_set_exposure_time_auto(_camera, ARV_AUTO_OFF, nullptr);
-			arv_camera_set_exposure_time(_camera, exposureTime, nullptr);
-		}
+		// the drops of the queue are kept past its source
+		_releasedSourceDrops += droppedBuffers(_source);
+		gst_object_unref(_source);
 	}
-	if(_options->frameRate)
+	_source = nullptr;
+}
+
+void DeviceHandle::suspendLocked()
+{
+	if(!_isInitialized)
 	{
-		if(double frameRate{ _options->frameRate.value() }; _bounds.frameRateMin <= frameRate <= _bounds.frameRateMax)
-		{
-			arv_camera_set_frame_rate(_camera, frameRate, nullptr);
-		}
+		GST_ERROR("device handle not initialized properly");
+		return;
+	}
+
+	GST_INFO("stopping acquisition");
+
+	// stop first, the stream thread may wait for room in the queue
+	_pusher.stop();
+	if(_backend != nullptr)
+		_backend->stop();
+	stopStream();
+	_recovering = false;
+
+	GST_INFO("frame pool: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses", _framePool.hits(),
+					 _framePool.misses());
+	GST_INFO("release records: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses", _framePool.releaseDataHits(),
+					 _framePool.releaseDataMisses());
+
+	GST_INFO("flow control: %" G_GUINT64_FORMAT " frames dropped", _flowControlDrops.load());
+
+	auto pusherStats = _pusher.stats();
+	GST_INFO("frame queue: %" G_GUINT64_FORMAT " pushed, %" G_GUINT64_FORMAT " dropped, latency avg %.1f us, "
+					 "max %" G_GINT64_FORMAT " us",
+					 pusherStats.pushed, pusherStats.dropped, pusherStats.averageLatency, pusherStats.maxLatency);
+	_state = GstState::GST_STATE_NULL;
+}
+
+void DeviceHandle::checkStream()
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 timeout;
+	double frameRate;
+	guint64 completed, failures, underruns;
+	// the main loop must not wait for a camera being started or stopped, the next check follows shortly
+	std::unique_lock lifecycle{ _lifecycleMutex, std::try_to_lock };
+
+	// a backend has no camera to reopen
+	if(!lifecycle.owns_lock() || !isPlaying() || _backend != nullptr)
+		return;
+
+	if(_recovering)
+	{
+		if(now >= _nextRecovery)
+			recover(now);
+		return;
+	}
+
+	if(ARV_IS_STREAM(_stream))
+	{
+		arv_stream_get_statistics(_stream, &completed, &failures, &underruns);
+		if(underruns > _underruns)
+			_metrics.countUnderruns(underruns - _underruns);
+		_underruns = underruns;
+	}
+
+	// a frame after reopening the camera ends the backoff
+	if(_lastFrameTime > _recoveredAt)
+		_recoveryDelay = RECOVERY_MIN_DELAY;
+
+	{
+		std::lock_guard lock{ _cameraMutex };
+
+		frameRate = _frameRate;
+	}
+	if(_options->stallFrames == 0 || frameRate <= 0)
+		return;
+	timeout = std::max(MIN_STALL_TIMEOUT, static_cast<gint64>(_options->stallFrames / frameRate * G_USEC_PER_SEC));
+	// a stream thread waiting for room in the frame queue is not a stalled camera
+	if(_frameBusy || now - _lastFrameTime < timeout)
+		return;
+
+	GST_WARNING("camera %s: no frame for %.1f s, reopening the camera", _serial.c_str(),
+							static_cast<double>(now - _lastFrameTime) / G_USEC_PER_SEC);
+	_metrics.countStall();
+	stopStream();
+	closeCamera();
+	_recovering = true;
+	// a camera stalling again right after it was reopened backs off
+	_nextRecovery = _lastFrameTime > _recoveredAt ? now : now + _recoveryDelay;
+}
+
+void DeviceHandle::beginFrame()
+{
+	_frameBusy = true;
+	_lastFrameTime = g_get_monotonic_time();
+}
+
+void DeviceHandle::endFrame()
+{
+	_lastFrameTime = g_get_monotonic_time();
+	_frameBusy = false;
+}
+
+void DeviceHandle::deliverFrame(const FrameView &frame, FrameRelease release)
+{
+	beginFrame();
+	_metrics.countStatus(ARV_BUFFER_STATUS_SUCCESS);
+	if(acceptFrame())
+		pushFrame(frame, release);
+	else
+		release.notify(release.data);
+	endFrame();
+}
+
+void DeviceHandle::pushFrame(const FrameView &frame, FrameRelease release)
+{
+	_metrics.observe(LatencyStage::Arrival, frame.systemTime);
+	GstBuffer *buffer = toGstBuffer(frame, &_framePool, videoMetaInfo(), release);
+
+	if(buffer != nullptr)
+	{
+		timestampBuffer(buffer, frame.deviceTime, frame.systemTime, frame.frameId);
+		_pusher.push(buffer);
+	}
+}
+
+bool DeviceHandle::isRecovering() const
+{
+	return _recovering;
+}
+
+ControlStatus DeviceHandle::setExposure(double exposure)
+{
+	if(!_isInitialized)
+		return ControlStatus::Failed;
+
+	std::lock_guard lock{ _cameraMutex };
+
+	if(!ARV_IS_CAMERA(_camera))
+		return ControlStatus::Failed;
+
+	auto status = applyExposure(exposure);
+
+	if(status == ControlStatus::Ok)
+	{
+		_exposure = exposure;
+		GST_INFO("camera %s: exposure set to %.1f us", _serial.c_str(), exposure);
+	}
+	return status;
+}
+
+ControlStatus DeviceHandle::setGain(double gain)
+{
+	if(!_isInitialized)
+		return ControlStatus::Failed;
+
+	std::lock_guard lock{ _cameraMutex };
+
+	if(!ARV_IS_CAMERA(_camera))
+		return ControlStatus::Failed;
+
+	auto status = applyGain(gain);
+
+	if(status == ControlStatus::Ok)
+	{
+		_gain = gain;
+		GST_INFO("camera %s: gain set to %.2f", _serial.c_str(), gain);
+	}
+	return status;
+}
+
+ControlStatus DeviceHandle::setFrameRate(double frameRate)
+{
+	if(!_isInitialized)
+		return ControlStatus::Failed;
+
+	std::lock_guard lock{ _cameraMutex };
+
+	if(!ARV_IS_CAMERA(_camera))
+		return ControlStatus::Failed;
+
+	auto status = applyFrameRate(frameRate);
+
+	if(status == ControlStatus::Ok)
+	{
+		_requestedFrameRate = frameRate;
+		GST_INFO("camera %s: frame rate set to %.2f", _serial.c_str(), _frameRate);
 	}
-	if(_options->gain)
+	return status;
+}
+
+ControlStatus DeviceHandle::setRoiOffset(int32_t x, int32_t y)
+{
+	if(!_isInitialized)
+		return ControlStatus::Failed;
+
+	std::lock_guard lock{ _cameraMutex };
+
+	if(!ARV_IS_CAMERA(_camera))
+		return ControlStatus::Failed;
+
+	auto status = applyRoiOffset(x, y);
+
+	if(status == ControlStatus::Ok)
 	{
-		if(double gain{ _options->gain.value() }; _bounds.gainMin <= gain <= _bounds.gainMax)
+		_offsetX = x;
+		_offsetY = y;
+		GST_INFO("camera %s: region offset set to %d,%d", _serial.c_str(), x, y);
+	}
+	return status;
+}
+
+CameraControls DeviceHandle::controls()
+{
+	CameraControls controls{};
+
+	std::lock_guard lock{ _cameraMutex };
+
+	if(!ARV_IS_CAMERA(_camera))
+		return controls;
+
+	if(arv_camera_get_exposure_time_auto(_camera, nullptr) == ARV_AUTO_OFF)
+		controls.exposure = arv_camera_get_exposure_time(_camera, nullptr);
+	if(!arv_camera_is_gain_auto_available(_camera, nullptr) ||
+		 arv_camera_get_gain_auto(_camera, nullptr) == ARV_AUTO_OFF)
+		controls.gain = arv_camera_get_gain(_camera, nullptr);
+	controls.frameRate = arv_camera_get_frame_rate(_camera, nullptr);
+	arv_camera_get_region(_camera, &controls.offsetX, &controls.offsetY, nullptr, nullptr, nullptr);
+	return controls;
+}
+
+DeviceBounds DeviceHandle::bounds()
+{
+	std::lock_guard lock{ _cameraMutex };
+
+	return _bounds;
+}
+
+void DeviceHandle::configureStream(uint32_t numStreamBuffers)
+{
+	StreamSettings settings{ numStreamBuffers, 0 };
+	CalibrationKey key{};
+	std::string path;
+	bool calibrate;
+	// frames wrapped without copying return to the stream when the pipeline releases them
+	uint32_t heldFrames = _options->queueDepth + APP_SOURCE_QUEUED_FRAMES + DOWNSTREAM_HELD_FRAMES;
+
+	if(numStreamBuffers == 0)
+	{
+		// calibrate at the rate the camera will stream at
+		if(_exposure)
+			applyExposure(*_exposure);
+		if(_requestedFrameRate)
+			applyFrameRate(*_requestedFrameRate);
+
+		key = { arv_camera_get_payload(_camera, nullptr), arv_camera_get_frame_rate(_camera, nullptr) };
+		path = calibrationFilePath(*_options);
+		// only real transports are calibrated, a simulated camera never drops a frame
+		calibrate = (_options->calibrate || _options->recalibrate) &&
+								(arv_camera_is_gv_device(_camera) || arv_camera_is_uv_device(_camera));
+		if(!_options->recalibrate && loadStreamSettings(path, _serial, key, settings))
 		{
-			arv_camera_set_gain(_camera, gain, nullptr);
+			GST_INFO("camera %s: calibration loaded from %s", _serial.c_str(), path.c_str());
+		}
+		else if(calibrate)
+		{
+			GST_INFO("camera %s: calibrating the stream, this takes a while", _serial.c_str());
+			settings = calibrateStream(_camera, heldFrames);
+			if(saveStreamSettings(path, _serial, key, settings))
+				GST_INFO("camera %s: calibration saved to %s", _serial.c_str(), path.c_str());
+		}
+		else
+		{
+			settings = { DEFAULT_STREAM_BUFFERS, 0 };
 		}
 	}
 
-	arv_camera_start_acquisition(_camera, nullptr);
+	_packetSize = settings.packetSize;
+	if(_packetSize > 0 && arv_camera_is_gv_device(_camera))
+		arv_camera_gv_set_packet_size(_camera, static_cast<gint>(_packetSize), nullptr);
+	_numStreamBuffers = settings.numBuffers;
+	_framePool.reserve(_numStreamBuffers);
+	GST_INFO("camera %s: %u stream buffers", _serial.c_str(), _numStreamBuffers);
+}
 
-	_state = GstState::GST_STATE_PLAYING;
-	g_signal_connect(_stream, "new-buffer", reinterpret_cast<GCallback>(newBuffer), _source);
+bool DeviceHandle::openCamera(const char *deviceId)
+{
+	ArvCamera *camera = arv_camera_new(deviceId, nullptr);
+
+	if(!ARV_IS_CAMERA(camera))
+	{
+		g_clear_object(&camera);
+		return false;
+	}
+
+	std::lock_guard lock{ _cameraMutex };
+
+	_camera = camera;
+	if(arv_camera_is_uv_device(_camera))
+		arv_camera_uv_set_usb_mode(_camera, static_cast<ArvUvUsbMode>(_options->usbMode));
+	arv_camera_set_chunk_mode(_camera, false, nullptr);
+	arv_camera_set_region(_camera, 0, 0, _options->width, _options->height, nullptr);
+	arv_camera_set_exposure_time_auto(_camera, ARV_AUTO_CONTINUOUS, nullptr);
+	if(_packetSize > 0 && arv_camera_is_gv_device(_camera))
+		arv_camera_gv_set_packet_size(_camera, static_cast<gint>(_packetSize), nullptr);
+	_pixelFormat = arv_camera_get_pixel_format(_camera, nullptr);
+	if(auto name = arv_camera_get_pixel_format_as_string(_camera, nullptr); name != nullptr)
+		_pixelFormatName = name;
+	// the padding is part of the payload
+	_rowStride = configureLinePitch();
+	_payload = arv_camera_get_payload(_camera, nullptr);
+	updateBounds();
+	return true;
 }
 
-void DeviceHandle::stopAcquisition()
+size_t DeviceHandle::configureLinePitch()
 {
-	if(!_isInitialized)
+	GError *error{};
+	auto rowSize = packedRowStride(_options->width, ARV_PIXEL_FORMAT_BIT_PER_PIXEL(_pixelFormat));
+	auto stride = alignedRowStride(rowSize);
+
+	// packed frames are unpacked into a pool buffer anyway
+	if(packedLayout(_pixelFormat) != PackedLayout::None || stride == rowSize)
+		return 0;
+
+	if(!arv_camera_is_feature_available(_camera, "LinePitch", nullptr))
 	{
-		GST_ERROR("device handle not initialized properly");
-		return;
+		GST_INFO("camera %s cannot pad its rows to %zu bytes, frames are repacked unless downstream takes video meta",
+						 _deviceId.c_str(), stride);
+		return 0;
 	}
 
-	GST_INFO("stopping acquisition");
+	if(arv_camera_is_feature_available(_camera, "LinePitchEnable", nullptr))
+		arv_camera_set_boolean(_camera, "LinePitchEnable", true, nullptr);
+	arv_camera_set_integer(_camera, "LinePitch", static_cast<gint64>(stride), &error);
+	if(error != nullptr)
+	{
+		GST_WARNING("failed to set the line pitch to %zu bytes: %s", stride, error->message);
+		g_error_free(error);
+		return 0;
+	}
+
+	// the camera may round the pitch to its own increment
+	auto pitch = arv_camera_get_integer(_camera, "LinePitch", nullptr);
+	return pitch >= static_cast<gint64>(rowSize) ? static_cast<size_t>(pitch) : 0;
+}
+
+void DeviceHandle::closeCamera()
+{
+	std::lock_guard lock{ _cameraMutex };
+
+	g_clear_object(&_camera);
+}
+
+void DeviceHandle::createStreamBuffers()
+{
+	// the buffers keep the arena alive, it is unmapped when the last one is freed
+	auto arena = BufferArena::create(_payload, _numStreamBuffers, _options->hugePages);
+	StreamMemory memory{ static_cast<size_t>(_payload) * _numStreamBuffers, ArenaBacking::Pages };
+
+	if(arena != nullptr)
+	{
+		for(uint32_t i = 0; i < arena->count(); i++)
+			arv_stream_push_buffer(_stream, arena->newBuffer(i));
+		memory = { arena->size(), arena->backing() };
+		GST_INFO("camera %s: %u stream buffers of %u bytes in %zu bytes of %s memory", _serial.c_str(), arena->count(),
+						 _payload, arena->size(), BufferArena::backingName(arena->backing()));
+	}
+	else
+	{
+		arv_stream_create_buffers(_stream, _numStreamBuffers, nullptr, nullptr, nullptr);
+	}
+
+	std::lock_guard lock{ _cameraMutex };
+	_streamMemory = memory;
+}
+
+bool DeviceHandle::startStream()
+{
+	GError *error{};
+
+	_stream = arv_camera_create_stream(_camera, cameraStream, this, nullptr);
+	if(!ARV_IS_STREAM(_stream))
+	{
+		GST_ERROR("can not start stream");
+		g_clear_object(&_stream);
+		return false;
+	}
+
+	arv_stream_set_emit_signals(_stream, true);
+	createStreamBuffers();
+	arv_camera_set_acquisition_mode(_camera, ARV_ACQUISITION_MODE_CONTINUOUS, nullptr);
+
+	{
+		std::lock_guard lock{ _cameraMutex };
+
+		// settings out of bounds are logged and left to the camera
+		if(_exposure)
+			applyExposure(*_exposure);
+		if(_requestedFrameRate)
+			applyFrameRate(*_requestedFrameRate);
+		// throttling steps down from and back up to this rate
+		_targetFrameRate = _frameRate = arv_camera_get_frame_rate(_camera, nullptr);
+		if(_gain)
+			applyGain(*_gain);
+		if(_offsetX != 0 || _offsetY != 0)
+			applyRoiOffset(_offsetX, _offsetY);
+	}
+
+	// the camera clock of a reopened camera starts over
+	_clockMapper.reset();
+	_lastSourceTime = 0;
+	_underruns = 0;
+	_lastFrameTime = g_get_monotonic_time();
+	g_signal_connect(_stream, "new-buffer", reinterpret_cast<GCallback>(newBuffer), this);
+
+	arv_camera_start_acquisition(_camera, &error);
+	if(error != nullptr)
+	{
+		GST_ERROR("failed to start acquisition: %s", error->message);
+		g_error_free(error);
+		return false;
+	}
+	return true;
+}
+
+void DeviceHandle::stopStream()
+{
+	// the camera stops sending before the stream receiving its frames goes away
+	if(ARV_IS_CAMERA(_camera))
+		arv_camera_stop_acquisition(_camera, nullptr);
 
 	if(ARV_IS_STREAM(_stream))
 	{
 		arv_stream_set_emit_signals(_stream, false);
 		g_object_unref(_stream);
 		_stream = nullptr;
+
+		std::lock_guard lock{ _cameraMutex };
+		_streamMemory = { 0, ArenaBacking::Pages };
+	}
+}
+
+void DeviceHandle::recover(gint64 now)
+{
+	// the device list is cached, a camera plugged in again has to be looked up
+	arv_update_device_list();
+	if(openCamera(_deviceId.c_str()) && startStream())
+	{
+		GST_INFO("camera %s: stream recovered", _serial.c_str());
+		_metrics.countRecovery();
+		_recovering = false;
+		_recoveredAt = now;
+		return;
 	}
 
-	if(ARV_IS_CAMERA(_camera))
-		arv_camera_stop_acquisition(_camera, nullptr);
+	stopStream();
+	closeCamera();
+	GST_WARNING("camera %s: reopening failed, next attempt in %.0f s", _serial.c_str(),
+							static_cast<double>(_recoveryDelay) / G_USEC_PER_SEC);
+	_nextRecovery = now + _recoveryDelay;
+	_recoveryDelay = std::min(2 * _recoveryDelay, RECOVERY_MAX_DELAY);
+}
 
-	if(GST_IS_APP_SRC(_source))
+void DeviceHandle::updateBounds()
+{
+	arv_camera_get_exposure_time_bounds(_camera, &_bounds.exposureMin, &_bounds.exposureMax, nullptr);
+	arv_camera_get_frame_rate_bounds(_camera, &_bounds.frameRateMin, &_bounds.frameRateMax, nullptr);
+	arv_camera_get_gain_bounds(_camera, &_bounds.gainMin, &_bounds.gainMax, nullptr);
+	// the offset bounds follow the region size, which is fixed while the camera is open
+	arv_camera_get_x_offset_bounds(_camera, &_bounds.offsetXMin, &_bounds.offsetXMax, nullptr);
+	arv_camera_get_y_offset_bounds(_camera, &_bounds.offsetYMin, &_bounds.offsetYMax, nullptr);
+	_bounds.offsetXIncrement = std::max(1, arv_camera_get_x_offset_increment(_camera, nullptr));
+	_bounds.offsetYIncrement = std::max(1, arv_camera_get_y_offset_increment(_camera, nullptr));
+}
+
+ControlStatus DeviceHandle::applyExposure(double exposure)
+{
+	GError *error{};
+	ControlStatus status;
+
+	if(!inBounds(exposure, _bounds.exposureMin, _bounds.exposureMax))
 	{
-		gst_object_unref(_source);
-		_source = nullptr;
+		GST_WARNING("exposure %.1f us out of bounds [%.1f, %.1f]", exposure, _bounds.exposureMin, _bounds.exposureMax);
+		return ControlStatus::OutOfBounds;
 	}
-	_state = GstState::GST_STATE_NULL;
+
+	arv_camera_set_exposure_time_auto(_camera, ARV_AUTO_OFF, nullptr);
+	arv_camera_set_exposure_time(_camera, exposure, &error);
+	status = controlStatus("exposure", error);
+	// the longest exposure bounds the frame rate
+	updateBounds();
+	return status;
+}
+
+ControlStatus DeviceHandle::applyGain(double gain)
+{
+	GError *error{};
+
+	if(!inBounds(gain, _bounds.gainMin, _bounds.gainMax))
+	{
+		GST_WARNING("gain %.2f out of bounds [%.2f, %.2f]", gain, _bounds.gainMin, _bounds.gainMax);
+		return ControlStatus::OutOfBounds;
+	}
+
+	if(arv_camera_is_gain_auto_available(_camera, nullptr))
+		arv_camera_set_gain_auto(_camera, ARV_AUTO_OFF, nullptr);
+	arv_camera_set_gain(_camera, gain, &error);
+	return controlStatus("gain", error);
+}
+
+ControlStatus DeviceHandle::applyFrameRate(double frameRate)
+{
+	GError *error{};
+	ControlStatus status;
+
+	if(!inBounds(frameRate, _bounds.frameRateMin, _bounds.frameRateMax))
+	{
+		GST_WARNING("frame rate %.2f out of bounds [%.2f, %.2f]", frameRate, _bounds.frameRateMin,
+								_bounds.frameRateMax);
+		return ControlStatus::OutOfBounds;
+	}
+
+	arv_camera_set_frame_rate(_camera, frameRate, &error);
+	if((status = controlStatus("frame rate", error)) == ControlStatus::Ok)
+		_targetFrameRate = _frameRate = arv_camera_get_frame_rate(_camera, nullptr);
+	return status;
+}
+
+ControlStatus DeviceHandle::applyRoiOffset(int32_t x, int32_t y)
+{
+	GError *error{};
+
+	if(!inBounds(x, _bounds.offsetXMin, _bounds.offsetXMax, _bounds.offsetXIncrement) ||
+		 !inBounds(y, _bounds.offsetYMin, _bounds.offsetYMax, _bounds.offsetYIncrement))
+	{
+		GST_WARNING("region offset %d,%d out of bounds [%d, %d] x [%d, %d] in steps of %d,%d", x, y, _bounds.offsetXMin,
+								_bounds.offsetXMax, _bounds.offsetYMin, _bounds.offsetYMax, _bounds.offsetXIncrement,
+								_bounds.offsetYIncrement);
+		return ControlStatus::OutOfBounds;
+	}
+
+	// the offsets stay writable during acquisition, unlike the region size
+	arv_camera_set_integer(_camera, "OffsetX", x, &error);
+	if(error == nullptr)
+		arv_camera_set_integer(_camera, "OffsetY", y, &error);
+	return controlStatus("region offset", error);
+}
+
+GstAppSrc *DeviceHandle::source() const
+{
+	return _source;
+}
+
+const GstVideoInfo *DeviceHandle::videoMetaInfo() const
+{
+	return _hasVideoInfo && _videoMetaSupported ? &_videoInfo : nullptr;
+}
+
+void DeviceHandle::setVideoMetaSupported(bool supported)
+{
+	if(supported != _videoMetaSupported)
+		GST_INFO("downstream %s video meta", supported ? "accepts" : "does not accept");
+	_videoMetaSupported = supported;
+}
+
+bool DeviceHandle::acceptFrame()
+{
+	if(_options->flowControl == FlowControl::Drop && _saturated)
+	{
+		_flowControlDrops++;
+		return false;
+	}
+	return true;
+}
+
+void DeviceHandle::onNeedData()
+{
+	// a throttled frame rate is raised back by the periodic step while the source stays unsaturated
+	_saturated = false;
+}
+
+void DeviceHandle::onEnoughData()
+{
+	if(_saturated.exchange(true) || _options->flowControl != FlowControl::Throttle)
+		return;
+
+	std::lock_guard lock{ _cameraMutex };
+
+	if(ARV_IS_CAMERA(_camera) && _frameRate > _bounds.frameRateMin)
+	{
+		_frameRate = std::max(_bounds.frameRateMin, _frameRate * 0.75);
+		arv_camera_set_frame_rate(_camera, _frameRate, nullptr);
+		GST_INFO("flow control: frame rate lowered to %.2f", _frameRate);
+		if(_throttleRaise == 0)
+			_throttleRaise = g_timeout_add(THROTTLE_RAISE_INTERVAL, reinterpret_cast<GSourceFunc>(throttleRaise), this);
+	}
+}
+
+bool DeviceHandle::raiseFrameRate()
+{
+	std::lock_guard lock{ _cameraMutex };
+
+	if(!ARV_IS_CAMERA(_camera) || _frameRate >= _targetFrameRate)
+	{
+		_throttleRaise = 0;
+		return false;
+	}
+	// a saturated source waits for its next need-data, a step now would hit the limit again right away
+	if(_saturated)
+		return true;
+
+	_frameRate = std::min(_targetFrameRate, _frameRate * 1.1);
+	arv_camera_set_frame_rate(_camera, _frameRate, nullptr);
+	GST_INFO("flow control: frame rate raised to %.2f", _frameRate);
+	if(_frameRate < _targetFrameRate)
+		return true;
+
+	_throttleRaise = 0;
+	return false;
+}
+
+uint64_t DeviceHandle::flowControlDrops() const
+{
+	return _flowControlDrops;
+}
+
+uint64_t DeviceHandle::sourceDrops()
+{
+	// the source may be replaced right now, the count of the last call stands then
+	std::unique_lock lifecycle{ _lifecycleMutex, std::try_to_lock };
+
+	if(lifecycle.owns_lock())
+		_sourceDrops = _releasedSourceDrops + droppedBuffers(_source);
+	return _sourceDrops;
+}
+
+void DeviceHandle::timestampBuffer(GstBuffer *buffer, guint64 deviceTime, guint64 systemTime, guint64 frameId)
+{
+	static GstStaticCaps unixTimeCaps = GST_STATIC_CAPS("timestamp/x-unix");
+	GstCaps *caps;
+	GstClock *clock;
+	GstClockTime clockTime, baseTime, pts;
+	// cameras without a timestamp counter are stamped on reception
+	guint64 sourceTime = deviceTime != 0 ? deviceTime : systemTime;
+
+	GST_BUFFER_OFFSET(buffer) = frameId;
+
+	caps = gst_caps_new_simple("timestamp/x-aravis-device", "frame-id", G_TYPE_UINT64, frameId, nullptr);
+	gst_buffer_add_reference_timestamp_meta(buffer, caps, deviceTime, GST_CLOCK_TIME_NONE);
+	gst_caps_unref(caps);
+
+	caps = gst_static_caps_get(&unixTimeCaps);
+	gst_buffer_add_reference_timestamp_meta(buffer, caps, systemTime, GST_CLOCK_TIME_NONE);
+	gst_caps_unref(caps);
+
+	if(!_options->hardwareTimestamps)
+		return;
+
+	// no clock before the pipeline goes to playing, such frames are not timestamped
+	clock = gst_element_get_clock(GST_ELEMENT(_source));
+	if(clock == nullptr)
+		return;
+
+	clockTime = gst_clock_get_time(clock);
+	baseTime = gst_element_get_base_time(GST_ELEMENT(_source));
+	gst_object_unref(clock);
+
+	pts = _clockMapper.map(sourceTime, clockTime);
+	pts = pts > baseTime ? pts - baseTime : 0;
+
+	GST_BUFFER_PTS(buffer) = pts;
+	GST_BUFFER_DTS(buffer) = pts;
+	if(_lastSourceTime != 0 && sourceTime > _lastSourceTime)
+		GST_BUFFER_DURATION(buffer) = sourceTime - _lastSourceTime;
+	_lastSourceTime = sourceTime;
+}
+
+FramePusher *DeviceHandle::pusher()
+{
+	return &_pusher;
+}
+
+size_t DeviceHandle::rowStride() const
+{
+	return _rowStride;
+}
+
+StreamMemory DeviceHandle::streamMemory()
+{
+	std::lock_guard lock{ _cameraMutex };
+
+	return _streamMemory;
+}
+
+FramePool *DeviceHandle::framePool()
+{
+	return &_framePool;
+}
+
+RawRecorder *DeviceHandle::rawRecorder()
+{
+	return _rawRecorder.get();
+}
+
+CaptureMetrics *DeviceHandle::metrics()
+{
+	return &_metrics;
 }
 
-int32_t DeviceHandle::incrNumClient()
+uint32_t DeviceHandle::numClients() const
 {
-	return ++_numClient;
+	return _numClients;
 }
 
-int32_t DeviceHandle::decrNumClient()
+void DeviceHandle::setNumClients(uint32_t numClients)
 {
-	return _numClient == 0 ? _numClient : --_numClient;
+	_numClients = numClients;
 }
\ No newline at end of file
@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "DiskRing.hpp"
+
+/// Bytes written at once, segments are a whole number of blocks
+static constexpr size_t BLOCK_SIZE{ 1 << 20 };
+/// Alignment of the staging block in memory
+static constexpr size_t BLOCK_ALIGNMENT{ 4096 };
+/// Fewest segments of a ring, one is written while the other is exported
+static constexpr uint64_t MIN_SEGMENTS{ 2 };
+/// Smallest segment in blocks
+static constexpr uint64_t MIN_SEGMENT_BLOCKS{ 4 };
+/// Segment room relative to the configured bitrate, encoders overshoot on busy scenes
+static constexpr uint64_t SEGMENT_HEADROOM{ 2 };
+/// Bytes of a clip read at once when it is exported
+static constexpr size_t CLIP_CHUNK_SIZE{ 256 << 10 };
+
+static uint64_t roundUpToBlocks(uint64_t size)
+{
+	return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+DiskRing::DiskRing(std::string directory, uint64_t size, uint64_t segmentSize, gint64 segmentDuration):
+	_directory{ std::move(directory) },
+	_segmentSize{ std::max(roundUpToBlocks(segmentSize), MIN_SEGMENT_BLOCKS * BLOCK_SIZE) },
+	_segmentDuration{ segmentDuration },
+	_segments(std::max(size / _segmentSize, MIN_SEGMENTS), Segment{}),
+	_current{},
+	_writing{},
+	_generation{},
+	_block{},
+	_blockOffset{},
+	_staged{},
+	_flushed{},
+	_bytesWritten{},
+	_writeErrors{}
+{}
+
+DiskRing::~DiskRing()
+{
+	finishSegment();
+	for(auto file : _files)
+		close(file);
+	std::free(_block);
+}
+
+bool DiskRing::open()
+{
+	std::lock_guard blockLock{ _blockMutex };
+	std::lock_guard lock{ _mutex };
+
+	if(g_mkdir_with_parents(_directory.c_str(), 0755) != 0)
+	{
+		GST_ERROR("failed to create recording directory %s: %s", _directory.c_str(), g_strerror(errno));
+		return false;
+	}
+
+	_block = static_cast<uint8_t *>(std::aligned_alloc(BLOCK_ALIGNMENT, BLOCK_SIZE));
+	for(size_t i = 0; i < _segments.size(); i++)
+	{
+		auto path = fmt::format("{}/segment-{:03}.ts", _directory, i);
+		int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		int error;
+
+		if(file < 0)
+		{
+			GST_ERROR("failed to open recording segment %s: %s", path.c_str(), g_strerror(errno));
+			break;
+		}
+		// reserved up front, the ring never runs out of space while it records
+		if((error = posix_fallocate(file, 0, static_cast<off_t>(_segmentSize))) != 0)
+		{
+			GST_ERROR("failed to preallocate %" G_GUINT64_FORMAT " bytes for %s: %s", _segmentSize, path.c_str(),
+								g_strerror(error));
+			close(file);
+			break;
+		}
+		_files.push_back(file);
+	}
+
+	if(_files.size() < _segments.size())
+	{
+		for(auto file : _files)
+			close(file);
+		_files.clear();
+		return false;
+	}
+
+	GST_INFO("recording to %s: %zu segments of %" G_GUINT64_FORMAT " MiB", _directory.c_str(), _segments.size(),
+					 _segmentSize >> 20);
+	return true;
+}
+
+void DiskRing::write(const uint8_t *data, size_t size, bool keyframe)
+{
+	std::unique_lock blockLock{ _blockMutex };
+	gint64 now = g_get_monotonic_time();
+	int closed{ -1 };
+
+	if(_files.empty())
+		return;
+	if(size > _segmentSize)
+	{
+		GST_WARNING("dropping %zu bytes larger than a recording segment", size);
+		return;
+	}
+
+	// a segment starts at a keyframe once it is long enough, or early when it is full
+	if(!_writing || (keyframe && now - _segments[_current].start >= _segmentDuration))
+		closed = startSegment(keyframe, now);
+	else if(_blockOffset + _staged + size > _segmentSize)
+		closed = startSegment(false, now);
+
+	while(size > 0)
+	{
+		auto count = std::min(size, BLOCK_SIZE - _staged);
+
+		std::memcpy(_block + _staged, data, count);
+		_staged += count;
+		data += count;
+		size -= count;
+		if(_staged == BLOCK_SIZE)
+		{
+			flush();
+			_blockOffset += BLOCK_SIZE;
+			_staged = 0;
+			_flushed = 0;
+		}
+	}
+
+	{
+		std::lock_guard lock{ _mutex };
+		auto &segment = _segments[_current];
+
+		segment.length = _blockOffset + _staged;
+		segment.end = now;
+	}
+
+	blockLock.unlock();
+	if(closed >= 0)
+		syncSegment(static_cast<uint32_t>(closed));
+}
+
+void DiskRing::finishSegment()
+{
+	std::unique_lock blockLock{ _blockMutex };
+	uint32_t closed;
+
+	if(!_writing)
+		return;
+	closed = closeSegment();
+	blockLock.unlock();
+	syncSegment(closed);
+}
+
+bool DiskRing::clipParts(double seconds, std::vector<ClipPart> &parts)
+{
+	std::lock_guard blockLock{ _blockMutex };
+	gint64 since = g_get_monotonic_time() - static_cast<gint64>(seconds * G_USEC_PER_SEC);
+	auto count = static_cast<uint32_t>(_segments.size());
+
+	parts.clear();
+	if(_files.empty())
+		return false;
+	// the staged bytes of the current segment are part of the clip
+	if(_writing)
+		flush();
+
+	std::lock_guard lock{ _mutex };
+
+	for(uint32_t i = 0, index = newest(); i < count; i++, index = (index + count - 1) % count)
+	{
+		const auto &segment = _segments[index];
+
+		if(segment.generation == 0)
+			break;
+		parts.push_back({ index, segment.length, segment.generation, segment.keyframe });
+		if(segment.keyframe && segment.start <= since)
+			break;
+	}
+
+	// oldest first, starting with a keyframe
+	std::reverse(parts.begin(), parts.end());
+	while(!parts.empty() && !parts.front().keyframe)
+		parts.erase(parts.begin());
+	return !parts.empty();
+}
+
+bool DiskRing::exportClip(const std::vector<ClipPart> &parts, const ClipWriter &write)
+{
+	std::vector<uint8_t> chunk(CLIP_CHUNK_SIZE);
+	bool started{};
+
+	// read without the lock, the streaming thread keeps writing
+	for(const auto &part : parts)
+	{
+		uint64_t offset{};
+
+		// segments reused before the clip got to them are lost, it starts at the next keyframe after them
+		if(!started && !part.keyframe)
+			continue;
+
+		while(offset < part.length)
+		{
+			auto size = static_cast<size_t>(std::min<uint64_t>(chunk.size(), part.length - offset));
+			auto count = pread(_files[part.index], chunk.data(), size, static_cast<off_t>(offset));
+
+			if(count <= 0)
+			{
+				if(count < 0 && errno == EINTR)
+					continue;
+				GST_WARNING("failed to read recording segment %u: %s", part.index, g_strerror(errno));
+				return false;
+			}
+			// checked after the read, the chunk may hold data of the next recording otherwise
+			if(!isCurrent(part))
+				break;
+			if(!write(chunk.data(), static_cast<size_t>(count)))
+				return false;
+			started = true;
+			offset += static_cast<uint64_t>(count);
+		}
+
+		// what was sent is continuous, a gap in the middle of the clip ends it
+		if(offset < part.length && started)
+		{
+			GST_INFO("recording segment %u was overwritten while it was exported, clip ends early", part.index);
+			return true;
+		}
+	}
+	return true;
+}
+
+double DiskRing::duration()
+{
+	std::lock_guard lock{ _mutex };
+	auto count = static_cast<uint32_t>(_segments.size());
+	gint64 start{}, end{};
+
+	for(uint32_t i = 0, index = newest(); i < count; i++, index = (index + count - 1) % count)
+	{
+		const auto &segment = _segments[index];
+
+		if(segment.generation == 0)
+			break;
+		if(i == 0)
+			end = segment.end;
+		if(segment.keyframe)
+			start = segment.start;
+	}
+	return start != 0 ? static_cast<double>(end - start) / G_USEC_PER_SEC : 0;
+}
+
+const std::string &DiskRing::directory() const
+{
+	return _directory;
+}
+
+uint64_t DiskRing::bytesWritten() const
+{
+	return _bytesWritten;
+}
+
+uint64_t DiskRing::writeErrors() const
+{
+	return _writeErrors;
+}
+
+const Histogram &DiskRing::writeTime() const
+{
+	return _writeTime;
+}
+
+const Histogram &DiskRing::syncTime() const
+{
+	return _syncTime;
+}
+
+uint64_t DiskRing::segmentSizeFor(int64_t bitrate, uint32_t seconds)
+{
+	// kbit/s to bytes per second
+	return static_cast<uint64_t>(std::max(bitrate, int64_t{ 0 })) * 125 * seconds * SEGMENT_HEADROOM;
+}
+
+int DiskRing::startSegment(bool keyframe, gint64 now)
+{
+	int closed{ -1 };
+
+	if(_writing)
+		closed = static_cast<int>(closeSegment());
+
+	std::lock_guard lock{ _mutex };
+
+	// the generation changes before the file is written again, exports notice the reuse
+	_segments[_current] = { now, now, 0, keyframe, ++_generation };
+	_blockOffset = 0;
+	_staged = 0;
+	_flushed = 0;
+	_writing = true;
+	return closed;
+}
+
+uint32_t DiskRing::closeSegment()
+{
+	uint32_t closed = _current;
+
+	flush();
+
+	std::lock_guard lock{ _mutex };
+
+	_current = (_current + 1) % static_cast<uint32_t>(_segments.size());
+	_writing = false;
+	return closed;
+}
+
+void DiskRing::syncSegment(uint32_t index)
+{
+	gint64 start = g_get_monotonic_time();
+
+	// the ring wraps around the other segments before the file is written again
+	if(fdatasync(_files[index]) != 0)
+	{
+		GST_WARNING("failed to sync recording segment %u: %s", index, g_strerror(errno));
+		_writeErrors++;
+	}
+	_syncTime.observe(static_cast<guint64>(g_get_monotonic_time() - start) * 1000);
+	// read again only for an export, the page cache is better left to the pipeline
+	posix_fadvise(_files[index], 0, 0, POSIX_FADV_DONTNEED);
+}
+
+void DiskRing::flush()
+{
+	gint64 start;
+	ssize_t written;
+
+	if(_staged == _flushed)
+		return;
+
+	// the whole block is written again, so every write starts block-aligned
+	start = g_get_monotonic_time();
+	written = pwrite(_files[_current], _block, _staged, static_cast<off_t>(_blockOffset));
+	_writeTime.observe(static_cast<guint64>(g_get_monotonic_time() - start) * 1000);
+	if(written != static_cast<ssize_t>(_staged))
+	{
+		GST_WARNING("failed to write recording segment %u: %s", _current,
+								written < 0 ? g_strerror(errno) : "short write");
+		_writeErrors++;
+		return;
+	}
+	_bytesWritten += _staged - _flushed;
+	_flushed = _staged;
+}
+
+bool DiskRing::isCurrent(const ClipPart &part)
+{
+	std::lock_guard lock{ _mutex };
+
+	return _segments[part.index].generation == part.generation;
+}
+
+uint32_t DiskRing::newest() const
+{
+	auto count = static_cast<uint32_t>(_segments.size());
+
+	return _writing ? _current : (_current + count - 1) % count;
+}
@@ -0,0 +1,264 @@
+#include <cstring>
+
+#include <fmt/format.h>
+
+#include "Encoder.hpp"
+
+/// Encoders in the order they are probed
+static constexpr EncoderInfo ENCODERS[] = {
+	{ Encoder::Nvv4l2H264, "nvv4l2h264enc", Codec::H264, "nvvidconv", 1000 },
+	{ Encoder::Nvv4l2H265, "nvv4l2h265enc", Codec::H265, "nvvidconv", 1000 },
+	{ Encoder::VaapiH264, "vaapih264enc", Codec::H264, nullptr, 1 },
+	{ Encoder::VaapiH265, "vaapih265enc", Codec::H265, nullptr, 1 },
+	{ Encoder::X264, "x264enc", Codec::H264, nullptr, 1 },
+	{ Encoder::OpenH264, "openh264enc", Codec::H264, nullptr, 1000 },
+	{ Encoder::X265, "x265enc", Codec::H265, nullptr, 1 },
+};
+
+static bool hasFeature(const char *name)
+{
+	GstPluginFeature *feature = gst_registry_lookup_feature(gst_registry_get(), name);
+
+	if(feature == nullptr)
+		return false;
+	gst_object_unref(feature);
+	return true;
+}
+
+/**
+ * @brief Preset name of x264enc and x265enc.
+ * */
+static const char *x26xPreset(EncoderPreset preset)
+{
+	switch(preset)
+	{
+		case EncoderPreset::UltraFast:
+			return "ultrafast";
+		case EncoderPreset::Fast:
+			return "fast";
+		case EncoderPreset::Slow:
+			return "slow";
+		default:
+			return "medium";
+	}
+}
+
+static void appendNvv4l2(PipelineBuilder &pipeline, const EncoderInfo &info, const EncoderDescription &description)
+{
+	const auto &settings = description.settings;
+
+	pipeline.element(info.converter).caps("video/x-raw", "memory:NVMM").field("format", "I420");
+	// insert-sps-pps repeats the parameter sets for clients joining late
+	pipeline.element(info.element)
+		.property("bitrate", description.bitrate * info.bitrateScale)
+		.property("insert-sps-pps", "true");
+	if(info.codec == Codec::H264)
+		pipeline.property("profile", int64_t{ 2 });
+	if(settings.rateControl.has_value())
+		pipeline.property("control-rate", *settings.rateControl == RateControl::Cbr ? int64_t{ 1 } : int64_t{ 0 });
+	if(settings.preset.has_value())
+		pipeline.property("preset-level", static_cast<int64_t>(*settings.preset) + 1);
+	if(settings.gopLength > 0)
+		pipeline.property("iframeinterval", settings.gopLength).property("idrinterval", settings.gopLength);
+	if(settings.bFrames > 0)
+		pipeline.property("num-B-Frames", settings.bFrames);
+}
+
+static void appendVaapi(PipelineBuilder &pipeline, const EncoderInfo &info, const EncoderDescription &description)
+{
+	const auto &settings = description.settings;
+	// 1 is the best quality, 7 the fastest
+	static constexpr int64_t QUALITY_LEVELS[]{ 7, 6, 4, 2 };
+
+	pipeline.element(info.element).property("bitrate", description.bitrate);
+	if(settings.rateControl.has_value())
+		pipeline.property("rate-control", *settings.rateControl == RateControl::Cbr ? "cbr" : "vbr");
+	if(settings.preset.has_value())
+		pipeline.property("quality-level", QUALITY_LEVELS[static_cast<size_t>(*settings.preset)]);
+	if(settings.gopLength > 0)
+		pipeline.property("keyframe-period", settings.gopLength);
+	if(settings.bFrames > 0)
+		pipeline.property("max-bframes", settings.bFrames);
+}
+
+static void appendX264(PipelineBuilder &pipeline, const EncoderInfo &info, const EncoderDescription &description)
+{
+	const auto &settings = description.settings;
+
+	// properties set after the tune override it, e.g. bframes
+	pipeline.element(info.element).property("tune", "zerolatency").property("bitrate", description.bitrate);
+	// qual encodes at constant quality with the bitrate as ceiling
+	if(settings.rateControl.has_value())
+		pipeline.property("pass", *settings.rateControl == RateControl::Cbr ? "cbr" : "qual");
+	if(settings.preset.has_value())
+		pipeline.property("speed-preset", x26xPreset(*settings.preset));
+	if(settings.gopLength > 0)
+		pipeline.property("key-int-max", settings.gopLength);
+	if(settings.bFrames > 0)
+		pipeline.property("bframes", settings.bFrames);
+	if(settings.threads > 0)
+		pipeline.property("threads", settings.threads);
+	pipeline.caps("video/x-h264").field("profile", "main");
+}
+
+static void appendOpenH264(PipelineBuilder &pipeline, const EncoderInfo &info, const EncoderDescription &description)
+{
+	const auto &settings = description.settings;
+
+	// the baseline profile has no B-frames
+	pipeline.element(info.element).property("bitrate", description.bitrate * info.bitrateScale);
+	if(settings.rateControl.has_value())
+		pipeline.property("rate-control", *settings.rateControl == RateControl::Cbr ? "bitrate" : "quality");
+	if(settings.preset.has_value())
+	{
+		if(*settings.preset == EncoderPreset::Slow)
+			pipeline.property("complexity", "high");
+		else if(*settings.preset == EncoderPreset::Medium)
+			pipeline.property("complexity", "medium");
+		else
+			pipeline.property("complexity", "low");
+	}
+	if(settings.gopLength > 0)
+		pipeline.property("gop-size", settings.gopLength);
+	if(settings.threads > 0)
+		pipeline.property("multi-thread", settings.threads);
+}
+
+static void appendX265(PipelineBuilder &pipeline, const EncoderInfo &info, const EncoderDescription &description)
+{
+	const auto &settings = description.settings;
+	std::string options;
+
+	pipeline.element(info.element).property("tune", "zerolatency").property("bitrate", description.bitrate);
+	if(settings.preset.has_value())
+		pipeline.property("speed-preset", x26xPreset(*settings.preset));
+	if(settings.gopLength > 0)
+		pipeline.property("key-int-max", settings.gopLength);
+
+	// x265enc has no properties for these, the option string overrides the tune
+	if(settings.bFrames > 0)
+		options += fmt::format(":bframes={}", settings.bFrames);
+	if(settings.threads > 0)
+		options += fmt::format(":pools={}", settings.threads);
+	if(settings.rateControl.has_value())
+	{
+		options += fmt::format(":vbv-maxrate={0}:vbv-bufsize={0}", description.bitrate);
+		if(*settings.rateControl == RateControl::Cbr)
+			options += ":strict-cbr=1";
+	}
+	if(!options.empty())
+		pipeline.property("option-string", std::string_view{ options }.substr(1));
+}
+
+std::span<const EncoderInfo> encoders()
+{
+	return ENCODERS;
+}
+
+const EncoderInfo &encoderInfo(Encoder encoder)
+{
+	for(const auto &info : ENCODERS)
+	{
+		if(info.encoder == encoder)
+			return info;
+	}
+	return ENCODERS[0];
+}
+
+bool encoderFromString(const char *name, Encoder &encoder)
+{
+	for(const auto &info : ENCODERS)
+	{
+		if(name != nullptr && g_str_equal(name, info.element))
+		{
+			encoder = info.encoder;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool codecFromString(const char *name, Codec &codec)
+{
+	if(name == nullptr)
+		return false;
+	if(g_ascii_strcasecmp(name, "h264") == 0)
+		codec = Codec::H264;
+	else if(g_ascii_strcasecmp(name, "h265") == 0 || g_ascii_strcasecmp(name, "hevc") == 0)
+		codec = Codec::H265;
+	else
+		return false;
+	return true;
+}
+
+const char *codecName(Codec codec)
+{
+	return codec == Codec::H265 ? "h265" : "h264";
+}
+
+std::string codecMediaType(Codec codec)
+{
+	return fmt::format("video/x-{}", codecName(codec));
+}
+
+bool isEncoderAvailable(Encoder encoder)
+{
+	const auto &info = encoderInfo(encoder);
+	auto parser = fmt::format("{}parse", codecName(info.codec));
+	auto payloader = fmt::format("rtp{}pay", codecName(info.codec));
+
+	return hasFeature(info.element) && (info.converter == nullptr || hasFeature(info.converter)) &&
+				 hasFeature(parser.c_str()) && hasFeature(payloader.c_str());
+}
+
+void appendEncoder(PipelineBuilder &pipeline, const EncoderDescription &description)
+{
+	const auto &info = encoderInfo(description.encoder);
+
+	switch(description.encoder)
+	{
+		case Encoder::Nvv4l2H264:
+		case Encoder::Nvv4l2H265:
+			appendNvv4l2(pipeline, info, description);
+			break;
+		case Encoder::VaapiH264:
+		case Encoder::VaapiH265:
+			appendVaapi(pipeline, info, description);
+			break;
+		case Encoder::X264:
+			appendX264(pipeline, info, description);
+			break;
+		case Encoder::OpenH264:
+			appendOpenH264(pipeline, info, description);
+			break;
+		case Encoder::X265:
+			appendX265(pipeline, info, description);
+			break;
+	}
+}
+
+GstElement *upstreamEncoder(GstElement *element)
+{
+	GstElement *current = GST_ELEMENT(gst_object_ref(element));
+
+	while(current != nullptr)
+	{
+		auto klass = gst_element_get_metadata(current, GST_ELEMENT_METADATA_KLASS);
+		GstPad *sink, *peer;
+
+		if(current != element && klass != nullptr && strstr(klass, "Encoder") != nullptr)
+			return current;
+
+		sink = gst_element_get_static_pad(current, "sink");
+		gst_object_unref(current);
+		if(sink == nullptr)
+			return nullptr;
+		peer = gst_pad_get_peer(sink);
+		gst_object_unref(sink);
+		if(peer == nullptr)
+			return nullptr;
+		current = gst_pad_get_parent_element(peer);
+		gst_object_unref(peer);
+	}
+	return nullptr;
+}
@@ -0,0 +1,130 @@
+#include "Callback.hpp"
+#include "EncoderProbe.hpp"
+
+/// Frames encoded by the benchmark of an encoder
+static constexpr int64_t PROBE_FRAMES{ 60 };
+/// Leading frames left out while encoders allocate and fill their lookahead
+static constexpr uint32_t PROBE_WARMUP_FRAMES{ 10 };
+/// Encoders slower than this are given up on
+static constexpr GstClockTime PROBE_TIMEOUT{ 20 * GST_SECOND };
+/// Frame rate the encoder has to reach when the camera frame rate is not configured
+static constexpr double DEFAULT_TARGET_FRAME_RATE{ 30 };
+
+double measureEncoder(const EncoderDescription &description, int32_t width, int32_t height)
+{
+	PipelineBuilder builder;
+	GError *error{};
+	GstElement *pipeline, *sink;
+	GstPad *pad;
+	GstBus *bus;
+	GstMessage *message;
+	EncodedFrameCount count{ PROBE_WARMUP_FRAMES, 0, 0, 0 };
+	bool failed;
+
+	builder.element("videotestsrc")
+		.property("num-buffers", PROBE_FRAMES)
+		.property("pattern", "smpte")
+		.property("horizontal-speed", int64_t{ 4 })
+		.caps("video/x-raw")
+		.field("format", "I420")
+		.field("width", width)
+		.field("height", height)
+		.field("framerate", 30, 1)
+		.element("queue");
+	appendEncoder(builder, description);
+	builder.element("fakesink").property("name", "sink").property("sync", "false");
+
+	pipeline = gst_parse_launch(builder.str().c_str(), &error);
+	if(pipeline == nullptr)
+	{
+		GST_WARNING("failed to create probe pipeline of %s: %s", encoderInfo(description.encoder).element,
+								error->message);
+		g_error_free(error);
+		return -1;
+	}
+	if(error != nullptr)
+		g_error_free(error);
+
+	sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	pad = gst_element_get_static_pad(sink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, encodedFrameProbe, &count, nullptr);
+	gst_object_unref(pad);
+	gst_object_unref(sink);
+
+	bus = gst_element_get_bus(pipeline);
+	if(gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+	{
+		message = nullptr;
+		failed = true;
+	}
+	else
+	{
+		message = gst_bus_timed_pop_filtered(bus, PROBE_TIMEOUT,
+																				 static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+		failed = message == nullptr || GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR;
+	}
+
+	if(message != nullptr)
+		gst_message_unref(message);
+	gst_object_unref(bus);
+	// the probe writes to the count until the streaming threads are stopped
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(pipeline);
+
+	if(failed || count.frames < 2 || count.last <= count.first)
+		return -1;
+	return static_cast<double>(count.frames - 1) * G_USEC_PER_SEC / static_cast<double>(count.last - count.first);
+}
+
+Encoder probeEncoder(const Options &options)
+{
+	double targetFrameRate = options.frameRate.value_or(DEFAULT_TARGET_FRAME_RATE);
+	double bestFrameRate{ -1 };
+	Encoder best = options.encoding.codec == Codec::H265 ? Encoder::X265 : Encoder::X264;
+
+	for(const auto &info : encoders())
+	{
+		bool gpu = info.converter != nullptr;
+
+		if(info.codec != options.encoding.codec)
+			continue;
+		if((options.mode == HardwareMode::Gpu && !gpu) || (options.mode == HardwareMode::Cpu && gpu))
+			continue;
+
+		if(!isEncoderAvailable(info.encoder))
+		{
+			GST_INFO("encoder %s: not available", info.element);
+			continue;
+		}
+
+		double frameRate =
+			measureEncoder({ info.encoder, options.bitrate, options.encoding }, options.width, options.height);
+		if(frameRate < 0)
+		{
+			GST_WARNING("encoder %s: failed to encode %dx%d frames", info.element, options.width, options.height);
+			continue;
+		}
+
+		GST_INFO("encoder %s: %.1f fps at %dx%d", info.element, frameRate, options.width, options.height);
+		if(frameRate > bestFrameRate)
+		{
+			bestFrameRate = frameRate;
+			best = info.encoder;
+		}
+	}
+
+	if(bestFrameRate < 0)
+	{
+		GST_ERROR("no working %s encoder found, falling back to %s", codecName(options.encoding.codec),
+							encoderInfo(best).element);
+		return best;
+	}
+
+	if(bestFrameRate < targetFrameRate)
+	{
+		GST_WARNING("fastest encoder %s reaches %.1f of %.1f fps", encoderInfo(best).element, bestFrameRate,
+								targetFrameRate);
+	}
+	GST_INFO("encoding with %s at up to %.1f fps", encoderInfo(best).element, bestFrameRate);
+	return best;
+}
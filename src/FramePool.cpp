@@ -0,0 +1,174 @@
+#include "FramePool.hpp"
+
+/**
+ * Release records of a pool, freed with the last of the pool and the records held downstream.
+ * */
+struct ReleaseDataStore
+{
+	~ReleaseDataStore()
+	{
+		for(auto record : releaseData)
+			delete record;
+	}
+
+	void add(uint32_t count)
+	{
+		for(uint32_t i = 0; i < count; i++)
+		{
+			auto record = new ArvGstBufferReleaseData();
+			releaseData.push_back(record);
+			freeReleaseData.push_back(record);
+		}
+	}
+
+	std::mutex mutex;
+	std::vector<ArvGstBufferReleaseData *> releaseData;
+	std::vector<ArvGstBufferReleaseData *> freeReleaseData;
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+};
+
+FramePool::FramePool(uint32_t capacity):
+	_capacity{ capacity },
+	_bufferSize{},
+	_bufferPool{},
+	_store{ std::make_shared<ReleaseDataStore>() },
+	_hits{},
+	_misses{}
+{
+	_store->releaseData.reserve(_capacity);
+	_store->freeReleaseData.reserve(_capacity);
+	_store->add(_capacity);
+}
+
+FramePool::~FramePool()
+{
+	// records still held downstream keep the store until they are released
+	reset();
+}
+
+GstBuffer *FramePool::acquireBuffer(gsize size)
+{
+	GstBuffer *buffer{};
+	GstBufferPoolAcquireParams params{};
+
+	if(size != _bufferSize)
+		configure(size);
+
+	// never wait for a buffer on the stream thread, allocate instead
+	params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+
+	if(_bufferPool != nullptr && gst_buffer_pool_acquire_buffer(_bufferPool, &buffer, &params) == GST_FLOW_OK)
+	{
+		_hits++;
+		return buffer;
+	}
+
+	_misses++;
+	return gst_buffer_new_allocate(nullptr, size, nullptr);
+}
+
+ArvGstBufferReleaseData *FramePool::acquireReleaseData()
+{
+	std::lock_guard lock{ _store->mutex };
+	ArvGstBufferReleaseData *releaseData;
+
+	if(_store->freeReleaseData.empty())
+	{
+		_store->misses++;
+		releaseData = new ArvGstBufferReleaseData();
+		_store->releaseData.push_back(releaseData);
+	}
+	else
+	{
+		_store->hits++;
+		releaseData = _store->freeReleaseData.back();
+		_store->freeReleaseData.pop_back();
+	}
+
+	releaseData->store = _store;
+	return releaseData;
+}
+
+void FramePool::recycleReleaseData(ArvGstBufferReleaseData *releaseData)
+{
+	// the store may go with this reference when its pool is gone, after the record is back in it
+	std::shared_ptr<ReleaseDataStore> store = std::move(releaseData->store);
+	std::lock_guard lock{ store->mutex };
+
+	releaseData->arvBuffer = nullptr;
+	store->freeReleaseData.push_back(releaseData);
+}
+
+void FramePool::reserve(uint32_t capacity)
+{
+	{
+		std::lock_guard lock{ _store->mutex };
+
+		if(capacity > _capacity)
+			_store->add(capacity - _capacity);
+	}
+	_capacity = capacity;
+	// the frame buffer pool is sized on its next configuration
+	reset();
+}
+
+void FramePool::reset()
+{
+	if(_bufferPool != nullptr)
+	{
+		// outstanding buffers are freed when they return to an inactive pool
+		gst_buffer_pool_set_active(_bufferPool, false);
+		gst_object_unref(_bufferPool);
+		_bufferPool = nullptr;
+	}
+	_bufferSize = 0;
+}
+
+uint64_t FramePool::hits() const
+{
+	return _hits;
+}
+
+uint64_t FramePool::misses() const
+{
+	return _misses;
+}
+
+uint64_t FramePool::releaseDataHits() const
+{
+	return _store->hits;
+}
+
+uint64_t FramePool::releaseDataMisses() const
+{
+	return _store->misses;
+}
+
+void FramePool::configure(gsize size)
+{
+	GstStructure *config;
+	GstAllocationParams params;
+
+	reset();
+
+	// a failed configuration is not retried until the frame size changes
+	_bufferSize = size;
+	_bufferPool = gst_buffer_pool_new();
+	config = gst_buffer_pool_get_config(_bufferPool);
+	gst_allocation_params_init(&params);
+	// cache line aligned rows for the repacking loop
+	params.align = 63;
+	gst_buffer_pool_config_set_allocator(config, nullptr, &params);
+	gst_buffer_pool_config_set_params(config, nullptr, static_cast<guint>(size), _capacity, _capacity);
+
+	if(!gst_buffer_pool_set_config(_bufferPool, config) || !gst_buffer_pool_set_active(_bufferPool, true))
+	{
+		GST_WARNING("failed to configure frame pool for %" G_GSIZE_FORMAT " bytes", size);
+		gst_object_unref(_bufferPool);
+		_bufferPool = nullptr;
+		return;
+	}
+
+	GST_INFO("frame pool configured: %u buffers of %" G_GSIZE_FORMAT " bytes", _capacity, size);
+}
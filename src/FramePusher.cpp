@@ -0,0 +1,167 @@
+#include "FramePusher.hpp"
+
+FramePusher::FramePusher(uint32_t depth, OverflowPolicy policy, CaptureMetrics *metrics):
+	_policy{ policy },
+	_metrics{ metrics },
+	_ring{ depth },
+	_source{},
+	_running{},
+	_queued{},
+	_taken{},
+	_pushing{},
+	_pushed{},
+	_dropped{},
+	_latencySum{},
+	_latencyMax{}
+{}
+
+FramePusher::~FramePusher()
+{
+	stop();
+	drain();
+}
+
+void FramePusher::start(GstAppSrc *source)
+{
+	if(_running)
+		return;
+
+	_source = source;
+	_running = true;
+	_thread = std::thread(&FramePusher::run, this);
+}
+
+void FramePusher::stop()
+{
+	if(!_running.exchange(false))
+		return;
+
+	_queued++;
+	_queued.notify_one();
+	_taken++;
+	_taken.notify_all();
+
+	if(_thread.joinable())
+		_thread.join();
+	_source = nullptr;
+
+	// a push that saw the pusher running may still queue its frame, wait for it
+	// so the drain catches it and the next start does not push it to a new source
+	for(uint32_t pushing = _pushing.load(); pushing != 0; pushing = _pushing.load())
+		_pushing.wait(pushing);
+	drain();
+}
+
+bool FramePusher::push(GstBuffer *buffer)
+{
+	bool queued;
+
+	_pushing++;
+	queued = enqueue(buffer);
+	if(--_pushing == 0)
+		_pushing.notify_all();
+	return queued;
+}
+
+bool FramePusher::enqueue(GstBuffer *buffer)
+{
+	GstBuffer *oldest;
+	uint64_t stamp;
+	bool queued{};
+
+	if(!_running)
+	{
+		drop(buffer);
+		return false;
+	}
+
+	while(!(queued = _ring.push(buffer, g_get_monotonic_time())))
+	{
+		if(!_running || _policy == OverflowPolicy::DropNewest)
+		{
+			drop(buffer);
+			break;
+		}
+
+		if(_policy == OverflowPolicy::DropOldest)
+		{
+			if(_ring.evict(oldest, stamp))
+				drop(oldest);
+			continue;
+		}
+
+		// wait for the pusher thread to take a frame
+		uint32_t taken = _taken.load(std::memory_order_acquire);
+		if(_ring.size() >= _ring.capacity() && _running)
+			_taken.wait(taken);
+	}
+
+	if(queued)
+	{
+		_queued.fetch_add(1, std::memory_order_release);
+		_queued.notify_one();
+	}
+	return queued;
+}
+
+FramePusherStats FramePusher::stats() const
+{
+	uint64_t pushed = _pushed;
+
+	return {
+		.pushed = pushed,
+		.dropped = _dropped,
+		.depth = _ring.size(),
+		.averageLatency = pushed > 0 ? static_cast<double>(_latencySum) / static_cast<double>(pushed) : 0.0,
+		.maxLatency = _latencyMax
+	};
+}
+
+void FramePusher::run()
+{
+	GstBuffer *buffer;
+	uint64_t stamp;
+
+	while(true)
+	{
+		uint32_t queued = _queued.load(std::memory_order_acquire);
+
+		if(_ring.pop(buffer, stamp))
+		{
+			int64_t latency = g_get_monotonic_time() - static_cast<int64_t>(stamp);
+
+			_taken.fetch_add(1, std::memory_order_release);
+			_taken.notify_one();
+
+			_latencySum += latency;
+			if(latency > _latencyMax)
+				_latencyMax = latency;
+			_pushed++;
+
+			if(_metrics != nullptr)
+				_metrics->observe(LatencyStage::Push, buffer);
+			gst_app_src_push_buffer(_source, buffer);
+			continue;
+		}
+
+		if(!_running)
+			break;
+
+		_queued.wait(queued);
+	}
+}
+
+void FramePusher::drain()
+{
+	GstBuffer *buffer;
+	uint64_t stamp;
+
+	while(_ring.pop(buffer, stamp))
+		drop(buffer);
+}
+
+void FramePusher::drop(GstBuffer *buffer)
+{
+	_dropped++;
+	gst_buffer_unref(buffer);
+}
@@ -0,0 +1,201 @@
+#include <fmt/format.h>
+
+#include "HttpServer.hpp"
+#include "Callback.hpp"
+
+/// Largest request head read from a client
+static constexpr size_t MAX_REQUEST_SIZE{ 8192 };
+/// Seconds a client may take to send its request
+static constexpr guint REQUEST_TIMEOUT{ 2 };
+/// Connections answered at the same time
+static constexpr int32_t MAX_CONNECTIONS{ 4 };
+
+static const char *statusText(int32_t status)
+{
+	switch(status)
+	{
+		case 200:
+			return "OK";
+		case 400:
+			return "Bad Request";
+		case 404:
+			return "Not Found";
+		case 405:
+			return "Method Not Allowed";
+		case 503:
+			return "Service Unavailable";
+		default:
+			return "Internal Server Error";
+	}
+}
+
+HttpServer::HttpServer():
+	_service{},
+	_cancellable{ g_cancellable_new() },
+	_serviceAlive{}
+{}
+
+HttpServer::~HttpServer()
+{
+	stop();
+	g_object_unref(_cancellable);
+}
+
+void HttpServer::stop()
+{
+	if(_service == nullptr)
+		return;
+
+	g_socket_service_stop(_service);
+	g_socket_listener_close(G_SOCKET_LISTENER(_service));
+	// wakes the workers blocked on a slow client
+	g_cancellable_cancel(_cancellable);
+	// every queued connection holds a reference, the service is finalized after the last one is answered
+	g_object_unref(_service);
+	_service = nullptr;
+
+	std::unique_lock lock{ _mutex };
+	_finalized.wait(lock, [this] { return !_serviceAlive; });
+}
+
+void HttpServer::addHandler(const std::string &path, HttpHandler handler)
+{
+	_handlers[path] = std::move(handler);
+}
+
+bool HttpServer::listen(const std::string &address, uint16_t port)
+{
+	GError *error{};
+	GInetAddress *inetAddress;
+	GSocketAddress *socketAddress;
+	bool success;
+
+	if(_service != nullptr)
+		return true;
+
+	inetAddress = g_inet_address_new_from_string(address.c_str());
+	if(inetAddress == nullptr)
+	{
+		GST_ERROR("invalid HTTP address %s", address.c_str());
+		return false;
+	}
+
+	socketAddress = g_inet_socket_address_new(inetAddress, port);
+	g_object_unref(inetAddress);
+
+	_service = g_threaded_socket_service_new(MAX_CONNECTIONS);
+	success = g_socket_listener_add_address(G_SOCKET_LISTENER(_service), socketAddress, G_SOCKET_TYPE_STREAM,
+																					G_SOCKET_PROTOCOL_TCP, nullptr, nullptr, &error);
+	g_object_unref(socketAddress);
+
+	if(!success)
+	{
+		GST_ERROR("failed to listen on %s:%u: %s", address.c_str(), port, error->message);
+		g_error_free(error);
+		g_object_unref(_service);
+		_service = nullptr;
+		return false;
+	}
+
+	_serviceAlive = true;
+	g_object_weak_ref(G_OBJECT(_service), httpServiceFinalized, this);
+	g_signal_connect(_service, "run", reinterpret_cast<GCallback>(httpRun), this);
+	g_socket_service_start(_service);
+	GST_INFO("HTTP endpoints ready at http://%s:%u", address.c_str(), port);
+	return true;
+}
+
+void HttpServer::onConnection(GSocketConnection *connection)
+{
+	GInputStream *input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+	GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	std::string request, head;
+	HttpResponse response;
+	char chunk[1024];
+
+	g_socket_set_timeout(g_socket_connection_get_socket(connection), REQUEST_TIMEOUT);
+
+	// only the request line is used, the rest of the head is skipped
+	while(request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE)
+	{
+		gssize size = g_input_stream_read(input, chunk, sizeof(chunk), _cancellable, nullptr);
+
+		if(size <= 0)
+			break;
+		request.append(chunk, static_cast<size_t>(size));
+	}
+
+	std::string_view line{ request };
+	line = line.substr(0, line.find("\r\n"));
+	auto methodEnd = line.find(' ');
+	auto targetEnd = methodEnd != std::string_view::npos ? line.find(' ', methodEnd + 1) : std::string_view::npos;
+
+	if(targetEnd == std::string_view::npos)
+		response = { 400, "text/plain", "bad request\n" };
+	else
+		response = handle(line.substr(0, methodEnd), line.substr(methodEnd + 1, targetEnd - methodEnd - 1));
+
+	head = fmt::format("HTTP/1.0 {} {}\r\nContent-Type: {}\r\n", response.status, statusText(response.status),
+										 response.contentType);
+	// a streamed body has no known length, the client reads it up to the end of the connection
+	if(!response.writeBody)
+		head += fmt::format("Content-Length: {}\r\n", response.body.size());
+	head += "Connection: close\r\n\r\n";
+
+	if(g_output_stream_write_all(output, head.data(), head.size(), nullptr, _cancellable, nullptr))
+	{
+		if(response.writeBody)
+			response.writeBody(output, _cancellable);
+		else
+			g_output_stream_write_all(output, response.body.data(), response.body.size(), nullptr, _cancellable, nullptr);
+	}
+	g_io_stream_close(G_IO_STREAM(connection), nullptr, nullptr);
+}
+
+void HttpServer::onServiceFinalized()
+{
+	std::lock_guard lock{ _mutex };
+	_serviceAlive = false;
+	_finalized.notify_all();
+}
+
+std::string HttpServer::queryValue(std::string_view query, std::string_view name)
+{
+	while(!query.empty())
+	{
+		auto end = query.find('&');
+		auto parameter = query.substr(0, end);
+		auto separator = parameter.find('=');
+
+		if(parameter.substr(0, separator) == name)
+		{
+			if(separator == std::string_view::npos)
+				return {};
+
+			std::string value{ parameter.substr(separator + 1) };
+			char *unescaped = g_uri_unescape_string(value.c_str(), nullptr);
+
+			if(unescaped != nullptr)
+			{
+				value = unescaped;
+				g_free(unescaped);
+			}
+			return value;
+		}
+		query = end != std::string_view::npos ? query.substr(end + 1) : std::string_view{};
+	}
+	return {};
+}
+
+HttpResponse HttpServer::handle(std::string_view method, std::string_view target) const
+{
+	auto queryStart = target.find('?');
+	std::string path{ target.substr(0, queryStart) };
+	std::string_view query = queryStart != std::string_view::npos ? target.substr(queryStart + 1) : std::string_view{};
+
+	auto it = _handlers.find(path);
+	if(it == _handlers.end())
+		return { 404, "text/plain", "not found\n" };
+
+	return it->second(method, query);
+}
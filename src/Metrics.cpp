@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "Metrics.hpp"
+
+Histogram::Histogram():
+	_buckets{},
+	_count{},
+	_sum{}
+{}
+
+void Histogram::observe(guint64 value)
+{
+	auto bucket = std::lower_bound(BOUNDS.begin(), BOUNDS.end(), value) - BOUNDS.begin();
+
+	_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Histogram::render(std::string &out, std::string_view name, std::string_view labels) const
+{
+	auto append = std::back_inserter(out);
+	std::string_view separator{ labels.empty() ? "" : "," };
+	uint64_t cumulative{};
+
+	for(size_t i = 0; i < BOUNDS.size(); i++)
+	{
+		cumulative += _buckets[i].load(std::memory_order_relaxed);
+		fmt::format_to(append, "{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, separator,
+									 static_cast<double>(BOUNDS[i]) / 1e9, cumulative);
+	}
+	cumulative += _buckets[BOUNDS.size()].load(std::memory_order_relaxed);
+	fmt::format_to(append, "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, separator, cumulative);
+	fmt::format_to(append, "{}_sum{{{}}} {}\n", name, labels,
+								 static_cast<double>(_sum.load(std::memory_order_relaxed)) / 1e9);
+	fmt::format_to(append, "{}_count{{{}}} {}\n", name, labels, _count.load(std::memory_order_relaxed));
+}
+
+LossWindow::LossWindow():
+	_slots{}
+{}
+
+void LossWindow::count(uint64_t frames, uint64_t lost)
+{
+	gint64 second = g_get_monotonic_time() / G_USEC_PER_SEC;
+	std::lock_guard lock{ _mutex };
+	auto &slot = _slots[static_cast<size_t>(second) % SLOTS];
+
+	// a slot left from a previous round of the window starts over
+	if(slot.second != second)
+		slot = { second, 0, 0 };
+	slot.frames += frames;
+	slot.lost += lost;
+}
+
+double LossWindow::rate() const
+{
+	gint64 second = g_get_monotonic_time() / G_USEC_PER_SEC;
+	uint64_t frames{}, lost{};
+	std::lock_guard lock{ _mutex };
+
+	for(const auto &slot : _slots)
+	{
+		if(second - slot.second < static_cast<gint64>(SLOTS))
+		{
+			frames += slot.frames;
+			lost += slot.lost;
+		}
+	}
+	return frames > 0 ? static_cast<double>(lost) / static_cast<double>(frames) : 0;
+}
+
+CaptureMetrics::CaptureMetrics():
+	_histograms{},
+	_statusCounts{},
+	_backlogDrops{},
+	_underruns{},
+	_stalls{},
+	_recoveries{},
+	_loss{},
+	_trace{},
+	_traceNext{}
+{
+	for(auto &entry : _trace)
+		entry.pts = GST_CLOCK_TIME_NONE;
+}
+
+guint64 CaptureMetrics::captureTime(GstBuffer *buffer)
+{
+	static GstStaticCaps unixTimeCaps = GST_STATIC_CAPS("timestamp/x-unix");
+	GstReferenceTimestampMeta *meta;
+	GstCaps *caps;
+
+	caps = gst_static_caps_get(&unixTimeCaps);
+	meta = gst_buffer_get_reference_timestamp_meta(buffer, caps);
+	gst_caps_unref(caps);
+
+	return meta != nullptr ? meta->timestamp : 0;
+}
+
+void CaptureMetrics::observe(LatencyStage stage, guint64 captureTime)
+{
+	// same clock as the Aravis system timestamp
+	auto now = static_cast<guint64>(g_get_real_time()) * 1000;
+
+	if(captureTime == 0 || now < captureTime)
+		return;
+	_histograms[static_cast<size_t>(stage)].observe(now - captureTime);
+}
+
+void CaptureMetrics::observe(LatencyStage stage, GstBuffer *buffer)
+{
+	observe(stage, captureTime(buffer));
+}
+
+void CaptureMetrics::trace(GstClockTime pts, guint64 captureTime)
+{
+	if(!GST_CLOCK_TIME_IS_VALID(pts) || captureTime == 0)
+		return;
+
+	std::lock_guard lock{ _traceMutex };
+
+	_trace[_traceNext] = { pts, captureTime };
+	_traceNext = (_traceNext + 1) % TRACE_SIZE;
+}
+
+void CaptureMetrics::observeTraced(LatencyStage stage, GstClockTime pts)
+{
+	observe(stage, tracedCaptureTime(pts));
+}
+
+guint64 CaptureMetrics::tracedCaptureTime(GstClockTime pts)
+{
+	if(!GST_CLOCK_TIME_IS_VALID(pts))
+		return 0;
+
+	std::lock_guard lock{ _traceMutex };
+
+	for(const auto &entry : _trace)
+	{
+		if(entry.pts == pts)
+			return entry.captureTime;
+	}
+	return 0;
+}
+
+void CaptureMetrics::countStatus(ArvBufferStatus status)
+{
+	auto it = std::find(STATUSES.begin(), STATUSES.end(), status);
+
+	// statuses of newer Aravis versions are counted as unknown
+	if(it == STATUSES.end())
+		it = STATUSES.begin();
+	_statusCounts[it - STATUSES.begin()].fetch_add(1, std::memory_order_relaxed);
+	_loss.count(1, status == ARV_BUFFER_STATUS_SUCCESS ? 0 : 1);
+}
+
+void CaptureMetrics::countBacklogDrop()
+{
+	_backlogDrops.fetch_add(1, std::memory_order_relaxed);
+	// the frame was counted with its status already
+	_loss.count(0, 1);
+}
+
+void CaptureMetrics::countUnderruns(uint64_t underruns)
+{
+	_underruns.fetch_add(underruns, std::memory_order_relaxed);
+	_loss.count(underruns, underruns);
+}
+
+void CaptureMetrics::countStall()
+{
+	_stalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CaptureMetrics::countRecovery()
+{
+	_recoveries.fetch_add(1, std::memory_order_relaxed);
+}
+
+const Histogram &CaptureMetrics::histogram(LatencyStage stage) const
+{
+	return _histograms[static_cast<size_t>(stage)];
+}
+
+uint64_t CaptureMetrics::statusCount(ArvBufferStatus status) const
+{
+	auto it = std::find(STATUSES.begin(), STATUSES.end(), status);
+
+	return it != STATUSES.end() ? _statusCounts[it - STATUSES.begin()].load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t CaptureMetrics::backlogDrops() const
+{
+	return _backlogDrops.load(std::memory_order_relaxed);
+}
+
+uint64_t CaptureMetrics::underruns() const
+{
+	return _underruns.load(std::memory_order_relaxed);
+}
+
+uint64_t CaptureMetrics::stalls() const
+{
+	return _stalls.load(std::memory_order_relaxed);
+}
+
+uint64_t CaptureMetrics::recoveries() const
+{
+	return _recoveries.load(std::memory_order_relaxed);
+}
+
+const LossWindow &CaptureMetrics::loss() const
+{
+	return _loss;
+}
+
+const char *CaptureMetrics::stageName(LatencyStage stage)
+{
+	switch(stage)
+	{
+		case LatencyStage::Arrival:
+			return "arrival";
+		case LatencyStage::Push:
+			return "push";
+		case LatencyStage::Source:
+			return "source";
+		case LatencyStage::Encoder:
+			return "encoder";
+		case LatencyStage::Payloader:
+			return "payloader";
+		default:
+			return "unknown";
+	}
+}
+
+const char *CaptureMetrics::statusName(ArvBufferStatus status)
+{
+	switch(status)
+	{
+		case ARV_BUFFER_STATUS_SUCCESS:
+			return "success";
+		case ARV_BUFFER_STATUS_CLEARED:
+			return "cleared";
+		case ARV_BUFFER_STATUS_TIMEOUT:
+			return "timeout";
+		case ARV_BUFFER_STATUS_MISSING_PACKETS:
+			return "missing_packets";
+		case ARV_BUFFER_STATUS_WRONG_PACKET_ID:
+			return "wrong_packet_id";
+		case ARV_BUFFER_STATUS_SIZE_MISMATCH:
+			return "size_mismatch";
+		case ARV_BUFFER_STATUS_FILLING:
+			return "filling";
+		case ARV_BUFFER_STATUS_ABORTED:
+			return "aborted";
+		case ARV_BUFFER_STATUS_PAYLOAD_NOT_SUPPORTED:
+			return "payload_not_supported";
+		default:
+			return "unknown";
+	}
+}
+
+TransportMetrics::TransportMetrics():
+	_bytes{},
+	_packets{},
+	_clients{},
+	_sentPackets{},
+	_sentBytes{}
+{}
+
+void TransportMetrics::count(uint64_t packets, uint64_t bytes)
+{
+	_sentPackets.fetch_add(packets, std::memory_order_relaxed);
+	_sentBytes.fetch_add(bytes, std::memory_order_relaxed);
+
+	for(size_t index = 0; index < COUNT; index++)
+	{
+		uint64_t clients = _clients[index].load(std::memory_order_relaxed);
+		// the multicast group gets a single copy for all of its clients
+		uint64_t copies = index == static_cast<size_t>(RtpTransport::Multicast) ? std::min<uint64_t>(clients, 1) : clients;
+
+		if(copies == 0)
+			continue;
+		_packets[index].fetch_add(packets * copies, std::memory_order_relaxed);
+		_bytes[index].fetch_add(bytes * copies, std::memory_order_relaxed);
+	}
+}
+
+void TransportMetrics::addClient(RtpTransport transport)
+{
+	_clients[static_cast<size_t>(transport)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransportMetrics::removeClient(RtpTransport transport)
+{
+	_clients[static_cast<size_t>(transport)].fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint64_t TransportMetrics::bytes(RtpTransport transport) const
+{
+	return _bytes[static_cast<size_t>(transport)].load(std::memory_order_relaxed);
+}
+
+uint64_t TransportMetrics::packets(RtpTransport transport) const
+{
+	return _packets[static_cast<size_t>(transport)].load(std::memory_order_relaxed);
+}
+
+uint32_t TransportMetrics::clients(RtpTransport transport) const
+{
+	return _clients[static_cast<size_t>(transport)].load(std::memory_order_relaxed);
+}
+
+uint64_t TransportMetrics::sentPackets() const
+{
+	return _sentPackets.load(std::memory_order_relaxed);
+}
+
+uint64_t TransportMetrics::sentBytes() const
+{
+	return _sentBytes.load(std::memory_order_relaxed);
+}
+
+const char *TransportMetrics::transportName(RtpTransport transport)
+{
+	switch(transport)
+	{
+		case RtpTransport::Udp:
+			return "udp";
+		case RtpTransport::Multicast:
+			return "multicast";
+		case RtpTransport::Tcp:
+			return "tcp";
+		default:
+			return "unknown";
+	}
+}
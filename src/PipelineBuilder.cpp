@@ -0,0 +1,159 @@
+#include <algorithm>
+
+#include "PipelineBuilder.hpp"
+
+/**
+ * @brief Quote a value unless it only holds characters the parser takes as is.
+ * */
+static std::string quoted(std::string_view value)
+{
+	std::string out;
+	bool plain = !value.empty() && std::all_of(value.begin(), value.end(), [](char c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+					 c == '.' || c == ':' || c == '/';
+	});
+
+	if(plain)
+		return std::string{ value };
+
+	out.reserve(value.size() + 2);
+	out += '"';
+	for(char c : value)
+	{
+		if(c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	out += '"';
+	return out;
+}
+
+PipelineBuilder::PipelineBuilder():
+	_chains{ 1 }
+{}
+
+PipelineBuilder &PipelineBuilder::element(std::string_view factory)
+{
+	_chains.back().items.emplace_back(factory);
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::caps(std::string_view mediaType, std::string_view features)
+{
+	std::string item{ mediaType };
+
+	if(!features.empty())
+	{
+		item += '(';
+		item += features;
+		item += ')';
+	}
+	_chains.back().items.push_back(std::move(item));
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::property(std::string_view name, std::string_view value)
+{
+	auto &item = last();
+
+	item += ' ';
+	item += name;
+	item += '=';
+	item += quoted(value);
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::property(std::string_view name, const char *value)
+{
+	return property(name, std::string_view{ value });
+}
+
+PipelineBuilder &PipelineBuilder::property(std::string_view name, int64_t value)
+{
+	auto &item = last();
+
+	item += ' ';
+	item += name;
+	item += '=';
+	item += std::to_string(value);
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::field(std::string_view name, std::string_view value)
+{
+	auto &item = last();
+
+	item += ", ";
+	item += name;
+	item += "=(string)";
+	item += quoted(value);
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::field(std::string_view name, const char *value)
+{
+	return field(name, std::string_view{ value });
+}
+
+PipelineBuilder &PipelineBuilder::field(std::string_view name, int32_t value)
+{
+	auto &item = last();
+
+	item += ", ";
+	item += name;
+	item += "=(int)";
+	item += std::to_string(value);
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::field(std::string_view name, int32_t numerator, int32_t denominator)
+{
+	auto &item = last();
+
+	item += ", ";
+	item += name;
+	item += "=(fraction)";
+	item += std::to_string(numerator);
+	item += '/';
+	item += std::to_string(denominator);
+	return *this;
+}
+
+PipelineBuilder &PipelineBuilder::branch(std::string_view name)
+{
+	_chains.push_back({ std::string{ name }, {} });
+	return *this;
+}
+
+std::string PipelineBuilder::str() const
+{
+	std::string out;
+
+	for(const auto &chain : _chains)
+	{
+		if(chain.items.empty())
+			continue;
+		if(!out.empty())
+			out += ' ';
+		if(!chain.origin.empty())
+		{
+			out += chain.origin;
+			out += ". ! ";
+		}
+		for(size_t i = 0; i < chain.items.size(); i++)
+		{
+			if(i > 0)
+				out += " ! ";
+			out += chain.items[i];
+		}
+	}
+	return out;
+}
+
+std::string &PipelineBuilder::last()
+{
+	// properties before the first element would be lost, attach them to an empty item
+	if(_chains.back().items.empty())
+		_chains.back().items.emplace_back();
+	return _chains.back().items.back();
+}
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RawCapture.hpp"
+
+static size_t roundUpToAlignment(size_t size)
+{
+	return (size + RAW_CAPTURE_ALIGNMENT - 1) / RAW_CAPTURE_ALIGNMENT * RAW_CAPTURE_ALIGNMENT;
+}
+
+/**
+ * @brief Write all bytes at an offset, retrying short and interrupted writes.
+ * */
+static bool writeAll(int file, const void *data, size_t size, off_t offset)
+{
+	auto bytes = static_cast<const uint8_t *>(data);
+
+	while(size > 0)
+	{
+		auto count = pwrite(file, bytes, size, offset);
+		if(count <= 0)
+		{
+			if(count < 0 && errno == EINTR)
+				continue;
+			return false;
+		}
+		bytes += count;
+		size -= static_cast<size_t>(count);
+		offset += count;
+	}
+	return true;
+}
+
+size_t rawCaptureSlotSize(const RawCaptureHeader &header)
+{
+	return roundUpToAlignment(header.frameSize);
+}
+
+bool readRawCaptureHeader(const std::string &path, RawCaptureHeader &header)
+{
+	struct stat status{};
+	int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if(file < 0)
+	{
+		GST_ERROR("failed to open raw capture %s: %s", path.c_str(), g_strerror(errno));
+		return false;
+	}
+
+	auto count = pread(file, &header, sizeof(header), 0);
+	fstat(file, &status);
+	close(file);
+
+	if(count != static_cast<ssize_t>(sizeof(header)) ||
+		 std::memcmp(header.magic, RAW_CAPTURE_MAGIC, sizeof(RAW_CAPTURE_MAGIC)) != 0)
+	{
+		GST_ERROR("%s is not a raw capture", path.c_str());
+		return false;
+	}
+	if(header.headerSize < sizeof(header) || header.frameSize == 0 || header.width <= 0 || header.height <= 0)
+	{
+		GST_ERROR("raw capture %s has an invalid header", path.c_str());
+		return false;
+	}
+	header.pixelFormatName[sizeof(header.pixelFormatName) - 1] = '\0';
+
+	// an interrupted recording has all frames written but the count
+	auto frames = static_cast<uint64_t>(std::max<off_t>(status.st_size - header.headerSize, 0)) /
+								rawCaptureSlotSize(header);
+	if(header.frameCount == 0 || header.frameCount > frames)
+		header.frameCount = frames;
+	if(header.frameCount == 0)
+	{
+		GST_ERROR("raw capture %s has no frames", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+FrameFormat rawCaptureFormat(const RawCaptureHeader &header)
+{
+	return { header.width,
+					 header.height,
+					 static_cast<ArvPixelFormat>(header.pixelFormat),
+					 header.pixelFormatName,
+					 header.rowStride,
+					 header.frameSize,
+					 header.frameRate };
+}
+
+RawRecorder::RawRecorder(uint64_t numFrames, uint32_t numSlots):
+	_numFrames{ numFrames },
+	_numSlots{ numSlots },
+	_file{ -1 },
+	_header{},
+	_slotSize{},
+	_slots{},
+	_free{ numSlots },
+	_filled{ numSlots },
+	_running{},
+	_queued{},
+	_requested{},
+	_written{},
+	_dropped{}
+{}
+
+RawRecorder::~RawRecorder()
+{
+	_running = false;
+	_queued++;
+	_queued.notify_one();
+	if(_thread.joinable())
+		_thread.join();
+	std::free(_slots);
+}
+
+bool RawRecorder::open(const std::string &path, const FrameFormat &format)
+{
+	auto directory = g_path_get_dirname(path.c_str());
+	int error = g_mkdir_with_parents(directory, 0755);
+
+	g_free(directory);
+	if(error != 0)
+	{
+		GST_ERROR("failed to create the directory of %s: %s", path.c_str(), g_strerror(errno));
+		return false;
+	}
+
+	_file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(_file < 0)
+	{
+		GST_ERROR("failed to create raw capture %s: %s", path.c_str(), g_strerror(errno));
+		return false;
+	}
+
+	std::memcpy(_header.magic, RAW_CAPTURE_MAGIC, sizeof(RAW_CAPTURE_MAGIC));
+	_header.headerSize = static_cast<uint32_t>(roundUpToAlignment(sizeof(_header)));
+	_header.pixelFormat = format.pixelFormat;
+	g_strlcpy(_header.pixelFormatName, format.pixelFormatName.c_str(), sizeof(_header.pixelFormatName));
+	_header.width = format.width;
+	_header.height = format.height;
+	_header.rowStride = static_cast<uint32_t>(format.rowStride);
+	_header.frameSize = format.payload;
+	_header.frameRate = format.frameRate;
+
+	// written with the frame count once the recording is complete
+	if(!writeAll(_file, &_header, sizeof(_header), 0))
+	{
+		GST_ERROR("failed to write raw capture %s: %s", path.c_str(), g_strerror(errno));
+		close(_file);
+		_file = -1;
+		return false;
+	}
+
+	// slots are written whole, the padding behind a frame stays zero
+	_slotSize = rawCaptureSlotSize(_header);
+	_slots = static_cast<uint8_t *>(std::aligned_alloc(RAW_CAPTURE_ALIGNMENT, _slotSize * _numSlots));
+	std::memset(_slots, 0, _slotSize * _numSlots);
+	for(uint32_t i = 0; i < _numSlots; i++)
+		_free.push(i, 0);
+
+	_path = path;
+	_running = true;
+	_thread = std::thread{ &RawRecorder::run, this };
+	GST_INFO("dumping %" G_GUINT64_FORMAT " raw frames of %u bytes to %s", _numFrames, _header.frameSize,
+					 path.c_str());
+	return true;
+}
+
+void RawRecorder::record(const FrameView &frame)
+{
+	uint32_t slot;
+	uint64_t stamp;
+
+	if(_requested >= _numFrames || !_running)
+		return;
+	// frames of another format would not replay
+	if(frame.size != _header.frameSize || !_free.pop(slot, stamp))
+	{
+		_dropped++;
+		return;
+	}
+
+	std::memcpy(_slots + slot * _slotSize, frame.data, frame.size);
+	_filled.push(slot, _requested++);
+	_queued++;
+	_queued.notify_one();
+}
+
+void RawRecorder::run()
+{
+	uint32_t slot;
+	uint64_t index;
+
+	while(_written < _numFrames)
+	{
+		uint32_t queued = _queued;
+
+		if(!_filled.pop(slot, index))
+		{
+			if(!_running)
+				break;
+			_queued.wait(queued);
+			continue;
+		}
+
+		if(!writeAll(_file, _slots + slot * _slotSize, _slotSize,
+								 static_cast<off_t>(_header.headerSize + index * _slotSize)))
+		{
+			GST_ERROR("failed to write raw capture %s: %s", _path.c_str(), g_strerror(errno));
+			break;
+		}
+		_written++;
+		_free.push(slot, 0);
+	}
+
+	finish();
+}
+
+void RawRecorder::finish()
+{
+	_running = false;
+	_header.frameCount = _written;
+	if(!writeAll(_file, &_header, sizeof(_header), 0) || fdatasync(_file) != 0)
+		GST_WARNING("failed to finish raw capture %s: %s", _path.c_str(), g_strerror(errno));
+	close(_file);
+	_file = -1;
+
+	GST_INFO("raw capture %s: %" G_GUINT64_FORMAT " frames written, %" G_GUINT64_FORMAT " dropped", _path.c_str(),
+					 _written.load(), _dropped.load());
+}
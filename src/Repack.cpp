@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "Repack.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RTSPCAM_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define RTSPCAM_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+using RepackRowsFunc = void (*)(const uint8_t *, size_t, uint8_t *, size_t, size_t, size_t);
+using UnpackRowFunc = size_t (*)(const uint8_t *, size_t, uint16_t *, size_t, PackedLayout);
+
+struct RepackKernels
+{
+	SimdLevel level;
+	RepackRowsFunc repackRows;
+	/// Unpacks as many pixels of a row as the kernel can, returns the number of unpacked pixels
+	UnpackRowFunc unpackRow;
+};
+
+/// Rows from this size on are copied with memcpy, its call overhead is amortized there
+constexpr size_t LONG_ROW_SIZE{ 256 };
+
+/// GigE Vision monochrome and Bayer formats
+constexpr ArvPixelFormat MONO_FORMAT_MASK{ 0xff000000u };
+constexpr ArvPixelFormat MONO_FORMAT{ 0x01000000u };
+
+/// Mono10Packed, BayerGR10Packed, BayerRG10Packed, BayerGB10Packed, BayerBG10Packed
+constexpr ArvPixelFormat GIGE_PACKED_10_FORMATS[] = { 0x010c0004u, 0x010c0026u, 0x010c0027u, 0x010c0028u,
+																											0x010c0029u };
+/// Mono12Packed, BayerGR12Packed, BayerRG12Packed, BayerGB12Packed, BayerBG12Packed
+constexpr ArvPixelFormat GIGE_PACKED_12_FORMATS[] = { 0x010c0006u, 0x010c002au, 0x010c002bu, 0x010c002cu,
+																											0x010c002du };
+
+size_t packedSourceRowSize(size_t width, PackedLayout layout)
+{
+	return layout == PackedLayout::Lsb10 ? (width * 10 + 7) / 8 : (width * 12 + 7) / 8;
+}
+
+void repackRowsScalar(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t rowSize,
+											size_t height)
+{
+	for(size_t y = 0; y < height; y++)
+	{
+		memcpy(dst + y * dstStride, src + y * srcStride, rowSize);
+	}
+}
+
+/**
+ * Unpacks pixel pair or quad starting at pixel x, the number of pixels is
+ * limited by the width so partial groups at the end of the row never read past it.
+ * */
+void unpackRowScalar(const uint8_t *src, size_t x, uint16_t *dst, size_t width, PackedLayout layout)
+{
+	size_t srcRowSize = packedSourceRowSize(width, layout);
+
+	if(layout == PackedLayout::Lsb10)
+	{
+		for(; x < width; x += 4)
+		{
+			size_t offset = x / 4 * 5;
+			size_t count = std::min<size_t>(5, srcRowSize - offset);
+			uint64_t word{};
+
+			for(size_t i = 0; i < count; i++)
+				word |= static_cast<uint64_t>(src[offset + i]) << (8 * i);
+			for(size_t i = 0; i < 4 && x + i < width; i++)
+				dst[x + i] = static_cast<uint16_t>(((word >> (10 * i)) & 0x3ff) << 6);
+		}
+		return;
+	}
+
+	for(; x < width; x += 2)
+	{
+		const uint8_t *pair = src + x / 2 * 3;
+		bool hasOdd = x + 1 < width;
+		uint8_t b0 = pair[0], b1 = pair[1], b2 = hasOdd ? pair[2] : 0;
+		uint16_t even, odd;
+
+		switch(layout)
+		{
+			case PackedLayout::GigE10:
+				even = static_cast<uint16_t>(((b0 << 2) | (b1 & 0x3)) << 6);
+				odd = static_cast<uint16_t>(((b2 << 2) | ((b1 >> 4) & 0x3)) << 6);
+				break;
+			case PackedLayout::GigE12:
+				even = static_cast<uint16_t>(((b0 << 4) | (b1 & 0xf)) << 4);
+				odd = static_cast<uint16_t>(((b2 << 4) | (b1 >> 4)) << 4);
+				break;
+			default:
+				even = static_cast<uint16_t>((b0 | ((b1 & 0xf) << 8)) << 4);
+				odd = static_cast<uint16_t>(((b1 >> 4) | (b2 << 4)) << 4);
+				break;
+		}
+
+		dst[x] = even;
+		if(hasOdd)
+			dst[x + 1] = odd;
+	}
+}
+
+size_t unpackRowNone(const uint8_t *, size_t, uint16_t *, size_t, PackedLayout)
+{
+	return 0;
+}
+
+#if RTSPCAM_X86
+void repackRowsSse2(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t rowSize,
+										size_t height)
+{
+	if(rowSize < 16 || rowSize >= LONG_ROW_SIZE)
+	{
+		repackRowsScalar(src, srcStride, dst, dstStride, rowSize, height);
+		return;
+	}
+
+	for(size_t y = 0; y < height; y++)
+	{
+		const uint8_t *s = src + y * srcStride;
+		uint8_t *d = dst + y * dstStride;
+		size_t x = 0;
+
+		for(; x + 16 <= rowSize; x += 16)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(d + x),
+											 _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + x)));
+		}
+		// the tail overlaps the last full vector instead of falling back to bytes
+		if(x < rowSize)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(d + rowSize - 16),
+											 _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + rowSize - 16)));
+		}
+	}
+}
+
+__attribute__((target("avx2"))) void repackRowsAvx2(const uint8_t *src, size_t srcStride, uint8_t *dst,
+																										size_t dstStride, size_t rowSize, size_t height)
+{
+	if(rowSize < 32 || rowSize >= LONG_ROW_SIZE)
+	{
+		repackRowsSse2(src, srcStride, dst, dstStride, rowSize, height);
+		return;
+	}
+
+	for(size_t y = 0; y < height; y++)
+	{
+		const uint8_t *s = src + y * srcStride;
+		uint8_t *d = dst + y * dstStride;
+		size_t x = 0;
+
+		for(; x + 32 <= rowSize; x += 32)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(d + x),
+													_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + x)));
+		}
+		if(x < rowSize)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(d + rowSize - 32),
+													_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + rowSize - 32)));
+		}
+	}
+	// the caller continues in SSE code
+	_mm256_zeroupper();
+}
+
+/**
+ * Unpacks 8 pixels from 12 bytes per iteration for the layouts storing a pixel
+ * pair in 3 bytes. Every 16-bit lane gets the two source bytes of its pixel,
+ * even and odd pixels are then decoded separately and blended.
+ * */
+__attribute__((target("ssse3"))) size_t unpackRowSsse3(const uint8_t *src, size_t srcRowSize, uint16_t *dst,
+																											 size_t width, PackedLayout layout)
+{
+	const __m128i evenMask = _mm_set1_epi32(0x0000ffff);
+	__m128i shuffle;
+	size_t x = 0;
+
+	if(layout == PackedLayout::Lsb10 || layout == PackedLayout::None)
+		return 0;
+
+	if(layout == PackedLayout::Lsb12)
+		shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	else
+		shuffle = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+
+	for(; x + 8 <= width && x / 2 * 3 + 16 <= srcRowSize; x += 8)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x / 2 * 3)), shuffle);
+		__m128i even, odd;
+
+		switch(layout)
+		{
+			case PackedLayout::GigE10:
+				even = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0x03fc)),
+														_mm_and_si128(v, _mm_set1_epi16(0x0003)));
+				odd = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0x03fc)),
+													 _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi16(0x0003)));
+				v = _mm_slli_epi16(_mm_or_si128(_mm_and_si128(evenMask, even), _mm_andnot_si128(evenMask, odd)), 6);
+				break;
+			case PackedLayout::GigE12:
+				even = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi16(0x0ff0)),
+														_mm_and_si128(v, _mm_set1_epi16(0x000f)));
+				odd = _mm_srli_epi16(v, 4);
+				v = _mm_slli_epi16(_mm_or_si128(_mm_and_si128(evenMask, even), _mm_andnot_si128(evenMask, odd)), 4);
+				break;
+			default:
+				even = _mm_and_si128(v, _mm_set1_epi16(0x0fff));
+				odd = _mm_srli_epi16(v, 4);
+				v = _mm_slli_epi16(_mm_or_si128(_mm_and_si128(evenMask, even), _mm_andnot_si128(evenMask, odd)), 4);
+				break;
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), v);
+	}
+	return x;
+}
+
+/**
+ * Same decoding as the SSSE3 kernel on 16 pixels from 24 bytes per iteration.
+ * The byte shuffle stays within 128-bit lanes, so every lane is loaded with
+ * the 12 bytes of its own 8 pixels.
+ * */
+__attribute__((target("avx2"))) size_t unpackRowAvx2(const uint8_t *src, size_t srcRowSize, uint16_t *dst,
+																										 size_t width, PackedLayout layout)
+{
+	const __m256i evenMask = _mm256_set1_epi32(0x0000ffff);
+	__m256i shuffle;
+	size_t x = 0;
+
+	if(layout == PackedLayout::Lsb10 || layout == PackedLayout::None)
+		return 0;
+
+	if(layout == PackedLayout::Lsb12)
+		shuffle = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11, 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8,
+															 9, 10, 10, 11);
+	else
+		shuffle = _mm256_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11, 1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8,
+															 10, 9, 10, 11);
+
+	// the upper lane loads 16 bytes from the 13th byte on
+	for(; x + 16 <= width && x / 2 * 3 + 28 <= srcRowSize; x += 16)
+	{
+		const uint8_t *s = src + x / 2 * 3;
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s))),
+																				_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 12)), 1);
+		__m256i even, odd;
+
+		v = _mm256_shuffle_epi8(v, shuffle);
+		switch(layout)
+		{
+			case PackedLayout::GigE10:
+				even = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(v, 6), _mm256_set1_epi16(0x03fc)),
+															 _mm256_and_si256(v, _mm256_set1_epi16(0x0003)));
+				odd = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(v, 6), _mm256_set1_epi16(0x03fc)),
+															_mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi16(0x0003)));
+				v = _mm256_slli_epi16(_mm256_blendv_epi8(odd, even, evenMask), 6);
+				break;
+			case PackedLayout::GigE12:
+				even = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi16(0x0ff0)),
+															 _mm256_and_si256(v, _mm256_set1_epi16(0x000f)));
+				odd = _mm256_srli_epi16(v, 4);
+				v = _mm256_slli_epi16(_mm256_blendv_epi8(odd, even, evenMask), 4);
+				break;
+			default:
+				even = _mm256_and_si256(v, _mm256_set1_epi16(0x0fff));
+				odd = _mm256_srli_epi16(v, 4);
+				v = _mm256_slli_epi16(_mm256_blendv_epi8(odd, even, evenMask), 4);
+				break;
+		}
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), v);
+	}
+	// the 128-bit kernel is not VEX encoded, dirty upper halves would make each of its instructions pay the
+	// AVX to SSE transition; a remaining group of 8 pixels fits it
+	_mm256_zeroupper();
+	return x + unpackRowSsse3(src + x / 2 * 3, srcRowSize - x / 2 * 3, dst + x, width - x, layout);
+}
+#endif
+
+#if RTSPCAM_NEON
+void repackRowsNeon(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t rowSize,
+										size_t height)
+{
+	if(rowSize < 16 || rowSize >= LONG_ROW_SIZE)
+	{
+		repackRowsScalar(src, srcStride, dst, dstStride, rowSize, height);
+		return;
+	}
+
+	for(size_t y = 0; y < height; y++)
+	{
+		const uint8_t *s = src + y * srcStride;
+		uint8_t *d = dst + y * dstStride;
+		size_t x = 0;
+
+		for(; x + 16 <= rowSize; x += 16)
+			vst1q_u8(d + x, vld1q_u8(s + x));
+		if(x < rowSize)
+			vst1q_u8(d + rowSize - 16, vld1q_u8(s + rowSize - 16));
+	}
+}
+
+/**
+ * De-interleaves 8 pixel pairs per iteration with vld3 and stores the decoded
+ * even and odd pixels interleaved back with vst2.
+ * */
+size_t unpackRowNeon(const uint8_t *src, size_t srcRowSize, uint16_t *dst, size_t width, PackedLayout layout)
+{
+	size_t x = 0;
+
+	if(layout == PackedLayout::Lsb10 || layout == PackedLayout::None)
+		return 0;
+
+	for(; x + 16 <= width && x / 2 * 3 + 24 <= srcRowSize; x += 16)
+	{
+		uint8x8x3_t bytes = vld3_u8(src + x / 2 * 3);
+		uint16x8_t b0 = vmovl_u8(bytes.val[0]);
+		uint16x8_t b1 = vmovl_u8(bytes.val[1]);
+		uint16x8_t b2 = vmovl_u8(bytes.val[2]);
+		uint16x8x2_t pixels;
+
+		switch(layout)
+		{
+			case PackedLayout::GigE10:
+				pixels.val[0] = vshlq_n_u16(vorrq_u16(vshlq_n_u16(b0, 2), vandq_u16(b1, vdupq_n_u16(0x3))), 6);
+				pixels.val[1] =
+						vshlq_n_u16(vorrq_u16(vshlq_n_u16(b2, 2), vandq_u16(vshrq_n_u16(b1, 4), vdupq_n_u16(0x3))), 6);
+				break;
+			case PackedLayout::GigE12:
+				pixels.val[0] = vshlq_n_u16(vorrq_u16(vshlq_n_u16(b0, 4), vandq_u16(b1, vdupq_n_u16(0xf))), 4);
+				pixels.val[1] = vshlq_n_u16(vorrq_u16(vshlq_n_u16(b2, 4), vshrq_n_u16(b1, 4)), 4);
+				break;
+			default:
+				pixels.val[0] = vshlq_n_u16(vorrq_u16(b0, vshlq_n_u16(vandq_u16(b1, vdupq_n_u16(0xf)), 8)), 4);
+				pixels.val[1] = vshlq_n_u16(vorrq_u16(vshrq_n_u16(b1, 4), vshlq_n_u16(b2, 4)), 4);
+				break;
+		}
+
+		vst2q_u16(dst + x, pixels);
+	}
+	return x;
+}
+#endif
+
+const RepackKernels SCALAR_KERNELS{ SimdLevel::Scalar, repackRowsScalar, unpackRowNone };
+#if RTSPCAM_X86
+const RepackKernels SSE2_KERNELS{ SimdLevel::Sse2, repackRowsSse2, unpackRowNone };
+const RepackKernels SSSE3_KERNELS{ SimdLevel::Ssse3, repackRowsSse2, unpackRowSsse3 };
+const RepackKernels AVX2_KERNELS{ SimdLevel::Avx2, repackRowsAvx2, unpackRowAvx2 };
+#endif
+#if RTSPCAM_NEON
+const RepackKernels NEON_KERNELS{ SimdLevel::Neon, repackRowsNeon, unpackRowNeon };
+#endif
+
+const RepackKernels *kernelsFor(SimdLevel level)
+{
+	switch(level)
+	{
+#if RTSPCAM_X86
+		case SimdLevel::Avx2:
+			return &AVX2_KERNELS;
+		case SimdLevel::Ssse3:
+			return &SSSE3_KERNELS;
+		case SimdLevel::Sse2:
+			return &SSE2_KERNELS;
+#endif
+#if RTSPCAM_NEON
+		case SimdLevel::Neon:
+			return &NEON_KERNELS;
+#endif
+		default:
+			return &SCALAR_KERNELS;
+	}
+}
+
+std::atomic<const RepackKernels *> gKernels{ nullptr };
+
+const RepackKernels *kernels()
+{
+	const RepackKernels *current = gKernels.load(std::memory_order_acquire);
+
+	if(current == nullptr)
+	{
+		current = kernelsFor(detectSimdLevel());
+		gKernels.store(current, std::memory_order_release);
+	}
+	return current;
+}
+} // namespace
+
+SimdLevel detectSimdLevel()
+{
+#if RTSPCAM_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return SimdLevel::Avx2;
+	if(__builtin_cpu_supports("ssse3"))
+		return SimdLevel::Ssse3;
+	if(__builtin_cpu_supports("sse2"))
+		return SimdLevel::Sse2;
+	return SimdLevel::Scalar;
+#elif RTSPCAM_NEON
+	return SimdLevel::Neon;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel repackSimdLevel()
+{
+	return kernels()->level;
+}
+
+void setRepackSimdLevel(SimdLevel level)
+{
+	SimdLevel supported = detectSimdLevel();
+	// the x86 levels include the ones below them
+	bool available{ level == SimdLevel::Scalar || level == supported ||
+									(level != SimdLevel::Neon && supported != SimdLevel::Neon && level < supported) };
+
+	if(!available)
+		level = supported;
+
+	gKernels.store(kernelsFor(level), std::memory_order_release);
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+	switch(level)
+	{
+		case SimdLevel::Sse2:
+			return "sse2";
+		case SimdLevel::Ssse3:
+			return "ssse3";
+		case SimdLevel::Avx2:
+			return "avx2";
+		case SimdLevel::Neon:
+			return "neon";
+		default:
+			return "scalar";
+	}
+}
+
+PackedLayout packedLayout(ArvPixelFormat pixelFormat)
+{
+	if((pixelFormat & MONO_FORMAT_MASK) != MONO_FORMAT)
+		return PackedLayout::None;
+
+	switch(ARV_PIXEL_FORMAT_BIT_PER_PIXEL(pixelFormat))
+	{
+		case 10:
+			return PackedLayout::Lsb10;
+		case 12:
+			for(auto format : GIGE_PACKED_10_FORMATS)
+				if(format == pixelFormat)
+					return PackedLayout::GigE10;
+			for(auto format : GIGE_PACKED_12_FORMATS)
+				if(format == pixelFormat)
+					return PackedLayout::GigE12;
+			return PackedLayout::Lsb12;
+		default:
+			return PackedLayout::None;
+	}
+}
+
+size_t packedRowStride(int32_t width, uint32_t bitsPerPixel)
+{
+	return (static_cast<size_t>(width) * bitsPerPixel + 7) / 8;
+}
+
+size_t alignedRowStride(size_t rowSize)
+{
+	return (rowSize + 3) & ~static_cast<size_t>(0x3);
+}
+
+void repackRows(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t rowSize, size_t height)
+{
+	if(srcStride == rowSize && dstStride == rowSize)
+	{
+		memcpy(dst, src, rowSize * height);
+		return;
+	}
+	kernels()->repackRows(src, srcStride, dst, dstStride, rowSize, height);
+}
+
+void unpackRows(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t width, size_t height,
+								PackedLayout layout)
+{
+	const RepackKernels *current = kernels();
+	size_t srcRowSize = packedSourceRowSize(width, layout);
+
+	for(size_t y = 0; y < height; y++)
+	{
+		const uint8_t *s = src + y * srcStride;
+		auto d = reinterpret_cast<uint16_t *>(dst + y * dstStride);
+		size_t x = current->unpackRow(s, srcRowSize, d, width, layout);
+
+		unpackRowScalar(s, x, d, width, layout);
+	}
+}
+
+std::string unpackedCapsString(const char *pixelFormatName)
+{
+	static constexpr const char *BAYER_ORDERS[][2] = {
+		{ "BayerRG", "rggb" },
+		{ "BayerGR", "grbg" },
+		{ "BayerGB", "gbrg" },
+		{ "BayerBG", "bggr" }
+	};
+	std::string name{ pixelFormatName != nullptr ? pixelFormatName : "" };
+
+	if(name.starts_with("Mono"))
+		return "video/x-raw, format=(string)GRAY16_LE";
+
+	for(const auto &order : BAYER_ORDERS)
+	{
+		if(name.starts_with(order[0]))
+			return std::string{ "video/x-bayer, format=(string)" } + order[1] + "16le";
+	}
+	return {};
+}
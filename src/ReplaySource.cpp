@@ -0,0 +1,149 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ReplaySource.hpp"
+#include "DeviceHandle.hpp"
+
+/**
+ * Read-only mapping of a raw capture file.
+ * */
+struct ReplaySource::Mapping
+{
+	~Mapping()
+	{
+		munmap(data, size);
+	}
+
+	uint8_t *data;
+	size_t size;
+};
+
+static void releaseMapping(void *data)
+{
+	delete static_cast<std::shared_ptr<void> *>(data);
+}
+
+ReplaySource::ReplaySource(std::string path, std::optional<double> frameRate):
+	_path{ std::move(path) },
+	_frameRate{ frameRate },
+	_header{},
+	_format{},
+	_running{}
+{
+	auto name = g_path_get_basename(_path.c_str());
+
+	_name = name;
+	g_free(name);
+}
+
+ReplaySource::~ReplaySource()
+{
+	stop();
+}
+
+bool ReplaySource::open()
+{
+	struct stat status{};
+	void *data;
+	int file;
+
+	if(!readRawCaptureHeader(_path, _header))
+		return false;
+
+	if((file = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC)) < 0 || fstat(file, &status) != 0)
+	{
+		GST_ERROR("failed to open raw capture %s: %s", _path.c_str(), g_strerror(errno));
+		if(file >= 0)
+			close(file);
+		return false;
+	}
+
+	// read in up front, the replay never waits for the disk
+	data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+	close(file);
+	if(data == MAP_FAILED)
+	{
+		GST_ERROR("failed to map raw capture %s: %s", _path.c_str(), g_strerror(errno));
+		return false;
+	}
+
+	_mapping.reset(new Mapping{ static_cast<uint8_t *>(data), static_cast<size_t>(status.st_size) });
+	_format = rawCaptureFormat(_header);
+	if(_frameRate)
+		_format.frameRate = *_frameRate;
+
+	GST_INFO("replaying %" G_GUINT64_FORMAT " frames of %s (%dx%d %s)", _header.frameCount, _path.c_str(),
+					 _format.width, _format.height, _format.pixelFormatName.c_str());
+	if(_format.frameRate > 0)
+		GST_INFO("replay rate: %.2f fps", _format.frameRate);
+	else
+		GST_INFO("replay rate: as fast as the pipeline takes frames");
+	return true;
+}
+
+const std::string &ReplaySource::name() const
+{
+	return _name;
+}
+
+const FrameFormat &ReplaySource::format() const
+{
+	return _format;
+}
+
+bool ReplaySource::start(DeviceHandle *device)
+{
+	if(_mapping == nullptr || _running)
+		return false;
+
+	_running = true;
+	_thread = std::thread{ &ReplaySource::run, this, device };
+	return true;
+}
+
+void ReplaySource::stop()
+{
+	_running = false;
+	if(_thread.joinable())
+		_thread.join();
+}
+
+void ReplaySource::run(DeviceHandle *device)
+{
+	gint64 period = _format.frameRate > 0 ? static_cast<gint64>(G_USEC_PER_SEC / _format.frameRate) : 0;
+	gint64 start = g_get_monotonic_time();
+	size_t slotSize = rawCaptureSlotSize(_header);
+
+	device->onStreamThreadStarted();
+
+	for(guint64 frameId = 0; _running; frameId++)
+	{
+		const uint8_t *data = _mapping->data + _header.headerSize + (frameId % _header.frameCount) * slotSize;
+
+		if(period > 0)
+		{
+			gint64 due = start + static_cast<gint64>(frameId) * period;
+			gint64 now = g_get_monotonic_time();
+
+			// a replay falling behind keeps its rate instead of catching up in a burst
+			if(now > due + period)
+				start = now - static_cast<gint64>(frameId) * period;
+			else if(now < due)
+				g_usleep(static_cast<gulong>(due - now));
+		}
+
+		FrameView frame{ data,
+										 _header.frameSize,
+										 _format.width,
+										 _format.height,
+										 _format.pixelFormat,
+										 _format.rowStride,
+										 0,
+										 static_cast<guint64>(g_get_real_time()) * 1000,
+										 frameId };
+		device->deliverFrame(frame, { new std::shared_ptr<void>(_mapping), releaseMapping });
+	}
+}
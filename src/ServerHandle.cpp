@@ -1,55 +1,153 @@
+#include <cmath>
 #include <fmt/format.h>
 
 #include "ServerHandle.hpp"
+#include "BufferArena.hpp"
 #include "Callback.hpp"
+#include "DebayerElement.hpp"
+#include "Encoder.hpp"
+#include "ReplaySource.hpp"
 
-static constexpr const char *CPU_LAUNCH_STRING{
-	"appsrc name=srvsrc ! "
-	"bayer2rgb ! video/x-raw, format=(string)RGBx ! "
-	"videoconvert ! video/x-raw, format=(string)I420, width=(int){0}, height=(int){1} ! "
-	"queue ! "
-	"x264enc tune=zerolatency bitrate={2} ! "
-	"video/x-h264, width=(int){0}, height=(int){1}, stream-format=byte-stream, profile=main ! "
-	"rtph264pay name=pay0 pt=96"
-};
-
-static constexpr const char *GPU_LAUNCH_STRING{
-	"appsrc name=srvsrc ! "
-	"bayer2rgb ! "
-	"nvvidconv ! video/x-raw(memory:NVMM), width=(int){0}, height=(int){1}, format=(string)I420 ! "
-	"queue max-size-buffers=300 ! "
-	"nvv4l2h264enc bitrate={2} preset-level=2 profile=2 insert-sps-pps=1 ! "
-	"rtph264pay name=pay0 pt=96"
-};
+/// RTP payload type of the video streams
+static constexpr int64_t PAYLOAD_TYPE{ 96 };
+
+/// Frame rate of the sub-stream sources when the camera frame rate is not configured
+static constexpr int32_t DEFAULT_PROFILE_FRAME_RATE{ 30 };
+
+/// Length of an exported clip when the request does not give one, in seconds
+static constexpr double DEFAULT_CLIP_SECONDS{ 30 };
+
+/// Bytes of muxed stream queued for the recording while the disk is busy
+static constexpr int64_t RECORDING_QUEUE_BYTES{ 64 << 20 };
+
+/// Names of the elements of the recording branch in the capture pipeline
+static constexpr const char *RECORDING_TEE{ "recordtee" };
+static constexpr const char *RECORDING_SINK{ "recordsink" };
+
+/// Kernel send buffer of the UDP sockets, absorbs the packet bursts of keyframes sent to many clients
+static constexpr guint UDP_SEND_BUFFER_BYTES{ 4 << 20 };
+
+/**
+ * @brief Lower transports a factory offers under a transport policy.
+ *
+ * Clients offer their transports in the order they prefer them and get the
+ * first one offered by the factory. A client that asks for a transport the
+ * factory does not offer is answered 461 and retries with another one, so
+ * leaving unicast UDP out makes multicast capable clients join the group
+ * and the others fall back to TCP.
+ * */
+static GstRTSPLowerTrans transportProtocols(TransportPolicy policy)
+{
+	switch(policy)
+	{
+		case TransportPolicy::Multicast:
+			return GST_RTSP_LOWER_TRANS_UDP_MCAST;
+		case TransportPolicy::MulticastPreferred:
+			return static_cast<GstRTSPLowerTrans>(GST_RTSP_LOWER_TRANS_UDP_MCAST | GST_RTSP_LOWER_TRANS_TCP);
+		default:
+			return static_cast<GstRTSPLowerTrans>(GST_RTSP_LOWER_TRANS_UDP | GST_RTSP_LOWER_TRANS_TCP);
+	}
+}
+
+static gboolean quitLoop(void *data)
+{
+	g_main_loop_quit(static_cast<GMainLoop *>(data));
+	return G_SOURCE_REMOVE;
+}
+
+/// Lowest adaptive bitrate as a fraction of the stream bitrate when none is configured
+static constexpr int64_t DEFAULT_MIN_BITRATE_DIVISOR{ 8 };
 
 ServerHandle::ServerHandle(const Options *options):
 	_options{ options },
-	_factory{},
-	_auth{}
+	_auth{},
+	_addressPool{},
+	_sessions{ [this](DeviceHandle *device, uint32_t numClients) { onClientsChanged(device, numClients); } },
+	_serverSource{},
+	_cleanupContext{},
+	_cleanupLoop{},
+	_cleanupSource{}
 {
 	auto path = (_options->path.starts_with("/") ? _options->path : "/" + _options->path);
-	_deviceHandle = new DeviceHandle(_options);
 	_enableAuth = !_options->username.empty() && !_options->password.empty();
 
 	/* create a server instance */
 	_server = gst_rtsp_server_new();
 	gst_rtsp_server_set_service(_server, _options->port.c_str());
 	gst_rtsp_server_set_address(_server, _options->address.c_str());
-	initMediaFactory(path.c_str());
+	initThreadPool();
+	// one pool for all streams, every shared media takes a group and port pair of it
+	_addressPool = gst_rtsp_address_pool_new();
+	if(!gst_rtsp_address_pool_add_range(_addressPool, _options->multicastAddressMin.c_str(),
+																			_options->multicastAddressMax.c_str(), _options->multicastPortMin,
+																			_options->multicastPortMax, static_cast<guint8>(_options->multicastTtl)))
+	{
+		GST_ERROR("invalid multicast range %s-%s", _options->multicastAddressMin.c_str(),
+							_options->multicastAddressMax.c_str());
+	}
+	initDevices(path);
 	if(_enableAuth)
 	{
 		initAuth();
 		addUser(_options->username, _options->password);
 	}
-	g_signal_connect(_server, "client-connected", reinterpret_cast<GCallback>(clientConnected), _deviceHandle);
+	g_signal_connect(_server, "client-connected", reinterpret_cast<GCallback>(clientConnected), this);
+
+	_http.addHandler("/metrics", [this](std::string_view, std::string_view) -> HttpResponse {
+		return { 200, "text/plain; version=0.0.4", renderMetrics() };
+	});
+	_http.addHandler("/control", [this](std::string_view method, std::string_view query) -> HttpResponse {
+		return handleControl(method, query);
+	});
+	_http.addHandler("/sessions", [this](std::string_view method, std::string_view query) -> HttpResponse {
+		return handleSessions(method, query);
+	});
+	_http.addHandler("/recording", [this](std::string_view method, std::string_view query) -> HttpResponse {
+		return handleRecording(method, query);
+	});
 }
 
 ServerHandle::~ServerHandle()
 {
-	gst_object_unref(_auth);
-	gst_object_unref(_factory);
+	// the handlers run on worker threads and use the devices deleted below
+	_http.stop();
+	// the sources reference the server, it would keep listening after it is gone
+	if(_cleanupSource != nullptr)
+	{
+		g_source_destroy(_cleanupSource);
+		g_source_unref(_cleanupSource);
+	}
+	if(_cleanupLoop != nullptr)
+	{
+		// quits once the loop runs, also when the thread did not get to start it yet
+		g_main_context_invoke(_cleanupContext, quitLoop, _cleanupLoop);
+		_cleanupThread.join();
+		g_main_loop_unref(_cleanupLoop);
+		g_main_context_unref(_cleanupContext);
+	}
+	if(_serverSource != 0)
+		g_source_remove(_serverSource);
+	// clients go first, their medias are fed by the devices deleted below
+	gst_rtsp_server_client_filter(_server, closeClient, nullptr);
+	// sessions of UDP clients outlive their connection, their transports end with them
+	if(auto pool = gst_rtsp_server_get_session_pool(_server); pool != nullptr)
+	{
+		gst_rtsp_session_pool_filter(pool, closeSession, nullptr);
+		g_object_unref(pool);
+	}
+
+	if(_auth != nullptr)
+		gst_object_unref(_auth);
+	g_object_unref(_addressPool);
+	for(auto &mount : _mounts)
+	{
+		for(auto &stream : mount.streams)
+			gst_object_unref(stream.factory);
+		// the capture pipeline stops the acquisition of the device
+		delete mount.capture;
+		delete mount.device;
+	}
 	gst_object_unref(_server);
-	delete _deviceHandle;
 }
 
 void ServerHandle::addUser(std::string_view username, std::string_view password) noexcept
@@ -68,40 +166,846 @@ void ServerHandle::addUser(std::string_view username, std::string_view password)
 
 void ServerHandle::attach(uint32_t timeoutInterval)
 {
-	if(gst_rtsp_server_attach(_server, nullptr) == 0)
+	if((_serverSource = gst_rtsp_server_attach(_server, nullptr)) == 0)
 		throw std::runtime_error("failed attach server to the main loop\n");
 
-	// add a timeout for the session cleanup
-	g_timeout_add_seconds(timeoutInterval, reinterpret_cast<GSourceFunc>(cleanupTimeout), _server);
+	// expired sessions are removed on a context of their own, a busy main context does not hold them up
+	_cleanupContext = g_main_context_new();
+	_cleanupLoop = g_main_loop_new(_cleanupContext, false);
+	_cleanupSource = g_timeout_source_new_seconds(timeoutInterval);
+	g_source_set_callback(_cleanupSource, reinterpret_cast<GSourceFunc>(cleanupTimeout), _server, nullptr);
+	g_source_attach(_cleanupSource, _cleanupContext);
+	_cleanupThread = std::thread{ g_main_loop_run, _cleanupLoop };
+
+	if(_options->httpPort != 0)
+		_http.listen(_options->httpAddress, _options->httpPort);
+
+	// persistent capture pipelines run without any client
+	if(_options->alwaysOn)
+	{
+		for(auto &mount : _mounts)
+		{
+			if(mount.capture != nullptr)
+				mount.capture->acquire();
+		}
+	}
+
+	for(const auto &mount : _mounts)
+	{
+		for(const auto &stream : mount.streams)
+		{
+			GST_INFO("Stream ready at rtsp://%s:%s%s", _options->address.c_str(), _options->port.c_str(),
+							 stream.path.c_str());
+		}
+	}
+}
+
+DeviceHandle *ServerHandle::deviceForPath(const char *path) const
+{
+	const CameraMount *match{};
+	std::string_view requestPath{ path != nullptr ? path : "" };
 
-	GST_INFO("Stream ready at rtsp://%s:%s/%s", _options->address.c_str(), _options->port.c_str(),
-					 _options->path.c_str());
+	// control URLs extend the mount path, e.g. /stream/serial/stream=0
+	for(const auto &mount : _mounts)
+	{
+		if(!requestPath.starts_with(mount.path))
+			continue;
+		if(requestPath.size() > mount.path.size() && requestPath[mount.path.size()] != '/')
+			continue;
+		if(match == nullptr || mount.path.size() > match->path.size())
+			match = &mount;
+	}
+	return match != nullptr ? match->device : nullptr;
 }
 
-void ServerHandle::initMediaFactory(const char *path) noexcept
+TransportMetrics *ServerHandle::transportsForPath(const char *path) const
 {
-	// get the mount points for this server, every server has a default object
-	// that be used to map uri mount points to media factories
-	std::string launchString;
+	const StreamMount *match{};
+	std::string_view requestPath{ path != nullptr ? path : "" };
+
+	// the main stream path is a prefix of the sub-stream paths, the longest match wins
+	for(const auto &mount : _mounts)
+	{
+		for(const auto &stream : mount.streams)
+		{
+			if(!requestPath.starts_with(stream.path))
+				continue;
+			if(requestPath.size() > stream.path.size() && requestPath[stream.path.size()] != '/')
+				continue;
+			if(match == nullptr || stream.path.size() > match->path.size())
+				match = &stream;
+		}
+	}
+	return match != nullptr ? match->transports.get() : nullptr;
+}
+
+SessionRegistry *ServerHandle::sessions()
+{
+	return &_sessions;
+}
+
+HttpResponse ServerHandle::handleSessions(std::string_view method, std::string_view query)
+{
+	auto serial = HttpServer::queryValue(query, "camera");
+	gint64 now = g_get_real_time();
+	std::string out;
+	auto append = std::back_inserter(out);
+
+	if(method != "GET")
+		return { 405, "text/plain", "use GET\n" };
+
+	for(const auto &session : _sessions.sessions())
+	{
+		if(!serial.empty() && session.camera != serial)
+			continue;
+
+		fmt::format_to(append, "id={} camera={} address={} path={} transport={} duration={:.1f} bytes={} packets={}",
+									 session.id, session.camera, session.address, session.path,
+									 TransportMetrics::transportName(session.transport),
+									 static_cast<double>(now - session.startTime) / G_USEC_PER_SEC, session.bytes, session.packets);
+		if(session.fractionLost.has_value())
+			fmt::format_to(append, " fraction-lost={} jitter={}", *session.fractionLost, *session.jitter);
+		fmt::format_to(append, " queue-bytes={}\n", session.queueBytes);
+	}
+	return { 200, "text/plain", std::move(out) };
+}
+
+std::string ServerHandle::renderMetrics() const
+{
+	std::string out;
+	auto append = std::back_inserter(out);
+
+	out += "# HELP rtspcam_stage_latency_seconds Time from frame reception by Aravis to a stage of the frame path.\n"
+				 "# TYPE rtspcam_stage_latency_seconds histogram\n";
+	for(const auto &mount : _mounts)
+	{
+		for(size_t i = 0; i < static_cast<size_t>(LatencyStage::Count); i++)
+		{
+			auto stage = static_cast<LatencyStage>(i);
+			auto labels = fmt::format("camera=\"{}\",stage=\"{}\"", mount.device->serial(),
+																CaptureMetrics::stageName(stage));
+
+			mount.device->metrics()->histogram(stage).render(out, "rtspcam_stage_latency_seconds", labels);
+		}
+	}
+
+	out += "# HELP rtspcam_buffer_status_total Frames completed by Aravis by buffer status.\n"
+				 "# TYPE rtspcam_buffer_status_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		for(auto status : CaptureMetrics::STATUSES)
+		{
+			fmt::format_to(append, "rtspcam_buffer_status_total{{camera=\"{}\",status=\"{}\"}} {}\n",
+										 mount.device->serial(), CaptureMetrics::statusName(status),
+										 mount.device->metrics()->statusCount(status));
+		}
+	}
+
+	out += "# HELP rtspcam_frames_dropped_total Frames dropped before reaching the app source.\n"
+				 "# TYPE rtspcam_frames_dropped_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		auto serial = mount.device->serial();
+
+		fmt::format_to(append, "rtspcam_frames_dropped_total{{camera=\"{}\",reason=\"no_stream_buffers\"}} {}\n",
+									 serial, mount.device->metrics()->backlogDrops());
+		fmt::format_to(append, "rtspcam_frames_dropped_total{{camera=\"{}\",reason=\"flow_control\"}} {}\n",
+									 serial, mount.device->flowControlDrops());
+		fmt::format_to(append, "rtspcam_frames_dropped_total{{camera=\"{}\",reason=\"queue_overflow\"}} {}\n",
+									 serial, mount.device->pusher()->stats().dropped);
+		fmt::format_to(append, "rtspcam_frames_dropped_total{{camera=\"{}\",reason=\"app_source\"}} {}\n",
+									 serial, mount.device->sourceDrops());
+	}
+
+	out += "# HELP rtspcam_frame_loss_ratio Frames failed, dropped or never delivered per expected frame over the "
+				 "last 10 s.\n"
+				 "# TYPE rtspcam_frame_loss_ratio gauge\n";
+	for(const auto &mount : _mounts)
+	{
+		fmt::format_to(append, "rtspcam_frame_loss_ratio{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->metrics()->loss().rate());
+	}
+
+	out += "# HELP rtspcam_stream_underruns_total Frames Aravis had no free buffer for.\n"
+				 "# TYPE rtspcam_stream_underruns_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		fmt::format_to(append, "rtspcam_stream_underruns_total{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->metrics()->underruns());
+	}
+
+	out += "# HELP rtspcam_stream_stalls_total Streams that stopped delivering frames.\n"
+				 "# TYPE rtspcam_stream_stalls_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		fmt::format_to(append, "rtspcam_stream_stalls_total{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->metrics()->stalls());
+	}
+
+	out += "# HELP rtspcam_stream_recoveries_total Stalled streams delivering again after reopening the camera.\n"
+				 "# TYPE rtspcam_stream_recoveries_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		fmt::format_to(append, "rtspcam_stream_recoveries_total{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->metrics()->recoveries());
+	}
+
+	out += "# HELP rtspcam_stream_recovering Whether the camera is being reopened.\n"
+				 "# TYPE rtspcam_stream_recovering gauge\n";
+	for(const auto &mount : _mounts)
+	{
+		fmt::format_to(append, "rtspcam_stream_recovering{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->isRecovering() ? 1 : 0);
+	}
+
+	out += "# HELP rtspcam_stream_buffer_bytes Memory mapped for the Aravis stream buffers by backing pages.\n"
+				 "# TYPE rtspcam_stream_buffer_bytes gauge\n";
+	for(const auto &mount : _mounts)
+	{
+		auto memory = mount.device->streamMemory();
+
+		fmt::format_to(append, "rtspcam_stream_buffer_bytes{{camera=\"{}\",backing=\"{}\"}} {}\n",
+									 mount.device->serial(), BufferArena::backingName(memory.backing), memory.bytes);
+	}
+
+	auto hugePages = hugePageInfo();
+	out += "# HELP rtspcam_huge_pages Huge pages of the system.\n"
+				 "# TYPE rtspcam_huge_pages gauge\n";
+	fmt::format_to(append, "rtspcam_huge_pages{{state=\"total\"}} {}\n", hugePages.total);
+	fmt::format_to(append, "rtspcam_huge_pages{{state=\"free\"}} {}\n", hugePages.free);
+
+	out += "# HELP rtspcam_frames_pushed_total Frames pushed to the app source.\n"
+				 "# TYPE rtspcam_frames_pushed_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		fmt::format_to(append, "rtspcam_frames_pushed_total{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->pusher()->stats().pushed);
+	}
+
+	if(const auto pool = debayerPool(); pool != nullptr)
+	{
+		out += "# HELP rtspcam_debayer_frame_seconds Wall time of debayering a frame on the CPU path.\n"
+					 "# TYPE rtspcam_debayer_frame_seconds histogram\n";
+		debayerFrameTime().render(out, "rtspcam_debayer_frame_seconds", "");
+
+		// the rate of the busy time is the utilization of a worker
+		out += "# HELP rtspcam_debayer_worker_busy_seconds_total Time a debayer worker spent on bands.\n"
+					 "# TYPE rtspcam_debayer_worker_busy_seconds_total counter\n";
+		for(uint32_t i = 0; i < pool->numThreads(); i++)
+		{
+			fmt::format_to(append, "rtspcam_debayer_worker_busy_seconds_total{{worker=\"{}\"}} {}\n", i,
+										 static_cast<double>(pool->busyTime(i)) / 1e9);
+		}
+
+		out += "# HELP rtspcam_debayer_steals_total Bands run by another debayer worker than they were queued to.\n"
+					 "# TYPE rtspcam_debayer_steals_total counter\n";
+		fmt::format_to(append, "rtspcam_debayer_steals_total {}\n", pool->steals());
+	}
+
+	static constexpr std::array TRANSPORTS{ RtpTransport::Udp, RtpTransport::Multicast, RtpTransport::Tcp };
+
+	out += "# HELP rtspcam_transport_bytes_total RTP bytes sent by lower transport, multicast once per group.\n"
+				 "# TYPE rtspcam_transport_bytes_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		for(const auto &stream : mount.streams)
+		{
+			for(auto transport : TRANSPORTS)
+			{
+				fmt::format_to(append, "rtspcam_transport_bytes_total{{stream=\"{}\",transport=\"{}\"}} {}\n",
+											 stream.path, TransportMetrics::transportName(transport),
+											 stream.transports->bytes(transport));
+			}
+		}
+	}
+
+	out += "# HELP rtspcam_transport_packets_total RTP packets sent by lower transport, multicast once per group.\n"
+				 "# TYPE rtspcam_transport_packets_total counter\n";
+	for(const auto &mount : _mounts)
+	{
+		for(const auto &stream : mount.streams)
+		{
+			for(auto transport : TRANSPORTS)
+			{
+				fmt::format_to(append, "rtspcam_transport_packets_total{{stream=\"{}\",transport=\"{}\"}} {}\n",
+											 stream.path, TransportMetrics::transportName(transport),
+											 stream.transports->packets(transport));
+			}
+		}
+	}
+
+	out += "# HELP rtspcam_transport_clients Clients receiving a stream by lower transport.\n"
+				 "# TYPE rtspcam_transport_clients gauge\n";
+	for(const auto &mount : _mounts)
+	{
+		for(const auto &stream : mount.streams)
+		{
+			for(auto transport : TRANSPORTS)
+			{
+				fmt::format_to(append, "rtspcam_transport_clients{{stream=\"{}\",transport=\"{}\"}} {}\n",
+											 stream.path, TransportMetrics::transportName(transport),
+											 stream.transports->clients(transport));
+			}
+		}
+	}
+
+	if(_options->adaptiveBitrate)
+	{
+		out += "# HELP rtspcam_encoder_bitrate_kbps Bitrate the encoder of a stream is set to.\n"
+					 "# TYPE rtspcam_encoder_bitrate_kbps gauge\n";
+		for(const auto &mount : _mounts)
+		{
+			for(const auto &stream : mount.streams)
+			{
+				fmt::format_to(append, "rtspcam_encoder_bitrate_kbps{{stream=\"{}\"}} {}\n", stream.path,
+											 stream.bitrate->stats().bitrate);
+			}
+		}
+
+		out += "# HELP rtspcam_bitrate_adjustments_total Encoder bitrate changes driven by receiver reports.\n"
+					 "# TYPE rtspcam_bitrate_adjustments_total counter\n";
+		for(const auto &mount : _mounts)
+		{
+			for(const auto &stream : mount.streams)
+			{
+				auto stats = stream.bitrate->stats();
+
+				fmt::format_to(append, "rtspcam_bitrate_adjustments_total{{stream=\"{}\",direction=\"increase\"}} {}\n",
+											 stream.path, stats.increases);
+				fmt::format_to(append, "rtspcam_bitrate_adjustments_total{{stream=\"{}\",direction=\"decrease\"}} {}\n",
+											 stream.path, stats.decreases);
+			}
+		}
+
+		out += "# HELP rtspcam_rtcp_fraction_lost Loss fraction of the last receiver report of a stream.\n"
+					 "# TYPE rtspcam_rtcp_fraction_lost gauge\n";
+		for(const auto &mount : _mounts)
+		{
+			for(const auto &stream : mount.streams)
+			{
+				fmt::format_to(append, "rtspcam_rtcp_fraction_lost{{stream=\"{}\"}} {}\n", stream.path,
+											 stream.bitrate->stats().fractionLost);
+			}
+		}
+
+		out += "# HELP rtspcam_rtcp_jitter_seconds Interarrival jitter of the last receiver report of a stream.\n"
+					 "# TYPE rtspcam_rtcp_jitter_seconds gauge\n";
+		for(const auto &mount : _mounts)
+		{
+			for(const auto &stream : mount.streams)
+			{
+				fmt::format_to(append, "rtspcam_rtcp_jitter_seconds{{stream=\"{}\"}} {}\n", stream.path,
+											 stream.bitrate->stats().jitter / 1000);
+			}
+		}
+	}
+
+	if(!_options->recordDir.empty())
+	{
+		out += "# HELP rtspcam_recording_bytes_written_total Bytes of the muxed main stream written to the recording.\n"
+					 "# TYPE rtspcam_recording_bytes_written_total counter\n";
+		for(const auto &mount : _mounts)
+		{
+			if(mount.recording != nullptr)
+				fmt::format_to(append, "rtspcam_recording_bytes_written_total{{camera=\"{}\"}} {}\n",
+											 mount.device->serial(), mount.recording->bytesWritten());
+		}
+
+		out += "# HELP rtspcam_recording_write_errors_total Failed writes and syncs of the recording.\n"
+					 "# TYPE rtspcam_recording_write_errors_total counter\n";
+		for(const auto &mount : _mounts)
+		{
+			if(mount.recording != nullptr)
+				fmt::format_to(append, "rtspcam_recording_write_errors_total{{camera=\"{}\"}} {}\n",
+											 mount.device->serial(), mount.recording->writeErrors());
+		}
+
+		out += "# HELP rtspcam_recording_write_seconds Time of writing a block of the recording.\n"
+					 "# TYPE rtspcam_recording_write_seconds histogram\n";
+		for(const auto &mount : _mounts)
+		{
+			if(mount.recording != nullptr)
+				mount.recording->writeTime().render(out, "rtspcam_recording_write_seconds",
+																						fmt::format("camera=\"{}\"", mount.device->serial()));
+		}
+
+		out += "# HELP rtspcam_recording_fsync_seconds Time of syncing a closed recording segment to disk.\n"
+					 "# TYPE rtspcam_recording_fsync_seconds histogram\n";
+		for(const auto &mount : _mounts)
+		{
+			if(mount.recording != nullptr)
+				mount.recording->syncTime().render(out, "rtspcam_recording_fsync_seconds",
+																					 fmt::format("camera=\"{}\"", mount.device->serial()));
+		}
+
+		out += "# HELP rtspcam_recording_seconds Recording available for export.\n"
+					 "# TYPE rtspcam_recording_seconds gauge\n";
+		for(const auto &mount : _mounts)
+		{
+			if(mount.recording != nullptr)
+				fmt::format_to(append, "rtspcam_recording_seconds{{camera=\"{}\"}} {}\n", mount.device->serial(),
+											 mount.recording->duration());
+		}
+	}
 
-	if(_options->useGpu)
+	out += "# HELP rtspcam_clients Clients watching a camera.\n"
+				 "# TYPE rtspcam_clients gauge\n";
+	for(const auto &mount : _mounts)
 	{
-		launchString = fmt::format(GPU_LAUNCH_STRING, _options->width, _options->height, _options->bitrate);
+		fmt::format_to(append, "rtspcam_clients{{camera=\"{}\"}} {}\n", mount.device->serial(),
+									 mount.device->numClients());
 	}
+
+	return out;
+}
+
+/**
+ * @brief Parse a number of a control query, the whole value has to be a number.
+ * */
+static bool parseControl(const std::string &value, double &number)
+{
+	char *end{};
+
+	if(value.empty())
+		return false;
+	number = g_ascii_strtod(value.c_str(), &end);
+	return end != nullptr && *end == '\0';
+}
+
+static bool parseControl(const std::string &value, int32_t &number)
+{
+	gint64 parsed;
+
+	if(!g_ascii_string_to_signed(value.c_str(), 10, G_MININT32, G_MAXINT32, &parsed, nullptr))
+		return false;
+	number = static_cast<int32_t>(parsed);
+	return true;
+}
+
+/**
+ * @brief Settings of a camera with their bounds, one key=value per line.
+ * */
+static std::string renderControls(DeviceHandle *device)
+{
+	auto controls = device->controls();
+	auto bounds = device->bounds();
+	std::string out;
+	auto append = std::back_inserter(out);
+
+	fmt::format_to(append, "camera={}\n", device->serial());
+	if(controls.exposure.has_value())
+		fmt::format_to(append, "exposure={}\n", *controls.exposure);
+	else
+		out += "exposure=auto\n";
+	if(controls.gain.has_value())
+		fmt::format_to(append, "gain={}\n", *controls.gain);
 	else
+		out += "gain=auto\n";
+	fmt::format_to(append, "frame-rate={}\n", controls.frameRate);
+	fmt::format_to(append, "offset-x={}\n", controls.offsetX);
+	fmt::format_to(append, "offset-y={}\n", controls.offsetY);
+	fmt::format_to(append, "exposure-bounds={},{}\n", bounds.exposureMin, bounds.exposureMax);
+	fmt::format_to(append, "gain-bounds={},{}\n", bounds.gainMin, bounds.gainMax);
+	fmt::format_to(append, "frame-rate-bounds={},{}\n", bounds.frameRateMin, bounds.frameRateMax);
+	fmt::format_to(append, "offset-x-bounds={},{},{}\n", bounds.offsetXMin, bounds.offsetXMax, bounds.offsetXIncrement);
+	fmt::format_to(append, "offset-y-bounds={},{},{}\n", bounds.offsetYMin, bounds.offsetYMax, bounds.offsetYIncrement);
+	return out;
+}
+
+HttpResponse ServerHandle::handleControl(std::string_view method, std::string_view query)
+{
+	auto serial = HttpServer::queryValue(query, "camera");
+	DeviceHandle *device{};
+	ControlStatus status{ ControlStatus::Ok };
+	const char *failed{};
+	double value;
+	int32_t offsetX, offsetY;
+
+	for(const auto &mount : _mounts)
+	{
+		if(serial.empty() ? _mounts.size() == 1 : mount.device->serial() == serial)
+			device = mount.device;
+	}
+	if(device == nullptr)
+		return { 404, "text/plain", serial.empty() ? "camera parameter required\n" : "camera not found\n" };
+
+	if(method == "GET")
+		return { 200, "text/plain", renderControls(device) };
+	if(method != "POST")
+		return { 405, "text/plain", "use GET or POST\n" };
+
+	auto exposure = HttpServer::queryValue(query, "exposure");
+	auto gain = HttpServer::queryValue(query, "gain");
+	auto frameRate = HttpServer::queryValue(query, "frame-rate");
+	auto x = HttpServer::queryValue(query, "offset-x");
+	auto y = HttpServer::queryValue(query, "offset-y");
+
+	if(!exposure.empty() && status == ControlStatus::Ok)
+	{
+		failed = "exposure";
+		status = parseControl(exposure, value) ? device->setExposure(value) : ControlStatus::OutOfBounds;
+	}
+	if(!gain.empty() && status == ControlStatus::Ok)
+	{
+		failed = "gain";
+		status = parseControl(gain, value) ? device->setGain(value) : ControlStatus::OutOfBounds;
+	}
+	if(!frameRate.empty() && status == ControlStatus::Ok)
+	{
+		failed = "frame-rate";
+		status = parseControl(frameRate, value) ? device->setFrameRate(value) : ControlStatus::OutOfBounds;
+	}
+	if((!x.empty() || !y.empty()) && status == ControlStatus::Ok)
+	{
+		auto controls = device->controls();
+
+		failed = "offset";
+		offsetX = controls.offsetX;
+		offsetY = controls.offsetY;
+		if((x.empty() || parseControl(x, offsetX)) && (y.empty() || parseControl(y, offsetY)))
+			status = device->setRoiOffset(offsetX, offsetY);
+		else
+			status = ControlStatus::OutOfBounds;
+	}
+
+	switch(status)
+	{
+		case ControlStatus::Ok:
+			return { 200, "text/plain", renderControls(device) };
+		case ControlStatus::OutOfBounds:
+			return { 400, "text/plain", fmt::format("invalid {}\n{}", failed, renderControls(device)) };
+		default:
+			return { 500, "text/plain", fmt::format("camera rejected {}\n{}", failed, renderControls(device)) };
+	}
+}
+
+HttpResponse ServerHandle::handleRecording(std::string_view method, std::string_view query)
+{
+	auto serial = HttpServer::queryValue(query, "camera");
+	auto length = HttpServer::queryValue(query, "seconds");
+	DiskRing *recording{};
+	double seconds{ DEFAULT_CLIP_SECONDS };
+	std::vector<DiskRing::ClipPart> parts;
+
+	for(const auto &mount : _mounts)
+	{
+		if(serial.empty() ? _mounts.size() == 1 : mount.device->serial() == serial)
+			recording = mount.recording.get();
+	}
+	if(recording == nullptr)
+		return { 404, "text/plain", serial.empty() ? "camera parameter required\n" : "camera not recorded\n" };
+
+	if(method != "GET")
+		return { 405, "text/plain", "use GET\n" };
+	if(!length.empty() && (!parseControl(length, seconds) || !(seconds > 0)))
+		return { 400, "text/plain", "invalid seconds\n" };
+
+	if(!recording->clipParts(seconds, parts))
+		return { 503, "text/plain", "no keyframe recorded yet\n" };
+
+	// the segments go to the client a chunk at a time, a clip may be tens of megabytes
+	auto writeBody = [recording, parts = std::move(parts)](GOutputStream *output, GCancellable *cancellable) {
+		return recording->exportClip(parts, [output, cancellable](const uint8_t *data, size_t size) {
+			return g_output_stream_write_all(output, data, size, nullptr, cancellable, nullptr) != FALSE;
+		});
+	};
+	return { 200, "video/mp2t", {}, std::move(writeBody) };
+}
+
+void ServerHandle::initDevices(const std::string &path)
+{
+	uint32_t i, numDevices;
+
+	// a replay stands in for all cameras
+	if(!_options->replayFile.empty())
+	{
+		auto replay = std::make_unique<ReplaySource>(_options->replayFile, _options->replayRate);
+		int32_t cpu = !_options->cpuAffinity.empty() ? _options->cpuAffinity[0] : -1;
+
+		if(!replay->open())
+			return;
+
+		auto deviceHandle = new DeviceHandle(_options, std::move(replay), cpu);
+		auto &mount = _mounts.emplace_back(CameraMount{ deviceHandle, nullptr, path, {} });
+		initMediaFactory(mount, _options->profiles);
+		return;
+	}
+
+	if(_options->fakeCamera)
+		arv_enable_interface("Fake");
+
+	arv_update_device_list();
+	numDevices = arv_get_n_devices();
+
+	if(numDevices == 0)
+	{
+		GST_ERROR("no device found!");
+		return;
+	}
+
+	GST_INFO("found camera(s): %u", numDevices);
+
+	for(i = 0; i < numDevices; i++)
+	{
+		int32_t cpu = i < _options->cpuAffinity.size() ? _options->cpuAffinity[i] : -1;
+		auto deviceHandle = new DeviceHandle(_options, arv_get_device_id(i), cpu, _options->streamBuffers);
+
+		if(!deviceHandle->isInitialized())
+		{
+			delete deviceHandle;
+			continue;
+		}
+
+		std::string mountPath = numDevices > 1 ? path + "/" + deviceHandle->serial() : path;
+		auto &mount = _mounts.emplace_back(CameraMount{ deviceHandle, nullptr, mountPath, {} });
+		initMediaFactory(mount, _options->profiles);
+	}
+}
+
+/**
+ * @brief Append the caps of the encoded frames and the payloader of a media.
+ * */
+static void appendPayloader(PipelineBuilder &pipeline, Codec codec, int32_t width, int32_t height)
+{
+	pipeline.caps(codecMediaType(codec))
+		.field("width", width)
+		.field("height", height)
+		.field("stream-format", "byte-stream")
+		.element(fmt::format("rtp{}pay", codecName(codec)))
+		.property("name", "pay0")
+		.property("pt", PAYLOAD_TYPE);
+}
+
+void ServerHandle::initMediaFactory(CameraMount &mount, const std::vector<StreamProfile> &profiles) noexcept
+{
+	auto codec = encoderInfo(_options->encoder).codec;
+	PipelineBuilder capture;
+	std::vector<std::string> relaySinks;
+	int32_t frameRate;
+
+	if(profiles.empty() && !_options->alwaysOn)
+	{
+		PipelineBuilder pipeline;
+
+		pipeline.element("appsrc")
+			.property("name", "srvsrc")
+			.element(DEBAYER_ELEMENT_NAME)
+			.caps("video/x-raw")
+			.field("format", "I420")
+			.field("width", _options->width)
+			.field("height", _options->height)
+			.element("queue");
+		appendEncoder(pipeline, { _options->encoder, _options->bitrate, _options->encoding });
+		appendPayloader(pipeline, codec, _options->width, _options->height);
+
+		addStream(mount, mount.path,
+							addMediaFactory(mount.path, pipeline.str(), reinterpret_cast<GCallback>(configureMedia), mount.device),
+							_options->bitrate);
+		return;
+	}
+
+	// recording needs the encoded stream of the persistent capture
+	if(!_options->recordDir.empty() && _options->alwaysOn)
+	{
+		auto recording = std::make_unique<DiskRing>(
+			_options->recordDir + "/" + mount.device->serial(), _options->recordSize,
+			DiskRing::segmentSizeFor(_options->bitrate, _options->recordSegment),
+			static_cast<gint64>(_options->recordSegment) * G_USEC_PER_SEC);
+
+		if(recording->open())
+			mount.recording = std::move(recording);
+		else
+			GST_ERROR("camera %s is not recorded", mount.device->serial().c_str());
+	}
+
+	// the main stream is the first profile of the shared capture
+	std::vector<StreamProfile> streams{ { "", _options->width, _options->height, _options->bitrate } };
+	streams.insert(streams.end(), profiles.begin(), profiles.end());
+	frameRate = static_cast<int32_t>(std::lround(_options->frameRate.value_or(DEFAULT_PROFILE_FRAME_RATE)));
+
+	capture.element("appsrc")
+		.property("name", "srvsrc")
+		.element(DEBAYER_ELEMENT_NAME)
+		.caps("video/x-raw")
+		.field("format", "I420")
+		.element("tee")
+		.property("name", "split");
+	for(const auto &profile : streams)
+	{
+		auto channel = CapturePipeline::channelName(mount.device->serial(), profile.name);
+
+		capture.branch("split")
+			.element("queue")
+			.property("leaky", "downstream")
+			.property("max-size-buffers", int64_t{ 2 })
+			.element("videoscale")
+			.caps("video/x-raw")
+			.field("format", "I420")
+			.field("width", profile.width)
+			.field("height", profile.height);
+		if(!_options->alwaysOn)
+		{
+			capture.element("intervideosink").property("channel", channel);
+			continue;
+		}
+
+		EncoderDescription encoder{ _options->encoder, profile.bitrate, _options->encoding };
+
+		// a keyframe every second bounds the frames cached for new clients
+		if(encoder.settings.gopLength == 0)
+			encoder.settings.gopLength = frameRate;
+		appendEncoder(capture, encoder);
+		capture.element(fmt::format("{}parse", codecName(codec)))
+			.property("config-interval", int64_t{ -1 })
+			.caps(codecMediaType(codec))
+			.field("stream-format", "byte-stream")
+			.field("alignment", "au");
+		bool record = mount.recording != nullptr && profile.name.empty();
+		if(record)
+			capture.element("tee").property("name", RECORDING_TEE);
+		capture.element("appsink")
+			.property("name", channel)
+			.property("emit-signals", "true")
+			.property("sync", "false");
+		relaySinks.push_back(channel);
+
+		// the disk may stall on a sync, the queue drops muxer input rather than stall the relay
+		if(record)
+		{
+			capture.branch(RECORDING_TEE)
+				.element("queue")
+				.property("leaky", "downstream")
+				.property("max-size-buffers", int64_t{ 0 })
+				.property("max-size-time", int64_t{ 0 })
+				.property("max-size-bytes", RECORDING_QUEUE_BYTES)
+				.element("mpegtsmux")
+				.element("appsink")
+				.property("name", RECORDING_SINK)
+				.property("emit-signals", "true")
+				.property("sync", "false");
+		}
+	}
+	mount.capture = new CapturePipeline(mount.device, capture.str(), relaySinks, codecMediaType(codec));
+	if(mount.recording != nullptr)
+		mount.capture->setRecording(RECORDING_SINK, mount.recording.get());
+
+	for(size_t i = 0; i < streams.size(); i++)
 	{
-		launchString = fmt::format(CPU_LAUNCH_STRING, _options->width, _options->height, _options->bitrate);
+		const auto &profile = streams[i];
+		auto channel = CapturePipeline::channelName(mount.device->serial(), profile.name);
+		auto path = profile.name.empty() ? mount.path : mount.path + "/" + profile.name;
+		PipelineBuilder pipeline;
+		GstRTSPMediaFactory *factory;
+
+		if(_options->alwaysOn)
+		{
+			pipeline.element("appsrc")
+				.property("name", "relaysrc")
+				.element(fmt::format("rtp{}pay", codecName(codec)))
+				.property("name", "pay0")
+				.property("pt", PAYLOAD_TYPE)
+				.property("config-interval", int64_t{ -1 });
+			factory = addMediaFactory(path, pipeline.str(), reinterpret_cast<GCallback>(configureRelayMedia),
+																mount.capture->relay(i));
+		}
+		else
+		{
+			pipeline.element("intervideosrc")
+				.property("channel", channel)
+				.caps("video/x-raw")
+				.field("format", "I420")
+				.field("width", profile.width)
+				.field("height", profile.height)
+				.field("framerate", frameRate, 1)
+				.element("queue");
+			appendEncoder(pipeline, { _options->encoder, profile.bitrate, _options->encoding });
+			appendPayloader(pipeline, codec, profile.width, profile.height);
+			factory = addMediaFactory(path, pipeline.str(), reinterpret_cast<GCallback>(configureProfileMedia),
+																mount.capture);
+		}
+		addStream(mount, path, factory, profile.bitrate);
 	}
+}
+
+void ServerHandle::addStream(CameraMount &mount, const std::string &path, GstRTSPMediaFactory *factory,
+														 int64_t bitrate)
+{
+	auto &stream = mount.streams.emplace_back(StreamMount{ path, factory });
+
+	g_signal_connect(factory, "media-configure", reinterpret_cast<GCallback>(configureTransportCounters),
+									 stream.transports.get());
+	if(!_options->adaptiveBitrate)
+		return;
+
+	auto minBitrate = _options->minBitrate > 0 ? _options->minBitrate : bitrate / DEFAULT_MIN_BITRATE_DIVISOR;
+	stream.bitrate = std::make_unique<BitrateController>(_options->encoder, minBitrate, bitrate);
+	g_object_set_data(G_OBJECT(factory), BITRATE_CONTROLLER_KEY, stream.bitrate.get());
+}
+
+GstRTSPMediaFactory *ServerHandle::addMediaFactory(const std::string &path, const std::string &launchString,
+																									 GCallback configure, void *data) noexcept
+{
+	// get the mount points for this server, every server has a default object
+	// that be used to map uri mount points to media factories
+	GstRTSPMediaFactory *factory;
 	GstRTSPMountPoints *mountPoints = gst_rtsp_server_get_mount_points(_server);
-	_factory = gst_rtsp_media_factory_new();
-	gst_rtsp_media_factory_set_launch(_factory, launchString.c_str());
-	gst_rtsp_media_factory_set_shared(_factory, true);
-	gst_rtsp_mount_points_add_factory(mountPoints, path, _factory);
+
+	GST_INFO("media pipeline of %s: %s", path.c_str(), launchString.c_str());
+	factory = gst_rtsp_media_factory_new();
+	gst_rtsp_media_factory_set_launch(factory, launchString.c_str());
+	gst_rtsp_media_factory_set_shared(factory, true);
+	gst_rtsp_media_factory_set_protocols(factory, transportProtocols(_options->transport));
+	gst_rtsp_media_factory_set_address_pool(factory, _addressPool);
+	gst_rtsp_media_factory_set_max_mcast_ttl(factory, _options->multicastTtl);
+	// multiudpsink sends the packet lists of the payloaders with one sendmmsg call per client
+	gst_rtsp_media_factory_set_buffer_size(factory, UDP_SEND_BUFFER_BYTES);
+	// the mount points take over a reference, we keep ours
+	gst_rtsp_mount_points_add_factory(mountPoints, path.c_str(), GST_RTSP_MEDIA_FACTORY(g_object_ref(factory)));
 	// notify when our media is ready, This is called whenever someone asks for
-	// the media and a new pipeline with our appsrc is created
-	g_signal_connect(_factory, "media-configure", reinterpret_cast<GCallback>(configureMedia), _deviceHandle);
-	g_signal_connect(_factory, "media-constructed", reinterpret_cast<GCallback>(mediaConstructed), nullptr);
+	// the media and a new pipeline is created
+	g_signal_connect(factory, "media-configure", configure, data);
 	g_object_unref(mountPoints);
+
+	return factory;
+}
+
+void ServerHandle::onClientsChanged(DeviceHandle *device, uint32_t numClients)
+{
+	device->setNumClients(numClients);
+	g_message("camera %s (current: %u)\n", device->serial().c_str(), numClients);
+
+	for(const auto &mount : _mounts)
+	{
+		// shared capture pipelines are started and stopped by their medias
+		if(mount.device != device || mount.capture != nullptr || _options->alwaysOn)
+			continue;
+		// both check the state under the lock of the device, a media may start or stop it meanwhile
+		if(numClients == 0)
+			device->suspendAcquisition();
+		else
+			device->resumeAcquisition();
+	}
+}
+
+void ServerHandle::initThreadPool() noexcept
+{
+	GstRTSPThreadPool *pool = gst_rtsp_server_get_thread_pool(_server);
+	gint maxThreads;
+
+	// a pool without limit starts a thread for every client, a limited one shares its threads between them
+	if(_options->threadPerClient)
+		maxThreads = -1;
+	else if(_options->serverThreads > 0)
+		maxThreads = static_cast<gint>(_options->serverThreads);
+	else
+		maxThreads = static_cast<gint>(g_get_num_processors());
+
+	gst_rtsp_thread_pool_set_max_threads(pool, maxThreads);
+	g_object_unref(pool);
+	if(maxThreads < 0)
+		GST_INFO("RTSP clients are served on a thread each");
+	else
+		GST_INFO("RTSP clients are served on up to %d threads", maxThreads);
 }
 
 void ServerHandle::initAuth() noexcept
@@ -119,6 +1023,10 @@ void ServerHandle::initAuth() noexcept
 	permissions = gst_rtsp_permissions_new();
 	gst_rtsp_permissions_add_role(permissions, "user", GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, true,
 																GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, true, nullptr);
-	gst_rtsp_media_factory_set_permissions(_factory, permissions);
+	for(const auto &mount : _mounts)
+	{
+		for(const auto &stream : mount.streams)
+			gst_rtsp_media_factory_set_permissions(stream.factory, permissions);
+	}
 	gst_rtsp_permissions_unref(permissions);
 }
@@ -0,0 +1,235 @@
+#include <sys/ioctl.h>
+#include <fmt/format.h>
+
+#include "SessionRegistry.hpp"
+#include "DeviceHandle.hpp"
+
+/**
+ * Session attached to the stream transport of its client.
+ * */
+struct SessionAttachment
+{
+	SessionRegistry *registry;
+	Session *session;
+};
+
+static GQuark sessionQuark()
+{
+	return g_quark_from_static_string("rtspcam-session");
+}
+
+Session::Session(SessionInfo info, const void *client, DeviceHandle *device, TransportMetrics *transports,
+								 std::string rtcpAddress, GSocket *socket):
+	_info{ std::move(info) },
+	_client{ client },
+	_device{ device },
+	_transports{ transports },
+	_packetsBase{ transports != nullptr ? transports->sentPackets() : 0 },
+	_bytesBase{ transports != nullptr ? transports->sentBytes() : 0 },
+	_rtcpAddress{ std::move(rtcpAddress) },
+	_socket{ socket != nullptr ? G_SOCKET(g_object_ref(socket)) : nullptr },
+	_hasReport{},
+	_fractionLost{},
+	_jitter{}
+{
+	if(_transports != nullptr)
+		_transports->addClient(_info.transport);
+}
+
+Session::~Session()
+{
+	if(_transports != nullptr)
+		_transports->removeClient(_info.transport);
+	if(_socket != nullptr)
+		g_object_unref(_socket);
+}
+
+void Session::report(double fractionLost, double jitter)
+{
+	_fractionLost.store(fractionLost, std::memory_order_relaxed);
+	_jitter.store(jitter, std::memory_order_relaxed);
+	_hasReport.store(true, std::memory_order_release);
+}
+
+uint64_t Session::id() const
+{
+	return _info.id;
+}
+
+const void *Session::client() const
+{
+	return _client;
+}
+
+DeviceHandle *Session::device() const
+{
+	return _device;
+}
+
+const std::string &Session::rtcpAddress() const
+{
+	return _rtcpAddress;
+}
+
+SessionInfo Session::info() const
+{
+	SessionInfo info{ _info };
+	int queued{};
+
+	if(_transports != nullptr)
+	{
+		info.bytes = _transports->sentBytes() - _bytesBase;
+		info.packets = _transports->sentPackets() - _packetsBase;
+	}
+	if(_hasReport.load(std::memory_order_acquire))
+	{
+		info.fractionLost = _fractionLost.load(std::memory_order_relaxed);
+		info.jitter = _jitter.load(std::memory_order_relaxed);
+	}
+	// bytes written to the connection but not yet acknowledged by the client
+	if(_socket != nullptr && !g_socket_is_closed(_socket) && ioctl(g_socket_get_fd(_socket), TIOCOUTQ, &queued) == 0)
+		info.queueBytes = static_cast<uint64_t>(queued);
+	return info;
+}
+
+SessionRegistry::SessionRegistry(ClientsChanged clientsChanged):
+	_clientsChanged{ std::move(clientsChanged) },
+	_nextId{ 1 }
+{}
+
+SessionRegistry::~SessionRegistry()
+{
+	std::lock_guard lock{ _mutex };
+
+	// transports outliving the registry must not call back into it
+	for(const auto &[id, transport] : _transports)
+		delete static_cast<SessionAttachment *>(g_object_steal_qdata(G_OBJECT(transport), sessionQuark()));
+}
+
+void SessionRegistry::add(GstRTSPClient *client, GstRTSPStreamTransport *transport, DeviceHandle *device,
+													TransportMetrics *transports, std::string path)
+{
+	const GstRTSPTransport *rtspTransport = gst_rtsp_stream_transport_get_transport(transport);
+	GstRTSPConnection *connection = gst_rtsp_client_get_connection(client);
+	RtpTransport lowerTransport{ RtpTransport::Udp };
+	std::string rtcpAddress;
+	bool newClient;
+
+	// a client setting up the stream again keeps the transport, its session starts over
+	if(auto previous = g_object_steal_qdata(G_OBJECT(transport), sessionQuark()); previous != nullptr)
+		transportFinalized(previous);
+
+	if(rtspTransport->lower_transport & GST_RTSP_LOWER_TRANS_TCP)
+	{
+		lowerTransport = RtpTransport::Tcp;
+	}
+	else if(rtspTransport->lower_transport & GST_RTSP_LOWER_TRANS_UDP_MCAST)
+	{
+		lowerTransport = RtpTransport::Multicast;
+	}
+	else if(rtspTransport->destination != nullptr)
+	{
+		// receiver reports come from the RTCP port the client set up
+		rtcpAddress = fmt::format("{}:{}", rtspTransport->destination, rtspTransport->client_port.max);
+	}
+
+	std::unique_lock lock{ _mutex };
+
+	SessionInfo info{};
+	info.id = _nextId++;
+	info.address = connection != nullptr ? gst_rtsp_connection_get_ip(connection) : "";
+	info.path = std::move(path);
+	info.camera = device->serial();
+	info.transport = lowerTransport;
+	info.startTime = g_get_real_time();
+	GST_INFO("session %" G_GUINT64_FORMAT " of %s set up %s over %s", info.id, info.address.c_str(), info.path.c_str(),
+					 TransportMetrics::transportName(lowerTransport));
+
+	auto session = std::make_unique<Session>(std::move(info), client, device, transports, std::move(rtcpAddress),
+																					 connection != nullptr ? gst_rtsp_connection_get_write_socket(connection)
+																																 : nullptr);
+	g_object_set_qdata_full(G_OBJECT(transport), sessionQuark(), new SessionAttachment{ this, session.get() },
+													transportFinalized);
+	_transports.emplace(session->id(), transport);
+
+	newClient = _clients[device][client]++ == 0;
+	_sessions.emplace(session->id(), std::move(session));
+	lock.unlock();
+
+	if(newClient)
+		clientsChanged(device);
+}
+
+void SessionRegistry::report(std::string_view rtcpAddress, double fractionLost, double jitter)
+{
+	std::lock_guard lock{ _mutex };
+
+	for(auto &[id, session] : _sessions)
+	{
+		if(session->rtcpAddress() == rtcpAddress)
+			session->report(fractionLost, jitter);
+	}
+}
+
+std::vector<SessionInfo> SessionRegistry::sessions() const
+{
+	std::lock_guard lock{ _mutex };
+	std::vector<SessionInfo> sessions;
+
+	sessions.reserve(_sessions.size());
+	for(const auto &[id, session] : _sessions)
+		sessions.push_back(session->info());
+	return sessions;
+}
+
+uint32_t SessionRegistry::numClients(DeviceHandle *device) const
+{
+	std::lock_guard lock{ _mutex };
+	auto clients = _clients.find(device);
+
+	return clients != _clients.end() ? static_cast<uint32_t>(clients->second.size()) : 0;
+}
+
+void SessionRegistry::remove(uint64_t id)
+{
+	std::unique_lock lock{ _mutex };
+	auto entry = _sessions.find(id);
+
+	if(entry == _sessions.end())
+		return;
+
+	auto &session = entry->second;
+	auto device = session->device();
+	auto &clients = _clients[device];
+	auto client = clients.find(session->client());
+	bool clientGone = client != clients.end() && --client->second == 0;
+
+	if(clientGone)
+		clients.erase(client);
+	GST_INFO("session %" G_GUINT64_FORMAT " closed after %" G_GUINT64_FORMAT " bytes", id, session->info().bytes);
+	_transports.erase(id);
+	_sessions.erase(entry);
+	lock.unlock();
+
+	if(clientGone)
+		clientsChanged(device);
+}
+
+void SessionRegistry::clientsChanged(DeviceHandle *device)
+{
+	if(!_clientsChanged)
+		return;
+
+	// a change racing on another thread waits here and passes its count on after this one
+	std::lock_guard lock{ _clientsChangedMutex };
+
+	_clientsChanged(device, numClients(device));
+}
+
+void SessionRegistry::transportFinalized(void *data)
+{
+	auto attachment = static_cast<SessionAttachment *>(data);
+
+	attachment->registry->remove(attachment->session->id());
+	delete attachment;
+}
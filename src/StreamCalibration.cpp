@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+#include "StreamCalibration.hpp"
+
+/// Buffer counts tried from the smallest one up
+static constexpr uint32_t CANDIDATE_BUFFERS[]{ 4, 6, 8, 12, 16, 24, 32, 48, 64 };
+/// Frames streamed at least per trial
+static constexpr double TRIAL_FRAMES{ 150 };
+/// Shortest and longest trial in microseconds
+static constexpr gint64 TRIAL_MIN_DURATION{ 3 * G_USEC_PER_SEC };
+static constexpr gint64 TRIAL_MAX_DURATION{ 10 * G_USEC_PER_SEC };
+/// Longest wait for a frame in microseconds
+static constexpr guint64 POP_TIMEOUT{ 200'000 };
+/// Relative frame rate difference above which a stored calibration is redone
+static constexpr double FRAME_RATE_TOLERANCE{ 0.01 };
+
+std::string calibrationFilePath(const Options &options)
+{
+	if(!options.calibrationFile.empty())
+		return options.calibrationFile;
+
+	char *path = g_build_filename(g_get_user_config_dir(), "rtspcam", "calibration.ini", nullptr);
+	std::string out{ path };
+
+	g_free(path);
+	return out;
+}
+
+bool loadStreamSettings(const std::string &path, const std::string &serial, const CalibrationKey &key,
+												StreamSettings &settings)
+{
+	GKeyFile *file = g_key_file_new();
+	GError *error{};
+	bool valid{};
+
+	if(g_key_file_load_from_file(file, path.c_str(), G_KEY_FILE_NONE, nullptr) &&
+		 g_key_file_has_group(file, serial.c_str()))
+	{
+		auto group = serial.c_str();
+		auto payload = g_key_file_get_uint64(file, group, "payload", &error);
+		auto frameRate = g_key_file_get_double(file, group, "frame-rate", error == nullptr ? &error : nullptr);
+		auto numBuffers = g_key_file_get_integer(file, group, "stream-buffers", error == nullptr ? &error : nullptr);
+		// cameras other than GigE Vision have no packet size
+		auto packetSize = g_key_file_get_integer(file, group, "packet-size", nullptr);
+
+		if(error != nullptr)
+		{
+			GST_WARNING("invalid calibration of camera %s in %s: %s", group, path.c_str(), error->message);
+			g_error_free(error);
+		}
+		else if(payload == key.payload && numBuffers > 0 &&
+						std::abs(frameRate - key.frameRate) <= FRAME_RATE_TOLERANCE * key.frameRate)
+		{
+			settings = { static_cast<uint32_t>(numBuffers), static_cast<uint32_t>(std::max(packetSize, 0)) };
+			valid = true;
+		}
+	}
+	g_key_file_free(file);
+	return valid;
+}
+
+bool saveStreamSettings(const std::string &path, const std::string &serial, const CalibrationKey &key,
+												const StreamSettings &settings)
+{
+	GKeyFile *file = g_key_file_new();
+	GError *error{};
+	char *directory = g_path_get_dirname(path.c_str());
+	bool saved;
+
+	// keep the calibrations of the other cameras
+	g_key_file_load_from_file(file, path.c_str(), G_KEY_FILE_KEEP_COMMENTS, nullptr);
+	g_key_file_set_uint64(file, serial.c_str(), "payload", key.payload);
+	g_key_file_set_double(file, serial.c_str(), "frame-rate", key.frameRate);
+	g_key_file_set_integer(file, serial.c_str(), "stream-buffers", static_cast<gint>(settings.numBuffers));
+	g_key_file_set_integer(file, serial.c_str(), "packet-size", static_cast<gint>(settings.packetSize));
+
+	g_mkdir_with_parents(directory, 0755);
+	saved = g_key_file_save_to_file(file, path.c_str(), &error);
+	if(!saved)
+	{
+		GST_WARNING("failed to save the calibration to %s: %s", path.c_str(), error->message);
+		g_error_free(error);
+	}
+	g_free(directory);
+	g_key_file_free(file);
+	return saved;
+}
+
+CalibrationTrial runCalibrationTrial(ArvCamera *camera, uint32_t numBuffers, uint32_t heldFrames)
+{
+	GError *error{};
+	ArvStream *stream;
+	std::deque<ArvBuffer *> held;
+	CalibrationTrial trial{};
+	double frameRate = arv_camera_get_frame_rate(camera, nullptr);
+	gint64 duration, end;
+
+	stream = arv_camera_create_stream(camera, nullptr, nullptr, &error);
+	if(!ARV_IS_STREAM(stream))
+	{
+		GST_WARNING("failed to create calibration stream: %s", error != nullptr ? error->message : "");
+		if(error != nullptr)
+			g_error_free(error);
+		// counts as a failed trial
+		trial.failures = 1;
+		return trial;
+	}
+	arv_stream_create_buffers(stream, numBuffers, nullptr, nullptr, nullptr);
+
+	duration = frameRate > 0 ? static_cast<gint64>(TRIAL_FRAMES / frameRate * G_USEC_PER_SEC) : TRIAL_MAX_DURATION;
+	duration = std::clamp(duration, TRIAL_MIN_DURATION, TRIAL_MAX_DURATION);
+
+	arv_camera_set_acquisition_mode(camera, ARV_ACQUISITION_MODE_CONTINUOUS, nullptr);
+	arv_camera_start_acquisition(camera, nullptr);
+	end = g_get_monotonic_time() + duration;
+	while(g_get_monotonic_time() < end)
+	{
+		ArvBuffer *buffer = arv_stream_timeout_pop_buffer(stream, POP_TIMEOUT);
+
+		if(buffer == nullptr)
+			continue;
+		// the oldest frame is released once the pipeline would be full
+		held.push_back(buffer);
+		if(held.size() > heldFrames)
+		{
+			arv_stream_push_buffer(stream, held.front());
+			held.pop_front();
+		}
+	}
+	arv_camera_stop_acquisition(camera, nullptr);
+
+	arv_stream_get_statistics(stream, &trial.completed, &trial.failures, &trial.underruns);
+	for(auto buffer : held)
+		arv_stream_push_buffer(stream, buffer);
+	g_object_unref(stream);
+	return trial;
+}
+
+StreamSettings calibrateStream(ArvCamera *camera, uint32_t heldFrames)
+{
+	StreamSettings settings{ CANDIDATE_BUFFERS[std::size(CANDIDATE_BUFFERS) - 1], 0 };
+	GError *error{};
+
+	if(arv_camera_is_gv_device(camera))
+	{
+		// probes the largest packet the network path delivers without fragmentation
+		settings.packetSize = arv_camera_gv_auto_packet_size(camera, &error);
+		if(error != nullptr)
+		{
+			GST_WARNING("packet size negotiation failed: %s", error->message);
+			g_clear_error(&error);
+			settings.packetSize = arv_camera_gv_get_packet_size(camera, nullptr);
+		}
+		GST_INFO("calibration: packet size %u bytes", settings.packetSize);
+	}
+
+	GST_INFO("calibration: %u bytes per frame at %.2f fps, %u frames held by the pipeline",
+					 arv_camera_get_payload(camera, nullptr), arv_camera_get_frame_rate(camera, nullptr), heldFrames);
+	for(auto numBuffers : CANDIDATE_BUFFERS)
+	{
+		// the stream needs a free buffer while the pipeline holds its frames
+		if(numBuffers <= heldFrames)
+			continue;
+
+		auto trial = runCalibrationTrial(camera, numBuffers, heldFrames);
+		GST_INFO("calibration: %u buffers, %" G_GUINT64_FORMAT " completed, %" G_GUINT64_FORMAT
+						 " failures, %" G_GUINT64_FORMAT " underruns",
+						 numBuffers, trial.completed, trial.failures, trial.underruns);
+		if(trial.completed > 0 && trial.failures == 0 && trial.underruns == 0)
+		{
+			settings.numBuffers = numBuffers;
+			return settings;
+		}
+	}
+
+	GST_WARNING("calibration: no buffer count streams without loss, using %u", settings.numBuffers);
+	return settings;
+}
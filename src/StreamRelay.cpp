@@ -0,0 +1,275 @@
+#include <algorithm>
+
+#include "StreamRelay.hpp"
+#include "Callback.hpp"
+#include "Encoder.hpp"
+
+/**
+ * @brief Shallow copy of a frame for a media.
+ *
+ * Timestamps of the capture pipeline mean nothing to the media pipeline,
+ * the copy is stamped on the running time of the media.
+ *
+ * @param pts PTS in the media, GST_CLOCK_TIME_NONE lets its app source stamp the frame on arrival.
+ * */
+static GstBuffer *relayBuffer(GstBuffer *buffer, GstClockTime pts)
+{
+	GstBuffer *copy = gst_buffer_copy(buffer);
+
+	GST_BUFFER_PTS(copy) = pts;
+	GST_BUFFER_DTS(copy) = pts;
+	return copy;
+}
+
+/**
+ * @brief Running time of the pipeline of an element.
+ *
+ * @return GST_CLOCK_TIME_NONE while the element has no clock.
+ * */
+static GstClockTime runningTime(GstElement *element)
+{
+	GstClock *clock = gst_element_get_clock(element);
+	GstClockTime now, base;
+
+	if(clock == nullptr)
+		return GST_CLOCK_TIME_NONE;
+	now = gst_clock_get_time(clock);
+	base = gst_element_get_base_time(element);
+	gst_object_unref(clock);
+	return now > base ? now - base : 0;
+}
+
+StreamRelay::StreamRelay(CaptureMetrics *metrics, std::string mediaType, uint32_t maxCachedFrames):
+	_mediaType{ std::move(mediaType) },
+	_sink{},
+	_caps{},
+	_metrics{ metrics },
+	_maxCachedFrames{ maxCachedFrames }
+{}
+
+StreamRelay::~StreamRelay()
+{
+	clearSink();
+	for(auto &source : _sources)
+		gst_object_unref(source.source);
+}
+
+void StreamRelay::setSink(GstAppSink *sink)
+{
+	std::lock_guard lock{ _mutex };
+
+	_sink = sink;
+	g_signal_connect(_sink, "new-sample", reinterpret_cast<GCallback>(relayNewSample), this);
+}
+
+void StreamRelay::clearSink()
+{
+	std::lock_guard lock{ _mutex };
+
+	if(_sink != nullptr)
+	{
+		g_signal_handlers_disconnect_by_data(_sink, this);
+		gst_object_unref(_sink);
+		_sink = nullptr;
+	}
+	clearCache();
+	gst_caps_replace(&_caps, nullptr);
+}
+
+GstCaps *StreamRelay::caps()
+{
+	std::lock_guard lock{ _mutex };
+
+	return _caps != nullptr ? gst_caps_ref(_caps) : nullptr;
+}
+
+const std::string &StreamRelay::mediaType() const
+{
+	return _mediaType;
+}
+
+GstElement *StreamRelay::encoder()
+{
+	GstElement *sink{}, *encoder;
+
+	{
+		std::lock_guard lock{ _mutex };
+
+		if(_sink != nullptr)
+			sink = GST_ELEMENT(gst_object_ref(_sink));
+	}
+
+	if(sink == nullptr)
+		return nullptr;
+	encoder = upstreamEncoder(sink);
+	gst_object_unref(sink);
+	return encoder;
+}
+
+CaptureMetrics *StreamRelay::metrics() const
+{
+	return _metrics;
+}
+
+void StreamRelay::attach(GstAppSrc *source)
+{
+	GstClockTime now = runningTime(GST_ELEMENT(source));
+	bool cached;
+
+	{
+		std::lock_guard lock{ _mutex };
+		Source entry{ reinterpret_cast<GstAppSrc *>(gst_object_ref(source)), GST_CLOCK_STIME_NONE };
+
+		if(_caps != nullptr)
+			gst_app_src_set_caps(source, _caps);
+		pushCache(entry, now);
+		_sources.push_back(entry);
+		cached = !_cache.empty();
+	}
+
+	GST_INFO("media attached to relay, %s", cached ? "sent cached frames" : "waiting for a keyframe");
+	if(!cached)
+		requestKeyframe();
+}
+
+void StreamRelay::detach(GstAppSrc *source)
+{
+	std::lock_guard lock{ _mutex };
+	auto it = std::find_if(_sources.begin(), _sources.end(),
+												 [source](const Source &entry) { return entry.source == source; });
+
+	if(it == _sources.end())
+		return;
+	gst_object_unref(it->source);
+	_sources.erase(it);
+}
+
+GstFlowReturn StreamRelay::onSample(GstSample *sample)
+{
+	std::lock_guard lock{ _mutex };
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstCaps *caps = gst_sample_get_caps(sample);
+	guint64 captureTime;
+
+	if(buffer == nullptr)
+		return GST_FLOW_OK;
+
+	if(caps != nullptr && (_caps == nullptr || !gst_caps_is_equal(caps, _caps)))
+	{
+		gst_caps_replace(&_caps, caps);
+		for(auto &source : _sources)
+			gst_app_src_set_caps(source.source, _caps);
+	}
+
+	// a new group of pictures starts at every IDR frame
+	if(!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+		clearCache();
+
+	if(!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) || !_cache.empty())
+	{
+		if(_cache.size() < _maxCachedFrames)
+			_cache.push_back(gst_buffer_ref(buffer));
+		else
+			clearCache();
+	}
+
+	// the payloaders of the medias look the capture time up by the PTS in the media
+	captureTime = _metrics != nullptr ? _metrics->tracedCaptureTime(GST_BUFFER_PTS(buffer)) : 0;
+	for(auto &source : _sources)
+	{
+		GstClockTime pts = sourceTime(source, GST_BUFFER_PTS(buffer));
+
+		if(captureTime != 0)
+			_metrics->trace(pts, captureTime);
+		gst_app_src_push_buffer(source.source, relayBuffer(buffer, pts));
+	}
+
+	return GST_FLOW_OK;
+}
+
+size_t StreamRelay::numSources()
+{
+	std::lock_guard lock{ _mutex };
+
+	return _sources.size();
+}
+
+void StreamRelay::pushCache(Source &source, GstClockTime now)
+{
+	GstClockTime first, last, start;
+
+	if(_cache.empty())
+		return;
+
+	first = GST_BUFFER_PTS(_cache.front());
+	last = GST_BUFFER_PTS(_cache.back());
+	if(!GST_CLOCK_TIME_IS_VALID(now) || !GST_CLOCK_TIME_IS_VALID(first) || !GST_CLOCK_TIME_IS_VALID(last) ||
+		 last < first)
+	{
+		for(auto buffer : _cache)
+			gst_app_src_push_buffer(source.source, relayBuffer(buffer, GST_CLOCK_TIME_NONE));
+		return;
+	}
+
+	// the group of pictures ends now, a media younger than the group gets it squeezed into its running time
+	start = now - std::min(last - first, now);
+	for(auto buffer : _cache)
+	{
+		GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+		if(!GST_CLOCK_TIME_IS_VALID(pts))
+			pts = GST_CLOCK_TIME_NONE;
+		else if(last == first)
+			pts = now;
+		else
+			pts = start + gst_util_uint64_scale(std::clamp(pts, first, last) - first, now - start, last - first);
+		gst_app_src_push_buffer(source.source, relayBuffer(buffer, pts));
+	}
+	source.offset = GST_CLOCK_DIFF(last, now);
+}
+
+GstClockTime StreamRelay::sourceTime(Source &source, GstClockTime pts)
+{
+	GstClockTimeDiff time;
+
+	if(!GST_CLOCK_TIME_IS_VALID(pts))
+		return GST_CLOCK_TIME_NONE;
+
+	// without a cached group of pictures the first live frame sets the offset
+	if(source.offset == GST_CLOCK_STIME_NONE)
+	{
+		GstClockTime now = runningTime(GST_ELEMENT(source.source));
+
+		if(!GST_CLOCK_TIME_IS_VALID(now))
+			return GST_CLOCK_TIME_NONE;
+		source.offset = GST_CLOCK_DIFF(pts, now);
+	}
+
+	time = static_cast<GstClockTimeDiff>(pts) + source.offset;
+	return time >= 0 ? static_cast<GstClockTime>(time) : GST_CLOCK_TIME_NONE;
+}
+
+void StreamRelay::clearCache()
+{
+	for(auto buffer : _cache)
+		gst_buffer_unref(buffer);
+	_cache.clear();
+}
+
+void StreamRelay::requestKeyframe()
+{
+	GstElement *sink{};
+
+	{
+		std::lock_guard lock{ _mutex };
+
+		if(_sink != nullptr)
+			sink = GST_ELEMENT(gst_object_ref(_sink));
+	}
+
+	if(sink == nullptr)
+		return;
+	// travels upstream from the app sink to the encoder
+	gst_element_send_event(sink, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+	gst_object_unref(sink);
+}
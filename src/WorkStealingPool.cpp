@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+
+#include "WorkStealingPool.hpp"
+
+WorkStealingPool::WorkStealingPool(uint32_t numThreads):
+	_pending{},
+	_stopping{},
+	_steals{}
+{
+	if(numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	_workers.reserve(numThreads);
+	for(uint32_t i = 0; i < numThreads; i++)
+		_workers.push_back(std::make_unique<Worker>());
+	// workers steal from each other, all deques exist before the first thread starts
+	for(uint32_t i = 0; i < numThreads; i++)
+		_workers[i]->thread = std::thread{ &WorkStealingPool::work, this, i };
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard lock{ _sleepMutex };
+		_stopping = true;
+	}
+	_wake.notify_all();
+
+	for(auto &worker : _workers)
+		worker->thread.join();
+}
+
+void WorkStealingPool::run(size_t numTasks, const std::function<void(size_t)> &task)
+{
+	Batch batch{ &task, numTasks, {}, {} };
+	size_t numWorkers = _workers.size();
+
+	if(numTasks == 0)
+		return;
+
+	{
+		std::lock_guard lock{ _sleepMutex };
+		_pending += numTasks;
+	}
+
+	for(size_t i = 0; i < numWorkers; i++)
+	{
+		auto &worker = *_workers[i];
+		std::lock_guard lock{ worker.mutex };
+
+		for(size_t index = i * numTasks / numWorkers; index < (i + 1) * numTasks / numWorkers; index++)
+			worker.tasks.push_back({ &batch, index });
+	}
+	_wake.notify_all();
+
+	std::unique_lock lock{ batch.mutex };
+	batch.done.wait(lock, [&batch] { return batch.remaining == 0; });
+}
+
+uint32_t WorkStealingPool::numThreads() const
+{
+	return static_cast<uint32_t>(_workers.size());
+}
+
+uint64_t WorkStealingPool::busyTime(uint32_t worker) const
+{
+	return worker < _workers.size() ? _workers[worker]->busy.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t WorkStealingPool::steals() const
+{
+	return _steals.load(std::memory_order_relaxed);
+}
+
+void WorkStealingPool::work(uint32_t index)
+{
+	Task task{};
+
+	while(true)
+	{
+		if(take(index, task))
+		{
+			execute(index, task);
+			continue;
+		}
+
+		std::unique_lock lock{ _sleepMutex };
+
+		// pending tasks may not be in a deque yet, the worker spins until they are
+		_wake.wait(lock, [this] { return _stopping || _pending > 0; });
+		if(_stopping)
+			return;
+	}
+}
+
+bool WorkStealingPool::take(uint32_t index, Task &task)
+{
+	size_t numWorkers = _workers.size();
+	bool found{};
+
+	for(size_t i = 0; i < numWorkers && !found; i++)
+	{
+		auto &worker = *_workers[(index + i) % numWorkers];
+		std::lock_guard lock{ worker.mutex };
+
+		if(worker.tasks.empty())
+			continue;
+
+		// the owner keeps the front for locality, thieves take the far end
+		if(i == 0)
+		{
+			task = worker.tasks.front();
+			worker.tasks.pop_front();
+		}
+		else
+		{
+			task = worker.tasks.back();
+			worker.tasks.pop_back();
+			_steals.fetch_add(1, std::memory_order_relaxed);
+		}
+		found = true;
+	}
+
+	if(found)
+	{
+		std::lock_guard lock{ _sleepMutex };
+		_pending--;
+	}
+	return found;
+}
+
+void WorkStealingPool::execute(uint32_t index, const Task &task)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	(*task.batch->task)(task.index);
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	_workers[index]->busy.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+
+	// the batch lives on the stack of run, it is only touched under its lock
+	std::lock_guard lock{ task.batch->mutex };
+	if(--task.batch->remaining == 0)
+		task.batch->done.notify_one();
+}